@@ -0,0 +1,208 @@
+/*
+ * compares reading bit fields, packed integers and varints
+ * one at a time with the inline loaders,
+ * with the bulk "extract_bit_field", "unpack_bits" and "decode_varints",
+ * all from memory, so that only the decoding is timed
+ */
+#include "bench_common.h"
+
+#include <bit_fields.h>
+
+#include <stdio.h>
+#include <string.h>
+
+/* the number of records, packed integers and varints */
+#define N_VALUES	(1 << 23)
+/* the number of times to decode every value with each method */
+#define N_PASSES	3
+/* the size of each record, with a bit field among other bytes */
+#define RECORD_SIZE	16
+/* the number of bits of each packed integer */
+#define PACKED_BITS	11
+
+/* a signed 13-bit field straddling the bytes of a big-endian flags word */
+static const struct fs_bit_field flags_field = { 37, 13, MSB_FIRST, 1 };
+
+/* the inputs of every method, and their outputs */
+struct bench_input {
+	struct file_struct records;
+	struct file_struct packed;
+	struct file_struct varints;
+	int32_t *fields;
+	uint16_t *unpacked;
+	uint64_t *decoded;
+};
+
+/* Load each field with "copy_bit_section". */
+static void copy_each_field(struct bench_input *input)
+{
+	size_t record_i;
+
+	for (record_i = 0; record_i < N_VALUES; record_i++) {
+		copy_bit_section(input->fields, record_i * sizeof(int32_t),
+				 sizeof(int32_t), &input->records,
+				 record_i * RECORD_SIZE, &flags_field);
+	}
+}
+
+/* Extract every field with "extract_bit_field". */
+static void extract_fields(struct bench_input *input)
+{
+	extract_bit_field(&input->records, RECORD_SIZE, &flags_field,
+			  input->fields, sizeof(int32_t));
+}
+
+/* Load each packed integer with "load_bit_field". */
+static void load_each_packed(struct bench_input *input)
+{
+	struct fs_bit_field field = { 0, PACKED_BITS, LSB_FIRST, 0 };
+	size_t value_i;
+
+	for (value_i = 0; value_i < N_VALUES; value_i++) {
+		field.bit_offset = value_i * PACKED_BITS;
+		input->unpacked[value_i] = load_bit_field(input->packed.data,
+							  &field);
+	}
+}
+
+/* Unpack every integer with "unpack_bits". */
+static void unpack_packed(struct bench_input *input)
+{
+	unpack_bits(&input->packed, 0, PACKED_BITS, LSB_FIRST, N_VALUES,
+		    input->unpacked, sizeof(uint16_t));
+}
+
+/* Decode each varint with "load_varint". */
+static void load_each_varint(struct bench_input *input)
+{
+	const uint8_t *data = input->varints.data;
+	size_t value_i, byte_i = 0;
+
+	for (value_i = 0; value_i < N_VALUES; value_i++) {
+		byte_i += load_varint(data + byte_i,
+				      input->varints.size - byte_i,
+				      &input->decoded[value_i]);
+	}
+}
+
+/* Decode every varint with "decode_varints". */
+static void decode_stream(struct bench_input *input)
+{
+	size_t n_values = N_VALUES;
+	off_t end;
+
+	decode_varints(&input->varints, 0, input->decoded, &n_values, &end);
+}
+
+/* a method to time */
+struct method {
+	const char *name;
+	void (*decode)(struct bench_input *input);
+};
+
+#define N_METHODS	6
+static const struct method methods[N_METHODS] = {
+	{"copy_bit_section", copy_each_field},
+	{"extract_bit_field", extract_fields},
+	{"load_bit_field (packed)", load_each_packed},
+	{"unpack_bits", unpack_packed},
+	{"load_varint", load_each_varint},
+	{"decode_varints", decode_stream},
+};
+
+/*
+ * Wrap a buffer in a struct chunk.
+ * structor:	will be set to the memory structor of the buffer
+ * chunk:	will be set to the chunk of the whole buffer
+ * data:	the buffer
+ * size:	the size of the buffer
+ */
+static int wrap_buffer(struct file_structor *structor,
+		       struct file_struct *chunk, void *data, size_t size)
+{
+	return data != NULL && !open_memory_structor(structor, data, size) &&
+	       !init_file_struct(chunk, structor, size, 0);
+}
+
+int main()
+{
+	const size_t packed_size = ((size_t) N_VALUES * PACKED_BITS + 7) / 8;
+	uint8_t *records = malloc((size_t) N_VALUES * RECORD_SIZE);
+	uint8_t *packed = calloc(packed_size + sizeof(uint64_t), 1);
+	uint8_t *varints = malloc((size_t) N_VALUES * VARINT_MAX_BYTES);
+	struct file_structor structors[3];
+	struct bench_input input;
+	uint64_t state = 0x9e3779b97f4a7c15ull;
+	size_t value_i, method_i, varint_size = 0;
+
+	for (value_i = 0; value_i < (size_t) N_VALUES * RECORD_SIZE;
+	     value_i++) {
+		records[value_i] = (uint8_t) bench_random(&state);
+	}
+	for (value_i = 0; value_i < N_VALUES; value_i++) {
+		uint64_t value = bench_random(&state);
+		size_t bit_i = value_i * PACKED_BITS, bit_j;
+
+		for (bit_j = 0; bit_j < PACKED_BITS; bit_j++) {
+			packed[(bit_i + bit_j) / 8] |=
+				(value >> bit_j & 1) << (bit_i + bit_j) % 8;
+		}
+		/* Mostly 1 and 2-byte varints, as for lengths and deltas. */
+		value >>= value % 4 == 0 ? value % 64 : 57;
+		do {
+			varints[varint_size++] = (uint8_t) (value |
+				(value >= 0x80 ? 0x80 : 0));
+			value >>= 7;
+		} while (value > 0);
+	}
+	input.fields = malloc(sizeof(*input.fields) * N_VALUES);
+	input.unpacked = malloc(sizeof(*input.unpacked) * N_VALUES);
+	input.decoded = malloc(sizeof(*input.decoded) * N_VALUES);
+	if (!wrap_buffer(&structors[0], &input.records, records,
+			 (size_t) N_VALUES * RECORD_SIZE) ||
+	    !wrap_buffer(&structors[1], &input.packed, packed, packed_size) ||
+	    !wrap_buffer(&structors[2], &input.varints, varints,
+			 varint_size) ||
+	    input.fields == NULL || input.unpacked == NULL ||
+	    input.decoded == NULL) {
+		return 1;
+	}
+
+	for (method_i = 0; method_i < N_METHODS; method_i++) {
+		const struct method *timed = &methods[method_i];
+		double start, elapsed;
+		uint64_t sum = 0;
+		unsigned pass_i;
+
+		timed->decode(&input);
+		start = bench_seconds();
+		for (pass_i = 0; pass_i < N_PASSES; pass_i++) {
+			timed->decode(&input);
+		}
+		elapsed = bench_seconds() - start;
+		for (value_i = 0; value_i < N_VALUES; value_i++) {
+			sum += method_i < 2 ? (uint64_t) input.fields[value_i] :
+			       method_i < 4 ? input.unpacked[value_i] :
+			       input.decoded[value_i];
+		}
+
+		printf("%-24s %6.2f ns/value (checksum %llx)\n", timed->name,
+		       elapsed * 1e9 / N_PASSES / N_VALUES,
+		       (unsigned long long) sum);
+	}
+
+	teardown_file_struct(&input.records);
+	teardown_file_struct(&input.packed);
+	teardown_file_struct(&input.varints);
+	for (method_i = 0; method_i < 3; method_i++) {
+		close_file_structor(&structors[method_i]);
+	}
+	free(records);
+	free(packed);
+	free(varints);
+	free(input.fields);
+	free(input.unpacked);
+	free(input.decoded);
+
+	return 0;
+}
@@ -0,0 +1,131 @@
+/*
+ * compares summing one 4-byte field of 40-byte records out of the page
+ * cache, by scanning the mapped records, and by scanning its column
+ */
+#include "bench_common.h"
+
+#include <column_store.h>
+
+#include <stdio.h>
+
+/* the file holding the generated records */
+#define BENCH_FILE	BENCH_DIR "/bench_column_store"
+/* the number of records in the file, which has 320 MiB */
+#define N_RECORDS	(1 << 23)
+/* the size of each record, with its big-endian value after an 8-byte ID */
+#define RECORD_SIZE	40
+#define VALUE_START	8
+
+static const struct member_layout bench_members[2] = {
+	{ 0, 0, sizeof(uint64_t), sizeof(uint64_t), BIG_END, MEMBER_BYTES,
+	  0 },
+	{ VALUE_START, 0, sizeof(uint32_t), sizeof(uint32_t), BIG_END,
+	  MEMBER_UNSIGNED, sizeof(uint32_t) },
+};
+static const struct column_layout bench_layout = {
+	0, RECORD_SIZE, bench_members, 2, 1 << 16
+};
+
+static void fill_record(uint8_t *record, uint64_t record_i, void *arg)
+{
+	uint32_t value = (uint32_t) (record_i * 2654435761u);
+
+	(void) arg;
+
+	memset(record, 0, RECORD_SIZE);
+	portable_memcpy(record, &record_i, sizeof(record_i), BIG_END);
+	portable_memcpy(record + VALUE_START, &value, sizeof(value), BIG_END);
+}
+
+/* Drop a file from the page cache. */
+static void drop_cache(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+
+	if (fd >= 0) {
+		fsync(fd);
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		close(fd);
+	}
+}
+
+/* Sum the values of the mapped records. */
+static uint64_t sum_rows(struct file_structor *structor)
+{
+	struct file_struct records;
+	const uint8_t *data;
+	uint64_t sum = 0;
+	size_t record_i;
+
+	if (init_file_struct(&records, structor, structor->size, 0)) {
+		return 0;
+	}
+	data = records.data;
+	for (record_i = 0; record_i < N_RECORDS; record_i++) {
+		sum += load_uint(data + record_i * RECORD_SIZE + VALUE_START,
+				 sizeof(uint32_t), BIG_END);
+	}
+	teardown_file_struct(&records);
+
+	return sum;
+}
+
+/* Sum the values of their column. */
+static uint64_t sum_column()
+{
+	struct column column;
+	const uint32_t *values;
+	uint64_t sum = 0;
+	size_t value_i;
+
+	if (open_column(&column, BENCH_FILE, &bench_layout, 1)) {
+		return 0;
+	}
+	values = COLUMN_ARRAY(&column, uint32_t);
+	for (value_i = 0; value_i < column.n_values; value_i++) {
+		sum += values[value_i];
+	}
+	close_column(&column);
+
+	return sum;
+}
+
+int main()
+{
+	struct file_structor structor;
+	double start, elapsed;
+	uint64_t sum;
+
+	if (generate_bench_file(BENCH_FILE, RECORD_SIZE, N_RECORDS,
+				fill_record, NULL) ||
+	    open_file_structor(&structor, BENCH_FILE)) {
+		return 1;
+	}
+
+	drop_cache(BENCH_FILE);
+	start = bench_seconds();
+	sum = sum_rows(&structor);
+	elapsed = bench_seconds() - start;
+	printf("%-26s %8.2f ms (checksum %llx)\n", "cold row scan",
+	       elapsed * 1e3, (unsigned long long) sum);
+
+	start = bench_seconds();
+	if (build_columns(BENCH_FILE, &bench_layout, 0)) {
+		return 1;
+	}
+	elapsed = bench_seconds() - start;
+	printf("%-26s %8.2f ms\n", "build_columns", elapsed * 1e3);
+
+	drop_cache(BENCH_FILE COLUMN_SUFFIX "1");
+	start = bench_seconds();
+	sum = sum_column();
+	elapsed = bench_seconds() - start;
+	printf("%-26s %8.2f ms (checksum %llx)\n", "cold column scan",
+	       elapsed * 1e3, (unsigned long long) sum);
+
+	close_file_structor(&structor);
+	remove_columns(BENCH_FILE, 2);
+	unlink(BENCH_FILE);
+
+	return 0;
+}
@@ -0,0 +1,116 @@
+/* shared helpers for the benchmarks */
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+#include <file_structor.h>
+
+#include <logger.h>
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+/* the directory in which the benchmarks generate their input files */
+#define BENCH_DIR	"/tmp"
+
+/*
+ * the current time of a monotonic clock
+ * returns	the time in seconds
+ */
+inline static double bench_seconds()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/*
+ * a fast, deterministic pseudo-random number generator
+ * state:	the generator state, which must not start at 0
+ * returns	the next pseudo-random number
+ */
+inline static uint64_t bench_random(uint64_t *state)
+{
+	uint64_t value = *state;
+
+	value ^= value << 13;
+	value ^= value >> 7;
+	value ^= value << 17;
+	*state = value;
+
+	return value;
+}
+
+/*
+ * the function filling each record of a generated benchmark file
+ * record:	the buffer for the record
+ * record_i:	the index of the record in the file
+ * arg:		the argument given to "generate_bench_file"
+ */
+typedef void (*bench_record_fn)(uint8_t *record, uint64_t record_i,
+				void *arg);
+
+/*
+ * Write a file of generated records, using large writes.
+ * path:	the path of the file to create
+ * record_size:	the size of each record
+ * n_records:	the number of records
+ * fill:	the function filling each record
+ * arg:		the argument to pass to "fill"
+ * returns	0 on success; -1 on error
+ */
+inline static int
+generate_bench_file(const char *path, size_t record_size, uint64_t n_records,
+		    bench_record_fn fill, void *arg)
+{
+	const size_t records_per_write = (1 << 20) / record_size + 1;
+	uint8_t *buffer = (uint8_t *) malloc(record_size * records_per_write);
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	uint64_t record_i = 0;
+
+	if (buffer == NULL || fd < 0) {
+		printlg(ERROR_LEVEL, "Unable to create %s.\n", path);
+		free(buffer);
+		if (fd >= 0) {
+			close(fd);
+		}
+		return -1;
+	}
+
+	while (record_i < n_records) {
+		size_t n_buffered = 0;
+		size_t to_write;
+		uint8_t *written = buffer;
+
+		while (n_buffered < records_per_write && record_i < n_records) {
+			fill(buffer + n_buffered * record_size, record_i, arg);
+			n_buffered++;
+			record_i++;
+		}
+
+		to_write = n_buffered * record_size;
+		while (to_write > 0) {
+			ssize_t n_written = write(fd, written, to_write);
+
+			if (n_written <= 0) {
+				printlg(ERROR_LEVEL, "Unable to write %s.\n",
+					path);
+				free(buffer);
+				close(fd);
+				return -1;
+			}
+			written += n_written;
+			to_write -= n_written;
+		}
+	}
+
+	free(buffer);
+	close(fd);
+
+	return 0;
+}
+
+#endif /* BENCH_COMMON_H */
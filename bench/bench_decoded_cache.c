@@ -0,0 +1,137 @@
+/*
+ * compares decoding hot headers from a file on every lookup,
+ * mapping each with "init_file_struct" and decoding it with a copy plan,
+ * with looking them up in a "struct decoded_cache"
+ */
+#include "bench_common.h"
+
+#include <decoded_cache.h>
+
+#include <stdio.h>
+
+/* the file holding the generated headers */
+#define BENCH_FILE	BENCH_DIR "/bench_decoded_cache"
+/* the number of headers in the file, and the size of each */
+#define N_HEADERS	(1 << 16)
+#define HEADER_SIZE	64
+/* the number of headers most lookups are for */
+#define N_HOT		256
+/* the number of lookups with each method */
+#define N_LOOKUPS	(1 << 21)
+/* the bytes the cache may hold */
+#define CACHE_MEMORY	(1 << 20)
+
+/* a decoded header, with a dozen members */
+struct bench_header {
+	uint64_t id;
+	uint64_t parent;
+	uint64_t data_start;
+	uint64_t data_size;
+	int64_t created;
+	int64_t modified;
+	uint32_t magic;
+	uint32_t flags;
+	uint32_t n_children;
+	uint32_t checksum;
+	uint16_t version;
+	uint16_t kind;
+};
+
+#define N_HEADER_MEMBERS	12
+static const struct member_layout header_layout[N_HEADER_MEMBERS] = {
+	MEMBER_LAYOUT(struct bench_header, magic, 0, BIG_END),
+	MEMBER_LAYOUT(struct bench_header, version, 4, BIG_END),
+	MEMBER_LAYOUT(struct bench_header, kind, 6, BIG_END),
+	MEMBER_LAYOUT(struct bench_header, id, 8, BIG_END),
+	MEMBER_LAYOUT(struct bench_header, parent, 16, BIG_END),
+	MEMBER_LAYOUT(struct bench_header, flags, 24, BIG_END),
+	MEMBER_LAYOUT(struct bench_header, n_children, 28, BIG_END),
+	MEMBER_LAYOUT(struct bench_header, data_start, 32, BIG_END),
+	MEMBER_LAYOUT(struct bench_header, data_size, 40, BIG_END),
+	INT_MEMBER_LAYOUT(struct bench_header, created, 48, 6, BIG_END, 1),
+	INT_MEMBER_LAYOUT(struct bench_header, modified, 54, 6, BIG_END,
+			  1),
+	MEMBER_LAYOUT(struct bench_header, checksum, 60, BIG_END),
+};
+
+static void fill_header(uint8_t *header, uint64_t header_i, void *arg)
+{
+	uint64_t state = header_i + 1;
+	size_t byte_i;
+
+	(void) arg;
+
+	for (byte_i = 0; byte_i < HEADER_SIZE; byte_i++) {
+		header[byte_i] = (uint8_t) bench_random(&state);
+	}
+}
+
+/* the header of a lookup: mostly hot ones, and sometimes any other */
+static off_t next_header(uint64_t *state)
+{
+	uint64_t random = bench_random(state);
+
+	return (off_t) (random % 10 == 0 ? random % N_HEADERS :
+			random % N_HOT) * HEADER_SIZE;
+}
+
+int main()
+{
+	struct file_structor structor;
+	struct decoded_cache cache;
+	struct decoded_cache_stats stats;
+	struct copy_plan plan;
+	struct bench_header header;
+	uint64_t state, sum;
+	double start, elapsed;
+	size_t lookup_i;
+
+	if (generate_bench_file(BENCH_FILE, HEADER_SIZE, N_HEADERS,
+				fill_header, NULL) ||
+	    open_file_structor(&structor, BENCH_FILE) ||
+	    compile_copy_plan(&plan, header_layout, N_HEADER_MEMBERS) ||
+	    init_decoded_cache(&cache, CACHE_MEMORY, 1000)) {
+		return 1;
+	}
+
+	state = 0x9e3779b97f4a7c15ull;
+	sum = 0;
+	start = bench_seconds();
+	for (lookup_i = 0; lookup_i < N_LOOKUPS; lookup_i++) {
+		struct file_struct chunk;
+
+		init_file_struct(&chunk, &structor, HEADER_SIZE,
+				 next_header(&state));
+		apply_copy_plan(&plan, &header, &chunk, 0);
+		teardown_file_struct(&chunk);
+		sum += header.id ^ header.created;
+	}
+	elapsed = bench_seconds() - start;
+	printf("%-24s %7.1f ns/lookup (checksum %llx)\n",
+	       "init_file_struct + plan", elapsed * 1e9 / N_LOOKUPS,
+	       (unsigned long long) sum);
+
+	state = 0x9e3779b97f4a7c15ull;
+	sum = 0;
+	start = bench_seconds();
+	for (lookup_i = 0; lookup_i < N_LOOKUPS; lookup_i++) {
+		decode_cached(&cache, &structor, next_header(&state), &plan,
+			      &header);
+		sum += header.id ^ header.created;
+	}
+	elapsed = bench_seconds() - start;
+	get_decoded_cache_stats(&cache, &stats);
+	printf("%-24s %7.1f ns/lookup (checksum %llx)\n", "decode_cached",
+	       elapsed * 1e9 / N_LOOKUPS, (unsigned long long) sum);
+	printf("hit rate %.1f%%, %u structs in %u bytes, %u evictions\n",
+	       100.0 * stats.n_hits / (stats.n_hits + stats.n_misses),
+	       (unsigned) stats.n_entries, (unsigned) stats.memory,
+	       (unsigned) stats.n_evictions);
+
+	teardown_decoded_cache(&cache);
+	free_copy_plan(&plan);
+	close_file_structor(&structor);
+	unlink(BENCH_FILE);
+
+	return 0;
+}
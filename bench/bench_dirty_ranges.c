@@ -0,0 +1,142 @@
+/*
+ * compares patching a few fields of random records in place
+ * with one "pwrite" per field and an "fdatasync" per batch,
+ * with storing them into a writable mapping with "update_int_section",
+ * and flushing each batch with "flush_dirty"
+ */
+#include "bench_common.h"
+
+#include <dirty_ranges.h>
+
+#include <stdio.h>
+
+/* the file holding the generated records */
+#define BENCH_FILE	BENCH_DIR "/bench_dirty_ranges"
+/* the number of records in the file, and the size of each */
+#define N_RECORDS	(1 << 18)
+#define RECORD_SIZE	64
+/*
+ * Each update sets a big-endian 4-byte counter, 8-byte timestamp
+ * and 2-byte flags of a record, which are not adjacent.
+ */
+#define COUNTER_START	8
+#define TIME_START	24
+#define FLAGS_START	40
+/* the number of record updates with each method */
+#define N_UPDATES	(1 << 16)
+/* the number of record updates flushed together */
+#define BATCH_SIZE	4096
+/* the most clean pages between dirty runs flushed together */
+#define MAX_GAP		16
+
+static void fill_record(uint8_t *record, uint64_t record_i, void *arg)
+{
+	(void) arg;
+
+	memset(record, (uint8_t) record_i, RECORD_SIZE);
+}
+
+/* the start of the record of an update */
+static off_t next_record(uint64_t *state)
+{
+	return (off_t) (bench_random(state) % N_RECORDS) * RECORD_SIZE;
+}
+
+/* Update records with "pwrite", returning the number of system calls. */
+static uint64_t pwrite_updates(int fd)
+{
+	uint64_t state = 0x9e3779b97f4a7c15ull, n_calls = 0;
+	size_t update_i;
+
+	for (update_i = 0; update_i < N_UPDATES; update_i++) {
+		off_t start = next_record(&state);
+		uint8_t counter[4], time[8], flags[2];
+
+		encode_uint(counter, update_i, sizeof(counter), BIG_END);
+		encode_uint(time, update_i << 20, sizeof(time), BIG_END);
+		encode_uint(flags, 1, sizeof(flags), BIG_END);
+		if (pwrite(fd, counter, sizeof(counter),
+			   start + COUNTER_START) != sizeof(counter) ||
+		    pwrite(fd, time, sizeof(time),
+			   start + TIME_START) != sizeof(time) ||
+		    pwrite(fd, flags, sizeof(flags),
+			   start + FLAGS_START) != sizeof(flags)) {
+			return 0;
+		}
+		n_calls += 3;
+		if ((update_i + 1) % BATCH_SIZE == 0) {
+			fdatasync(fd);
+			n_calls++;
+		}
+	}
+
+	return n_calls;
+}
+
+/* Update records through a mapping, returning the number of "msync"s. */
+static uint64_t mapped_updates(struct dirty_ranges *dirty)
+{
+	uint64_t state = 0x9e3779b97f4a7c15ull;
+	const uint16_t flags = 1;
+	size_t update_i;
+
+	for (update_i = 0; update_i < N_UPDATES; update_i++) {
+		off_t start = next_record(&state);
+		uint32_t counter = update_i;
+		uint64_t time = (uint64_t) update_i << 20;
+
+		if (update_int_section(dirty, start + COUNTER_START, 4,
+				       &counter, 0, sizeof(counter), BIG_END,
+				       0) ||
+		    update_int_section(dirty, start + TIME_START, 8, &time, 0,
+				       sizeof(time), BIG_END, 0) ||
+		    update_int_section(dirty, start + FLAGS_START, 2, &flags,
+				       0, sizeof(flags), BIG_END, 0)) {
+			return 0;
+		}
+		if ((update_i + 1) % BATCH_SIZE == 0 &&
+		    flush_dirty(dirty, FLUSH_SYNC)) {
+			return 0;
+		}
+	}
+
+	return dirty->n_syncs;
+}
+
+int main()
+{
+	struct file_structor structor;
+	struct file_struct chunk;
+	struct dirty_ranges dirty;
+	uint64_t n_calls;
+	double start, elapsed;
+
+	if (generate_bench_file(BENCH_FILE, RECORD_SIZE, N_RECORDS,
+				fill_record, NULL) ||
+	    open_writable_file_structor(&structor, BENCH_FILE) ||
+	    init_file_struct(&chunk, &structor, structor.size, 0) ||
+	    init_dirty_ranges(&dirty, &chunk, MAX_GAP)) {
+		return 1;
+	}
+
+	start = bench_seconds();
+	n_calls = pwrite_updates(structor.fd);
+	elapsed = bench_seconds() - start;
+	printf("%-28s %7.1f ns/update, %6.1f calls/batch\n",
+	       "pwrite + fdatasync", elapsed * 1e9 / N_UPDATES,
+	       (double) n_calls * BATCH_SIZE / N_UPDATES);
+
+	start = bench_seconds();
+	n_calls = mapped_updates(&dirty);
+	elapsed = bench_seconds() - start;
+	printf("%-28s %7.1f ns/update, %6.1f calls/batch\n",
+	       "update_int_section + flush", elapsed * 1e9 / N_UPDATES,
+	       (double) n_calls * BATCH_SIZE / N_UPDATES);
+
+	teardown_dirty_ranges(&dirty);
+	teardown_file_struct(&chunk);
+	close_file_structor(&structor);
+	unlink(BENCH_FILE);
+
+	return 0;
+}
@@ -0,0 +1,137 @@
+/*
+ * compares widening a 3-byte big-endian field into "int64_t"s
+ * by copying the raw bytes and then converting them in a second pass,
+ * with "copy_int_section" on each record, and with "extract_int_field"
+ */
+#include "bench_common.h"
+
+#include <field_convert.h>
+
+#include <stdlib.h>
+
+/* the file holding the generated records */
+#define BENCH_FILE	BENCH_DIR "/bench_field_convert"
+/* the number of records in the file */
+#define N_RECORDS	(1 << 23)
+/* the number of times to convert every record with each method */
+#define N_PASSES	3
+/* the size of each record, with its 3-byte counter after an 8-byte ID */
+#define RECORD_SIZE	13
+
+static const struct fs_int_field counter_field = {
+	sizeof(uint64_t), 3, BIG_END, 1
+};
+
+static void fill_record(uint8_t *record, uint64_t record_i, void *arg)
+{
+	uint32_t counter = (uint32_t) (record_i * 2654435761u);
+
+	(void) arg;
+
+	memcpy(record, &record_i, sizeof(record_i));
+	record[8] = (uint8_t) (counter >> 16);
+	record[9] = (uint8_t) (counter >> 8);
+	record[10] = (uint8_t) counter;
+	record[11] = 0;
+	record[12] = 0;
+}
+
+/* Copy the raw counters, then widen them in a second pass. */
+static void
+widen_after_copy(struct file_struct *records, int64_t *counters)
+{
+	uint8_t *raw = malloc(N_RECORDS * counter_field.width);
+	size_t record_i;
+
+	for (record_i = 0; record_i < N_RECORDS; record_i++) {
+		copy_section_at(raw, record_i * counter_field.width, records,
+				record_i * RECORD_SIZE + counter_field.offset,
+				counter_field.width, BIG_END);
+	}
+	for (record_i = 0; record_i < N_RECORDS; record_i++) {
+		counters[record_i] = sign_extend(
+			load_uint(raw + record_i * counter_field.width,
+				  counter_field.width, machine_endianness()),
+			counter_field.width);
+	}
+	free(raw);
+}
+
+/* Convert each counter with "copy_int_section". */
+static void
+widen_each_record(struct file_struct *records, int64_t *counters)
+{
+	size_t record_i;
+
+	for (record_i = 0; record_i < N_RECORDS; record_i++) {
+		copy_int_section(counters, record_i * sizeof(*counters),
+				 sizeof(*counters), records,
+				 record_i * RECORD_SIZE + counter_field.offset,
+				 counter_field.width, BIG_END, 1);
+	}
+}
+
+/* Convert every counter with "extract_int_field". */
+static void
+widen_with_kernels(struct file_struct *records, int64_t *counters)
+{
+	extract_int_field(records, RECORD_SIZE, &counter_field, counters,
+			  sizeof(*counters));
+}
+
+/* a method to time */
+struct method {
+	const char *name;
+	void (*widen)(struct file_struct *records, int64_t *counters);
+};
+
+#define N_METHODS	3
+static const struct method methods[N_METHODS] = {
+	{"copy, then widen", widen_after_copy},
+	{"copy_int_section", widen_each_record},
+	{"extract_int_field", widen_with_kernels},
+};
+
+int main()
+{
+	int64_t *counters = malloc(sizeof(*counters) * N_RECORDS);
+	struct file_structor structor;
+	struct file_struct records;
+	size_t method_i;
+
+	if (generate_bench_file(BENCH_FILE, RECORD_SIZE, N_RECORDS,
+				fill_record, NULL) ||
+	    open_file_structor(&structor, BENCH_FILE) ||
+	    init_file_struct(&records, &structor, structor.size, 0)) {
+		return 1;
+	}
+
+	for (method_i = 0; method_i < N_METHODS; method_i++) {
+		const struct method *timed = &methods[method_i];
+		double start, elapsed;
+		uint64_t sum = 0;
+		unsigned pass_i;
+		size_t record_i;
+
+		timed->widen(&records, counters);
+		start = bench_seconds();
+		for (pass_i = 0; pass_i < N_PASSES; pass_i++) {
+			timed->widen(&records, counters);
+		}
+		elapsed = bench_seconds() - start;
+		for (record_i = 0; record_i < N_RECORDS; record_i++) {
+			sum += (uint64_t) counters[record_i];
+		}
+
+		printf("%-26s %6.2f GB/s (checksum %llx)\n", timed->name,
+		       (double) records.size * N_PASSES / elapsed / 1e9,
+		       (unsigned long long) sum);
+	}
+
+	teardown_file_struct(&records);
+	close_file_structor(&structor);
+	unlink(BENCH_FILE);
+	free(counters);
+
+	return 0;
+}
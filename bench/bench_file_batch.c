@@ -0,0 +1,158 @@
+/*
+ * compares initializing the records found through an index
+ * with one "init_file_struct" call each,
+ * and with one "init_file_batch" call for all of them
+ */
+#include "bench_common.h"
+
+#include <file_batch.h>
+
+/* the file holding the generated records */
+#define BENCH_FILE	BENCH_DIR "/bench_file_batch"
+/* the number of records in the file, which has 256 MiB */
+#define N_RECORDS	(1 << 22)
+/*
+ * the number of records to initialize,
+ * which stays under the default limit of 65530 mappings
+ */
+#define N_REQUESTS	50000
+/* the number of times to initialize the records with each method */
+#define N_PASSES	3
+
+struct bench_record {
+	uint64_t value;
+	uint8_t padding[56];
+};
+
+static void fill_record(uint8_t *record, uint64_t record_i, void *arg)
+{
+	struct bench_record *bench_record = (struct bench_record *) record;
+
+	(void) arg;
+
+	bench_record->value = record_i;
+	memset(bench_record->padding, 0, sizeof(bench_record->padding));
+}
+
+/* Sum the values of the initialized records. */
+static uint64_t sum_chunks(struct file_struct *chunks)
+{
+	struct bench_record decoded = { 0 };
+	uint64_t sum = 0;
+	size_t request_i;
+
+	for (request_i = 0; request_i < N_REQUESTS; request_i++) {
+		COPY_MEMBER(&decoded, &chunks[request_i], struct bench_record,
+			    value, machine_endianness());
+		sum += decoded.value;
+	}
+
+	return sum;
+}
+
+static uint64_t
+init_each(struct file_structor *structor,
+	  const struct chunk_request *requests, struct file_struct *chunks,
+	  size_t *n_mappings)
+{
+	uint64_t sum;
+	size_t request_i;
+
+	for (request_i = 0; request_i < N_REQUESTS; request_i++) {
+		if (init_file_struct(&chunks[request_i], structor,
+				     requests[request_i].size,
+				     requests[request_i].start_in_file)) {
+			return 0;
+		}
+	}
+	sum = sum_chunks(chunks);
+	for (request_i = 0; request_i < N_REQUESTS; request_i++) {
+		teardown_file_struct(&chunks[request_i]);
+	}
+	*n_mappings = N_REQUESTS;
+
+	return sum;
+}
+
+static uint64_t
+init_batch(struct file_structor *structor,
+	   const struct chunk_request *requests, struct file_struct *chunks,
+	   size_t *n_mappings)
+{
+	struct file_batch batch;
+	uint64_t sum;
+
+	if (init_file_batch(&batch, structor, requests, N_REQUESTS, chunks,
+			    0)) {
+		return 0;
+	}
+	sum = sum_chunks(chunks);
+	*n_mappings = batch.n_mappings;
+	teardown_file_batch(&batch);
+
+	return sum;
+}
+
+/* a method to time */
+struct method {
+	const char *name;
+	uint64_t (*init)(struct file_structor *structor,
+			 const struct chunk_request *requests,
+			 struct file_struct *chunks, size_t *n_mappings);
+};
+
+#define N_METHODS	2
+static const struct method methods[N_METHODS] = {
+	{"init_file_struct each", init_each},
+	{"init_file_batch", init_batch},
+};
+
+int main()
+{
+	struct chunk_request *requests =
+		malloc(sizeof(*requests) * N_REQUESTS);
+	struct file_struct *chunks = malloc(sizeof(*chunks) * N_REQUESTS);
+	uint64_t random_state = 88172645463325252ull;
+	struct file_structor structor;
+	size_t request_i, method_i;
+
+	if (requests == NULL || chunks == NULL ||
+	    generate_bench_file(BENCH_FILE, sizeof(struct bench_record),
+				N_RECORDS, fill_record, NULL) ||
+	    open_file_structor(&structor, BENCH_FILE)) {
+		return 1;
+	}
+	for (request_i = 0; request_i < N_REQUESTS; request_i++) {
+		uint64_t record_i = bench_random(&random_state) % N_RECORDS;
+
+		requests[request_i].start_in_file =
+			record_i * sizeof(struct bench_record);
+		requests[request_i].size = sizeof(struct bench_record);
+	}
+
+	for (method_i = 0; method_i < N_METHODS; method_i++) {
+		const struct method *timed = &methods[method_i];
+		double start = bench_seconds(), elapsed;
+		size_t n_mappings = 0;
+		uint64_t sum = 0;
+		unsigned pass_i;
+
+		for (pass_i = 0; pass_i < N_PASSES; pass_i++) {
+			sum += timed->init(&structor, requests, chunks,
+					   &n_mappings);
+		}
+		elapsed = bench_seconds() - start;
+
+		printf("%-22s %8.2f M chunks/s, %6u mappings "
+		       "(checksum %llx)\n", timed->name,
+		       (double) N_REQUESTS * N_PASSES / elapsed / 1e6,
+		       (unsigned) n_mappings, (unsigned long long) sum);
+	}
+
+	close_file_structor(&structor);
+	unlink(BENCH_FILE);
+	free(requests);
+	free(chunks);
+
+	return 0;
+}
@@ -0,0 +1,157 @@
+/*
+ * compares decoding records with the "COPY_MEMBER" macros,
+ * with hand-written loads and byte swaps,
+ * and with the typed views in "file_structor.hpp"
+ */
+#include "bench_common.h"
+
+#include <file_structor.hpp>
+
+/* the file holding the generated records */
+#define BENCH_FILE	BENCH_DIR "/bench_file_view"
+/* the number of records in the file */
+#define N_RECORDS	(1 << 22)
+/* the number of times to decode every record with each decoder */
+#define N_PASSES	5
+
+/* the decoded record */
+struct bench_record {
+	uint64_t id;
+	uint32_t value;
+	uint16_t count;
+	uint8_t flags;
+};
+
+using bench_record_layout = fs::record_layout<sizeof(bench_record),
+	fs::member<&bench_record::id, 0, BIG_END>,
+	fs::member<&bench_record::value, 8, BIG_END>,
+	fs::member<&bench_record::count, 12, LITTLE_END>,
+	fs::member<&bench_record::flags, 14>>;
+
+static void fill_record(uint8_t *record, uint64_t record_i, void *arg)
+{
+	uint64_t id = __builtin_bswap64(record_i);
+	uint32_t value = __builtin_bswap32((uint32_t) (record_i * 7));
+	uint16_t count = (uint16_t) record_i;
+
+	(void) arg;
+
+	memset(record, 0, sizeof(bench_record));
+	memcpy(record, &id, sizeof(id));
+	memcpy(record + 8, &value, sizeof(value));
+	memcpy(record + 12, &count, sizeof(count));
+	record[14] = (uint8_t) (record_i & 0xff);
+}
+
+/* the checksum of a decoded record, so that decoding is not optimized out */
+static uint64_t checksum(const bench_record &record)
+{
+	return record.id + record.value + record.count + record.flags;
+}
+
+static uint64_t
+decode_with_macros(struct file_struct *records, bench_record *decoded)
+{
+	uint64_t sum = 0;
+
+	for (size_t record_i = 0; record_i < N_RECORDS; record_i++) {
+		COPY_MEMBER_IN_ARRAY(decoded, records, bench_record, id,
+				     BIG_END, record_i);
+		COPY_MEMBER_IN_ARRAY(decoded, records, bench_record, value,
+				     BIG_END, record_i);
+		COPY_MEMBER_IN_ARRAY(decoded, records, bench_record, count,
+				     LITTLE_END, record_i);
+		COPY_MEMBER_IN_ARRAY(decoded, records, bench_record, flags,
+				     LITTLE_END, record_i);
+		sum += checksum(decoded[record_i]);
+	}
+
+	return sum;
+}
+
+static uint64_t
+decode_by_hand(struct file_struct *records, bench_record *decoded)
+{
+	const uint8_t *raw = static_cast<const uint8_t *>(records->data);
+	uint64_t sum = 0;
+
+	for (size_t record_i = 0; record_i < N_RECORDS; record_i++) {
+		const uint8_t *src = raw + record_i * sizeof(bench_record);
+		bench_record *record = &decoded[record_i];
+
+		memcpy(&record->id, src, sizeof(record->id));
+		record->id = __builtin_bswap64(record->id);
+		memcpy(&record->value, src + 8, sizeof(record->value));
+		record->value = __builtin_bswap32(record->value);
+		memcpy(&record->count, src + 12, sizeof(record->count));
+		record->flags = src[14];
+		sum += checksum(*record);
+	}
+
+	return sum;
+}
+
+static uint64_t
+decode_with_view(struct file_struct *records, bench_record *decoded)
+{
+	fs::file_view<bench_record, bench_record_layout> view;
+	uint64_t sum = 0;
+
+	view.derive(records, 0, N_RECORDS);
+	for (size_t record_i = 0; record_i < N_RECORDS; record_i++) {
+		view.decode(record_i, decoded[record_i]);
+		sum += checksum(decoded[record_i]);
+	}
+
+	return sum;
+}
+
+/* a decoder to time */
+struct decoder {
+	const char *name;
+	uint64_t (*decode)(struct file_struct *records,
+			  bench_record *decoded);
+};
+
+#define N_DECODERS	3
+static const decoder decoders[N_DECODERS] = {
+	{"COPY_MEMBER_IN_ARRAY", decode_with_macros},
+	{"hand-written", decode_by_hand},
+	{"fs::file_view", decode_with_view},
+};
+
+int main()
+{
+	struct file_structor structor;
+	struct file_struct records;
+	bench_record *decoded = new bench_record[N_RECORDS]();
+
+	if (generate_bench_file(BENCH_FILE, sizeof(bench_record), N_RECORDS,
+				fill_record, NULL) ||
+	    open_file_structor(&structor, BENCH_FILE) ||
+	    init_file_struct(&records, &structor, structor.size, 0)) {
+		return 1;
+	}
+
+	for (size_t decoder_i = 0; decoder_i < N_DECODERS; decoder_i++) {
+		const decoder *timed = &decoders[decoder_i];
+		uint64_t sum = timed->decode(&records, decoded);
+		double start = bench_seconds(), elapsed;
+
+		for (unsigned pass_i = 0; pass_i < N_PASSES; pass_i++) {
+			sum += timed->decode(&records, decoded);
+		}
+		elapsed = bench_seconds() - start;
+
+		printf("%-22s %6.2f ns/record (checksum %llx)\n", timed->name,
+		       elapsed * 1e9 / ((double) N_RECORDS * N_PASSES),
+		       (unsigned long long) sum);
+	}
+
+	teardown_file_struct(&records);
+	close_file_structor(&structor);
+	unlink(BENCH_FILE);
+	delete[] decoded;
+
+	return 0;
+}
@@ -0,0 +1,150 @@
+/*
+ * compares reading random small files by opening and closing them each time,
+ * with acquiring them from a handle cache
+ */
+#include "bench_common.h"
+
+#include <handle_cache.h>
+
+#include <stdio.h>
+#include <sys/stat.h>
+
+/* the directory holding the generated files */
+#define BENCH_DIR_PATH	BENCH_DIR "/bench_handle_cache"
+/* the number of files, and the size of each */
+#define N_FILES		2000
+#define FILE_SIZE	256
+/* the number of files read with each method */
+#define N_READS		(1 << 20)
+
+static void fill_record(uint8_t *record, uint64_t record_i, void *arg)
+{
+	(void) arg;
+
+	*record = (uint8_t) record_i;
+}
+
+/* the path of a generated file */
+static void bench_path(char *path, uint64_t file_i)
+{
+	sprintf(path, BENCH_DIR_PATH "/%u", (unsigned) file_i);
+}
+
+/*
+ * Sum the bytes of a file.
+ * file:	the opened file
+ * returns	the sum
+ */
+static uint64_t sum_file(struct file_structor *file)
+{
+	struct file_struct whole;
+	const uint8_t *bytes;
+	uint64_t sum = 0;
+	size_t byte_i;
+
+	if (init_file_struct(&whole, file, file->size, 0)) {
+		return 0;
+	}
+	bytes = whole.data;
+	for (byte_i = 0; byte_i < whole.size; byte_i++) {
+		sum += bytes[byte_i];
+	}
+	teardown_file_struct(&whole);
+
+	return sum;
+}
+
+/* Read random files, opening and closing each one. */
+static uint64_t read_with_opens(struct handle_cache *cache)
+{
+	uint64_t state = 1, sum = 0;
+	char path[64];
+	size_t read_i;
+
+	(void) cache;
+
+	for (read_i = 0; read_i < N_READS; read_i++) {
+		struct file_structor file;
+
+		bench_path(path, bench_random(&state) % N_FILES);
+		if (open_file_structor(&file, path)) {
+			return 0;
+		}
+		sum += sum_file(&file);
+		close_file_structor(&file);
+	}
+
+	return sum;
+}
+
+/* Read random files, acquiring them from the cache. */
+static uint64_t read_with_cache(struct handle_cache *cache)
+{
+	uint64_t state = 1, sum = 0;
+	char path[64];
+	size_t read_i;
+
+	for (read_i = 0; read_i < N_READS; read_i++) {
+		struct file_structor *file;
+
+		bench_path(path, bench_random(&state) % N_FILES);
+		if (acquire_cached_file(cache, path, &file)) {
+			return 0;
+		}
+		sum += sum_file(file);
+		release_cached_file(cache, file);
+	}
+
+	return sum;
+}
+
+/* a method to time */
+struct method {
+	const char *name;
+	uint64_t (*read)(struct handle_cache *cache);
+};
+
+#define N_METHODS	2
+static const struct method methods[N_METHODS] = {
+	{"open_file_structor", read_with_opens},
+	{"acquire_cached_file", read_with_cache},
+};
+
+int main()
+{
+	struct handle_cache cache;
+	char path[64];
+	size_t method_i;
+	unsigned file_i;
+
+	mkdir(BENCH_DIR_PATH, 0755);
+	for (file_i = 0; file_i < N_FILES; file_i++) {
+		bench_path(path, file_i);
+		if (generate_bench_file(path, 1, FILE_SIZE, fill_record,
+					NULL)) {
+			return 1;
+		}
+	}
+	if (init_handle_cache(&cache, N_FILES, FILE_SIZE, 1000)) {
+		return 1;
+	}
+
+	for (method_i = 0; method_i < N_METHODS; method_i++) {
+		const struct method *timed = &methods[method_i];
+		double start = bench_seconds(), elapsed;
+		uint64_t sum = timed->read(&cache);
+
+		elapsed = bench_seconds() - start;
+		printf("%-26s %6.2f M files/s (checksum %llx)\n", timed->name,
+		       N_READS / elapsed / 1e6, (unsigned long long) sum);
+	}
+
+	teardown_handle_cache(&cache);
+	for (file_i = 0; file_i < N_FILES; file_i++) {
+		bench_path(path, file_i);
+		unlink(path);
+	}
+	rmdir(BENCH_DIR_PATH);
+
+	return 0;
+}
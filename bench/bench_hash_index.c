@@ -0,0 +1,131 @@
+/*
+ * times building a hash index on one thread and on every processor,
+ * and compares the latency of looking up random keys in it
+ * with scanning the unsorted records for each key
+ */
+#include "bench_common.h"
+
+#include <hash_index.h>
+
+/* the file holding the generated records, and its index */
+#define BENCH_FILE	BENCH_DIR "/bench_hash_index"
+#define INDEX_FILE	BENCH_DIR "/bench_hash_index.idx"
+/* the number of records in the file */
+#define N_RECORDS	(1 << 23)
+/* the number of lookups through the index, and by scanning */
+#define N_LOOKUPS	(1 << 21)
+#define N_SCANS		4
+
+/* the record, with an unsorted big-endian key */
+struct bench_record {
+	uint64_t key;
+	uint64_t payload;
+};
+
+static const struct fs_int_field key_field = {
+	offsetof(struct bench_record, key), sizeof(uint64_t), BIG_END, 0
+};
+
+/* the key of a record, which is a permutation of the record indices */
+static uint64_t record_key(uint64_t record_i)
+{
+	return (record_i * 0x9e3779b97f4a7c15ull) & (N_RECORDS - 1);
+}
+
+static void fill_record(uint8_t *record, uint64_t record_i, void *arg)
+{
+	struct bench_record *bench_record = (struct bench_record *) record;
+	uint64_t key = record_key(record_i);
+
+	(void) arg;
+
+	portable_memcpy(&bench_record->key, &key, sizeof(key), BIG_END);
+	bench_record->payload = record_i;
+}
+
+/*
+ * Build the index and time it.
+ * structor:	the source file
+ * n_threads:	the number of threads, or 0 for every processor
+ * returns	0 on success; 1 on error
+ */
+static int time_build(struct file_structor *structor, unsigned n_threads)
+{
+	double start = bench_seconds();
+
+	if (build_hash_index(structor, 0, sizeof(struct bench_record),
+			     N_RECORDS, &key_field, n_threads, INDEX_FILE)) {
+		return 1;
+	}
+	printf("build_hash_index, %s %8.2f M records/s\n",
+	       n_threads == 1 ? "1 thread" : "all     ",
+	       N_RECORDS / (bench_seconds() - start) / 1e6);
+
+	return 0;
+}
+
+/* Find the first record with a key by reading every record. */
+static off_t scan_for_key(const struct file_struct *records, uint64_t key)
+{
+	const uint8_t *data = (const uint8_t *) records->data;
+	size_t record_i;
+
+	for (record_i = 0; record_i < N_RECORDS; record_i++) {
+		if (load_int_field_key(data + record_i *
+				       sizeof(struct bench_record),
+				       &key_field) == key) {
+			return record_i * sizeof(struct bench_record);
+		}
+	}
+
+	return -1;
+}
+
+int main()
+{
+	struct file_structor structor;
+	struct file_struct records;
+	struct hash_index index;
+	uint64_t random_state = 88172645463325252ull, checksum = 0;
+	double start, elapsed;
+	size_t lookup_i;
+
+	if (generate_bench_file(BENCH_FILE, sizeof(struct bench_record),
+				N_RECORDS, fill_record, NULL) ||
+	    open_file_structor(&structor, BENCH_FILE) ||
+	    init_file_struct(&records, &structor, structor.size, 0) ||
+	    time_build(&structor, 1) || time_build(&structor, 0) ||
+	    open_hash_index(&index, INDEX_FILE, &structor)) {
+		return 1;
+	}
+
+	start = bench_seconds();
+	for (lookup_i = 0; lookup_i < N_SCANS; lookup_i++) {
+		checksum += scan_for_key(&records, bench_random(&random_state) %
+						   N_RECORDS);
+	}
+	elapsed = bench_seconds() - start;
+	printf("scan for each key           %10.0f ns/lookup (checksum %llx)\n",
+	       elapsed / N_SCANS * 1e9, (unsigned long long) checksum);
+
+	checksum = 0;
+	start = bench_seconds();
+	for (lookup_i = 0; lookup_i < N_LOOKUPS; lookup_i++) {
+		off_t record_start = 0;
+
+		hash_index_find(&index, bench_random(&random_state) %
+					N_RECORDS, &record_start);
+		checksum += record_start;
+	}
+	elapsed = bench_seconds() - start;
+	printf("hash_index_find             %10.0f ns/lookup (checksum %llx)\n",
+	       elapsed / N_LOOKUPS * 1e9, (unsigned long long) checksum);
+
+	close_hash_index(&index);
+	teardown_file_struct(&records);
+	close_file_structor(&structor);
+	unlink(INDEX_FILE);
+	unlink(BENCH_FILE);
+
+	return 0;
+}
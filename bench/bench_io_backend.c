@@ -0,0 +1,163 @@
+/*
+ * compares the backends reading the chunks of a file,
+ * on sequential, strided and random chunks, with a cold and a warm cache
+ */
+#include "bench_common.h"
+
+#include <io_backend.h>
+
+#include <stdio.h>
+
+/* the file holding the generated records */
+#define BENCH_FILE	BENCH_DIR "/bench_io_backend"
+/* the number of records in the file, and the size of each */
+#define N_RECORDS	(1 << 14)
+#define RECORD_SIZE	4096
+#define FILE_SIZE	((off_t) N_RECORDS * RECORD_SIZE)
+/* the number of chunks read by the random workload */
+#define N_RANDOM	4096
+
+static void fill_record(uint8_t *record, uint64_t record_i, void *arg)
+{
+	uint64_t state = record_i + 1;
+	size_t word_i;
+
+	(void) arg;
+
+	for (word_i = 0; word_i < RECORD_SIZE / sizeof(uint64_t); word_i++) {
+		((uint64_t *) record)[word_i] = bench_random(&state);
+	}
+}
+
+/* a pattern of chunks read from the file */
+struct workload {
+	const char *name;
+	/* the size of each chunk, and the distance between them */
+	off_t chunk_size;
+	off_t stride;
+	/* nonzero to read chunks at random locations instead */
+	int is_random;
+};
+
+/* Sum the words of a chunk, touching each of its pages. */
+static uint64_t sum_chunk(const struct file_struct *chunk)
+{
+	const uint64_t *words = chunk->data;
+	size_t word_i;
+	uint64_t sum = 0;
+
+	for (word_i = 0; word_i < chunk->size / sizeof(uint64_t); word_i++) {
+		sum += words[word_i];
+	}
+
+	return sum;
+}
+
+/*
+ * Read the chunks of a workload, one at a time.
+ * returns	the checksum of the chunks, or 0 on error
+ */
+static uint64_t
+run_workload(struct file_structor *structor, const struct workload *workload)
+{
+	const size_t n_chunks = workload->is_random ? N_RANDOM :
+				FILE_SIZE / workload->stride;
+	uint64_t state = 1, sum = 0;
+	size_t chunk_i;
+
+	for (chunk_i = 0; chunk_i < n_chunks; chunk_i++) {
+		struct file_struct chunk;
+		off_t start = workload->is_random ?
+			      (off_t) (bench_random(&state) %
+				       (FILE_SIZE / workload->chunk_size)) *
+			      workload->chunk_size :
+			      (off_t) chunk_i * workload->stride;
+
+		if (init_file_struct(&chunk, structor, workload->chunk_size,
+				     start)) {
+			return 0;
+		}
+		sum += sum_chunk(&chunk);
+		teardown_file_struct(&chunk);
+	}
+
+	return sum;
+}
+
+int main()
+{
+	static const struct workload workloads[] = {
+		{ "sequential", 64 << 10, 64 << 10, 0 },
+		{ "strided", 4096, 64 << 10, 0 },
+		{ "random", 256, 0, 1 },
+	};
+	static const enum io_backend_kind kinds[] = {
+		IO_BACKEND_MMAP, IO_BACKEND_PREAD, IO_BACKEND_MEMORY,
+		IO_BACKEND_AUTO
+	};
+	const size_t n_kinds = sizeof(kinds) / sizeof(kinds[0]);
+	struct file_structor structor;
+	size_t workload_i, kind_i;
+	int is_warm;
+
+	if (generate_bench_file(BENCH_FILE, RECORD_SIZE, N_RECORDS,
+				fill_record, NULL) ||
+	    open_file_structor(&structor, BENCH_FILE)) {
+		return 1;
+	}
+	fsync(structor.fd);
+
+	printf("%-16s", "ms");
+	for (kind_i = 0; kind_i < n_kinds; kind_i++) {
+		printf(" %9s", get_io_backend(kinds[kind_i])->name);
+	}
+	printf("\n");
+
+	for (workload_i = 0;
+	     workload_i < sizeof(workloads) / sizeof(workloads[0]);
+	     workload_i++) {
+		for (is_warm = 0; is_warm <= 1; is_warm++) {
+			uint64_t checksum = 0;
+
+			printf("%-10s %-5s", workloads[workload_i].name,
+			       is_warm ? "warm" : "cold");
+			for (kind_i = 0; kind_i < n_kinds; kind_i++) {
+				double start, elapsed;
+				uint64_t sum;
+
+				set_io_backend(&structor, IO_BACKEND_MMAP);
+				if (!is_warm) {
+					posix_fadvise(structor.fd, 0, 0,
+						      POSIX_FADV_DONTNEED);
+				} else {
+					run_workload(&structor,
+						     &workloads[workload_i]);
+				}
+				/* Loading into memory is part of the time. */
+				start = bench_seconds();
+				if (set_io_backend(&structor, kinds[kind_i])) {
+					return 1;
+				}
+				sum = run_workload(&structor,
+						   &workloads[workload_i]);
+				elapsed = bench_seconds() - start;
+				if (sum == 0 || (checksum && sum != checksum)) {
+					printlg(ERROR_LEVEL,
+						"Wrong checksum %llx.\n",
+						(unsigned long long) sum);
+					return 1;
+				}
+				checksum = sum;
+				printf(" %9.2f", elapsed * 1e3);
+			}
+			printf("  (%llu mapped, %llu copied by auto)\n",
+			       (unsigned long long) structor.costs.n_mmaps,
+			       (unsigned long long) structor.costs.n_preads);
+		}
+	}
+
+	close_file_structor(&structor);
+	unlink(BENCH_FILE);
+
+	return 0;
+}
@@ -0,0 +1,121 @@
+/*
+ * compares cold scans of a file by unmodified loops of "init_file_struct"
+ * at regular strides, forwards and backwards,
+ * with adaptive readahead disabled and enabled
+ */
+#include "bench_common.h"
+
+#include <readahead.h>
+
+#include <stdio.h>
+
+/* the file holding the generated records */
+#define BENCH_FILE	BENCH_DIR "/bench_readahead"
+/* the number of records in the file, and the size of each */
+#define N_RECORDS	(1 << 15)
+#define RECORD_SIZE	4096
+/* the size of the header read from each record visited */
+#define HEADER_SIZE	64
+
+static void fill_record(uint8_t *record, uint64_t record_i, void *arg)
+{
+	uint64_t state = record_i + 1;
+	size_t byte_i;
+
+	(void) arg;
+
+	for (byte_i = 0; byte_i < HEADER_SIZE; byte_i++) {
+		record[byte_i] = (uint8_t) bench_random(&state);
+	}
+}
+
+/* Drop the pages of the file from the page cache. */
+static void drop_cache(struct file_structor *structor)
+{
+	fsync(structor->fd);
+	posix_fadvise(structor->fd, 0, 0, POSIX_FADV_DONTNEED);
+}
+
+/*
+ * Sum the headers of every "step"th record from the first or the last,
+ * mapping each one by itself, the way legacy loops do.
+ */
+static uint64_t
+scan_headers(struct file_structor *structor, size_t step, int is_backwards)
+{
+	uint64_t sum = 0;
+	size_t visit_i;
+
+	for (visit_i = 0; visit_i < N_RECORDS / step; visit_i++) {
+		size_t record_i = is_backwards ?
+				  N_RECORDS - 1 - visit_i * step :
+				  visit_i * step;
+		struct file_struct header;
+		uint64_t field = 0;
+		size_t field_i;
+
+		if (init_file_struct(&header, structor, HEADER_SIZE,
+				     (off_t) record_i * RECORD_SIZE)) {
+			return 0;
+		}
+		for (field_i = 0; field_i < HEADER_SIZE / sizeof(field);
+		     field_i++) {
+			copy_section_at(&field, 0, &header,
+					field_i * sizeof(field), sizeof(field),
+					BIG_END);
+			sum += field;
+		}
+		teardown_file_struct(&header);
+	}
+
+	return sum;
+}
+
+int main()
+{
+	static const struct {
+		const char *name;
+		size_t step;
+		int is_backwards;
+	} scans[] = {
+		{ "every record", 1, 0 },
+		{ "every record backwards", 1, 1 },
+		{ "every 64th record", 64, 0 },
+	};
+	struct file_structor structor;
+	size_t scan_i;
+
+	if (generate_bench_file(BENCH_FILE, RECORD_SIZE, N_RECORDS,
+				fill_record, NULL) ||
+	    open_file_structor(&structor, BENCH_FILE)) {
+		return 1;
+	}
+
+	for (scan_i = 0; scan_i < sizeof(scans) / sizeof(scans[0]); scan_i++) {
+		unsigned max_distance;
+
+		for (max_distance = 0; max_distance <= READAHEAD_MAX_DISTANCE;
+		     max_distance += READAHEAD_MAX_DISTANCE) {
+			double start, elapsed;
+			uint64_t sum;
+
+			drop_cache(&structor);
+			set_adaptive_readahead(&structor, max_distance);
+			start = bench_seconds();
+			sum = scan_headers(&structor, scans[scan_i].step,
+					   scans[scan_i].is_backwards);
+			elapsed = bench_seconds() - start;
+			printf("%-24s %-10s %8.2f ms, %5u readaheads "
+			       "(checksum %llx)\n", scans[scan_i].name,
+			       max_distance ? "readahead" : "plain",
+			       elapsed * 1e3,
+			       (unsigned) structor.pattern.n_readaheads,
+			       (unsigned long long) sum);
+		}
+	}
+
+	close_file_structor(&structor);
+	unlink(BENCH_FILE);
+
+	return 0;
+}
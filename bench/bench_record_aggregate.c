@@ -0,0 +1,133 @@
+/*
+ * compares summing a field with "COPY_MEMBER" on each record,
+ * with the aggregation kernels on one thread and on every processor
+ */
+#include "bench_common.h"
+
+#include <record_aggregate.h>
+
+/* the file holding the generated records */
+#define BENCH_FILE	BENCH_DIR "/bench_record_aggregate"
+/* the number of records in the file */
+#define N_RECORDS	(1 << 23)
+/* the number of times to aggregate every record with each method */
+#define N_PASSES	3
+
+/* the record, with a big-endian value to aggregate */
+struct bench_record {
+	uint64_t id;
+	uint32_t value;
+	uint32_t other;
+};
+
+static const struct fs_int_field value_field = {
+	offsetof(struct bench_record, value), sizeof(uint32_t), BIG_END, 0
+};
+
+static void fill_record(uint8_t *record, uint64_t record_i, void *arg)
+{
+	struct bench_record *bench_record = (struct bench_record *) record;
+	uint32_t value = (uint32_t) (record_i * 2654435761u);
+
+	(void) arg;
+
+	bench_record->id = record_i;
+	portable_memcpy(&bench_record->value, &value, sizeof(value), BIG_END);
+	bench_record->other = 0;
+}
+
+static uint64_t sum_with_macros(struct file_struct *records)
+{
+	struct bench_record decoded;
+	uint64_t sum = 0;
+	size_t record_i;
+
+	for (record_i = 0; record_i < N_RECORDS; record_i++) {
+		struct file_struct record;
+
+		derive_file_struct(&record, records,
+				   sizeof(struct bench_record),
+				   record_i * sizeof(struct bench_record));
+		COPY_MEMBER(&decoded, &record, struct bench_record, value,
+			    BIG_END);
+		sum += decoded.value;
+	}
+
+	return sum;
+}
+
+/*
+ * Aggregate with the kernels.
+ * records:	the chunk holding the records
+ * n_threads:	the number of threads, or 0 for every processor
+ * returns	the sum
+ */
+static uint64_t sum_with_kernels(struct file_struct *records,
+				 unsigned n_threads)
+{
+	struct field_aggregate aggregate;
+
+	aggregate_field(records, sizeof(struct bench_record), &value_field,
+			n_threads, &aggregate);
+
+	return aggregate.sum;
+}
+
+static uint64_t sum_on_one_thread(struct file_struct *records)
+{
+	return sum_with_kernels(records, 1);
+}
+
+static uint64_t sum_on_every_processor(struct file_struct *records)
+{
+	return sum_with_kernels(records, 0);
+}
+
+/* a method to time */
+struct method {
+	const char *name;
+	uint64_t (*sum)(struct file_struct *records);
+};
+
+#define N_METHODS	3
+static const struct method methods[N_METHODS] = {
+	{"COPY_MEMBER", sum_with_macros},
+	{"aggregate_field, 1 thread", sum_on_one_thread},
+	{"aggregate_field, all", sum_on_every_processor},
+};
+
+int main()
+{
+	struct file_structor structor;
+	struct file_struct records;
+	size_t method_i;
+
+	if (generate_bench_file(BENCH_FILE, sizeof(struct bench_record),
+				N_RECORDS, fill_record, NULL) ||
+	    open_file_structor(&structor, BENCH_FILE) ||
+	    init_file_struct(&records, &structor, structor.size, 0)) {
+		return 1;
+	}
+
+	for (method_i = 0; method_i < N_METHODS; method_i++) {
+		const struct method *timed = &methods[method_i];
+		uint64_t sum = timed->sum(&records);
+		double start = bench_seconds(), elapsed;
+		unsigned pass_i;
+
+		for (pass_i = 0; pass_i < N_PASSES; pass_i++) {
+			sum += timed->sum(&records);
+		}
+		elapsed = bench_seconds() - start;
+
+		printf("%-26s %6.2f GB/s (checksum %llx)\n", timed->name,
+		       (double) records.size * N_PASSES / elapsed / 1e9,
+		       (unsigned long long) sum);
+	}
+
+	teardown_file_struct(&records);
+	close_file_structor(&structor);
+	unlink(BENCH_FILE);
+
+	return 0;
+}
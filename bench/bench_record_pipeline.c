@@ -0,0 +1,167 @@
+/*
+ * compares decoding and summing the records of a file that starts out
+ * of the page cache, serially on one thread,
+ * and with a pipeline overlapping the reading, decoding and summing
+ */
+#include "bench_common.h"
+
+#include <record_pipeline.h>
+
+/* the file holding the generated records */
+#define BENCH_FILE	BENCH_DIR "/bench_record_pipeline"
+/* the number of records in the file, which has 256 MiB */
+#define N_RECORDS	(1 << 24)
+/* the number of records decoded at once by each method */
+#define BATCH_RECORDS	(1 << 16)
+
+/* the record, with every member big-endian in the file */
+struct bench_record {
+	uint64_t id;
+	uint32_t value;
+	uint32_t other;
+};
+
+static const struct member_layout bench_layout[3] = {
+	MEMBER_LAYOUT(struct bench_record, id, 0, BIG_END),
+	MEMBER_LAYOUT(struct bench_record, value,
+		      offsetof(struct bench_record, value), BIG_END),
+	MEMBER_LAYOUT(struct bench_record, other,
+		      offsetof(struct bench_record, other), BIG_END),
+};
+
+static void fill_record(uint8_t *record, uint64_t record_i, void *arg)
+{
+	struct bench_record *bench_record = (struct bench_record *) record;
+	uint32_t value = (uint32_t) (record_i * 2654435761u);
+
+	(void) arg;
+
+	portable_memcpy(&bench_record->id, &record_i, sizeof(record_i),
+			BIG_END);
+	portable_memcpy(&bench_record->value, &value, sizeof(value), BIG_END);
+	bench_record->other = 0;
+}
+
+/* Sum the members of decoded records. */
+static uint64_t sum_decoded(const struct bench_record *records, size_t n)
+{
+	uint64_t sum = 0;
+	size_t record_i;
+
+	for (record_i = 0; record_i < n; record_i++) {
+		sum += records[record_i].id + records[record_i].value;
+	}
+
+	return sum;
+}
+
+/* Map, decode and sum each batch in turn on this thread. */
+static uint64_t
+scan_serially(struct file_structor *structor, const struct copy_plan *plan)
+{
+	struct bench_record *decoded =
+		malloc(sizeof(*decoded) * BATCH_RECORDS);
+	uint64_t sum = 0;
+	size_t first;
+
+	for (first = 0; first < N_RECORDS; first += BATCH_RECORDS) {
+		struct file_struct batch;
+
+		if (init_file_struct(&batch, structor,
+				     BATCH_RECORDS * sizeof(*decoded),
+				     first * sizeof(*decoded))) {
+			break;
+		}
+		apply_copy_plan_array(plan, decoded, sizeof(*decoded), &batch,
+				      0, sizeof(*decoded), BATCH_RECORDS);
+		teardown_file_struct(&batch);
+		sum += sum_decoded(decoded, BATCH_RECORDS);
+	}
+	free(decoded);
+
+	return sum;
+}
+
+/* the consumer of the pipeline, adding to a sum */
+static enum fs_status
+consume_sum(void *arg, const void *decoded, size_t first, size_t n_records)
+{
+	uint64_t *sum = arg;
+
+	(void) first;
+
+	*sum += sum_decoded(decoded, n_records);
+
+	return FS_NO_ERROR;
+}
+
+/* Decode and sum the records with a pipeline. */
+static uint64_t
+scan_pipelined(struct file_structor *structor, const struct copy_plan *plan)
+{
+	struct plan_decoder decoder = { plan, sizeof(struct bench_record) };
+	struct record_pipeline pipeline = { 0 };
+	uint64_t sum = 0;
+
+	pipeline.record_size = sizeof(struct bench_record);
+	pipeline.n_records = N_RECORDS;
+	pipeline.batch_records = BATCH_RECORDS;
+	pipeline.decoded_size = sizeof(struct bench_record);
+	pipeline.decode = decode_with_plan;
+	pipeline.decode_arg = &decoder;
+	pipeline.consume = consume_sum;
+	pipeline.consume_arg = &sum;
+	run_record_pipeline(structor, &pipeline);
+
+	return sum;
+}
+
+/* a method to time */
+struct method {
+	const char *name;
+	uint64_t (*scan)(struct file_structor *structor,
+			 const struct copy_plan *plan);
+};
+
+#define N_METHODS	2
+static const struct method methods[N_METHODS] = {
+	{"serial", scan_serially},
+	{"run_record_pipeline", scan_pipelined},
+};
+
+int main()
+{
+	struct file_structor structor;
+	struct copy_plan plan;
+	size_t method_i;
+
+	if (generate_bench_file(BENCH_FILE, sizeof(struct bench_record),
+				N_RECORDS, fill_record, NULL) ||
+	    open_file_structor(&structor, BENCH_FILE) ||
+	    compile_copy_plan(&plan, bench_layout, 3)) {
+		return 1;
+	}
+	fsync(structor.fd);
+
+	for (method_i = 0; method_i < N_METHODS; method_i++) {
+		const struct method *timed = &methods[method_i];
+		double start, elapsed;
+		uint64_t sum;
+
+		/* Start each scan with the file out of the page cache. */
+		posix_fadvise(structor.fd, 0, 0, POSIX_FADV_DONTNEED);
+		start = bench_seconds();
+		sum = timed->scan(&structor, &plan);
+		elapsed = bench_seconds() - start;
+
+		printf("%-26s %6.2f GB/s (checksum %llx)\n", timed->name,
+		       (double) structor.size / elapsed / 1e9,
+		       (unsigned long long) sum);
+	}
+
+	free_copy_plan(&plan);
+	close_file_structor(&structor);
+	unlink(BENCH_FILE);
+
+	return 0;
+}
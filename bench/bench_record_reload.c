@@ -0,0 +1,134 @@
+/*
+ * compares reloading a file of records after a few of them are rewritten
+ * in place by decoding every record again,
+ * and with "reload_records" decoding only the changed blocks
+ */
+#include "bench_common.h"
+
+#include <record_reload.h>
+
+/* the file holding the generated records */
+#define BENCH_FILE	BENCH_DIR "/bench_record_reload"
+/* the number of records in the file, which has 256 MiB */
+#define N_RECORDS	(1 << 24)
+/* the number of records rewritten before each reload */
+#define N_REWRITES	16
+
+/* the record, with every member big-endian in the file */
+struct bench_record {
+	uint64_t id;
+	uint32_t value;
+	uint32_t other;
+};
+
+static const struct member_layout bench_layout[3] = {
+	MEMBER_LAYOUT(struct bench_record, id, 0, BIG_END),
+	MEMBER_LAYOUT(struct bench_record, value,
+		      offsetof(struct bench_record, value), BIG_END),
+	MEMBER_LAYOUT(struct bench_record, other,
+		      offsetof(struct bench_record, other), BIG_END),
+};
+
+static void fill_record(uint8_t *record, uint64_t record_i, void *arg)
+{
+	struct bench_record *bench_record = (struct bench_record *) record;
+	uint32_t value = (uint32_t) (record_i * 2654435761u);
+
+	(void) arg;
+
+	portable_memcpy(&bench_record->id, &record_i, sizeof(record_i),
+			BIG_END);
+	portable_memcpy(&bench_record->value, &value, sizeof(value), BIG_END);
+	bench_record->other = 0;
+}
+
+/* Rewrite the "other" member of random records in place. */
+static void rewrite_records(uint64_t *state)
+{
+	int fd = open(BENCH_FILE, O_WRONLY);
+	unsigned rewrite_i;
+
+	for (rewrite_i = 0; rewrite_i < N_REWRITES; rewrite_i++) {
+		uint64_t record_i = bench_random(state) % N_RECORDS;
+		uint32_t other = (uint32_t) bench_random(state);
+
+		if (pwrite(fd, &other, sizeof(other),
+			   record_i * sizeof(struct bench_record) +
+			   offsetof(struct bench_record, other)) !=
+		    sizeof(other)) {
+			break;
+		}
+	}
+	close(fd);
+}
+
+/* Sum the members of the decoded records. */
+static uint64_t sum_decoded(const struct record_reload *reload)
+{
+	const struct bench_record *records = reload->decoded;
+	uint64_t sum = 0;
+	size_t record_i;
+
+	for (record_i = 0; record_i < reload->n_records; record_i++) {
+		sum += records[record_i].value + records[record_i].other;
+	}
+
+	return sum;
+}
+
+int main()
+{
+	struct copy_plan plan;
+	struct plan_decoder decoder = { &plan, sizeof(struct bench_record) };
+	struct record_reload reload = { 0 };
+	uint64_t state = 42;
+	double start, full, unchanged, incremental;
+
+	if (generate_bench_file(BENCH_FILE, sizeof(struct bench_record),
+				N_RECORDS, fill_record, NULL) ||
+	    compile_copy_plan(&plan, bench_layout, 3)) {
+		return 1;
+	}
+	reload.record_size = sizeof(struct bench_record);
+	reload.decoded_size = sizeof(struct bench_record);
+	reload.decode = decode_with_plan;
+	reload.decode_arg = &decoder;
+	if (init_record_reload(&reload, BENCH_FILE)) {
+		return 1;
+	}
+
+	/* Decoding every block is what a full reload does. */
+	rewrite_records(&state);
+	memset(reload.fingerprints, 0,
+	       sizeof(*reload.fingerprints) * reload.n_blocks);
+	start = bench_seconds();
+	reload_records(&reload, 0);
+	full = bench_seconds() - start;
+	printf("%-26s %8.2f ms (%u blocks, checksum %llx)\n", "full reload",
+	       full * 1e3, (unsigned) reload.n_changed,
+	       (unsigned long long) sum_decoded(&reload));
+
+	rewrite_records(&state);
+	start = bench_seconds();
+	reload_records(&reload, 0);
+	incremental = bench_seconds() - start;
+	printf("%-26s %8.2f ms (%u blocks, checksum %llx)\n",
+	       "reload_records", incremental * 1e3,
+	       (unsigned) reload.n_changed,
+	       (unsigned long long) sum_decoded(&reload));
+
+	/* Wait for the coarse clock to pass the last modification. */
+	usleep(20000);
+	reload_records(&reload, 0);
+	start = bench_seconds();
+	reload_records(&reload, 0);
+	unchanged = bench_seconds() - start;
+	printf("%-26s %8.2f ms (%u blocks)\n", "reload_records, unchanged",
+	       unchanged * 1e3, (unsigned) reload.n_changed);
+
+	teardown_record_reload(&reload);
+	free_copy_plan(&plan);
+	unlink(BENCH_FILE);
+
+	return 0;
+}
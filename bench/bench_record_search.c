@@ -0,0 +1,124 @@
+/*
+ * compares looking up random keys with a plain binary search,
+ * decoding each probed record with "COPY_MEMBER",
+ * with the sampled searches of "sorted_lower_bound"
+ */
+#include "bench_common.h"
+
+#include <record_search.h>
+
+/* the file holding the generated records */
+#define BENCH_FILE	BENCH_DIR "/bench_record_search"
+/* the number of records in the file */
+#define N_RECORDS	(1 << 24)
+/* the number of lookups with each method */
+#define N_LOOKUPS	(1 << 21)
+
+/* the record, sorted by its big-endian key */
+struct bench_record {
+	uint64_t key;
+	uint64_t payload;
+};
+
+static const struct fs_int_field key_field = {
+	offsetof(struct bench_record, key), sizeof(uint64_t), BIG_END, 0
+};
+
+/* the key of a record, with gaps so that some lookups miss */
+static uint64_t record_key(uint64_t record_i)
+{
+	return record_i * 3;
+}
+
+static void fill_record(uint8_t *record, uint64_t record_i, void *arg)
+{
+	struct bench_record *bench_record = (struct bench_record *) record;
+	uint64_t key = record_key(record_i);
+
+	(void) arg;
+
+	portable_memcpy(&bench_record->key, &key, sizeof(key), BIG_END);
+	bench_record->payload = record_i;
+}
+
+static size_t naive_lower_bound(struct sorted_records *sorted, uint64_t key)
+{
+	size_t low = 0, high = sorted->n_records;
+
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+		struct bench_record decoded;
+		struct file_struct record;
+
+		derive_file_struct(&record, &sorted->records,
+				   sizeof(struct bench_record),
+				   middle * sizeof(struct bench_record));
+		COPY_MEMBER(&decoded, &record, struct bench_record, key,
+			    BIG_END);
+		if (decoded.key < key) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+
+	return low;
+}
+
+/* a method to time */
+struct method {
+	const char *name;
+	size_t (*lower_bound)(struct sorted_records *sorted, uint64_t key);
+};
+
+static size_t sampled_lower_bound(struct sorted_records *sorted, uint64_t key)
+{
+	return sorted_lower_bound(sorted, key);
+}
+
+#define N_METHODS	2
+static const struct method methods[N_METHODS] = {
+	{"COPY_MEMBER binary search", naive_lower_bound},
+	{"sorted_lower_bound", sampled_lower_bound},
+};
+
+int main()
+{
+	struct file_structor structor;
+	struct sorted_records sorted;
+	size_t method_i;
+
+	if (generate_bench_file(BENCH_FILE, sizeof(struct bench_record),
+				N_RECORDS, fill_record, NULL) ||
+	    open_file_structor(&structor, BENCH_FILE) ||
+	    init_sorted_records(&sorted, &structor, 0,
+				sizeof(struct bench_record), N_RECORDS,
+				&key_field, 0)) {
+		return 1;
+	}
+
+	for (method_i = 0; method_i < N_METHODS; method_i++) {
+		const struct method *timed = &methods[method_i];
+		uint64_t random_state = 88172645463325252ull, checksum = 0;
+		double start = bench_seconds(), elapsed;
+		size_t lookup_i;
+
+		for (lookup_i = 0; lookup_i < N_LOOKUPS; lookup_i++) {
+			uint64_t key = bench_random(&random_state) %
+				       record_key(N_RECORDS);
+
+			checksum += timed->lower_bound(&sorted, key);
+		}
+		elapsed = bench_seconds() - start;
+
+		printf("%-26s %6.2f M lookups/s (checksum %llx)\n",
+		       timed->name, N_LOOKUPS / elapsed / 1e6,
+		       (unsigned long long) checksum);
+	}
+
+	teardown_sorted_records(&sorted);
+	close_file_structor(&structor);
+	unlink(BENCH_FILE);
+
+	return 0;
+}
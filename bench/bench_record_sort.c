@@ -0,0 +1,112 @@
+/*
+ * times sorting a file of records by a random big-endian key
+ * with "sort_record_file", within a budget small enough to need a merge
+ * of many runs, and within one large enough for a single run
+ */
+#include "bench_common.h"
+
+#include <record_sort.h>
+
+/* the file holding the generated records, and the sorted file */
+#define BENCH_FILE	BENCH_DIR "/bench_record_sort"
+#define SORTED_FILE	BENCH_DIR "/bench_record_sort.sorted"
+/* the number of records in the file */
+#define N_RECORDS	(1 << 23)
+/* the size of each record, with its 4-byte key after an 8-byte ID */
+#define RECORD_SIZE	16
+
+static const struct fs_int_field sort_key = {
+	sizeof(uint64_t), 4, BIG_END, 0
+};
+
+static void fill_record(uint8_t *record, uint64_t record_i, void *arg)
+{
+	uint64_t key = bench_random((uint64_t *) arg);
+	size_t byte_i;
+
+	memcpy(record, &record_i, sizeof(record_i));
+	for (byte_i = 0; byte_i < sort_key.width; byte_i++) {
+		record[sort_key.offset + byte_i] =
+			(uint8_t) (key >> (8 * byte_i));
+	}
+	record[14] = 0;
+	record[15] = 0;
+}
+
+/*
+ * Check that the sorted file holds as many records as the source,
+ * in order.
+ * returns	1 if it does; 0 otherwise
+ */
+static int check_sorted()
+{
+	struct file_structor structor;
+	struct file_struct records;
+	uint64_t last = 0;
+	const uint8_t *data;
+	size_t record_i;
+	int ret = 1;
+
+	if (open_file_structor(&structor, SORTED_FILE)) {
+		return 0;
+	}
+	if (structor.size != (off_t) N_RECORDS * RECORD_SIZE ||
+	    init_file_struct(&records, &structor, structor.size, 0)) {
+		close_file_structor(&structor);
+		return 0;
+	}
+	data = records.data;
+	for (record_i = 0; ret && record_i < N_RECORDS; record_i++) {
+		uint64_t key = load_int_field(data + record_i * RECORD_SIZE,
+					      &sort_key);
+
+		ret = key >= last;
+		last = key;
+	}
+	teardown_file_struct(&records);
+	close_file_structor(&structor);
+
+	return ret;
+}
+
+/* the memory budgets to time */
+#define N_BUDGETS	2
+static const size_t budgets[N_BUDGETS] = {
+	SORT_MIN_BUDGET, (size_t) 1 << 30
+};
+
+int main()
+{
+	uint64_t state = 42;
+	struct file_structor structor;
+	size_t budget_i;
+
+	if (generate_bench_file(BENCH_FILE, RECORD_SIZE, N_RECORDS,
+				fill_record, &state) ||
+	    open_file_structor(&structor, BENCH_FILE)) {
+		return 1;
+	}
+
+	for (budget_i = 0; budget_i < N_BUDGETS; budget_i++) {
+		double start, elapsed;
+
+		start = bench_seconds();
+		if (sort_record_file(&structor, 0, RECORD_SIZE, N_RECORDS,
+				     &sort_key, budgets[budget_i], 0,
+				     SORTED_FILE)) {
+			return 1;
+		}
+		elapsed = bench_seconds() - start;
+
+		printf("budget %5u MiB %6.2f GB/s (%s)\n",
+		       (unsigned) (budgets[budget_i] >> 20),
+		       (double) structor.size / elapsed / 1e9,
+		       check_sorted() ? "sorted" : "NOT SORTED");
+	}
+
+	close_file_structor(&structor);
+	unlink(BENCH_FILE);
+	unlink(SORTED_FILE);
+
+	return 0;
+}
@@ -0,0 +1,163 @@
+/*
+ * compares the peak resident memory and throughput
+ * of summing a field over a file many times larger than a memory budget,
+ * with one plain mapping, and with a bounded-memory stream scan
+ */
+#include "bench_common.h"
+
+#include <stream_scan.h>
+
+#include <stdio.h>
+
+/* the file holding the generated records */
+#define BENCH_FILE	BENCH_DIR "/bench_stream_scan"
+/* the number of records in the file, which has 512 MiB */
+#define N_RECORDS	(1 << 25)
+/* the memory budget of the stream scan */
+#define BUDGET		(64 << 20)
+/* the number of records between samples of the resident memory */
+#define SAMPLE_RECORDS	(1 << 20)
+
+struct bench_record {
+	uint64_t value;
+	uint64_t other;
+};
+
+static void fill_record(uint8_t *record, uint64_t record_i, void *arg)
+{
+	struct bench_record *bench_record = (struct bench_record *) record;
+
+	(void) arg;
+
+	bench_record->value = record_i;
+	bench_record->other = 0;
+}
+
+/* the resident memory of this process, in bytes */
+static size_t resident_size()
+{
+	unsigned long n_pages = 0, n_resident = 0;
+	FILE *statm = fopen("/proc/self/statm", "r");
+
+	if (statm != NULL) {
+		if (fscanf(statm, "%lu %lu", &n_pages, &n_resident) != 2) {
+			n_resident = 0;
+		}
+		fclose(statm);
+	}
+
+	return n_resident * sysconf(_SC_PAGE_SIZE);
+}
+
+/*
+ * Sum the values of an array of records,
+ * sampling the resident memory as it goes.
+ * data:	the first record
+ * n_records:	the number of records
+ * peak:	the highest resident memory seen, which is raised
+ * returns	the sum
+ */
+static uint64_t
+sum_values(const uint8_t *data, size_t n_records, size_t *peak)
+{
+	uint64_t sum = 0;
+	size_t record_i;
+
+	for (record_i = 0; record_i < n_records; record_i++) {
+		const struct bench_record *record =
+			(const struct bench_record *) data + record_i;
+
+		sum += record->value;
+		if (record_i % SAMPLE_RECORDS == SAMPLE_RECORDS - 1) {
+			size_t resident = resident_size();
+
+			if (resident > *peak) {
+				*peak = resident;
+			}
+		}
+	}
+
+	return sum;
+}
+
+static uint64_t scan_plain(struct file_structor *structor, size_t *peak)
+{
+	struct file_struct records;
+	uint64_t sum;
+
+	if (init_file_struct(&records, structor, structor->size, 0)) {
+		return 0;
+	}
+	sum = sum_values((const uint8_t *) records.data, N_RECORDS, peak);
+	teardown_file_struct(&records);
+
+	return sum;
+}
+
+static uint64_t scan_stream(struct file_structor *structor, size_t *peak)
+{
+	struct stream_scan scan;
+	struct file_struct batch;
+	uint64_t sum = 0;
+	size_t n_batch;
+
+	if (init_stream_scan(&scan, structor, 0, sizeof(struct bench_record),
+			     N_RECORDS, BUDGET, STREAM_DROP_CACHE)) {
+		return 0;
+	}
+	while ((n_batch = stream_scan_next(&scan, &batch)) > 0) {
+		sum += sum_values((const uint8_t *) batch.data, n_batch, peak);
+	}
+	teardown_stream_scan(&scan);
+
+	return sum;
+}
+
+/* a method to time */
+struct method {
+	const char *name;
+	uint64_t (*scan)(struct file_structor *structor, size_t *peak);
+};
+
+#define N_METHODS	2
+static const struct method methods[N_METHODS] = {
+	{"init_file_struct", scan_plain},
+	{"stream_scan, 64 MiB", scan_stream},
+};
+
+int main()
+{
+	struct file_structor structor;
+	size_t method_i;
+
+	if (generate_bench_file(BENCH_FILE, sizeof(struct bench_record),
+				N_RECORDS, fill_record, NULL) ||
+	    open_file_structor(&structor, BENCH_FILE)) {
+		return 1;
+	}
+	fsync(structor.fd);
+
+	for (method_i = 0; method_i < N_METHODS; method_i++) {
+		const struct method *timed = &methods[method_i];
+		size_t base = resident_size(), peak = base;
+		double start, elapsed;
+		uint64_t sum;
+
+		/* Start each scan with the file out of the page cache. */
+		posix_fadvise(structor.fd, 0, 0, POSIX_FADV_DONTNEED);
+		start = bench_seconds();
+		sum = timed->scan(&structor, &peak);
+		elapsed = bench_seconds() - start;
+
+		printf("%-20s %6.2f GB/s, peak RSS +%6.1f MiB "
+		       "(checksum %llx)\n", timed->name,
+		       structor.size / elapsed / 1e9,
+		       (double) (peak - base) / (1 << 20),
+		       (unsigned long long) sum);
+	}
+
+	close_file_structor(&structor);
+	unlink(BENCH_FILE);
+
+	return 0;
+}
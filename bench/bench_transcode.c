@@ -0,0 +1,139 @@
+/*
+ * compares scanning a big-endian file, swapping the bytes of every field
+ * on each pass, with transcoding it once into a native-endian sidecar
+ * and scanning the sidecar
+ */
+#include "bench_common.h"
+
+#include <transcode.h>
+
+/* the file holding the generated records */
+#define BENCH_FILE	BENCH_DIR "/bench_transcode"
+/* the number of records in the file */
+#define N_RECORDS	(1 << 23)
+/* the number of times to scan every record */
+#define N_PASSES	3
+
+/* the record, with every member big-endian in the file */
+struct bench_record {
+	uint64_t id;
+	uint32_t value;
+	uint32_t other;
+};
+
+static const struct member_layout bench_members[] = {
+	MEMBER_LAYOUT(struct bench_record, id, 0, BIG_END),
+	MEMBER_LAYOUT(struct bench_record, value,
+		      offsetof(struct bench_record, value), BIG_END),
+	MEMBER_LAYOUT(struct bench_record, other,
+		      offsetof(struct bench_record, other), BIG_END),
+};
+static const struct transcode_layout bench_layout = {
+	0, sizeof(struct bench_record), bench_members,
+	sizeof(bench_members) / sizeof(*bench_members)
+};
+
+static void fill_record(uint8_t *record, uint64_t record_i, void *arg)
+{
+	struct bench_record *bench_record = (struct bench_record *) record;
+	uint32_t value = (uint32_t) (record_i * 2654435761u);
+
+	(void) arg;
+
+	portable_memcpy(&bench_record->id, &record_i, sizeof(record_i),
+			BIG_END);
+	portable_memcpy(&bench_record->value, &value, sizeof(value), BIG_END);
+	bench_record->other = 0;
+}
+
+/*
+ * Sum the members of every record, in their byte order in the opened file.
+ * records:	the chunk holding the records
+ * returns	the sum
+ */
+static uint64_t sum_records(struct file_struct *records)
+{
+	const enum endianness id_order =
+		native_member_endianness(records->src_file, &bench_members[0]);
+	const enum endianness value_order =
+		native_member_endianness(records->src_file, &bench_members[1]);
+	struct bench_record *raw = records->data;
+	uint64_t sum = 0;
+	size_t record_i;
+
+	for (record_i = 0; record_i < N_RECORDS; record_i++) {
+		struct bench_record decoded;
+
+		portable_memcpy(&decoded.id, &raw[record_i].id,
+				sizeof(decoded.id), id_order);
+		portable_memcpy(&decoded.value, &raw[record_i].value,
+				sizeof(decoded.value), value_order);
+		sum += decoded.id + decoded.value;
+	}
+
+	return sum;
+}
+
+/*
+ * Open the benchmark file, scan it repeatedly, and print the speed.
+ * name:	the name of the method
+ */
+static int time_scans(const char *name)
+{
+	struct file_structor structor;
+	struct file_struct records;
+	double start, elapsed;
+	uint64_t sum;
+	unsigned pass_i;
+
+	if (open_native_file_structor(&structor, BENCH_FILE,
+				      &bench_layout) ||
+	    init_file_struct(&records, &structor,
+			     N_RECORDS * sizeof(struct bench_record), 0)) {
+		return 1;
+	}
+	sum = sum_records(&records);
+	start = bench_seconds();
+	for (pass_i = 0; pass_i < N_PASSES; pass_i++) {
+		sum += sum_records(&records);
+	}
+	elapsed = bench_seconds() - start;
+
+	printf("%-26s %6.2f GB/s (checksum %llx)\n", name,
+	       (double) records.size * N_PASSES / elapsed / 1e9,
+	       (unsigned long long) sum);
+	teardown_file_struct(&records);
+	close_file_structor(&structor);
+
+	return 0;
+}
+
+int main()
+{
+	double start, elapsed;
+
+	remove_native_sidecar(BENCH_FILE);
+	if (generate_bench_file(BENCH_FILE, sizeof(struct bench_record),
+				N_RECORDS, fill_record, NULL) ||
+	    time_scans("big-endian scan")) {
+		return 1;
+	}
+
+	start = bench_seconds();
+	if (transcode_file(BENCH_FILE, &bench_layout, 0)) {
+		return 1;
+	}
+	elapsed = bench_seconds() - start;
+	printf("%-26s %6.2f GB/s\n", "transcode_file, all",
+	       (double) N_RECORDS * sizeof(struct bench_record) / elapsed /
+	       1e9);
+
+	if (time_scans("native sidecar scan")) {
+		return 1;
+	}
+
+	remove_native_sidecar(BENCH_FILE);
+	unlink(BENCH_FILE);
+
+	return 0;
+}
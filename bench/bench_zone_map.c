@@ -0,0 +1,164 @@
+/*
+ * compares cold range scans of a time series on its timestamp,
+ * checking every record, with "scan_zones",
+ * which only maps the blocks whose bounds overlap the range
+ */
+#include "bench_common.h"
+
+#include <zone_map.h>
+
+#include <stdio.h>
+
+/* the file holding the generated records */
+#define BENCH_FILE	BENCH_DIR "/bench_zone_map"
+/* the number of records in the file, and the size of each */
+#define N_RECORDS	(1 << 21)
+#define RECORD_SIZE	64
+/* the number of records in each block of the zone map */
+#define BLOCK_RECORDS	1024
+/* the big-endian timestamp of each record, and its value */
+#define TIME_START	0
+#define TIME_STEP	1000
+
+/* a decoded record */
+struct bench_record {
+	int64_t time;
+	uint32_t value;
+};
+
+#define N_FIELDS	2
+static const struct member_layout fields[N_FIELDS] = {
+	INT_MEMBER_LAYOUT(struct bench_record, time, TIME_START, 8, BIG_END, 1),
+	INT_MEMBER_LAYOUT(struct bench_record, value, 8, 4, BIG_END, 0),
+};
+
+static const struct column_layout layout = {
+	.records_start = 0,
+	.record_size = RECORD_SIZE,
+	.members = fields,
+	.n_members = N_FIELDS,
+	.block_values = BLOCK_RECORDS,
+};
+
+/* Write an increasing timestamp with some jitter, and a random value. */
+static void fill_record(uint8_t *record, uint64_t record_i, void *arg)
+{
+	uint64_t state = record_i + 1;
+	uint64_t time = record_i * TIME_STEP + bench_random(&state) % 100;
+
+	(void) arg;
+
+	memset(record, 0, RECORD_SIZE);
+	encode_uint(record + TIME_START, time, 8, BIG_END);
+	encode_uint(record + 8, bench_random(&state), 4, BIG_END);
+}
+
+/* the state of "sum_matches" */
+struct match_sum {
+	/* the range of timestamps to sum the values of */
+	int64_t min;
+	int64_t max;
+	/* the number of matching records, and the sum of their values */
+	uint64_t n_matches;
+	uint64_t sum;
+};
+
+/* Sum the values of the records of a run in the range of timestamps. */
+static enum fs_status
+sum_matches(struct file_struct *records, size_t first, size_t n_records,
+	    void *arg)
+{
+	struct match_sum *sum = arg;
+	const uint8_t *record = records->data;
+	size_t record_i;
+
+	(void) first;
+
+	for (record_i = 0; record_i < n_records; record_i++) {
+		int64_t time = load_uint(record + TIME_START, 8, BIG_END);
+
+		if (time >= sum->min && time <= sum->max) {
+			sum->n_matches++;
+			sum->sum += load_uint(record + 8, 4, BIG_END);
+		}
+		record += RECORD_SIZE;
+	}
+
+	return FS_NO_ERROR;
+}
+
+/* Drop the pages of a file from the page cache. */
+static void drop_cache(struct file_structor *structor)
+{
+	posix_fadvise(structor->fd, 0, 0, POSIX_FADV_DONTNEED);
+}
+
+int main()
+{
+	/* the fractions of the time span to select */
+	static const double fractions[] = { 0.001, 0.01, 0.1 };
+	struct file_structor structor;
+	struct zone_map map;
+	size_t fraction_i;
+
+	if (generate_bench_file(BENCH_FILE, RECORD_SIZE, N_RECORDS,
+				fill_record, NULL) ||
+	    build_zone_map(BENCH_FILE, &layout, 0) ||
+	    open_file_structor(&structor, BENCH_FILE) ||
+	    open_zone_map(&map, BENCH_FILE, &layout)) {
+		return 1;
+	}
+	fsync(structor.fd);
+
+	for (fraction_i = 0; fraction_i < sizeof(fractions) /
+					  sizeof(fractions[0]);
+	     fraction_i++) {
+		const int64_t span = (int64_t) N_RECORDS * TIME_STEP;
+		struct zone_range range = { .field_i = 0 };
+		struct match_sum sum;
+		struct file_struct records;
+		double start, elapsed;
+		size_t n_visited;
+
+		range.min.i = span / 3;
+		range.max.i = range.min.i + span * fractions[fraction_i];
+
+		sum.min = range.min.i;
+		sum.max = range.max.i;
+		sum.n_matches = 0;
+		sum.sum = 0;
+		drop_cache(&structor);
+		start = bench_seconds();
+		if (init_file_struct(&records, &structor, structor.size, 0)) {
+			return 1;
+		}
+		sum_matches(&records, 0, N_RECORDS, &sum);
+		teardown_file_struct(&records);
+		elapsed = bench_seconds() - start;
+		printf("%5.1f%% %-12s %8.2f ms, %7u matches (sum %llx)\n",
+		       fractions[fraction_i] * 100, "full scan", elapsed * 1e3,
+		       (unsigned) sum.n_matches, (unsigned long long) sum.sum);
+
+		sum.n_matches = 0;
+		sum.sum = 0;
+		drop_cache(&structor);
+		start = bench_seconds();
+		if (scan_zones(&structor, &map, &range, 1, sum_matches, &sum,
+			       &n_visited)) {
+			return 1;
+		}
+		elapsed = bench_seconds() - start;
+		printf("%5.1f%% %-12s %8.2f ms, %7u matches (sum %llx), "
+		       "%u of %u blocks\n",
+		       fractions[fraction_i] * 100, "scan_zones", elapsed * 1e3,
+		       (unsigned) sum.n_matches, (unsigned long long) sum.sum,
+		       (unsigned) n_visited, (unsigned) map.n_blocks);
+	}
+
+	close_zone_map(&map);
+	close_file_structor(&structor);
+	remove_zone_map(BENCH_FILE);
+	unlink(BENCH_FILE);
+
+	return 0;
+}
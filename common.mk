@@ -4,3 +4,5 @@ AR=ar
 _CPPFLAGS=-O3 -Wall -Wextra -Werror
 AR_FLAGS=cr -o
 RM_FLAGS=-r
+LDLIBS=-pthread
+CXXFLAGS=-std=c++17
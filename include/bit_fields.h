@@ -0,0 +1,237 @@
+/*
+ * Tools for reading integers that do not fill whole bytes:
+ * bit fields packing flags and small integers together,
+ * arrays of integers packed with a fixed number of bits each,
+ * and streams of LEB128 variable-length integers ("varints"),
+ * without first copying their bytes out of the struct chunk.
+ * The bulk functions use BMI2 "pdep" and "pext", and AVX2,
+ * when the machine supports them.
+ */
+#ifndef BIT_FIELDS_H
+#define BIT_FIELDS_H
+
+#include <file_structor.h>
+
+#include <stddef.h>
+
+/* the most bits in a bit field */
+#define BIT_FIELD_MAX_BITS	57
+/* the most bytes in a varint of up to 64 bits */
+#define VARINT_MAX_BYTES	10
+
+/* the order of the bits of a bit field in its bytes */
+enum bit_order {
+	/*
+	 * Bits are numbered from the least significant bit of each byte,
+	 * and the first bits are the least significant of a field,
+	 * as in little-endian formats, DEFLATE, and C bitfields on x86.
+	 */
+	LSB_FIRST,
+	/*
+	 * Bits are numbered from the most significant bit of each byte,
+	 * and the first bits are the most significant of a field,
+	 * as in network protocol headers and other big-endian formats.
+	 */
+	MSB_FIRST
+};
+
+/* a description of a bit field inside a struct chunk */
+struct fs_bit_field {
+	/* the location of the first bit of the field, in bits */
+	size_t bit_offset;
+	/* the number of bits in the field, from 1 to "BIT_FIELD_MAX_BITS" */
+	unsigned n_bits;
+	/* the order of the bits */
+	enum bit_order order;
+	/* Is the field a two's complement signed integer? */
+	int is_signed;
+};
+
+/*
+ * the number of bytes after the start of a struct
+ * up to the end of the last byte holding part of a bit field
+ * field:	the description of the field
+ */
+inline static size_t bit_field_end(const struct fs_bit_field *field)
+{
+	return (field->bit_offset + field->n_bits + 7) / 8;
+}
+
+/*
+ * Load the integer described by "field" from raw struct data,
+ * reading only the bytes that hold part of it.
+ * data:	the start of the raw struct containing the field
+ * field:	the description of the field
+ * returns	the integer, sign-extended if the field is signed,
+ *		and zero-extended otherwise
+ */
+inline static uint64_t
+load_bit_field(const void *data, const struct fs_bit_field *field)
+{
+	const size_t first_byte = field->bit_offset / 8;
+	const size_t width = bit_field_end(field) - first_byte;
+	const unsigned unused_bits = 64 - field->n_bits;
+	unsigned shift = field->bit_offset % 8;
+	uint64_t bits;
+
+	debug_assert(field->n_bits >= 1 &&
+		     field->n_bits <= BIT_FIELD_MAX_BITS);
+	bits = load_uint((const uint8_t *) data + first_byte, width,
+			 field->order == LSB_FIRST ? LITTLE_END : BIG_END);
+	if (field->order == MSB_FIRST) {
+		shift = 8 * width - shift - field->n_bits;
+	}
+
+	/* Move the field to the top bits, then back down, extending it. */
+	bits <<= unused_bits - shift;
+	return field->is_signed ? (uint64_t) ((int64_t) bits >> unused_bits) :
+	       bits >> unused_bits;
+}
+
+/*
+ * Convert and copy a bit field in the struct chunk to memory,
+ * as an integer of whole bytes in machine order.
+ * dst:		the pointer to the destination struct,
+ *		ie. the base, not the member
+ * dst_offset:	the offset in the destination struct
+ * dst_width:	the number of bytes of the destination integer, from 1 to 8
+ * src:		the source chunk
+ * src_offset:	the offset in the raw data
+ *		that the bit offset of the field is from
+ * field:	the description of the field
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if the requested section
+ *			is outside the range of the chunk
+ */
+inline static enum fs_status
+copy_bit_section(void *dst, size_t dst_offset, size_t dst_width,
+		 struct file_struct *src, off_t src_offset,
+		 const struct fs_bit_field *field)
+{
+	if (src_offset + bit_field_end(field) > src->size) {
+		printlg(ERROR_LEVEL,
+			"Requesting bits in %u-%u, "
+			"but struct chunk only has data up to byte %u.\n",
+			(unsigned) (src_offset * 8 + field->bit_offset),
+			(unsigned) (src_offset * 8 + field->bit_offset +
+				    field->n_bits),
+			(unsigned) src->size);
+		return FSERR_OUT_OF_STRUCT;
+	}
+
+	store_uint((uint8_t *) dst + dst_offset,
+		   load_bit_field((uint8_t *) src->data + src_offset, field),
+		   dst_width);
+
+	return FS_NO_ERROR;
+}
+
+/*
+ * Decode one unsigned LEB128 varint from raw data:
+ * 7 bits in each byte, least significant first,
+ * with the high bit of every byte but the last set.
+ * src:		the raw data of the varint
+ * size:	the number of bytes that can be read from "src"
+ * value:	will be set to the decoded integer
+ * returns	the number of bytes of the varint;
+ *		0 if it does not end within "size" bytes,
+ *		or within "VARINT_MAX_BYTES"
+ */
+inline static size_t
+load_varint(const void *src, size_t size, uint64_t *value)
+{
+	const uint8_t *src_bytes = (const uint8_t *) src;
+	uint64_t decoded = 0;
+	size_t byte_i;
+
+	if (size > VARINT_MAX_BYTES) {
+		size = VARINT_MAX_BYTES;
+	}
+	for (byte_i = 0; byte_i < size; byte_i++) {
+		decoded |= (uint64_t) (src_bytes[byte_i] & 0x7f) <<
+			   (7 * byte_i);
+		if (!(src_bytes[byte_i] & 0x80)) {
+			*value = decoded;
+			return byte_i + 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Decode a signed integer that was "zigzag" encoded into an unsigned one
+ * before being written as a varint, as in Protocol Buffers' "sint64":
+ * 0, -1, 1, -2, ... are encoded as 0, 1, 2, 3, ...
+ * value:	the unsigned integer from the varint
+ * returns	the signed integer
+ */
+inline static int64_t zigzag_decode(uint64_t value)
+{
+	return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
+
+/*
+ * Extract a bit field of every record in an array,
+ * as if by "load_bit_field".
+ * Each field is read with one 8-byte load, shift and mask,
+ * and, with AVX2 when the machine supports it
+ * and the destination has 4 or 8 bytes, 4 records at a time.
+ * records:	the chunk holding the array of records
+ * record_size:	the distance between records
+ * field:	the description of the field
+ * dst:		will be filled with one integer for each whole record
+ * dst_width:	the number of bytes of each destination integer, from 1 to 8
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if the field is outside of the record
+ */
+enum fs_status
+extract_bit_field(struct file_struct *records, size_t record_size,
+		  const struct fs_bit_field *field, void *dst,
+		  size_t dst_width);
+/*
+ * Unpack an array of unsigned integers stored with the same number of bits
+ * each, one after another with no padding, into whole-byte integers.
+ * With BMI2, when the machine supports it,
+ * and destination integers of 1, 2 or 4 bytes,
+ * the integers that fit into 8 bytes of the destination
+ * are spread into it at once with "pdep".
+ * src:		the source chunk
+ * src_offset:	the location of the first byte of the packed array
+ * n_bits:	the number of bits of each integer,
+ *		from 1 to "BIT_FIELD_MAX_BITS"
+ * order:	the order of the bits of the array
+ * n_values:	the number of integers to unpack
+ * dst:		will be filled with the integers in machine order
+ * dst_width:	the number of bytes of each destination integer, from 1 to 8
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if the packed array
+ *			is outside the range of the chunk
+ */
+enum fs_status
+unpack_bits(struct file_struct *src, off_t src_offset, unsigned n_bits,
+	    enum bit_order order, size_t n_values, void *dst,
+	    size_t dst_width);
+/*
+ * Decode a stream of unsigned LEB128 varints, as if by "load_varint",
+ * until the requested number are decoded
+ * or the chunk ends between two varints.
+ * With BMI2, when the machine supports it,
+ * each varint of up to 8 bytes is decoded from one load
+ * with "pext", and 8 varints of one byte at once.
+ * src:		the source chunk
+ * src_offset:	the location of the first varint
+ * dst:		will be filled with the decoded integers
+ * n_values:	the most varints to decode,
+ *		which will be set to the number decoded
+ * src_end:	will be set to the location after the last varint decoded
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if a varint does not end
+ *			within the chunk, or within "VARINT_MAX_BYTES",
+ *			after decoding the varints before it
+ */
+enum fs_status
+decode_varints(struct file_struct *src, off_t src_offset, uint64_t *dst,
+	       size_t *n_values, off_t *src_end);
+
+#endif /* BIT_FIELDS_H */
@@ -0,0 +1,202 @@
+/*
+ * Conversion of a file of records into columns of single fields,
+ * for scans that read a few fields of wide records,
+ * and would otherwise bring every page of the file into memory.
+ * Each field of a "struct column_layout" is converted into machine order,
+ * as by a "struct copy_plan", and written to a column file of its own
+ * next to the source file, named by adding "COLUMN_SUFFIX"
+ * and the index of the field to its path.
+ * A column file holds a "struct column_header",
+ * the converted values one after another from "COLUMN_DATA_START",
+ * and optionally the smallest and largest value of each block of records,
+ * so that scans can skip the blocks that cannot match.
+ * Columns are opened as "struct file_structor"s and read in place,
+ * as arrays of their values.
+ */
+#ifndef COLUMN_STORE_H
+#define COLUMN_STORE_H
+
+#include <file_structor.h>
+#include <copy_plan.h>
+#include <fs_common.h>
+
+#include <stddef.h>
+
+/* the suffix added to the path of a source file, before the field index */
+#define COLUMN_SUFFIX		".col"
+/* the first bytes of a column file */
+#define COLUMN_MAGIC		"FSCOLMN1"
+/* the byte order mark, which reads differently on other machines */
+#define COLUMN_BYTE_ORDER	0x01020304u
+/* the location of the first value in a column file */
+#define COLUMN_DATA_START	128
+
+/* the header at the start of a column file */
+struct column_header {
+	/* "COLUMN_MAGIC", without its terminating null */
+	char magic[8];
+	/* "COLUMN_BYTE_ORDER", in the byte order of the builder */
+	uint32_t byte_order;
+	/* the "enum member_conversion" of the values */
+	uint32_t conversion;
+	/* the number of bytes of each value */
+	uint64_t value_size;
+	/* the number of values */
+	uint64_t n_values;
+	/* the number of values in each block, or 0 without block bounds */
+	uint64_t block_values;
+	/* the location of the "struct column_bounds" of each block */
+	uint64_t bounds_start;
+	/* the size and modification time of the source when it was built */
+	struct source_identity source;
+	/* the hash of the field and record layout it was built from */
+	uint64_t field_hash;
+	uint64_t reserved[6];
+};
+
+/* a value of a column with bounds, as wide as possible */
+union column_value {
+	/* the value of a "MEMBER_SIGNED" column */
+	int64_t i;
+	/* the value of a "MEMBER_UNSIGNED" column */
+	uint64_t u;
+	/* the value of a "MEMBER_FLOAT" column */
+	double f;
+};
+
+/*
+ * the smallest and largest value of a block of a column,
+ * ignoring "NaN"s in floating point columns,
+ * so that a block of only "NaN"s has "min" above "max"
+ */
+struct column_bounds {
+	union column_value min;
+	union column_value max;
+};
+
+/* the layout of the records to convert into columns */
+struct column_layout {
+	/* the location of the first record in the file */
+	off_t records_start;
+	/* the distance between records */
+	size_t record_size;
+	/*
+	 * the field of each column, as from "MEMBER_LAYOUT",
+	 * "ARRAY_MEMBER_LAYOUT", "INT_MEMBER_LAYOUT" or "FLOAT_MEMBER_LAYOUT",
+	 * whose destination offset is not used
+	 */
+	const struct member_layout *members;
+	/* the number of fields */
+	size_t n_members;
+	/*
+	 * the number of records in each block with bounds,
+	 * which are kept for scalar fields from "INT_MEMBER_LAYOUT"
+	 * and "FLOAT_MEMBER_LAYOUT", or 0 for no bounds
+	 */
+	size_t block_values;
+};
+
+/* an opened column */
+struct column {
+	/* the column file */
+	struct file_structor file;
+	/* the mapping of the whole column file */
+	struct file_struct mapping;
+	/* the header of the column */
+	const struct column_header *header;
+	/* the values, aligned to "COLUMN_DATA_START" */
+	const void *values;
+	/* the number of values, and the size of each */
+	size_t n_values;
+	size_t value_size;
+	/* the bounds of each block of values, or NULL */
+	const struct column_bounds *bounds;
+	/* the number of values in each block, and the number of blocks */
+	size_t block_values;
+	size_t n_blocks;
+};
+
+/*
+ * Convert the records of a file into a column file for each field,
+ * unless every column is already valid and from the same layout.
+ * The records are read once, in batches on several threads,
+ * and each batch of each column is written with one large write.
+ * The columns are built under temporary names and renamed when complete,
+ * so that a partial column is never opened.
+ * path:	the path of the source file
+ * layout:	the layout of the records
+ * n_threads:	the number of threads, or 0 for one per online processor
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if a field is outside of the record;
+ *		FSERR_ERRNO if reading the source or writing a column
+ *			failed, with errno set by the failing function
+ */
+enum fs_status
+build_columns(const char *path, const struct column_layout *layout,
+	      unsigned n_threads);
+/*
+ * Open and map a column of a file, checking it against the source file
+ * and the layout it should have been built from.
+ * Pages of the column are only read once its values are.
+ * to_open:	the column to open
+ * path:	the path of the source file, not of the column
+ * layout:	the layout of the records
+ * column_i:	the index of the field of the column in the layout
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_BAD_SIDECAR if the column is missing, or not valid,
+ *			eg. because the source changed since it was built;
+ *		the error from mapping the column
+ */
+enum fs_status
+open_column(struct column *to_open, const char *path,
+	    const struct column_layout *layout, size_t column_i);
+/*
+ * Unmap and close a column.
+ * to_close:	the column to close
+ * returns	the status from "close_file_structor"
+ */
+enum fs_status close_column(struct column *to_close);
+/*
+ * Delete the column files of a file, if it has them.
+ * path:	the path of the source file
+ * n_columns:	the number of fields of its layout
+ * returns	FS_NO_ERROR on success or if there were no columns;
+ *		FSERR_ERRNO if "unlink" failed
+ */
+enum fs_status remove_columns(const char *path, size_t n_columns);
+
+/*
+ * Find the bounds of a block of converted values,
+ * as kept for each block of a column.
+ * values:	the values in machine order
+ * n_values:	the number of values
+ * conversion:	the conversion of the values,
+ *		"MEMBER_UNSIGNED", "MEMBER_SIGNED" or "MEMBER_FLOAT"
+ * value_size:	the number of bytes of each value
+ * bounds:	will be set to the bounds of the values
+ */
+void
+find_column_bounds(const void *values, size_t n_values,
+		   enum member_conversion conversion, size_t value_size,
+		   struct column_bounds *bounds);
+
+/*
+ * the values of a column as an array of a type, without copying them
+ * column:	the opened column
+ * value_size:	the size of the type of the array
+ * returns	the values, or NULL if they do not have the size of the type
+ */
+inline static const void *
+column_values(const struct column *column, size_t value_size)
+{
+	return column->value_size == value_size ? column->values : NULL;
+}
+/*
+ * the values of a column as a typed array
+ * column:	the opened column
+ * type:	the type of each value, eg. "int64_t"
+ */
+#define COLUMN_ARRAY(column, type) \
+	((const type *) column_values(column, sizeof(type)))
+
+#endif /* COLUMN_STORE_H */
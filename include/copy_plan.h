@@ -0,0 +1,254 @@
+/*
+ * Tools for copying structs whose layout in the file differs from
+ * their layout in memory, eg. packed or differently padded file formats.
+ * The layout of each member is described once,
+ * and compiled into a "struct copy_plan" that copies a whole struct
+ * in one pass, with the members sorted, adjacent runs merged
+ * and byte swaps grouped by width.
+ */
+#ifndef COPY_PLAN_H
+#define COPY_PLAN_H
+
+#include <file_structor.h>
+
+#include <stddef.h>
+
+/* how the elements of a member are converted from the raw data */
+enum member_conversion {
+	/* Copy the bytes, reversing them if the byte order differs. */
+	MEMBER_BYTES,
+	/* Widen or narrow unsigned integers, with zero extension. */
+	MEMBER_UNSIGNED,
+	/* Widen or narrow signed integers, with sign extension. */
+	MEMBER_SIGNED,
+	/* Convert IEEE 754 "float"s and "double"s to either width. */
+	MEMBER_FLOAT
+};
+
+/* the location and byte order of a struct member in the file and memory */
+struct member_layout {
+	/* the offset of the member in the raw data */
+	size_t src_offset;
+	/* the offset of the member in the destination struct */
+	size_t dst_offset;
+	/* the number of bytes in the member */
+	size_t size;
+	/*
+	 * the number of bytes in each element whose order is converted,
+	 * which is "size" for scalar members,
+	 * and the element size for array members
+	 */
+	size_t width;
+	/* the byte order of the member in the raw data */
+	enum endianness endianness;
+	/*
+	 * how each element is converted,
+	 * which is "MEMBER_BYTES" unless made by "INT_MEMBER_LAYOUT"
+	 * or "FLOAT_MEMBER_LAYOUT"
+	 */
+	enum member_conversion conversion;
+	/*
+	 * the number of bytes in each converted element in memory,
+	 * when it differs from "width"; unused for "MEMBER_BYTES"
+	 */
+	size_t dst_width;
+};
+
+/*
+ * initializer for a "struct member_layout" of a scalar struct member
+ * type:		the type of the destination struct
+ * member:		the name of the member
+ * member_src_offset:	the offset of the member in the raw data
+ * member_endianness:	the byte order of the member in the raw data
+ */
+#define MEMBER_LAYOUT(type, member, member_src_offset, member_endianness) { \
+	.src_offset = member_src_offset, \
+	.dst_offset = offsetof(type, member), \
+	.size = sizeof(((type *) NULL)->member), \
+	.width = sizeof(((type *) NULL)->member), \
+	.endianness = member_endianness, \
+}
+/*
+ * initializer for a "struct member_layout" of an array struct member,
+ * whose elements keep their order, but have their bytes converted
+ * type:		the type of the destination struct
+ * member:		the name of the array member
+ * member_src_offset:	the offset of the member in the raw data
+ * member_endianness:	the byte order of the elements in the raw data
+ */
+#define ARRAY_MEMBER_LAYOUT(type, member, member_src_offset, \
+			    member_endianness) { \
+	.src_offset = member_src_offset, \
+	.dst_offset = offsetof(type, member), \
+	.size = sizeof(((type *) NULL)->member), \
+	.width = sizeof(((type *) NULL)->member[0]), \
+	.endianness = member_endianness, \
+}
+
+/*
+ * initializer for a "struct member_layout" of an integer struct member,
+ * converted from a raw integer of any width up to 8 bytes,
+ * eg. a 3-byte big-endian counter into an "int64_t"
+ * type:		the type of the destination struct
+ * member:		the name of the integer member
+ * member_src_offset:	the offset of the raw integer
+ * member_src_width:	the number of bytes of the raw integer
+ * member_endianness:	the byte order of the raw integer
+ * member_is_signed:	nonzero to sign-extend the raw integer
+ */
+#define INT_MEMBER_LAYOUT(type, member, member_src_offset, member_src_width, \
+			  member_endianness, member_is_signed) { \
+	.src_offset = member_src_offset, \
+	.dst_offset = offsetof(type, member), \
+	.size = member_src_width, \
+	.width = member_src_width, \
+	.endianness = member_endianness, \
+	.conversion = member_is_signed ? MEMBER_SIGNED : MEMBER_UNSIGNED, \
+	.dst_width = sizeof(((type *) NULL)->member), \
+}
+/*
+ * initializer for a "struct member_layout" of a "float" or "double" member,
+ * converted from a raw "float" or "double"
+ * type:		the type of the destination struct
+ * member:		the name of the floating point member
+ * member_src_offset:	the offset of the raw number
+ * member_src_width:	the size of the raw number,
+ *			"sizeof(float)" or "sizeof(double)"
+ * member_endianness:	the byte order of the raw number
+ */
+#define FLOAT_MEMBER_LAYOUT(type, member, member_src_offset, \
+			    member_src_width, member_endianness) { \
+	.src_offset = member_src_offset, \
+	.dst_offset = offsetof(type, member), \
+	.size = member_src_width, \
+	.width = member_src_width, \
+	.endianness = member_endianness, \
+	.conversion = MEMBER_FLOAT, \
+	.dst_width = sizeof(((type *) NULL)->member), \
+}
+
+/* the kinds of steps in a copy plan */
+enum copy_op_type {
+	/* Copy bytes in their original order. */
+	COPY_OP_RUN,
+	/* Reverse the bytes of each 2-byte element. */
+	COPY_OP_SWAP16,
+	/* Reverse the bytes of each 4-byte element. */
+	COPY_OP_SWAP32,
+	/* Reverse the bytes of each 8-byte element. */
+	COPY_OP_SWAP64,
+	/* Reverse the bytes of each element of any other width. */
+	COPY_OP_REVERSE,
+	/* Widen or narrow each integer element, as with "convert_int". */
+	COPY_OP_INT,
+	/* Convert each floating point element, as with "convert_float". */
+	COPY_OP_FLOAT
+};
+
+/* a single step of a copy plan */
+struct copy_op {
+	/* what the step does */
+	enum copy_op_type type;
+	/* the offset to copy from in the raw data */
+	size_t src_offset;
+	/* the offset to copy to in the destination struct */
+	size_t dst_offset;
+	/* the total number of bytes to copy from the raw data */
+	size_t size;
+	/*
+	 * the number of bytes in each raw element,
+	 * for "COPY_OP_REVERSE" and the conversions
+	 */
+	size_t width;
+	/* the number of bytes in each element in memory */
+	size_t dst_width;
+	/* the byte order of the raw elements, for the conversions */
+	enum endianness endianness;
+	/* Are the elements sign-extended, for "COPY_OP_INT"? */
+	int is_signed;
+};
+
+/* a compiled list of steps that copies a whole struct */
+struct copy_plan {
+	/* the number of steps */
+	size_t n_ops;
+	/* the steps, sorted by their offsets in the raw data */
+	struct copy_op *ops;
+	/* the raw bytes the plan reads, from the start of the struct */
+	size_t src_size;
+	/* the number of bytes the plan writes, from the start of the struct */
+	size_t dst_size;
+};
+
+/*
+ * Compile the member layouts of a struct into a copy plan.
+ * to_init:	the plan to initialize
+ * members:	the layouts of the members to copy
+ * n_members:	the number of members
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_ERRNO if "malloc" failed
+ */
+enum fs_status
+compile_copy_plan(struct copy_plan *to_init,
+		  const struct member_layout *members, size_t n_members);
+/*
+ * Free the steps of a copy plan.
+ * to_free:	the plan to free
+ */
+void free_copy_plan(struct copy_plan *to_free);
+
+/*
+ * Run a copy plan on a single struct.
+ * plan:	the compiled plan
+ * dst:		the pointer to the destination struct
+ * src:		the source chunk
+ * src_start:	the location of the struct in the source chunk
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if the raw struct
+ *			is outside the range of the chunk
+ */
+enum fs_status
+apply_copy_plan(const struct copy_plan *plan, void *dst,
+		struct file_struct *src, off_t src_start);
+/*
+ * Run a copy plan on each struct in an array,
+ * checking the range of the whole array only once.
+ * plan:	the compiled plan
+ * dst:		the pointer to the first destination struct
+ * dst_stride:	the distance between destination structs,
+ *		eg. the size of the destination type
+ * src:		the source chunk
+ * src_start:	the location of the first struct in the source chunk
+ * src_stride:	the distance between raw structs in the source chunk
+ * n_structs:	the number of structs to copy
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if any raw struct
+ *			is outside the range of the chunk
+ */
+enum fs_status
+apply_copy_plan_array(const struct copy_plan *plan, void *dst,
+		      size_t dst_stride, struct file_struct *src,
+		      off_t src_start, size_t src_stride, size_t n_structs);
+/*
+ * Run a copy plan on the selected structs in an array,
+ * eg. the ones found by "filter_records",
+ * writing them one after another in the destination.
+ * plan:	the compiled plan
+ * dst:		the pointer to the first destination struct
+ * dst_stride:	the distance between destination structs,
+ *		eg. the size of the destination type
+ * src:		the source chunk, starting with the array
+ * src_stride:	the distance between raw structs in the source chunk
+ * selection:	the indices of the structs to copy
+ * n_selected:	the number of structs to copy
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if any selected raw struct
+ *			is outside the range of the chunk
+ */
+enum fs_status
+apply_copy_plan_selected(const struct copy_plan *plan, void *dst,
+			 size_t dst_stride, struct file_struct *src,
+			 size_t src_stride, const size_t *selection,
+			 size_t n_selected);
+
+#endif /* COPY_PLAN_H */
@@ -0,0 +1,157 @@
+/*
+ * A bounded cache of structs decoded from files by a "struct copy_plan",
+ * keyed by the source wrapper, the location of the raw struct and the plan,
+ * for workloads that keep decoding the same headers and directory blocks.
+ * A hit copies the decoded struct out of the cache
+ * after one hash probe under the lock of one of several shards,
+ * so that threads looking up different structs rarely wait for each other.
+ * Each shard keeps its share of the memory bound,
+ * and evicts with the CLOCK algorithm,
+ * giving another pass to the structs hit since the hand last passed them.
+ * A struct is decoded again once the size of its source wrapper changes,
+ * or, for sources with a descriptor, once "fstat" shows that the file
+ * changed, which is checked at most once per interval.
+ */
+#ifndef DECODED_CACHE_H
+#define DECODED_CACHE_H
+
+#include <file_structor.h>
+#include <copy_plan.h>
+
+#include <pthread.h>
+#include <stddef.h>
+
+/* the number of independently locked shards of a cache */
+#define DECODED_CACHE_SHARDS	16
+
+/* a decoded struct in a cache */
+struct decoded_entry {
+	/* the key: the source wrapper, the raw struct's location, the plan */
+	const struct file_structor *file;
+	off_t offset;
+	const struct copy_plan *plan;
+	/* the hash of the key */
+	uint64_t hash;
+	/* the size of the source wrapper when the struct was decoded */
+	uint64_t file_size;
+	/* the size and modification time of the file, if it has a descriptor */
+	uint64_t size;
+	int64_t mtime_sec;
+	uint32_t mtime_nsec;
+	/* nonzero if the struct was hit since the clock hand last passed */
+	int is_referenced;
+	/* when the file was last checked for changes, in nanoseconds */
+	uint64_t checked_ns;
+	/* the decoded struct, of "dst_size" bytes of the plan */
+	void *decoded;
+	/* the neighbours in the clock ring */
+	struct decoded_entry *clock_prev;
+	struct decoded_entry *clock_next;
+	/* the next entry in the same hash bucket */
+	struct decoded_entry *bucket_next;
+};
+
+/* a part of a cache, holding the keys with some hashes */
+struct decoded_shard {
+	/* the lock protecting every field */
+	pthread_mutex_t lock;
+	/* the hash table of entries, with a power of 2 of buckets */
+	struct decoded_entry **buckets;
+	size_t n_buckets;
+	/* the number of entries in the table */
+	size_t n_entries;
+	/* the bytes held by the entries, including the decoded structs */
+	size_t memory;
+	/* the next entry the clock hand considers evicting, or NULL */
+	struct decoded_entry *hand;
+	/* the number of hits, misses, changed structs and evictions */
+	uint64_t n_hits;
+	uint64_t n_misses;
+	uint64_t n_stale;
+	uint64_t n_evictions;
+} __attribute__((aligned(64)));
+
+/* a cache of decoded structs */
+struct decoded_cache {
+	/* the shards, chosen by the high bits of the hash of a key */
+	struct decoded_shard shards[DECODED_CACHE_SHARDS];
+	/* the most bytes each shard holds */
+	size_t shard_memory;
+	/*
+	 * the time after which a hit checks if its file changed,
+	 * in nanoseconds, or 0 to check on every hit
+	 */
+	uint64_t recheck_ns;
+};
+
+/* the statistics of a cache, summed over its shards */
+struct decoded_cache_stats {
+	/* the number of lookups that found a valid struct */
+	uint64_t n_hits;
+	/* the number of lookups that had to decode the struct */
+	uint64_t n_misses;
+	/* the number of structs dropped because their file changed */
+	uint64_t n_stale;
+	/* the number of structs evicted to stay within the memory bound */
+	uint64_t n_evictions;
+	/* the number of structs held */
+	size_t n_entries;
+	/* the bytes held, including the entries */
+	size_t memory;
+};
+
+/*
+ * Initialize an empty decoded cache.
+ * to_init:	the cache to initialize
+ * max_memory:	the most bytes to hold, including the bookkeeping;
+ *		a struct larger than a shard's share is never kept
+ * recheck_ms:	the time after which a hit checks if its file changed,
+ *		in milliseconds, or 0 to check on every hit
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_ERRNO if "malloc" failed
+ */
+enum fs_status
+init_decoded_cache(struct decoded_cache *to_init, size_t max_memory,
+		   unsigned recheck_ms);
+/*
+ * Free every struct in a decoded cache.
+ * to_teardown:	the cache to tear down
+ */
+void teardown_decoded_cache(struct decoded_cache *to_teardown);
+
+/*
+ * Get a decoded struct, decoding it on a miss as by "apply_copy_plan"
+ * on a chunk of "src_size" bytes of the plan mapped at its location,
+ * and keeping a copy for later lookups.
+ * The plan and the source wrapper must stay valid
+ * as long as the cache may hold their structs,
+ * eg. until "invalidate_decoded" is called with the source wrapper.
+ * cache:	the cache
+ * file:	the source wrapper
+ * offset:	the location of the raw struct in the file
+ * plan:	the compiled plan of the struct
+ * dst:		will be filled with the "dst_size" bytes of the plan
+ * returns	FS_NO_ERROR on success;
+ *		the error from mapping or decoding the struct on a miss
+ */
+enum fs_status
+decode_cached(struct decoded_cache *cache, struct file_structor *file,
+	      off_t offset, const struct copy_plan *plan, void *dst);
+/*
+ * Drop every struct decoded from a source wrapper,
+ * eg. before closing it, or after it was written to.
+ * cache:	the cache
+ * file:	the source wrapper
+ */
+void invalidate_decoded(struct decoded_cache *cache,
+			const struct file_structor *file);
+/*
+ * Sum the statistics of every shard of a cache.
+ * The hit rate is "n_hits" over "n_hits" plus "n_misses".
+ * cache:	the cache
+ * stats:	will be set to the statistics
+ */
+void get_decoded_cache_stats(struct decoded_cache *cache,
+			     struct decoded_cache_stats *stats);
+
+#endif /* DECODED_CACHE_H */
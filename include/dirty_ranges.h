@@ -0,0 +1,174 @@
+/*
+ * Tracking of the pages written through a writable struct chunk,
+ * for patching records of a file in place through its mapping,
+ * and flushing them to the file with few system calls.
+ * Each store marks the pages it touches in a bitmap,
+ * and a flush walks the bitmap in order, merging runs of dirty pages
+ * separated by few clean ones, and calling "msync" once per merged run,
+ * so that a batch of thousands of record updates
+ * takes a handful of calls instead of one "pwrite" per field.
+ */
+#ifndef DIRTY_RANGES_H
+#define DIRTY_RANGES_H
+
+#include <file_structor.h>
+
+#include <stddef.h>
+
+/* how "flush_dirty" waits for the pages to reach the file */
+enum dirty_flush {
+	/* Wait until the pages are written, with "MS_SYNC". */
+	FLUSH_SYNC,
+	/* Only start writing the pages, with "MS_ASYNC". */
+	FLUSH_ASYNC
+};
+
+/* the dirty pages of a writable struct chunk */
+struct dirty_ranges {
+	/* the chunk whose pages are tracked */
+	struct file_struct *chunk;
+	/* the size of the chunk when tracking started */
+	uint64_t size;
+	/* the size of a page */
+	size_t page_size;
+	/* the offset of the chunk's data from the page boundary before it */
+	size_t start_adjustment;
+	/* one bit for each page the chunk spans, set if the page is dirty */
+	uint64_t *bitmap;
+	/* the number of pages the chunk spans */
+	size_t n_pages;
+	/* the number of dirty pages */
+	size_t n_dirty;
+	/*
+	 * the most clean pages between two dirty runs
+	 * that are flushed with them in a single call
+	 */
+	size_t max_gap;
+	/* the number of "msync" calls made, and the pages they covered */
+	uint64_t n_syncs;
+	uint64_t n_synced_pages;
+};
+
+/*
+ * Start tracking the dirty pages of a struct chunk, with none dirty.
+ * The chunk is mapped by "init_file_struct" from a source wrapper
+ * opened by "open_writable_file_structor", or derived from such a chunk,
+ * or points into a memory source, whose flushes only clear the pages.
+ * If the chunk is extended, tracking must be started again.
+ * to_init:	the tracker to initialize
+ * chunk:	the writable chunk, which must outlive the tracker
+ * max_gap:	the most clean pages between two dirty runs
+ *		that are flushed with them in a single call
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_ERRNO if "malloc" failed
+ */
+enum fs_status
+init_dirty_ranges(struct dirty_ranges *to_init, struct file_struct *chunk,
+		  size_t max_gap);
+/*
+ * Free the bitmap of a tracker, without flushing its dirty pages,
+ * which still reach the file when the kernel writes them back.
+ * to_teardown:	the tracker to tear down
+ */
+void teardown_dirty_ranges(struct dirty_ranges *to_teardown);
+
+/*
+ * Mark the pages of a section of the chunk as dirty,
+ * eg. after storing into it directly.
+ * dirty:	the tracker
+ * offset:	the start of the section in the chunk
+ * size:	the number of bytes in the section
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if the section
+ *			is outside the range of the chunk
+ */
+enum fs_status
+mark_dirty(struct dirty_ranges *dirty, off_t offset, size_t size);
+/*
+ * Flush the dirty pages of the chunk to the file,
+ * in order, with one "msync" call for each run of dirty pages,
+ * where runs at most "max_gap" clean pages apart are merged,
+ * and mark them clean.
+ * dirty:	the tracker
+ * flush:	whether to wait for the pages to be written
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_ERRNO if "msync" failed,
+ *			leaving the pages from the failed run on dirty
+ */
+enum fs_status flush_dirty(struct dirty_ranges *dirty, enum dirty_flush flush);
+
+/*
+ * Store a piece of memory into the tracked chunk as by "store_section_at",
+ * and mark its pages as dirty.
+ * dirty:	the tracker
+ * dst_offset:	the offset in the raw data
+ * src:		the pointer to the source struct
+ * src_offset:	the offset in the source struct
+ * size:	the number of bytes to store
+ * endianness	the byte order of the raw data
+ * returns	the same as "store_section_at"
+ */
+inline static enum fs_status
+update_section_at(struct dirty_ranges *dirty, off_t dst_offset,
+		  const void *src, size_t src_offset, size_t size,
+		  enum endianness endianness)
+{
+	enum fs_status status = store_section_at(dirty->chunk, dst_offset, src,
+						 src_offset, size, endianness);
+
+	return status ? status : mark_dirty(dirty, dst_offset, size);
+}
+
+/*
+ * Store an integer into the tracked chunk as by "store_int_section",
+ * and mark its pages as dirty.
+ * dirty:	the tracker
+ * dst_offset:	the offset in the raw data
+ * dst_width:	the number of bytes of the raw integer, from 1 to 8
+ * src:		the pointer to the source struct
+ * src_offset:	the offset in the source struct
+ * src_width:	the number of bytes of the integer in memory, from 1 to 8
+ * endianness:	the byte order of the raw integer
+ * is_signed:	nonzero to sign-extend the integer in memory
+ * returns	the same as "store_int_section"
+ */
+inline static enum fs_status
+update_int_section(struct dirty_ranges *dirty, off_t dst_offset,
+		   size_t dst_width, const void *src, size_t src_offset,
+		   size_t src_width, enum endianness endianness, int is_signed)
+{
+	enum fs_status status = store_int_section(dirty->chunk, dst_offset,
+						  dst_width, src, src_offset,
+						  src_width, endianness,
+						  is_signed);
+
+	return status ? status : mark_dirty(dirty, dst_offset, dst_width);
+}
+
+/*
+ * Store a floating point number into the tracked chunk
+ * as by "store_float_section", and mark its pages as dirty.
+ * dirty:	the tracker
+ * dst_offset:	the offset in the raw data
+ * dst_width:	the size of the raw number, "sizeof(float)" or "sizeof(double)"
+ * src:		the pointer to the source struct
+ * src_offset:	the offset in the source struct
+ * src_width:	the size of the number in memory,
+ *		"sizeof(float)" or "sizeof(double)"
+ * endianness:	the byte order of the raw number
+ * returns	the same as "store_float_section"
+ */
+inline static enum fs_status
+update_float_section(struct dirty_ranges *dirty, off_t dst_offset,
+		     size_t dst_width, const void *src, size_t src_offset,
+		     size_t src_width, enum endianness endianness)
+{
+	enum fs_status status = store_float_section(dirty->chunk, dst_offset,
+						    dst_width, src,
+						    src_offset, src_width,
+						    endianness);
+
+	return status ? status : mark_dirty(dirty, dst_offset, dst_width);
+}
+
+#endif /* DIRTY_RANGES_H */
@@ -0,0 +1,53 @@
+/*
+ * Tools for extracting one numeric field from every record in an array
+ * into a packed array of machine-order numbers of another width,
+ * converting byte order and width in the same pass,
+ * eg. 3-byte big-endian counters into "int64_t"s,
+ * or big-endian "float"s into "double"s.
+ */
+#ifndef FIELD_CONVERT_H
+#define FIELD_CONVERT_H
+
+#include <file_structor.h>
+
+#include <stddef.h>
+
+/*
+ * Extract an integer field of every record in an array,
+ * as if by "convert_int".
+ * Fields of up to 8 bytes are converted 8 or 4 at a time with AVX2
+ * when the machine supports it and the destination has 4 or 8 bytes.
+ * records:	the chunk holding the array of records
+ * record_size:	the distance between records
+ * field:	the description of the field, of 1 to 8 bytes
+ * dst:		will be filled with one integer for each whole record
+ * dst_width:	the number of bytes of each destination integer, from 1 to 8
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if the field is outside of the record
+ */
+enum fs_status
+extract_int_field(struct file_struct *records, size_t record_size,
+		  const struct fs_int_field *field, void *dst,
+		  size_t dst_width);
+/*
+ * Extract an IEEE 754 floating point field of every record in an array,
+ * as if by "convert_float".
+ * The fields are converted 8 or 4 at a time with AVX2
+ * when the machine supports it.
+ * records:	the chunk holding the array of records
+ * record_size:	the distance between records
+ * offset:	the location of the field in each record
+ * src_width:	the size of the field, "sizeof(float)" or "sizeof(double)"
+ * endianness:	the byte order of the field
+ * dst:		will be filled with one number for each whole record
+ * dst_width:	the size of each destination number,
+ *		"sizeof(float)" or "sizeof(double)"
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if the field is outside of the record
+ */
+enum fs_status
+extract_float_field(struct file_struct *records, size_t record_size,
+		    size_t offset, size_t src_width,
+		    enum endianness endianness, void *dst, size_t dst_width);
+
+#endif /* FIELD_CONVERT_H */
@@ -0,0 +1,66 @@
+/*
+ * Tools for initializing many struct chunks of a file at once,
+ * eg. the records found through an index.
+ * The requested ranges are sorted and merged,
+ * so that chunks on the same or neighbouring pages share one mapping,
+ * and each chunk is derived from the mapping containing it.
+ */
+#ifndef FILE_BATCH_H
+#define FILE_BATCH_H
+
+#include <file_structor.h>
+
+#include <stddef.h>
+
+/* a chunk to initialize, as given to "init_file_struct" */
+struct chunk_request {
+	/* the starting location of the chunk in the file */
+	off_t start_in_file;
+	/* the size of the chunk */
+	off_t size;
+};
+
+/* the mappings shared by a batch of chunks */
+struct file_batch {
+	/* the number of mappings */
+	size_t n_mappings;
+	/* the mappings, in the order of their location in the file */
+	struct file_struct *mappings;
+};
+
+/*
+ * Initialize a batch of struct chunks with as few mappings as possible.
+ * Requests may be in any order, and may overlap.
+ * Two requests share a mapping if the gap between them,
+ * after rounding their ends out to whole pages, is at most "max_gap".
+ * The chunks are derived from the mappings,
+ * so tearing one down does nothing,
+ * and they stay valid until "teardown_file_batch".
+ * to_init:	the batch to initialize
+ * src_file:	the source wrapper
+ * requests:	the chunks to initialize
+ * n_requests:	the number of requests
+ * chunks:	will be filled with one chunk for each request, in order
+ * max_gap:	the most bytes between two requests
+ *		that are mapped to put them in the same mapping
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_FILE if any requested chunk
+ *			is beyond the range of the file,
+ *			in which case nothing is mapped;
+ *		FSERR_ERRNO if "malloc" or "mmap" failed,
+ *			in which case nothing is left mapped
+ */
+enum fs_status
+init_file_batch(struct file_batch *to_init, struct file_structor *src_file,
+		const struct chunk_request *requests, size_t n_requests,
+		struct file_struct *chunks, size_t max_gap);
+/*
+ * Unmap every mapping of a batch, invalidating all its chunks.
+ * to_teardown:	the batch to tear down
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_ERRNO if unmapping any mapping failed,
+ *			as in "teardown_file_struct"
+ */
+enum fs_status teardown_file_batch(struct file_batch *to_teardown);
+
+#endif /* FILE_BATCH_H */
@@ -0,0 +1,104 @@
+/*
+ * Tools for following offsets stored inside a file
+ * from one struct chunk to another, as in trees and linked blocks,
+ * with many independent traversals interleaved to hide memory latency.
+ */
+#ifndef FILE_CHASE_H
+#define FILE_CHASE_H
+
+#include <file_structor.h>
+
+#include <stddef.h>
+
+/* what an in-file offset field is relative to */
+enum chase_base {
+	/* the offset is relative to the start of the struct containing it */
+	CHASE_FROM_STRUCT,
+	/* the offset is relative to the location of the offset field itself */
+	CHASE_FROM_FIELD,
+	/* the offset is relative to the start of the root chunk */
+	CHASE_FROM_ROOT
+};
+
+/* a description of an offset field pointing from one struct to another */
+struct chase_link {
+	/* the location, width, byte order and signedness of the offset */
+	struct fs_int_field field;
+	/* what the offset is relative to */
+	enum chase_base base;
+	/* the size of the struct the offset points to */
+	off_t target_size;
+};
+
+/* flags for "run_file_chases" */
+enum chase_flags {
+	/* Only prefetch the next structs into the cache. */
+	CHASE_PREFETCH_CACHE = 0,
+	/*
+	 * Also advise the kernel to read in the pages of the next structs,
+	 * so that page faults from several traversals overlap.
+	 */
+	CHASE_PREFETCH_PAGES = 1
+};
+
+/*
+ * Initialize a struct chunk for the struct pointed to by an offset field,
+ * as a subrange of a root chunk, like "derive_file_struct".
+ * to_init:	the chunk for the target struct
+ * root:	the chunk containing both structs, eg. the whole file
+ * from:	the chunk containing the offset field,
+ *		which must be inside "root"
+ * link:	the description of the offset field
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if the offset field is outside of "from",
+ *			or the target struct is outside of "root"
+ */
+enum fs_status
+follow_file_struct(struct file_struct *to_init, struct file_struct *root,
+		   struct file_struct *from, const struct chase_link *link);
+
+/* the state of a single traversal run by "run_file_chases" */
+struct file_chase {
+	/* the struct the traversal is currently at */
+	struct file_struct current;
+	/* the link to follow next, or NULL if the traversal is done */
+	const struct chase_link *next_link;
+	/* the location of the next struct in the root chunk */
+	off_t next_start;
+	/* the status of the traversal, which stops on any error */
+	enum fs_status status;
+	/* caller state, such as the key being looked up */
+	void *arg;
+};
+
+/*
+ * the function deciding where each traversal goes next
+ * chase:	the traversal, whose "current" field holds the struct
+ *		it has just arrived at
+ * returns	the link in "current" to follow next,
+ *		or NULL to end the traversal
+ */
+typedef const struct chase_link *(*chase_step_fn)(struct file_chase *chase);
+
+/*
+ * Advance many independent traversals in lock step.
+ * In each round, the next struct of every traversal is located
+ * and prefetched, before any of them is touched,
+ * so that their cache and page misses overlap rather than add up.
+ * Before the first round, "step" is called on every traversal's
+ * starting struct, which the caller must put in "current",
+ * eg. using "derive_file_struct" on the root chunk.
+ * root:	the chunk containing every struct, eg. the whole file
+ * chases:	the traversals to run
+ * n_chases:	the number of traversals
+ * step:	the function choosing the next link of each traversal
+ * flags:	the "enum chase_flags" choosing how far to prefetch
+ * returns	FS_NO_ERROR if every traversal ended without error;
+ *		otherwise the status of the first one that failed,
+ *		which is also left in its "status" field
+ */
+enum fs_status
+run_file_chases(struct file_struct *root, struct file_chase *chases,
+		size_t n_chases, chase_step_fn step, int flags);
+
+#endif /* FILE_CHASE_H */
@@ -0,0 +1,86 @@
+/*
+ * Tools for following a file of fixed-size records
+ * while a writer appends to it, like "tail -f",
+ * without reopening the file or remapping the records already seen.
+ * The mapping of the records is extended with "extend_file_struct"
+ * as the file grows, and the follower waits for new records
+ * with inotify when it is given the path of the file,
+ * or by polling its size otherwise.
+ */
+#ifndef FILE_FOLLOW_H
+#define FILE_FOLLOW_H
+
+#include <file_structor.h>
+
+#include <stddef.h>
+
+/* the timeout to wait for new records without limit */
+#define FOLLOW_FOREVER		-1
+/* the interval between polls of the size, without inotify */
+#define FOLLOW_POLL_MS		10
+
+/* the state of a reader following the records of a growing file */
+struct file_follower {
+	/* the file being followed */
+	struct file_structor *src_file;
+	/* the location of the first record in the file */
+	off_t start_in_file;
+	/* the size of each record */
+	size_t record_size;
+	/*
+	 * the mapping of every complete record seen so far,
+	 * which has no data until there is at least one
+	 */
+	struct file_struct records;
+	/* the number of complete records in "records" */
+	size_t n_records;
+	/* the number of records already returned */
+	size_t n_returned;
+	/* the inotify instance watching the file, or -1 to poll */
+	int inotify_fd;
+};
+
+/*
+ * Start following the records of a file.
+ * to_init:		the follower to initialize
+ * src_file:		the file to follow
+ * path:		the path of the file, to be woken up by inotify
+ *			when it is written, or NULL to poll its size
+ * start_in_file:	the location of the first record in the file
+ * record_size:		the size of each record
+ * returns		FS_NO_ERROR on success;
+ *			FSERR_ERRNO if setting up inotify failed
+ */
+enum fs_status
+init_file_follower(struct file_follower *to_init,
+		   struct file_structor *src_file, const char *path,
+		   off_t start_in_file, size_t record_size);
+/*
+ * Stop following a file, unmapping its records.
+ * to_teardown:	the follower to tear down
+ * returns	the status from "teardown_file_struct"
+ */
+enum fs_status teardown_file_follower(struct file_follower *to_teardown);
+
+/*
+ * Get the complete records appended since the last call,
+ * waiting for some if there are none yet.
+ * A partial record at the end of the file is only returned
+ * once the writer has completed it.
+ * follower:	the follower of the file
+ * timeout_ms:	the longest time to wait for new records in milliseconds,
+ *		0 to only check for them, or "FOLLOW_FOREVER"
+ * batch:	will be derived from the mapping to hold the new records,
+ *		and stays valid until the next call
+ * n_new:	will be set to the number of new records, or 0 on a timeout
+ * returns	FS_NO_ERROR on success, including timeouts;
+ *		FSERR_OUT_OF_FILE if the file was truncated
+ *			before the end of the records seen so far;
+ *		FSERR_ERRNO if finding the size, extending the mapping,
+ *			or waiting for inotify failed
+ */
+enum fs_status
+follow_records(struct file_follower *follower, int timeout_ms,
+	       struct file_struct *batch, size_t *n_new);
+
+#endif /* FILE_FOLLOW_H */
@@ -0,0 +1,148 @@
+/*
+ * Tools for accessing a set of shard files as one logical file,
+ * in which the shards are concatenated in the order they were given.
+ */
+#ifndef FILE_SET_H
+#define FILE_SET_H
+
+#include <file_structor.h>
+
+#include <stddef.h>
+
+/* wrapper around several source files sharing one logical offset space */
+struct file_set {
+	/* the number of shard files */
+	size_t n_files;
+	/* the opened shard files, in logical order */
+	struct file_structor *files;
+	/*
+	 * the logical offset at which each shard starts,
+	 * with one more entry at the end holding the total size
+	 */
+	off_t *starts;
+	/* the total size of all the shards */
+	off_t size;
+};
+
+/*
+ * Try to open all the shards of a "struct file_set".
+ * The files are opened in batches spread across threads,
+ * so that large sets do not wait on each "open" and "fstat" in turn.
+ * to_open:	the set to initialize
+ * paths:	the paths of the shard files, in logical order
+ * n_paths:	the number of paths
+ * n_threads:	the number of threads to open the files with,
+ *		or 0 for one per online processor
+ * returns	FS_NO_ERROR on success,
+ *		FSERR_ERRNO if allocating the set, or opening any file failed,
+ *			with errno set by the failing function:
+ *			"malloc", "open" or "fstat".
+ *			In that case, no file is left open.
+ */
+enum fs_status
+open_file_set(struct file_set *to_open, const char *const *paths,
+	      size_t n_paths, unsigned n_threads);
+/*
+ * Try to open all the files matching a pattern as a "struct file_set",
+ * with the shards in the sorted order given by "glob".
+ * to_open:	the set to initialize
+ * pattern:	the "glob" pattern matching the shard paths
+ * n_threads:	the number of threads to open the files with,
+ *		or 0 for one per online processor
+ * returns	FS_NO_ERROR on success,
+ *		FSERR_ERRNO if no file matched, with errno set to ENOENT,
+ *			or if opening the set failed,
+ *			as in "open_file_set"
+ */
+enum fs_status
+open_file_set_glob(struct file_set *to_open, const char *pattern,
+		   unsigned n_threads);
+/*
+ * Close all the shard files, and free the set's arrays.
+ * to_close:	the set to close
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_ERRNO if closing any file failed,
+ *			as in "close_file_structor"
+ */
+enum fs_status close_file_set(struct file_set *to_close);
+
+/*
+ * Find the shard containing a logical offset.
+ * set:			the set to search
+ * logical_start:	the offset in the logical space
+ * file_i:		will be set to the index of the containing shard
+ * start_in_file:	will be set to the corresponding offset in that shard
+ * returns		FS_NO_ERROR on success;
+ *			FSERR_OUT_OF_FILE if the offset is
+ *				beyond the total size of the set
+ */
+enum fs_status
+locate_in_file_set(struct file_set *set, off_t logical_start, size_t *file_i,
+		   off_t *start_in_file);
+
+/*
+ * Initialize a struct chunk from a logical offset in the set,
+ * like "init_file_struct".
+ * to_init:		the chunk for which to map the data
+ * set:			the set containing the data
+ * size:		the size of the struct
+ * logical_start:	the starting location of the chunk in the set
+ * returns		FS_NO_ERROR on success;
+ *			FSERR_ERRNO if "mmap" failed;
+ *			FSERR_OUT_OF_FILE if the requested chunk
+ *				is beyond the total size of the set;
+ *			FSERR_SPANS_FILES if the chunk starts in one shard,
+ *				but ends in another
+ */
+enum fs_status
+init_file_set_struct(struct file_struct *to_init, struct file_set *set,
+		     off_t size, off_t logical_start);
+/*
+ * wrapper around "init_file_set_struct" to map
+ * the record with the given index,
+ * assuming that the set is an array of records of the same type
+ * to_init:		the chunk for which to map the data
+ * set:			the set containing the data
+ * data_type:		the type of each record
+ * index:		the logical index of the record
+ * returns		the same values as "init_file_set_struct"
+ */
+#define INIT_FILE_SET_RECORD(to_init, set, data_type, index) \
+	init_file_set_struct(to_init, set, sizeof(data_type), \
+			     (off_t) sizeof(data_type) * (index))
+
+/*
+ * the function called on each record during "scan_file_set"
+ * record:		the mapped record,
+ *			which is only valid until the function returns
+ * logical_start:	the logical offset of the record in the set
+ * arg:			the argument given to "scan_file_set"
+ * returns		FS_NO_ERROR to continue scanning,
+ *			or an error to stop the scan and report
+ */
+typedef enum fs_status
+(*file_set_record_fn)(struct file_struct *record, off_t logical_start,
+		      void *arg);
+
+/*
+ * Visit every complete record in the set,
+ * scanning the shards in parallel.
+ * Each shard is mapped once, and must hold a whole number of records;
+ * any bytes left over at the end of a shard are skipped.
+ * Records in the same shard are visited in order on the same thread,
+ * but records in different shards may be visited concurrently.
+ * set:		the set to scan
+ * record_size:	the size of each record
+ * n_threads:	the number of threads to scan with,
+ *		or 0 for one per online processor
+ * visit:	the function to call on each record
+ * arg:		the argument to pass to "visit"
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_ERRNO if mapping any shard failed;
+ *		otherwise the first error returned by "visit"
+ */
+enum fs_status
+scan_file_set(struct file_set *set, size_t record_size, unsigned n_threads,
+	      file_set_record_fn visit, void *arg);
+
+#endif /* FILE_SET_H */
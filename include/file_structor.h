@@ -2,7 +2,9 @@
  * Generic tools for extracting information from a file,
  * and putting it into a struct in memory.
  * The file contents are assumed to be aligned like the struct,
- * although endianness may vary.
+ * although endianness may vary,
+ * except when copying with "copy_section_at" or "COPY_MEMBER_FROM",
+ * or with a "struct copy_plan" from "copy_plan.h".
  */
 #ifndef FILE_STRUCTOR_H
 #define FILE_STRUCTOR_H
@@ -15,6 +17,10 @@
 #include <string.h>
 #include <stddef.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /* error codes */
 enum fs_status {
 	/* There was no error. Equivalent to FALSE. */
@@ -34,16 +40,138 @@ enum fs_status {
 	 * given by the instance of "struct file_struct".
 	 */
 	FSERR_OUT_OF_STRUCT,
+	/*
+	 * The requested segment of data crosses the boundary
+	 * between two files of a "struct file_set".
+	 */
+	FSERR_SPANS_FILES,
+	/*
+	 * A sidecar file built from a source file is corrupt,
+	 * was built on a machine of another byte order,
+	 * or no longer matches its source file.
+	 */
+	FSERR_BAD_SIDECAR,
+};
+
+/*
+ * the recent locations of the chunks mapped from a source wrapper,
+ * from which "init_file_struct" predicts the next ones and reads them ahead,
+ * as described in "readahead.h"
+ */
+struct access_pattern {
+	/* nonzero while a thread updates the pattern */
+	char is_busy;
+	/* the most strides to read ahead, or 0 to never read ahead */
+	unsigned max_distance;
+	/* the start and size of the last chunk */
+	off_t last_start;
+	off_t last_size;
+	/* the distance between the starts of the last two chunks */
+	off_t stride;
+	/* the number of chunks in a row that followed the stride */
+	unsigned n_hits;
+	/* the number of strides to read ahead of the last chunk */
+	unsigned distance;
+	/* the number of strides after the last chunk already read ahead */
+	unsigned n_ahead;
+	/* the number of readahead requests made */
+	uint64_t n_readaheads;
+};
+
+/*
+ * the number of classes of chunk sizes the automatic backend keeps costs of,
+ * from a page and smaller up to "IO_AUTO_PREAD_MAX" in "io_backend.h"
+ */
+#define IO_COST_CLASSES	9
+
+/* the measured costs of reading chunks of a class of sizes */
+struct io_cost_class {
+	/* the number of chunks of the class mapped */
+	uint64_t n_chunks;
+	/* the average nanoseconds to read a chunk by mapping and by copying */
+	uint64_t mmap_ns;
+	uint64_t pread_ns;
+	/* the number of chunks timed with each */
+	uint32_t n_mmap_samples;
+	uint32_t n_pread_samples;
+};
+
+/*
+ * the costs from which the automatic backend of a source wrapper
+ * picks how to read each chunk, as described in "io_backend.h"
+ */
+struct io_costs {
+	/* nonzero while a thread updates the costs */
+	char is_busy;
+	/*
+	 * the costs of each class of sizes,
+	 * for chunks off and on the stride of the access pattern
+	 */
+	struct io_cost_class classes[2][IO_COST_CLASSES];
+	/* the number of chunks the automatic backend mapped and copied */
+	uint64_t n_mmaps;
+	uint64_t n_preads;
 };
 
-/* wrapper around the file from which to map the data chunks */
+/* the functions reading chunks of a source wrapper, from "io_backend.h" */
+struct io_backend;
+
+/*
+ * wrapper around the file from which to map the data chunks,
+ * or around bytes already in memory, which are used in place of a file
+ */
 struct file_structor {
-	/* the descriptor of the source file */
+	/* the descriptor of the source file, or -1 for a memory source */
 	int fd;
 	/* the size of the source file */
 	off_t size;
+	/*
+	 * the caller-owned bytes of a memory source,
+	 * which chunks point into instead of mapping them,
+	 * the copy of a file loaded by the memory backend,
+	 * which the wrapper owns, and keeps the file open with,
+	 * or NULL for a file read by another backend
+	 */
+	void *memory;
+	/*
+	 * nonzero if the data is read from a native-endian sidecar
+	 * written by "transcode_file" and opened by
+	 * "open_native_file_structor" in "transcode.h",
+	 * in which the fields of its layout are in machine order
+	 */
+	int is_native;
+	/*
+	 * the number of bytes at the end of the file that are not data,
+	 * eg. the trailer of a native-endian sidecar, which "size" leaves out
+	 */
+	off_t trailer_size;
+	/*
+	 * nonzero if the file was opened by "open_writable_file_structor",
+	 * so that chunks are mapped writable, and stores into them
+	 * reach the file
+	 */
+	int is_writable;
+	/* the pattern of the chunks mapped from the file */
+	struct access_pattern pattern;
+	/*
+	 * the backend reading chunks of the file, "mmap" unless changed
+	 * by "set_io_backend"; chunks of memory sources point into them
+	 * whatever the backend
+	 */
+	const struct io_backend *backend;
+	/* the costs measured by the automatic backend */
+	struct io_costs costs;
 };
 
+/*
+ * Initialize a "struct file_structor" to that of no file:
+ * closed, empty, read-only and read by "IO_BACKEND_MMAP",
+ * without reading ahead, and with every other field cleared.
+ * Each way of opening a wrapper starts from this,
+ * so that it only sets the fields that differ.
+ * to_init:	the source wrapper to initialize
+ */
+void init_closed_file_structor(struct file_structor *to_init);
 /*
  * Try to initialize a "struct file_structor",
  * given the path of the source file.
@@ -56,9 +184,23 @@ struct file_structor {
  */
 enum fs_status
 open_file_structor(struct file_structor *to_open, const char *path);
+/*
+ * Initialize a "struct file_structor" from a file opened for reading
+ * and writing,
+ * so that chunks initialized from it are shared writable mappings,
+ * which the "store_" functions can encode values into in place.
+ * Stores reach the file when the kernel writes back the pages,
+ * or when they are flushed, eg. with "flush_dirty" in "dirty_ranges.h".
+ * to_open:	the source wrapper to initialize, with "is_writable" set
+ * path:	the path of the source file
+ * returns	the same as "open_file_structor"
+ */
+enum fs_status
+open_writable_file_structor(struct file_structor *to_open, const char *path);
 /*
  * Try to close the source file,
  * and set its descriptor to indicate that it is invalid.
+ * The copy of a file loaded into memory by its backend is freed.
  * to_close:	the wrapper whose source file descriptor to close
  * returns	FS_NO_ERROR on success or if
  *			the file descriptor does not need to be closed;
@@ -66,6 +208,36 @@ open_file_structor(struct file_structor *to_open, const char *path);
  *			with errno set by the failing function: "close"
  */
 enum fs_status close_file_structor(struct file_structor *to_close);
+/*
+ * Initialize a "struct file_structor" around bytes already in memory,
+ * eg. a received message or a decompressed buffer,
+ * so that chunks initialized from it point into the bytes,
+ * with no system calls.
+ * The bytes must outlive every chunk initialized from them,
+ * and closing the wrapper does not free them.
+ * to_open:	the source wrapper to initialize
+ * memory:	the bytes to use as the file
+ * size:	the number of bytes
+ * returns	FS_NO_ERROR
+ */
+enum fs_status
+open_memory_structor(struct file_structor *to_open, void *memory,
+		     size_t size);
+/*
+ * Update the size of the source file, eg. after a writer appended to it,
+ * so that chunks can be mapped or extended up to the new size.
+ * Memory sources keep the size they were opened with.
+ * A file loaded into memory by its backend is loaded again
+ * if its size changed, or mapped instead if "IO_BACKEND_AUTO"
+ * would no longer load it, so that the chunks initialized from the old copy
+ * must be initialized again, or extended, which points them at the new one.
+ * to_refresh:	the source wrapper whose size to update
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_ERRNO if "fstat" failed, leaving the old size;
+ *		the error from "set_io_backend" if loading the file failed,
+ *			leaving it mapped
+ */
+enum fs_status refresh_file_structor(struct file_structor *to_refresh);
 
 /*
  * contains pointer to a data struct chunk in the file
@@ -88,20 +260,32 @@ struct file_struct {
 	 * Otherwise, "data" was taken from a subset of the "data" field of
 	 * another "struct file_struct", using "derive_file_struct",
 	 * and this pointer is NULL.
+	 * Chunks read by the "pread" backend point to their own buffer.
 	 */
 	void *mapping_start;
+	/*
+	 * the backend that read the data, which resizes and releases it,
+	 * if "mapping_start" is not NULL
+	 */
+	const struct io_backend *backend;
 };
 
 /*
- * Initialize a struct chunk, with a mapping to the data in the file.
+ * Initialize a struct chunk, with a mapping to the data in the file,
+ * which is writable if the source wrapper is,
+ * or with the data read by another backend of the source wrapper.
+ * Once the chunks of a source file follow a stride,
+ * the ones predicted to follow are read ahead, as by "observe_access".
  * to_init:		the chunk for which to map the data
  * src_file:		the source wrapper,
  *			and the value for the "src_file" field
  * size:		the size of the struct
  * start_in_file:	the starting location of the chunk in the file
  * returns		FS_NO_ERROR on success;
- *			FSERR_ERRNO if "mmap" failed, in which case
- *				the failed function will set errno;
+ *			FSERR_ERRNO if "mmap", or the "posix_memalign"
+ *				of the "pread" backend, failed,
+ *				in which case the failed function
+ *				will set errno;
  *			FSERR_OUT_OF_FILE if the requested chunk
  *				is beyond the range of the file,
  *				indicated by its size,
@@ -165,6 +349,7 @@ derive_file_struct(struct file_struct *to_init, struct file_struct *big_struct,
 
 /*
  * Unmap the data chunk, if this struct contains the original mapping,
+ * or free the buffer the "pread" backend read it into,
  * so that the struct can be deallocated.
  * Set all the pointers to NULL.
  * to_teardown:		the data chunk whose data to unmap,
@@ -174,6 +359,26 @@ derive_file_struct(struct file_struct *to_init, struct file_struct *big_struct,
  *				with errno set by the failing function: "munmap"
  */
 enum fs_status teardown_file_struct(struct file_struct *to_teardown);
+/*
+ * Resize a mapped struct chunk in place, keeping its start in the file,
+ * eg. to cover records appended since it was mapped.
+ * The mapping may move, so the "data" pointer changes,
+ * and chunks derived from this one must be derived again.
+ * Chunks of memory sources are resized without moving,
+ * chunks of files loaded into memory point into the current copy,
+ * and chunks read by the "pread" backend read the bytes added.
+ * to_extend:	the chunk initialized by "init_file_struct"
+ * size:	the new size of the chunk
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if the chunk was derived,
+ *			so that it has no mapping of its own;
+ *		FSERR_OUT_OF_FILE if the new size
+ *			is beyond the range of the file;
+ *		FSERR_ERRNO if "mremap", or the "posix_memalign"
+ *			of the "pread" backend, failed,
+ *			leaving the chunk unchanged
+ */
+enum fs_status extend_file_struct(struct file_struct *to_extend, off_t size);
 
 /*
  * Helper function to "copy_section" to copy memory in reverse,
@@ -185,7 +390,7 @@ enum fs_status teardown_file_struct(struct file_struct *to_teardown);
  */
 inline static void *memcpy_rev(void *dest, void *src, size_t size)
 {
-	uint8_t *dest_bytes = dest, *src_bytes = src;
+	uint8_t *dest_bytes = (uint8_t *) dest, *src_bytes = (uint8_t *) src;
 	size_t byte_i;
 
 	for (byte_i = 0; byte_i < size; byte_i++) {
@@ -258,12 +463,134 @@ inline static void portable_memcpy(void *dst, void *src, size_t size,
 	}
 }
 
+/* a description of an integer field inside a struct chunk */
+struct fs_int_field {
+	/* the location of the field in the struct */
+	size_t offset;
+	/* the number of bytes in the field, from 1 to 8 */
+	size_t width;
+	/* the byte order of the field */
+	enum endianness endianness;
+	/* Is the field a two's complement signed integer? */
+	int is_signed;
+};
+
 /*
- * Convert and copy a piece of data in the struct chunk to memory
+ * Load an unsigned integer of any width up to 8 bytes from raw data,
+ * converting it from the given byte order to the machine's.
+ * src:		the raw data of the integer
+ * width:	the number of bytes in the integer, from 1 to 8
+ * endianness:	the byte order of the raw data
+ * returns	the integer, zero-extended to 64 bits
+ */
+inline static uint64_t
+load_uint(const void *src, size_t width, enum endianness endianness)
+{
+	const uint8_t *src_bytes = (const uint8_t *) src;
+	uint64_t value = 0;
+	size_t byte_i;
+
+	switch (width) {
+	case sizeof(uint8_t):
+		return *src_bytes;
+	case sizeof(uint16_t): {
+		uint16_t value16;
+
+		memcpy(&value16, src, sizeof(value16));
+		return endianness == machine_endianness() ? value16 :
+		       __builtin_bswap16(value16);
+	}
+	case sizeof(uint32_t): {
+		uint32_t value32;
+
+		memcpy(&value32, src, sizeof(value32));
+		return endianness == machine_endianness() ? value32 :
+		       __builtin_bswap32(value32);
+	}
+	case sizeof(uint64_t):
+		memcpy(&value, src, sizeof(value));
+		return endianness == machine_endianness() ? value :
+		       __builtin_bswap64(value);
+	}
+
+	debug_assert(width < sizeof(uint64_t));
+	for (byte_i = 0; byte_i < width; byte_i++) {
+		size_t shift_i = endianness == BIG_END ?
+				 width - 1 - byte_i : byte_i;
+
+		value |= (uint64_t) src_bytes[byte_i] << (shift_i * 8);
+	}
+
+	return value;
+}
+
+/*
+ * Sign-extend a two's complement integer loaded by "load_uint".
+ * value:	the zero-extended integer
+ * width:	the number of bytes in the original integer, from 1 to 8
+ * returns	the integer, sign-extended to 64 bits
+ */
+inline static int64_t sign_extend(uint64_t value, size_t width)
+{
+	unsigned unused_bits = (sizeof(uint64_t) - width) * 8;
+
+	return (int64_t) (value << unused_bits) >> unused_bits;
+}
+
+/*
+ * Load the integer described by "field" from raw struct data.
+ * data:	the start of the raw struct containing the field
+ * field:	the description of the field
+ * returns	the integer in machine order,
+ *		sign-extended if the field is signed,
+ *		and zero-extended otherwise
+ */
+inline static uint64_t
+load_int_field(const void *data, const struct fs_int_field *field)
+{
+	uint64_t value = load_uint((const uint8_t *) data + field->offset,
+				   field->width, field->endianness);
+
+	return field->is_signed ? (uint64_t) sign_extend(value, field->width) :
+	       value;
+}
+
+/*
+ * Convert an integer loaded by "load_int_field" into a key,
+ * whose unsigned order is the order of the field's values,
+ * so that signed and unsigned fields can be compared the same way.
+ * value:	the integer, as returned by "load_int_field"
+ * field:	the description of the field
+ * returns	the key
+ */
+inline static uint64_t
+int_field_key(uint64_t value, const struct fs_int_field *field)
+{
+	return field->is_signed ? value ^ ((uint64_t) 1 << 63) : value;
+}
+
+/*
+ * Load the integer described by "field" from raw struct data as a key,
+ * as if by "load_int_field" followed by "int_field_key".
+ * data:	the start of the raw struct containing the field
+ * field:	the description of the field
+ * returns	the key
+ */
+inline static uint64_t
+load_int_field_key(const void *data, const struct fs_int_field *field)
+{
+	return int_field_key(load_int_field(data, field), field);
+}
+
+/*
+ * Convert and copy a piece of data in the struct chunk to memory,
+ * where the data may be at different offsets in the destination
+ * and in the raw data, eg. for packed file formats.
  * dst:		the pointer to the destination struct,
  *		ie. the base, not the member
+ * dst_offset:	the offset in the destination struct
  * src:		the source chunk
- * offset:	the offset in the destination struct and in the raw data
+ * src_offset:	the offset in the raw data
  * size:	the number of bytes to copy
  * endianness	the desired endianness
  * returns	FS_NO_ERROR on success;
@@ -271,26 +598,45 @@ inline static void portable_memcpy(void *dst, void *src, size_t size,
  *			is outside the range of the chunk
  */
 inline static enum fs_status
-copy_section(void *dst, struct file_struct *src, off_t offset, size_t size,
-	     enum endianness endianness)
+copy_section_at(void *dst, size_t dst_offset, struct file_struct *src,
+		off_t src_offset, size_t size, enum endianness endianness)
 {
-	if (offset + size > src->size) {
+	if (src_offset + size > src->size) {
 		printlg(ERROR_LEVEL,
 			"Requesting data in %u-%u, "
 			"but struct chunk only has data up to %u.\n",
-			(unsigned) offset, (unsigned) (offset + size),
+			(unsigned) src_offset, (unsigned) (src_offset + size),
 			(unsigned) src->size);
 		return FSERR_OUT_OF_STRUCT;
 	} else {
-		void *dst_section = dst + offset;
-		void *src_section = src->data + offset;
+		void *dst_section = (uint8_t *) dst + dst_offset;
+		void *src_section = (uint8_t *) src->data + src_offset;
 
 		portable_memcpy(dst_section, src_section, size, endianness);
 
-		return 0;
+		return FS_NO_ERROR;
 	}
 }
 
+/*
+ * Convert and copy a piece of data in the struct chunk to memory
+ * dst:		the pointer to the destination struct,
+ *		ie. the base, not the member
+ * src:		the source chunk
+ * offset:	the offset in the destination struct and in the raw data
+ * size:	the number of bytes to copy
+ * endianness	the desired endianness
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if the requested section
+ *			is outside the range of the chunk
+ */
+inline static enum fs_status
+copy_section(void *dst, struct file_struct *src, off_t offset, size_t size,
+	     enum endianness endianness)
+{
+	return copy_section_at(dst, offset, src, offset, size, endianness);
+}
+
 /*
  * Wrapper function around "copy_section" to copy a chosen struct member
  * dst:		the pointer to the destination struct,
@@ -306,6 +652,23 @@ copy_section(void *dst, struct file_struct *src, off_t offset, size_t size,
 #define COPY_MEMBER(dst, src, type, member, endianness) \
 	copy_section(dst, src, offsetof(type, member), \
 		     sizeof((((type *) dst)->member)), endianness)
+/*
+ * Wrapper function around "copy_section_at" to copy a chosen struct member
+ * from a different offset in the raw data, eg. for packed file formats
+ * dst:		the pointer to the destination struct,
+ *		ie. the base, not the member
+ * src:		the source chunk
+ * type:	the type of the struct
+ * member:	the name of the member
+ * src_offset:	the offset of the member in the raw data
+ * endianness:	the desired endianness
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if the requested section
+ *			is outside the range of the chunk
+ */
+#define COPY_MEMBER_FROM(dst, src, type, member, src_offset, endianness) \
+	copy_section_at(dst, offsetof(type, member), src, src_offset, \
+			sizeof((((type *) dst)->member)), endianness)
 /*
  * Wrapper function around "copy_section" to copy the chosen member of a struct
  * that is an indexed element in an array
@@ -363,7 +726,7 @@ copy_section(void *dst, struct file_struct *src, off_t offset, size_t size,
 	size_t width = sizeof((((type *) dst)->member[0])); \
 	size_t array_offset; \
 	debug_assert(full_width % width == 0); \
-	status = 0; \
+	status = FS_NO_ERROR; \
 	for (array_offset = 0; array_offset < full_width; \
 	     array_offset += width) { \
 		status = copy_section(dst, src, array_start + array_offset, \
@@ -374,4 +737,455 @@ copy_section(void *dst, struct file_struct *src, off_t offset, size_t size,
 	} \
 } while (0);
 
+/*
+ * Store an integer in machine order in any width up to 8 bytes,
+ * keeping only its low bytes if the width is narrower than the value.
+ * dst:		the destination of the integer
+ * value:	the integer
+ * width:	the number of bytes to store, from 1 to 8
+ */
+inline static void store_uint(void *dst, uint64_t value, size_t width)
+{
+	if (machine_endianness() == LITTLE_END) {
+		memcpy(dst, &value, width);
+	} else {
+		memcpy(dst, (uint8_t *) &value + sizeof(value) - width, width);
+	}
+}
+
+/*
+ * Convert a raw integer to an integer of another width in machine order,
+ * widening it with sign or zero extension, or narrowing it.
+ * dst:		the destination integer
+ * dst_width:	the number of bytes of the destination integer, from 1 to 8
+ * src:		the raw integer
+ * src_width:	the number of bytes of the raw integer, from 1 to 8
+ * endianness:	the byte order of the raw integer
+ * is_signed:	nonzero to sign-extend the raw integer
+ */
+inline static void
+convert_int(void *dst, size_t dst_width, const void *src, size_t src_width,
+	    enum endianness endianness, int is_signed)
+{
+	uint64_t value = load_uint(src, src_width, endianness);
+
+	if (is_signed) {
+		value = (uint64_t) sign_extend(value, src_width);
+	}
+	store_uint(dst, value, dst_width);
+}
+
+/*
+ * Convert a raw IEEE 754 floating point number to machine order,
+ * converting between "float" and "double" if the widths differ.
+ * dst:		the destination number
+ * dst_width:	the size of the destination, "sizeof(float)" or "sizeof(double)"
+ * src:		the raw number
+ * src_width:	the size of the raw number, "sizeof(float)" or "sizeof(double)"
+ * endianness:	the byte order of the raw number
+ */
+inline static void
+convert_float(void *dst, size_t dst_width, const void *src, size_t src_width,
+	      enum endianness endianness)
+{
+	uint64_t bits = load_uint(src, src_width, endianness);
+
+	debug_assert(src_width == sizeof(float) ||
+		     src_width == sizeof(double));
+	debug_assert(dst_width == sizeof(float) ||
+		     dst_width == sizeof(double));
+
+	if (src_width == dst_width) {
+		store_uint(dst, bits, dst_width);
+	} else if (src_width == sizeof(float)) {
+		uint32_t bits32 = (uint32_t) bits;
+		float value32;
+		double value;
+
+		memcpy(&value32, &bits32, sizeof(value32));
+		value = value32;
+		memcpy(dst, &value, sizeof(value));
+	} else {
+		float value32;
+		double value;
+
+		memcpy(&value, &bits, sizeof(value));
+		value32 = (float) value;
+		memcpy(dst, &value32, sizeof(value32));
+	}
+}
+
+/*
+ * Convert and copy an integer in the struct chunk to memory,
+ * widening it with sign or zero extension, or narrowing it,
+ * eg. from a 3-byte big-endian counter to an "int64_t".
+ * dst:		the pointer to the destination struct,
+ *		ie. the base, not the member
+ * dst_offset:	the offset in the destination struct
+ * dst_width:	the number of bytes of the destination integer, from 1 to 8
+ * src:		the source chunk
+ * src_offset:	the offset in the raw data
+ * src_width:	the number of bytes of the raw integer, from 1 to 8
+ * endianness:	the byte order of the raw integer
+ * is_signed:	nonzero to sign-extend the raw integer
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if the requested section
+ *			is outside the range of the chunk
+ */
+inline static enum fs_status
+copy_int_section(void *dst, size_t dst_offset, size_t dst_width,
+		 struct file_struct *src, off_t src_offset, size_t src_width,
+		 enum endianness endianness, int is_signed)
+{
+	if (src_offset + src_width > src->size) {
+		printlg(ERROR_LEVEL,
+			"Requesting data in %u-%u, "
+			"but struct chunk only has data up to %u.\n",
+			(unsigned) src_offset,
+			(unsigned) (src_offset + src_width),
+			(unsigned) src->size);
+		return FSERR_OUT_OF_STRUCT;
+	}
+
+	convert_int((uint8_t *) dst + dst_offset, dst_width,
+		    (uint8_t *) src->data + src_offset, src_width, endianness,
+		    is_signed);
+
+	return FS_NO_ERROR;
+}
+
+/*
+ * Convert and copy an IEEE 754 floating point number in the struct chunk
+ * to memory, converting its byte order,
+ * and converting between "float" and "double" if the widths differ.
+ * dst:		the pointer to the destination struct,
+ *		ie. the base, not the member
+ * dst_offset:	the offset in the destination struct
+ * dst_width:	the size of the destination, "sizeof(float)" or "sizeof(double)"
+ * src:		the source chunk
+ * src_offset:	the offset in the raw data
+ * src_width:	the size of the raw number, "sizeof(float)" or "sizeof(double)"
+ * endianness:	the byte order of the raw number
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if the requested section
+ *			is outside the range of the chunk
+ */
+inline static enum fs_status
+copy_float_section(void *dst, size_t dst_offset, size_t dst_width,
+		   struct file_struct *src, off_t src_offset, size_t src_width,
+		   enum endianness endianness)
+{
+	if (src_offset + src_width > src->size) {
+		printlg(ERROR_LEVEL,
+			"Requesting data in %u-%u, "
+			"but struct chunk only has data up to %u.\n",
+			(unsigned) src_offset,
+			(unsigned) (src_offset + src_width),
+			(unsigned) src->size);
+		return FSERR_OUT_OF_STRUCT;
+	}
+
+	convert_float((uint8_t *) dst + dst_offset, dst_width,
+		      (uint8_t *) src->data + src_offset, src_width,
+		      endianness);
+
+	return FS_NO_ERROR;
+}
+
+/*
+ * Wrapper function around "copy_int_section" to copy an integer member
+ * from a raw integer of another width, eg. a 2-byte counter into a "uint32_t"
+ * dst:		the pointer to the destination struct,
+ *		ie. the base, not the member
+ * src:		the source chunk
+ * type:	the type of the struct
+ * member:	the name of the integer member
+ * src_offset:	the offset of the raw integer
+ * src_width:	the number of bytes of the raw integer, from 1 to 8
+ * endianness:	the byte order of the raw integer
+ * is_signed:	nonzero to sign-extend the raw integer
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if the requested section
+ *			is outside the range of the chunk
+ */
+#define COPY_INT_MEMBER_FROM(dst, src, type, member, src_offset, src_width, \
+			     endianness, is_signed) \
+	copy_int_section(dst, offsetof(type, member), \
+			 sizeof((((type *) dst)->member)), src, src_offset, \
+			 src_width, endianness, is_signed)
+/*
+ * Wrapper function around "copy_float_section" to copy a "float"
+ * or "double" member from a raw number of either width
+ * dst:		the pointer to the destination struct,
+ *		ie. the base, not the member
+ * src:		the source chunk
+ * type:	the type of the struct
+ * member:	the name of the floating point member
+ * src_offset:	the offset of the raw number
+ * src_width:	the size of the raw number, "sizeof(float)" or "sizeof(double)"
+ * endianness:	the byte order of the raw number
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if the requested section
+ *			is outside the range of the chunk
+ */
+#define COPY_FLOAT_MEMBER_FROM(dst, src, type, member, src_offset, \
+			       src_width, endianness) \
+	copy_float_section(dst, offsetof(type, member), \
+			   sizeof((((type *) dst)->member)), src, src_offset, \
+			   src_width, endianness)
+
+/*
+ * Store an unsigned integer of any width up to 8 bytes into raw data,
+ * converting it from the machine's byte order to the given one,
+ * and keeping only its low bytes if the width is narrower than the value.
+ * This is the reverse of "load_uint".
+ * dst:		the raw data to store the integer into
+ * value:	the integer
+ * width:	the number of bytes to store, from 1 to 8
+ * endianness:	the byte order of the raw data
+ */
+inline static void
+encode_uint(void *dst, uint64_t value, size_t width,
+	    enum endianness endianness)
+{
+	uint8_t *dst_bytes = (uint8_t *) dst;
+	size_t byte_i;
+
+	if (endianness == machine_endianness()) {
+		store_uint(dst, value, width);
+		return;
+	}
+
+	for (byte_i = 0; byte_i < width; byte_i++) {
+		size_t shift_i = endianness == BIG_END ?
+				 width - 1 - byte_i : byte_i;
+
+		dst_bytes[byte_i] = (uint8_t) (value >> (shift_i * 8));
+	}
+}
+
+/*
+ * Convert and store a piece of memory into the struct chunk,
+ * which is the reverse of "copy_section_at".
+ * The chunk must be writable, eg. from "open_writable_file_structor",
+ * or from a memory source whose bytes are writable.
+ * dst:		the destination chunk
+ * dst_offset:	the offset in the raw data
+ * src:		the pointer to the source struct,
+ *		ie. the base, not the member
+ * src_offset:	the offset in the source struct
+ * size:	the number of bytes to store
+ * endianness	the byte order of the raw data
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if the requested section
+ *			is outside the range of the chunk
+ */
+inline static enum fs_status
+store_section_at(struct file_struct *dst, off_t dst_offset, const void *src,
+		 size_t src_offset, size_t size, enum endianness endianness)
+{
+	if (dst_offset + size > dst->size) {
+		printlg(ERROR_LEVEL,
+			"Storing data in %u-%u, "
+			"but struct chunk only has data up to %u.\n",
+			(unsigned) dst_offset, (unsigned) (dst_offset + size),
+			(unsigned) dst->size);
+		return FSERR_OUT_OF_STRUCT;
+	}
+
+	portable_memcpy((uint8_t *) dst->data + dst_offset,
+			(uint8_t *) src + src_offset, size, endianness);
+
+	return FS_NO_ERROR;
+}
+
+/*
+ * Convert and store a piece of memory into the struct chunk
+ * at the same offset, which is the reverse of "copy_section".
+ * dst:		the destination chunk
+ * src:		the pointer to the source struct,
+ *		ie. the base, not the member
+ * offset:	the offset in the source struct and in the raw data
+ * size:	the number of bytes to store
+ * endianness	the byte order of the raw data
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if the requested section
+ *			is outside the range of the chunk
+ */
+inline static enum fs_status
+store_section(struct file_struct *dst, const void *src, off_t offset,
+	      size_t size, enum endianness endianness)
+{
+	return store_section_at(dst, offset, src, offset, size, endianness);
+}
+
+/*
+ * Wrapper function around "store_section" to store a chosen struct member
+ * dst:		the destination chunk
+ * src:		the pointer to the source struct,
+ *		ie. the base, not the member
+ * type:	the type of the struct
+ * member:	the name of the member
+ * endianness:	the byte order of the raw data
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if the requested section
+ *			is outside the range of the chunk
+ */
+#define STORE_MEMBER(dst, src, type, member, endianness) \
+	store_section(dst, src, offsetof(type, member), \
+		      sizeof((((type *) src)->member)), endianness)
+/*
+ * Wrapper function around "store_section_at" to store a chosen struct member
+ * at a different offset in the raw data, eg. for packed file formats
+ * dst:		the destination chunk
+ * src:		the pointer to the source struct,
+ *		ie. the base, not the member
+ * type:	the type of the struct
+ * member:	the name of the member
+ * dst_offset:	the offset of the member in the raw data
+ * endianness:	the byte order of the raw data
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if the requested section
+ *			is outside the range of the chunk
+ */
+#define STORE_MEMBER_TO(dst, src, type, member, dst_offset, endianness) \
+	store_section_at(dst, dst_offset, src, offsetof(type, member), \
+			 sizeof((((type *) src)->member)), endianness)
+
+/*
+ * Convert and store an integer in memory into the struct chunk,
+ * narrowing it, or widening it with sign or zero extension,
+ * which is the reverse of "copy_int_section".
+ * dst:		the destination chunk
+ * dst_offset:	the offset in the raw data
+ * dst_width:	the number of bytes of the raw integer, from 1 to 8
+ * src:		the pointer to the source struct,
+ *		ie. the base, not the member
+ * src_offset:	the offset in the source struct
+ * src_width:	the number of bytes of the integer in memory, from 1 to 8
+ * endianness:	the byte order of the raw integer
+ * is_signed:	nonzero to sign-extend the integer in memory
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if the requested section
+ *			is outside the range of the chunk
+ */
+inline static enum fs_status
+store_int_section(struct file_struct *dst, off_t dst_offset, size_t dst_width,
+		  const void *src, size_t src_offset, size_t src_width,
+		  enum endianness endianness, int is_signed)
+{
+	uint64_t value;
+
+	if (dst_offset + dst_width > dst->size) {
+		printlg(ERROR_LEVEL,
+			"Storing data in %u-%u, "
+			"but struct chunk only has data up to %u.\n",
+			(unsigned) dst_offset,
+			(unsigned) (dst_offset + dst_width),
+			(unsigned) dst->size);
+		return FSERR_OUT_OF_STRUCT;
+	}
+
+	value = load_uint((const uint8_t *) src + src_offset, src_width,
+			  machine_endianness());
+	if (is_signed) {
+		value = (uint64_t) sign_extend(value, src_width);
+	}
+	encode_uint((uint8_t *) dst->data + dst_offset, value, dst_width,
+		    endianness);
+
+	return FS_NO_ERROR;
+}
+
+/*
+ * Convert and store an IEEE 754 floating point number in memory
+ * into the struct chunk, converting its byte order,
+ * and converting between "float" and "double" if the widths differ,
+ * which is the reverse of "copy_float_section".
+ * dst:		the destination chunk
+ * dst_offset:	the offset in the raw data
+ * dst_width:	the size of the raw number, "sizeof(float)" or "sizeof(double)"
+ * src:		the pointer to the source struct,
+ *		ie. the base, not the member
+ * src_offset:	the offset in the source struct
+ * src_width:	the size of the number in memory,
+ *		"sizeof(float)" or "sizeof(double)"
+ * endianness:	the byte order of the raw number
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if the requested section
+ *			is outside the range of the chunk
+ */
+inline static enum fs_status
+store_float_section(struct file_struct *dst, off_t dst_offset,
+		    size_t dst_width, const void *src, size_t src_offset,
+		    size_t src_width, enum endianness endianness)
+{
+	uint8_t converted[sizeof(double)];
+
+	if (dst_offset + dst_width > dst->size) {
+		printlg(ERROR_LEVEL,
+			"Storing data in %u-%u, "
+			"but struct chunk only has data up to %u.\n",
+			(unsigned) dst_offset,
+			(unsigned) (dst_offset + dst_width),
+			(unsigned) dst->size);
+		return FSERR_OUT_OF_STRUCT;
+	}
+
+	convert_float(converted, dst_width, (const uint8_t *) src + src_offset,
+		      src_width, machine_endianness());
+	encode_uint((uint8_t *) dst->data + dst_offset,
+		    load_uint(converted, dst_width, machine_endianness()),
+		    dst_width, endianness);
+
+	return FS_NO_ERROR;
+}
+
+/*
+ * Wrapper function around "store_int_section" to store an integer member
+ * into a raw integer of another width, eg. a "uint32_t" into a 2-byte counter
+ * dst:		the destination chunk
+ * src:		the pointer to the source struct,
+ *		ie. the base, not the member
+ * type:	the type of the struct
+ * member:	the name of the integer member
+ * dst_offset:	the offset of the raw integer
+ * dst_width:	the number of bytes of the raw integer, from 1 to 8
+ * endianness:	the byte order of the raw integer
+ * is_signed:	nonzero to sign-extend the member
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if the requested section
+ *			is outside the range of the chunk
+ */
+#define STORE_INT_MEMBER_TO(dst, src, type, member, dst_offset, dst_width, \
+			    endianness, is_signed) \
+	store_int_section(dst, dst_offset, dst_width, src, \
+			  offsetof(type, member), \
+			  sizeof((((type *) src)->member)), endianness, \
+			  is_signed)
+/*
+ * Wrapper function around "store_float_section" to store a "float"
+ * or "double" member into a raw number of either width
+ * dst:		the destination chunk
+ * src:		the pointer to the source struct,
+ *		ie. the base, not the member
+ * type:	the type of the struct
+ * member:	the name of the floating point member
+ * dst_offset:	the offset of the raw number
+ * dst_width:	the size of the raw number, "sizeof(float)" or "sizeof(double)"
+ * endianness:	the byte order of the raw number
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if the requested section
+ *			is outside the range of the chunk
+ */
+#define STORE_FLOAT_MEMBER_TO(dst, src, type, member, dst_offset, dst_width, \
+			      endianness) \
+	store_float_section(dst, dst_offset, dst_width, src, \
+			    offsetof(type, member), \
+			    sizeof((((type *) src)->member)), endianness)
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* FILE_STRUCTOR_H */
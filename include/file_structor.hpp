@@ -0,0 +1,435 @@
+/*
+ * Typed C++ views over "struct file_struct" chunks.
+ * The layout of each record in the file is described at compile time,
+ * as a list of members with their offsets and byte orders,
+ * so that decoding a record compiles down to
+ * the same loads and byte swaps one would write by hand,
+ * instead of going through "copy_section" for each member.
+ * Requires C++17.
+ */
+#ifndef FILE_STRUCTOR_HPP
+#define FILE_STRUCTOR_HPP
+
+#include <file_structor.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+namespace fs {
+
+/* the byte order of this machine, known at compile time */
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+constexpr enum endianness native_endianness = BIG_END;
+#else
+constexpr enum endianness native_endianness = LITTLE_END;
+#endif
+
+/*
+ * Reverse the bytes of a trivially copyable value of 1, 2, 4 or 8 bytes,
+ * eg. an integer or a floating point number.
+ * value:	the value to convert
+ * returns	the value with its bytes reversed
+ */
+template <typename Value>
+inline Value byte_swap(Value value)
+{
+	static_assert(std::is_trivially_copyable_v<Value>,
+		      "Only plain values can have their bytes swapped.");
+
+	if constexpr (sizeof(Value) == sizeof(uint8_t)) {
+		return value;
+	} else if constexpr (sizeof(Value) == sizeof(uint16_t)) {
+		uint16_t bits;
+
+		std::memcpy(&bits, &value, sizeof(bits));
+		bits = __builtin_bswap16(bits);
+		std::memcpy(&value, &bits, sizeof(bits));
+		return value;
+	} else if constexpr (sizeof(Value) == sizeof(uint32_t)) {
+		uint32_t bits;
+
+		std::memcpy(&bits, &value, sizeof(bits));
+		bits = __builtin_bswap32(bits);
+		std::memcpy(&value, &bits, sizeof(bits));
+		return value;
+	} else {
+		static_assert(sizeof(Value) == sizeof(uint64_t),
+			      "Only 1, 2, 4 and 8-byte values can be swapped.");
+		uint64_t bits;
+
+		std::memcpy(&bits, &value, sizeof(bits));
+		bits = __builtin_bswap64(bits);
+		std::memcpy(&value, &bits, sizeof(bits));
+		return value;
+	}
+}
+
+/* splits a pointer to a data member into its struct and member types */
+template <typename MemberPointer>
+struct member_pointer_traits;
+
+template <typename Struct, typename Member>
+struct member_pointer_traits<Member Struct::*> {
+	using struct_type = Struct;
+	using member_type = Member;
+};
+
+/*
+ * the layout of a single struct member in the file
+ * MemberPointer:	the pointer to the member, eg. "&my_struct::id"
+ * SrcOffset:		the offset of the member in the raw record
+ * Order:		the byte order of the member in the raw record;
+ *			for array members, the order of each element
+ */
+template <auto MemberPointer, std::size_t SrcOffset,
+	  enum endianness Order = native_endianness>
+struct member {
+	using traits = member_pointer_traits<decltype(MemberPointer)>;
+	using struct_type = typename traits::struct_type;
+	using member_type = typename traits::member_type;
+	/* the type of each element whose bytes are converted */
+	using element_type = std::remove_all_extents_t<member_type>;
+
+	static_assert(std::is_trivially_copyable_v<member_type>,
+		      "Only plain members can be decoded from a file.");
+
+	/* the offset of the member in the raw record */
+	static constexpr std::size_t src_offset = SrcOffset;
+	/* the number of bytes in the member */
+	static constexpr std::size_t size = sizeof(member_type);
+	/* the end of the member in the raw record */
+	static constexpr std::size_t src_end = SrcOffset + size;
+	/* Can the bytes be copied without conversion? */
+	static constexpr bool is_direct = Order == native_endianness ||
+					  sizeof(element_type) == 1;
+
+	/*
+	 * Decode the member from a raw record, without checking ranges.
+	 * dst:	the destination struct
+	 * src:	the start of the raw record
+	 */
+	static void decode(struct_type &dst, const unsigned char *src)
+	{
+		member_type &dst_member = dst.*MemberPointer;
+
+		if constexpr (is_direct) {
+			std::memcpy(&dst_member, src + SrcOffset, size);
+		} else {
+			constexpr std::size_t n_elements =
+				size / sizeof(element_type);
+			element_type *dst_elements =
+				reinterpret_cast<element_type *>(&dst_member);
+
+			for (std::size_t element_i = 0;
+			     element_i < n_elements; element_i++) {
+				element_type element;
+
+				std::memcpy(&element,
+					    src + SrcOffset +
+					    element_i * sizeof(element),
+					    sizeof(element));
+				dst_elements[element_i] = byte_swap(element);
+			}
+		}
+	}
+};
+
+/*
+ * the layout of a whole record in the file, as a list of "member"s
+ * RecordSize:	the distance between records in the file,
+ *		which must cover every member
+ * Members:	the layouts of the members to decode
+ */
+template <std::size_t RecordSize, typename... Members>
+struct record_layout {
+	/* the distance between records in the file */
+	static constexpr std::size_t record_size = RecordSize;
+	/* the number of raw bytes read from each record */
+	static constexpr std::size_t src_size =
+		std::max({static_cast<std::size_t>(0), Members::src_end...});
+
+	static_assert(src_size <= RecordSize,
+		      "Every member must be inside the raw record.");
+
+	/*
+	 * Decode every member from a raw record, without checking ranges.
+	 * The calls are unrolled at compile time.
+	 * dst:	the destination struct
+	 * src:	the start of the raw record
+	 */
+	template <typename Struct>
+	static void decode(Struct &dst, const unsigned char *src)
+	{
+		(Members::decode(dst, src), ...);
+	}
+};
+
+/*
+ * the default layout of a struct type,
+ * which can be specialized with a "type" member naming its "record_layout",
+ * so that "file_view" does not need the layout to be given each time
+ */
+template <typename Struct>
+struct layout_of;
+
+/*
+ * Decode a single record from a chunk, checking its range.
+ * Layout:	the "record_layout" of the record
+ * dst:		the destination struct
+ * src:		the source chunk
+ * src_start:	the location of the record in the chunk
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if the record
+ *			is outside the range of the chunk
+ */
+template <typename Layout, typename Struct>
+inline enum fs_status
+decode_record(Struct &dst, const struct file_struct &src, off_t src_start)
+{
+	if (src_start < 0 ||
+	    static_cast<uint64_t>(src_start) + Layout::src_size > src.size) {
+		return FSERR_OUT_OF_STRUCT;
+	}
+	Layout::decode(dst, static_cast<const unsigned char *>(src.data) +
+			    src_start);
+
+	return FS_NO_ERROR;
+}
+
+/*
+ * an array of records of the same type in a file,
+ * which owns its "struct file_struct",
+ * and tears it down when it goes out of scope
+ * Struct:	the type of each decoded record
+ * Layout:	the "record_layout" of each record in the file
+ */
+template <typename Struct, typename Layout = typename layout_of<Struct>::type>
+class file_view {
+public:
+	/* iterator over decoded records */
+	class iterator {
+	public:
+		using iterator_category = std::input_iterator_tag;
+		using value_type = Struct;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const Struct *;
+		using reference = Struct;
+
+		iterator(const file_view *view, std::size_t index)
+			: view(view), index(index)
+		{
+		}
+
+		Struct operator*() const
+		{
+			return (*view)[index];
+		}
+		iterator &operator++()
+		{
+			index++;
+			return *this;
+		}
+		iterator operator++(int)
+		{
+			iterator old = *this;
+
+			index++;
+			return old;
+		}
+		iterator &operator+=(difference_type distance)
+		{
+			index += distance;
+			return *this;
+		}
+		difference_type operator-(const iterator &other) const
+		{
+			return static_cast<difference_type>(index) -
+			       static_cast<difference_type>(other.index);
+		}
+		bool operator==(const iterator &other) const
+		{
+			return index == other.index;
+		}
+		bool operator!=(const iterator &other) const
+		{
+			return index != other.index;
+		}
+
+	private:
+		/* the view being iterated over */
+		const file_view *view;
+		/* the index of the current record */
+		std::size_t index;
+	};
+
+	file_view() noexcept : chunk{}, n_records(0)
+	{
+	}
+	~file_view()
+	{
+		reset();
+	}
+
+	file_view(const file_view &) = delete;
+	file_view &operator=(const file_view &) = delete;
+
+	file_view(file_view &&other) noexcept
+		: chunk(other.chunk), n_records(other.n_records)
+	{
+		other.release();
+	}
+	file_view &operator=(file_view &&other) noexcept
+	{
+		if (this != &other) {
+			reset();
+			chunk = other.chunk;
+			n_records = other.n_records;
+			other.release();
+		}
+		return *this;
+	}
+
+	/*
+	 * Map an array of records from a file, using "init_file_struct".
+	 * Any records mapped before are torn down first.
+	 * file:	the source wrapper
+	 * start:	the location of the first record in the file
+	 * count:	the number of records
+	 * returns	the status from "init_file_struct"
+	 */
+	enum fs_status init(struct file_structor *file, off_t start,
+			    std::size_t count = 1)
+	{
+		enum fs_status status;
+
+		reset();
+		if ((status = init_file_struct(&chunk, file,
+					       Layout::record_size * count,
+					       start)) == FS_NO_ERROR) {
+			n_records = count;
+		}
+
+		return status;
+	}
+	/*
+	 * View an array of records inside a larger chunk,
+	 * using "derive_file_struct", so that nothing is mapped.
+	 * Any records mapped before are torn down first.
+	 * big_struct:		the chunk containing the records
+	 * start_in_struct:	the location of the first record
+	 * count:		the number of records
+	 * returns		the status from "derive_file_struct"
+	 */
+	enum fs_status derive(struct file_struct *big_struct,
+			      std::size_t start_in_struct,
+			      std::size_t count = 1)
+	{
+		enum fs_status status;
+
+		reset();
+		if ((status = derive_file_struct(&chunk, big_struct,
+						 Layout::record_size * count,
+						 start_in_struct)) ==
+		    FS_NO_ERROR) {
+			n_records = count;
+		}
+
+		return status;
+	}
+	/* Tear down the chunk, if there is one. */
+	void reset()
+	{
+		if (chunk.data != NULL) {
+			teardown_file_struct(&chunk);
+		}
+		release();
+	}
+
+	/* the number of records in the view */
+	std::size_t size() const
+	{
+		return n_records;
+	}
+	bool empty() const
+	{
+		return n_records == 0;
+	}
+	/* the underlying chunk, for use with the C functions */
+	struct file_struct *file_chunk()
+	{
+		return &chunk;
+	}
+	/* the raw bytes of the record at the index, without checking it */
+	const unsigned char *raw(std::size_t index) const
+	{
+		return static_cast<const unsigned char *>(chunk.data) +
+		       index * Layout::record_size;
+	}
+
+	/* Decode the record at the index, without checking it. */
+	void decode(std::size_t index, Struct &dst) const
+	{
+		Layout::decode(dst, raw(index));
+	}
+	/*
+	 * Decode the record at the index, checking it.
+	 * returns	FS_NO_ERROR on success;
+	 *		FSERR_OUT_OF_STRUCT if the index is too high
+	 */
+	enum fs_status decode_checked(std::size_t index, Struct &dst) const
+	{
+		if (index >= n_records) {
+			return FSERR_OUT_OF_STRUCT;
+		}
+		decode(index, dst);
+
+		return FS_NO_ERROR;
+	}
+	/* Decode every record into an array of "size()" structs. */
+	void decode_all(Struct *dst) const
+	{
+		for (std::size_t record_i = 0; record_i < n_records;
+		     record_i++) {
+			decode(record_i, dst[record_i]);
+		}
+	}
+	/* the decoded record at the index, which is not checked */
+	Struct operator[](std::size_t index) const
+	{
+		Struct record{};
+
+		decode(index, record);
+		return record;
+	}
+
+	iterator begin() const
+	{
+		return iterator(this, 0);
+	}
+	iterator end() const
+	{
+		return iterator(this, n_records);
+	}
+
+private:
+	/* Forget the chunk without tearing it down. */
+	void release()
+	{
+		chunk = {};
+		n_records = 0;
+	}
+
+	/* the chunk containing the raw records */
+	struct file_struct chunk;
+	/* the number of records in "chunk" */
+	std::size_t n_records;
+};
+
+} /* namespace fs */
+
+#endif /* FILE_STRUCTOR_HPP */
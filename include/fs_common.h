@@ -0,0 +1,136 @@
+/*
+ * Helpers shared by the file structor tools,
+ * for writing sidecar files and checking them against their source file,
+ * and for reading the clock.
+ */
+#ifndef FS_COMMON_H
+#define FS_COMMON_H
+
+#include <file_structor.h>
+
+#include <stddef.h>
+#include <sys/stat.h>
+#include <time.h>
+
+/* the suffix of a sidecar while it is being written */
+#define TMP_SUFFIX	".tmp"
+
+/*
+ * the size and modification time of a source file,
+ * recorded in the sidecars built from it to tell if it changed since
+ */
+struct source_identity {
+	uint64_t size;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+};
+
+/*
+ * Record the identity of a source file.
+ * to_set:	the identity to set
+ * source:	the status of the source file
+ */
+inline static void
+set_source_identity(struct source_identity *to_set, const struct stat *source)
+{
+	to_set->size = source->st_size;
+	to_set->mtime_sec = source->st_mtim.tv_sec;
+	to_set->mtime_nsec = source->st_mtim.tv_nsec;
+}
+
+/*
+ * Tell if a source file is the one an identity was recorded from.
+ * identity:	the recorded identity
+ * source:	the status of the source file
+ * returns	1 if its size and modification time are the same; 0 otherwise
+ */
+inline static int
+is_same_source(const struct source_identity *identity,
+	       const struct stat *source)
+{
+	return identity->size == (uint64_t) source->st_size &&
+	       identity->mtime_sec == source->st_mtim.tv_sec &&
+	       identity->mtime_nsec == source->st_mtim.tv_nsec;
+}
+
+/*
+ * Mix a value into a running hash,
+ * with the finalizer of MurmurHash3.
+ * hash:	the hash so far
+ * value:	the value to mix in
+ * returns	the new hash
+ */
+inline static uint64_t mix_hash(uint64_t hash, uint64_t value)
+{
+	hash ^= value;
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdull;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ull;
+	hash ^= hash >> 33;
+
+	return hash;
+}
+
+/*
+ * the path of a file with a suffix added, which must be freed
+ * path:	the path of the file
+ * suffix:	the suffix to add
+ * returns	the new path, or NULL if "malloc" failed
+ */
+char *add_suffix(const char *path, const char *suffix);
+
+/*
+ * Write all of a buffer at an offset in a file,
+ * continuing after short writes.
+ * fd:		the descriptor of the file
+ * buffer:	the bytes to write
+ * size:	the number of bytes
+ * offset:	the location to write them at
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_ERRNO if "pwrite" failed
+ */
+enum fs_status
+write_all(int fd, const void *buffer, size_t size, off_t offset);
+
+/*
+ * Finish a file written under a temporary name:
+ * sync and close it, and rename it into place if it was written,
+ * or delete it otherwise,
+ * so that a partial file is never found at its path.
+ * fd:		the descriptor of the temporary file, which is closed
+ * tmp_path:	the path of the temporary file
+ * path:	the path to rename it to
+ * status:	the status of writing the file
+ * returns	"status" if it is an error;
+ *		FSERR_ERRNO if "fsync" or "rename" failed;
+ *		FS_NO_ERROR otherwise
+ */
+enum fs_status
+finish_tmp_file(int fd, const char *tmp_path, const char *path,
+		enum fs_status status);
+
+/* the current time of the monotonic clock, in nanoseconds */
+inline static uint64_t now_ns()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/*
+ * the current time of a coarse monotonic clock, in nanoseconds,
+ * which is read without a system call
+ */
+inline static uint64_t coarse_now_ns()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+
+	return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+#endif /* FS_COMMON_H */
@@ -0,0 +1,63 @@
+/*
+ * Helpers for splitting work in the file structor tools across threads.
+ */
+#ifndef FS_PARALLEL_H
+#define FS_PARALLEL_H
+
+#include <file_structor.h>
+
+#include <stddef.h>
+
+/*
+ * the work done by each thread started by "run_parallel"
+ * arg:		the argument given to "run_parallel", shared by all threads
+ * worker_i:	the index of the thread, from 0 up to the number of threads
+ * returns	FS_NO_ERROR on success, or the error to report
+ */
+typedef enum fs_status (*fs_worker)(void *arg, unsigned worker_i);
+
+/*
+ * Find the number of threads to use when the caller asks for 0,
+ * ie. the number of online processors.
+ * n_threads:	the requested number of threads, or 0 for automatic
+ * returns	"n_threads" if it is not 0,
+ *		otherwise the number of online processors, and at least 1
+ */
+unsigned fs_thread_count(unsigned n_threads);
+
+/*
+ * Run the worker function on "n_threads" threads,
+ * including the calling thread, and wait for all of them to finish.
+ * If fewer threads can be started, the work is done on the ones that could,
+ * so workers should claim their work with "claim_work",
+ * rather than dividing it up by "worker_i".
+ * n_threads:	the number of threads, or 0 for one per online processor
+ * worker:	the function to run on each thread
+ * arg:		the argument to pass to each call to "worker"
+ * returns	FS_NO_ERROR if all the workers succeeded;
+ *		otherwise the first error returned by a worker
+ */
+enum fs_status run_parallel(unsigned n_threads, fs_worker worker, void *arg);
+
+/*
+ * Atomically claim the next range of work items shared by several threads.
+ * next:	the index of the next unclaimed item
+ * n_items:	the total number of items
+ * batch:	the maximum number of items to claim at once
+ * start:	will be set to the index of the first claimed item
+ * returns	the number of items claimed, or 0 if there are none left
+ */
+inline static size_t claim_work(size_t *next, size_t n_items, size_t batch,
+				size_t *start)
+{
+	size_t claimed = __atomic_fetch_add(next, batch, __ATOMIC_RELAXED);
+
+	if (claimed >= n_items) {
+		return 0;
+	}
+	*start = claimed;
+
+	return claimed + batch > n_items ? n_items - claimed : batch;
+}
+
+#endif /* FS_PARALLEL_H */
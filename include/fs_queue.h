@@ -0,0 +1,212 @@
+/*
+ * Bounded lock-free queues of pointers, for handing batches of work
+ * between the threads of a pipeline.
+ * "struct spsc_queue" has one producer and one consumer,
+ * and "struct mpmc_queue" any number of each.
+ * Neither blocks: pushing to a full queue or popping from an empty one
+ * fails, and the caller waits with "queue_backoff",
+ * so that a full queue holds back its producers.
+ */
+#ifndef FS_QUEUE_H
+#define FS_QUEUE_H
+
+#include <file_structor.h>
+
+#include <sched.h>
+#include <stddef.h>
+
+/* the size of a cache line, which separates the ends of a queue */
+#define QUEUE_LINE_SIZE	64
+/* the number of failed attempts before a waiting thread yields */
+#define QUEUE_SPINS	64
+
+/* a queue with a single producer and a single consumer */
+struct spsc_queue {
+	/* the ring of items, with a power of 2 of slots */
+	void **slots;
+	/* the number of slots minus 1 */
+	size_t mask;
+	/* the number of items popped, written only by the consumer */
+	size_t head __attribute__((aligned(QUEUE_LINE_SIZE)));
+	/* the number of items pushed, written only by the producer */
+	size_t tail __attribute__((aligned(QUEUE_LINE_SIZE)));
+};
+
+/* a slot of a "struct mpmc_queue" */
+struct mpmc_cell {
+	/*
+	 * the position the slot is ready to be pushed at,
+	 * or that plus 1 once it holds the item pushed there
+	 */
+	size_t sequence;
+	/* the item */
+	void *item;
+};
+
+/* a queue with any number of producers and consumers */
+struct mpmc_queue {
+	/* the ring of slots, with a power of 2 of them */
+	struct mpmc_cell *cells;
+	/* the number of slots minus 1 */
+	size_t mask;
+	/* the position of the next push */
+	size_t tail __attribute__((aligned(QUEUE_LINE_SIZE)));
+	/* the position of the next pop */
+	size_t head __attribute__((aligned(QUEUE_LINE_SIZE)));
+};
+
+/*
+ * Initialize an empty single-producer, single-consumer queue.
+ * to_init:	the queue to initialize
+ * capacity:	the number of items it can hold,
+ *		which is rounded up to a power of 2
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_ERRNO if "malloc" failed
+ */
+enum fs_status init_spsc_queue(struct spsc_queue *to_init, size_t capacity);
+/* Free the slots of a single-producer, single-consumer queue. */
+void free_spsc_queue(struct spsc_queue *to_free);
+/*
+ * Initialize an empty multi-producer, multi-consumer queue.
+ * to_init:	the queue to initialize
+ * capacity:	the number of items it can hold,
+ *		which is rounded up to a power of 2
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_ERRNO if "malloc" failed
+ */
+enum fs_status init_mpmc_queue(struct mpmc_queue *to_init, size_t capacity);
+/* Free the slots of a multi-producer, multi-consumer queue. */
+void free_mpmc_queue(struct mpmc_queue *to_free);
+
+/*
+ * Wait a little after failing to push or pop,
+ * spinning at first, then yielding the processor.
+ * spins:	the number of failures so far, which is incremented
+ */
+inline static void queue_backoff(unsigned *spins)
+{
+	if (++*spins < QUEUE_SPINS) {
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#endif
+	} else {
+		sched_yield();
+	}
+}
+
+/*
+ * Push an item to a single-producer, single-consumer queue.
+ * queue:	the queue, only pushed to by this thread
+ * item:	the item to push
+ * returns	1 if it was pushed; 0 if the queue is full
+ */
+inline static int spsc_push(struct spsc_queue *queue, void *item)
+{
+	size_t tail = queue->tail;
+
+	if (tail - __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) >
+	    queue->mask) {
+		return 0;
+	}
+	queue->slots[tail & queue->mask] = item;
+	__atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+
+	return 1;
+}
+
+/*
+ * Pop an item from a single-producer, single-consumer queue.
+ * queue:	the queue, only popped from by this thread
+ * item:	will be set to the popped item
+ * returns	1 if an item was popped; 0 if the queue is empty
+ */
+inline static int spsc_pop(struct spsc_queue *queue, void **item)
+{
+	size_t head = queue->head;
+
+	if (head == __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE)) {
+		return 0;
+	}
+	*item = queue->slots[head & queue->mask];
+	__atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+
+	return 1;
+}
+
+/*
+ * Push an item to a multi-producer, multi-consumer queue.
+ * queue:	the queue
+ * item:	the item to push
+ * returns	1 if it was pushed; 0 if the queue is full
+ */
+inline static int mpmc_push(struct mpmc_queue *queue, void *item)
+{
+	size_t position = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+
+	for (;;) {
+		struct mpmc_cell *cell = &queue->cells[position & queue->mask];
+		size_t sequence = __atomic_load_n(&cell->sequence,
+						  __ATOMIC_ACQUIRE);
+		intptr_t difference = (intptr_t) sequence -
+				      (intptr_t) position;
+
+		if (difference == 0) {
+			if (__atomic_compare_exchange_n(&queue->tail,
+							&position,
+							position + 1, 1,
+							__ATOMIC_RELAXED,
+							__ATOMIC_RELAXED)) {
+				cell->item = item;
+				__atomic_store_n(&cell->sequence,
+						 position + 1,
+						 __ATOMIC_RELEASE);
+				return 1;
+			}
+		} else if (difference < 0) {
+			return 0;
+		} else {
+			position = __atomic_load_n(&queue->tail,
+						   __ATOMIC_RELAXED);
+		}
+	}
+}
+
+/*
+ * Pop an item from a multi-producer, multi-consumer queue.
+ * queue:	the queue
+ * item:	will be set to the popped item
+ * returns	1 if an item was popped; 0 if the queue is empty
+ */
+inline static int mpmc_pop(struct mpmc_queue *queue, void **item)
+{
+	size_t position = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+
+	for (;;) {
+		struct mpmc_cell *cell = &queue->cells[position & queue->mask];
+		size_t sequence = __atomic_load_n(&cell->sequence,
+						  __ATOMIC_ACQUIRE);
+		intptr_t difference = (intptr_t) sequence -
+				      (intptr_t) (position + 1);
+
+		if (difference == 0) {
+			if (__atomic_compare_exchange_n(&queue->head,
+							&position,
+							position + 1, 1,
+							__ATOMIC_RELAXED,
+							__ATOMIC_RELAXED)) {
+				*item = cell->item;
+				__atomic_store_n(&cell->sequence,
+						 position + queue->mask + 1,
+						 __ATOMIC_RELEASE);
+				return 1;
+			}
+		} else if (difference < 0) {
+			return 0;
+		} else {
+			position = __atomic_load_n(&queue->head,
+						   __ATOMIC_RELAXED);
+		}
+	}
+}
+
+#endif /* FS_QUEUE_H */
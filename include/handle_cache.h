@@ -0,0 +1,128 @@
+/*
+ * A bounded cache of opened source files, keyed by path,
+ * for workloads that keep reopening the same small files.
+ * Threads share each "struct file_structor" it returns,
+ * counting references to it, so that a file is opened once
+ * however many threads use it, and stays open after its last release
+ * until it is the least recently used file and the cache is full.
+ * Files up to a size limit are mapped whole and their descriptor closed,
+ * so that they hold no descriptor, and chunks of them need no system calls.
+ * A hit costs no system calls unless its file is due to be checked
+ * for changes with "statx", which happens at most once per interval.
+ */
+#ifndef HANDLE_CACHE_H
+#define HANDLE_CACHE_H
+
+#include <file_structor.h>
+
+#include <pthread.h>
+#include <stddef.h>
+
+/* a file in a handle cache */
+struct cached_file {
+	/*
+	 * the shared source wrapper, which is a memory source
+	 * over "mapping" if the file is mapped whole;
+	 * first, so that a pointer to it is a pointer to the entry
+	 */
+	struct file_structor file;
+	/* the path of the file, which is the key of the entry */
+	char *path;
+	/* the hash of the path */
+	uint64_t hash;
+	/* the number of holders of the file, protected by the cache lock */
+	unsigned refs;
+	/* nonzero if the entry was dropped from the cache while held */
+	int is_detached;
+	/* the whole mapping of a small file, or NULL */
+	void *mapping;
+	/* the identity, size and modification time of the opened file */
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	int64_t mtime_sec;
+	uint32_t mtime_nsec;
+	/* when the file was last checked for changes, in nanoseconds */
+	uint64_t checked_ns;
+	/* the neighbours in the LRU list, most recently used first */
+	struct cached_file *lru_prev;
+	struct cached_file *lru_next;
+	/* the next entry in the same hash bucket */
+	struct cached_file *bucket_next;
+};
+
+/* a cache of opened files */
+struct handle_cache {
+	/* the lock protecting every field but the settings */
+	pthread_mutex_t lock;
+	/*
+	 * the number of files to keep open;
+	 * more are kept only while all of them are held
+	 */
+	size_t max_files;
+	/* the largest size of the files mapped whole, or 0 for none */
+	size_t map_limit;
+	/*
+	 * the time after which a hit checks if its file changed,
+	 * in nanoseconds, or 0 to check on every hit
+	 */
+	uint64_t recheck_ns;
+	/* the hash table of entries, with a power of 2 of buckets */
+	struct cached_file **buckets;
+	size_t n_buckets;
+	/* the number of entries in the table */
+	size_t n_files;
+	/* the sentinel of the circular LRU list */
+	struct cached_file lru;
+	/* the number of hits, misses, reopened changed files and evictions */
+	uint64_t n_hits;
+	uint64_t n_misses;
+	uint64_t n_stale;
+	uint64_t n_evictions;
+};
+
+/*
+ * Initialize an empty handle cache.
+ * to_init:	the cache to initialize
+ * max_files:	the number of files to keep open, at least 1
+ * map_limit:	the largest size of the files to map whole, or 0 for none
+ * recheck_ms:	the time after which a hit checks if its file changed,
+ *		in milliseconds, or 0 to check on every hit
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_ERRNO if "malloc" failed
+ */
+enum fs_status
+init_handle_cache(struct handle_cache *to_init, size_t max_files,
+		  size_t map_limit, unsigned recheck_ms);
+/*
+ * Close every file in a handle cache and free it.
+ * Every acquired file must have been released.
+ * to_teardown:	the cache to tear down
+ */
+void teardown_handle_cache(struct handle_cache *to_teardown);
+
+/*
+ * Get the shared source wrapper of a file, opening it on a miss
+ * with "open_file_structor", and reopening it if it changed.
+ * The wrapper must not be closed, but released with "release_cached_file"
+ * once the chunks initialized from it are torn down.
+ * cache:	the cache
+ * path:	the path of the file
+ * file:	will be set to the shared wrapper
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_ERRNO if opening or mapping the file failed
+ */
+enum fs_status
+acquire_cached_file(struct handle_cache *cache, const char *path,
+		    struct file_structor **file);
+/*
+ * Release a file acquired from a handle cache.
+ * It stays open for later acquisitions,
+ * unless it changed or was evicted while it was held.
+ * cache:	the cache
+ * file:	the wrapper from "acquire_cached_file"
+ */
+void release_cached_file(struct handle_cache *cache,
+			 struct file_structor *file);
+
+#endif /* HANDLE_CACHE_H */
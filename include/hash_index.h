@@ -0,0 +1,147 @@
+/*
+ * Hash indexes from the integer key of each record in an unsorted array
+ * to the location of the record in the file,
+ * saved as a sidecar file next to the source file.
+ * The sidecar is an open-addressing hash table in the byte order
+ * of the machine that built it, so that opening it only maps it,
+ * and looking up a key touches one or two cache lines of it.
+ */
+#ifndef HASH_INDEX_H
+#define HASH_INDEX_H
+
+#include <file_structor.h>
+#include <fs_common.h>
+
+#include <stddef.h>
+
+/* the first bytes of a hash index sidecar */
+#define HASH_INDEX_MAGIC	"FSHASH02"
+/* the byte order mark, which reads differently on other machines */
+#define HASH_INDEX_BYTE_ORDER	0x01020304u
+
+/* the header at the start of a hash index sidecar */
+struct hash_index_header {
+	/* "HASH_INDEX_MAGIC", without its terminating null */
+	char magic[8];
+	/* "HASH_INDEX_BYTE_ORDER", in the byte order of the builder */
+	uint32_t byte_order;
+	/* the offset of the key field in each record */
+	uint32_t key_offset;
+	/* the width, "enum endianness" and signedness of the key field */
+	uint8_t key_width;
+	uint8_t key_endianness;
+	uint8_t key_is_signed;
+	uint8_t padding[5];
+	/* the size and modification time of the source when it was built */
+	struct source_identity source;
+	/* the location of the first record in the source file */
+	uint64_t records_start;
+	/* the distance between records */
+	uint64_t record_size;
+	/* the number of records indexed */
+	uint64_t n_records;
+	/* the number of slots, a power of 2, following the header */
+	uint64_t n_slots;
+	/* padding, so that the slots start on a cache line */
+	uint64_t reserved[6];
+};
+
+/* the location of a record in an empty slot */
+#define HASH_INDEX_EMPTY	UINT64_MAX
+
+/* a slot of the hash table */
+struct hash_index_slot {
+	/* the key of the record, as from "int_field_key" */
+	uint64_t key;
+	/*
+	 * the location of the record in the source file,
+	 * or "HASH_INDEX_EMPTY"
+	 */
+	uint64_t record_start;
+};
+
+/* an opened hash index */
+struct hash_index {
+	/* the sidecar file, and its mapping */
+	struct file_structor sidecar;
+	struct file_struct mapping;
+	/* the header and slots, inside "mapping" */
+	const struct hash_index_header *header;
+	const struct hash_index_slot *slots;
+	/* the key field of the records */
+	struct fs_int_field key;
+};
+
+/*
+ * Build a hash index over an array of records,
+ * and write it to a sidecar file, replacing any file already there.
+ * The index is built under a temporary name and renamed when complete,
+ * so that readers never open a partial index.
+ * Records with equal keys are each indexed.
+ * src_file:		the file containing the records
+ * start_in_file:	the location of the first record in the file
+ * record_size:		the distance between records
+ * n_records:		the number of records
+ * key:			the key field of each record, of 1 to 8 bytes
+ * n_threads:		the number of threads inserting records,
+ *			or 0 for one per online processor
+ * index_path:		the path of the sidecar file to write
+ * returns		FS_NO_ERROR on success;
+ *			FSERR_OUT_OF_STRUCT if the key is outside of the record;
+ *			FSERR_OUT_OF_FILE if the array
+ *				is beyond the range of the file;
+ *			FSERR_ERRNO if finding the modification time
+ *				of the source, or creating, sizing, mapping,
+ *				syncing or renaming the sidecar failed
+ */
+enum fs_status
+build_hash_index(struct file_structor *src_file, off_t start_in_file,
+		 size_t record_size, size_t n_records,
+		 const struct fs_int_field *key, unsigned n_threads,
+		 const char *index_path);
+
+/*
+ * Open and map a hash index sidecar, checking it against its source file.
+ * to_open:	the index to initialize
+ * index_path:	the path of the sidecar file
+ * src_file:	the source file that the index was built from
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_ERRNO if opening or mapping the sidecar failed;
+ *		FSERR_BAD_SIDECAR if the sidecar is not a valid index
+ *			from this machine, or the source file changed size
+ *			or modification time
+ */
+enum fs_status open_hash_index(struct hash_index *to_open,
+			       const char *index_path,
+			       struct file_structor *src_file);
+/*
+ * Unmap and close a hash index.
+ * to_close:	the index to close
+ * returns	the first error from "teardown_file_struct"
+ *		or "close_file_structor"
+ */
+enum fs_status close_hash_index(struct hash_index *to_close);
+
+/*
+ * Find a record whose key equals a value.
+ * index:		the index to search
+ * value:		the value to search for, as for "int_field_key"
+ * record_start:	will be set to the location of the record in the file
+ * returns		1 if a record was found; 0 otherwise
+ */
+int hash_index_find(const struct hash_index *index, uint64_t value,
+		    off_t *record_start);
+/*
+ * Find every record whose key equals a value, in no particular order.
+ * index:		the index to search
+ * value:		the value to search for, as for "int_field_key"
+ * record_starts:	will be filled with the locations of up to
+ *			"max_records" records in the file
+ * max_records:		the number of locations "record_starts" can hold
+ * returns		the number of matching records,
+ *			which may be more than "max_records"
+ */
+size_t hash_index_find_all(const struct hash_index *index, uint64_t value,
+			   off_t *record_starts, size_t max_records);
+
+#endif /* HASH_INDEX_H */
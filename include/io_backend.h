@@ -0,0 +1,128 @@
+/*
+ * Backends reading the chunks of a source wrapper,
+ * behind "init_file_struct", "extend_file_struct" and "teardown_file_struct",
+ * so that the same code runs however the bytes are read:
+ * "mmap" maps each chunk, which is the default,
+ * and the only backend of writable sources,
+ * "pread" copies each chunk into a buffer of its own,
+ * which is cheaper than mapping small chunks far apart,
+ * at the same distance from a 64-byte boundary as in the file,
+ * and "memory" points into bytes in memory,
+ * either those of a memory source, or a copy of the whole file.
+ * The automatic backend loads small files into memory,
+ * and for larger ones picks "mmap" or "pread" for each chunk,
+ * from its size, whether it follows the stride of the access pattern,
+ * and the measured costs of reading similar chunks with each.
+ * Until both have been timed a few times, it alternates between them,
+ * and afterwards it times the other one every so often,
+ * so that it follows changes in the costs, eg. as the file gets cached.
+ */
+#ifndef IO_BACKEND_H
+#define IO_BACKEND_H
+
+#include <file_structor.h>
+
+/* the largest file the automatic backend loads into memory */
+#define IO_AUTO_LOAD_MAX	(1 << 20)
+/* the largest chunk the automatic backend copies rather than maps */
+#define IO_AUTO_PREAD_MAX	(1 << 20)
+/* the number of times each backend is timed before comparing them */
+#define IO_AUTO_MIN_SAMPLES	4
+/* the number of chunks of a class after which the other backend is timed */
+#define IO_AUTO_SAMPLE_INTERVAL	64
+
+/* the backends of a source wrapper */
+enum io_backend_kind {
+	IO_BACKEND_MMAP,
+	IO_BACKEND_PREAD,
+	IO_BACKEND_MEMORY,
+	IO_BACKEND_AUTO,
+};
+
+/*
+ * the functions reading the chunks of a source wrapper,
+ * which may be set as its "backend" to read them another way
+ */
+struct io_backend {
+	/* the name of the backend, for messages */
+	const char *name;
+	/* the kind of the backend */
+	enum io_backend_kind kind;
+	/*
+	 * Read a chunk of the file, already checked to be inside it.
+	 * to_init:		the chunk, whose "data", "mapping_start"
+	 *			and "backend" to set
+	 * src_file:		the source wrapper
+	 * size:		the size of the chunk
+	 * start_in_file:	the location of the chunk in the file
+	 * returns		FS_NO_ERROR on success;
+	 *			an error as from "init_file_struct",
+	 *			with "data" and "mapping_start" set to NULL
+	 */
+	enum fs_status (*map)(struct file_struct *to_init,
+			      struct file_structor *src_file, off_t size,
+			      off_t start_in_file);
+	/*
+	 * Resize a chunk this backend read, already checked to fit the file.
+	 * to_extend:	the chunk
+	 * size:	the new size of the chunk
+	 * returns	FS_NO_ERROR on success;
+	 *		an error as from "extend_file_struct",
+	 *		leaving the chunk unchanged
+	 */
+	enum fs_status (*extend)(struct file_struct *to_extend, off_t size);
+	/*
+	 * Release the data of a chunk this backend read.
+	 * to_release:	the chunk
+	 * returns	FS_NO_ERROR on success; FSERR_ERRNO on error
+	 */
+	enum fs_status (*release)(struct file_struct *to_release);
+};
+
+/*
+ * Find the backend of a kind.
+ * kind:	the kind of backend
+ * returns	the backend, which is never freed
+ */
+const struct io_backend *get_io_backend(enum io_backend_kind kind);
+
+/*
+ * Change how the chunks of a source wrapper are read,
+ * which must not have any chunks initialized from it.
+ * This is called when a source wrapper is opened, with "IO_BACKEND_MMAP",
+ * or "IO_BACKEND_MEMORY" for a memory source.
+ * Choosing "IO_BACKEND_MEMORY" for a file reads it whole into memory,
+ * which is freed when the backend changes again,
+ * or when the wrapper is closed,
+ * as is choosing "IO_BACKEND_AUTO" for a file of up to "IO_AUTO_LOAD_MAX".
+ * Choosing "IO_BACKEND_AUTO" also forgets the measured costs.
+ * file:	the source wrapper
+ * kind:	the kind of backend
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_ERRNO with errno set to EBADF if the backend
+ *			needs a file, but it is a memory source,
+ *			or to EINVAL if it does not write back to the file,
+ *			but the wrapper is writable;
+ *		FSERR_ERRNO if reading the file into memory failed,
+ *			with errno set by the failing function:
+ *			"posix_memalign" or "pread",
+ *			leaving the backend unchanged;
+ *		FSERR_OUT_OF_FILE if the file shrank while it was read
+ */
+enum fs_status
+set_io_backend(struct file_structor *file, enum io_backend_kind kind);
+
+/*
+ * Tell if chunks of a source wrapper may be copied out of the file,
+ * by "pread" or by the automatic backend,
+ * rather than mapped from it or pointed into in memory,
+ * so that scans of long ranges should read them one piece at a time.
+ * file:	the source wrapper
+ * returns	nonzero if chunks may be copied; 0 otherwise
+ */
+inline static int copies_chunks(const struct file_structor *file)
+{
+	return file->memory == NULL && file->backend->kind != IO_BACKEND_MMAP;
+}
+
+#endif /* IO_BACKEND_H */
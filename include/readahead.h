@@ -0,0 +1,55 @@
+/*
+ * Adaptive readahead for code that maps chunks in a loop,
+ * with "init_file_struct" at regular strides,
+ * and never hints at what it reads next.
+ * Each source wrapper keeps the last location and stride it was mapped at.
+ * Once enough chunks in a row follow the same stride,
+ * which may be negative or smaller than the chunks,
+ * the chunks predicted to follow are read ahead with "posix_fadvise",
+ * as one range when the gaps between them are small,
+ * and one by one otherwise.
+ * The number of strides read ahead doubles with each chunk
+ * that follows the stride, up to a limit, and halves when one does not.
+ */
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include <file_structor.h>
+
+/* the number of chunks in a row that must follow a stride to read ahead */
+#define READAHEAD_MIN_HITS	2
+/* the number of strides read ahead once a stride is found */
+#define READAHEAD_MIN_DISTANCE	4
+/* the default most strides read ahead */
+#define READAHEAD_MAX_DISTANCE	512
+/* the most bytes of chunks read ahead of the last one */
+#define READAHEAD_MAX_BYTES	(8 << 20)
+/* the largest gap between chunks read ahead as a single range */
+#define READAHEAD_MAX_GAP	(16 << 10)
+
+/*
+ * Reset the access pattern of a source wrapper,
+ * and set how far ahead it may be read.
+ * This is called when a source wrapper is opened,
+ * with "READAHEAD_MAX_DISTANCE".
+ * file:		the source wrapper
+ * max_distance:	the most strides to read ahead,
+ *			or 0 to never read ahead
+ */
+void set_adaptive_readahead(struct file_structor *file, unsigned max_distance);
+
+/*
+ * Record that a chunk of a source file is mapped,
+ * and read ahead the chunks predicted to follow it.
+ * This is called by "init_file_struct".
+ * Threads mapping chunks from the same source wrapper at once
+ * skip the update while another thread holds the pattern,
+ * and their interleaved locations rarely follow any stride.
+ * Memory sources are never read ahead.
+ * file:	the source wrapper
+ * start:	the location of the chunk in the file
+ * size:	the size of the chunk
+ */
+void observe_access(struct file_structor *file, off_t start, off_t size);
+
+#endif /* READAHEAD_H */
@@ -0,0 +1,79 @@
+/*
+ * Tools for computing aggregates of one integer field
+ * across an array of records, directly on their raw data.
+ */
+#ifndef RECORD_AGGREGATE_H
+#define RECORD_AGGREGATE_H
+
+#include <file_structor.h>
+
+#include <stddef.h>
+
+/*
+ * the aggregates of a field.
+ * The values are stored as "uint64_t",
+ * but should be cast to "int64_t" if the field is signed.
+ */
+struct field_aggregate {
+	/* the number of records aggregated */
+	uint64_t count;
+	/* the sum of the values, wrapping around on overflow */
+	uint64_t sum;
+	/* the smallest value, if "count" is not 0 */
+	uint64_t min;
+	/* the largest value, if "count" is not 0 */
+	uint64_t max;
+};
+
+/*
+ * Set an aggregate to that of no records.
+ * to_init:	the aggregate to reset
+ */
+void init_field_aggregate(struct field_aggregate *to_init);
+/*
+ * Combine the aggregates of two sets of records of the same field.
+ * into:	the aggregate to add "from" to
+ * from:	the aggregate of the other records
+ * field:	the description of the field, for comparing values
+ */
+void merge_field_aggregates(struct field_aggregate *into,
+			    const struct field_aggregate *from,
+			    const struct fs_int_field *field);
+
+/*
+ * Aggregate a field of every record in an array,
+ * splitting the array across threads.
+ * 4 and 8-byte fields are loaded with AVX2 gathers and byte swaps
+ * when the machine supports them.
+ * records:	the chunk holding the array of records
+ * record_size:	the distance between records
+ * field:	the description of the field to aggregate
+ * n_threads:	the number of threads,
+ *		or 0 for one per online processor
+ * result:	will be set to the aggregate
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if the field is outside of the record
+ */
+enum fs_status
+aggregate_field(struct file_struct *records, size_t record_size,
+		const struct fs_int_field *field, unsigned n_threads,
+		struct field_aggregate *result);
+/*
+ * Aggregate a field of the selected records in an array,
+ * eg. the ones found by "filter_records".
+ * records:	the chunk holding the array of records
+ * record_size:	the distance between records
+ * field:	the description of the field to aggregate
+ * selection:	the indices of the records to aggregate
+ * n_selected:	the number of records to aggregate
+ * result:	will be set to the aggregate
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if the field is outside of the record,
+ *			or a selected record is outside of "records"
+ */
+enum fs_status
+aggregate_selected(struct file_struct *records, size_t record_size,
+		   const struct fs_int_field *field, const size_t *selection,
+		   size_t n_selected, struct field_aggregate *result);
+
+#endif /* RECORD_AGGREGATE_H */
@@ -0,0 +1,84 @@
+/*
+ * Tools for filtering an array of records directly on their raw data,
+ * so that only the records that match need to be copied into memory.
+ * The result is a selection vector of the indices of the matching records.
+ */
+#ifndef RECORD_FILTER_H
+#define RECORD_FILTER_H
+
+#include <file_structor.h>
+
+#include <stddef.h>
+
+/* the kinds of tests on an integer field */
+enum predicate_type {
+	/* The field must equal "low". */
+	PREDICATE_EQUAL,
+	/* The field must be between "low" and "high", inclusive. */
+	PREDICATE_RANGE,
+	/* The field must equal one of "values". */
+	PREDICATE_IN_SET
+};
+
+/*
+ * a test on an integer field of each record.
+ * The values are compared as "int64_t" if the field is signed,
+ * and as "uint64_t" otherwise.
+ */
+struct record_predicate {
+	/* the field to test */
+	struct fs_int_field field;
+	/* the kind of test */
+	enum predicate_type type;
+	/* the value to match, or the lowest value in the range */
+	uint64_t low;
+	/* the highest value in the range */
+	uint64_t high;
+	/* the set of values to match */
+	const uint64_t *values;
+	/* the number of values in the set */
+	size_t n_values;
+};
+
+/*
+ * Find the records in an array that match all the given predicates.
+ * The first predicate is tested on every record,
+ * with AVX2 gathers and byte swaps for 4 and 8-byte fields
+ * when the machine supports them,
+ * and the rest only on the records that still match.
+ * records:	the chunk holding the array of records
+ * record_size:	the distance between records
+ * predicates:	the tests that each selected record must pass
+ * n_predicates:the number of predicates
+ * selection:	will be filled with the indices of the matching records,
+ *		in increasing order, and must have room for every record
+ *		in "records"
+ * n_selected:	will be set to the number of matching records
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if a field is outside of the record;
+ *		FSERR_ERRNO if "malloc" failed for a set of values
+ */
+enum fs_status
+filter_records(struct file_struct *records, size_t record_size,
+	       const struct record_predicate *predicates, size_t n_predicates,
+	       size_t *selection, size_t *n_selected);
+/*
+ * Remove the records that do not match a predicate from a selection.
+ * records:	the chunk holding the array of records
+ * record_size:	the distance between records
+ * predicate:	the test that each remaining record must pass
+ * selection:	the indices of the selected records,
+ *		which will be updated in place
+ * n_selected:	the number of selected records,
+ *		which will be updated to the number remaining
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if the field is outside of the record,
+ *			or a selected record is outside of "records";
+ *		FSERR_ERRNO if "malloc" failed for a set of values
+ */
+enum fs_status
+refine_selection(struct file_struct *records, size_t record_size,
+		 const struct record_predicate *predicate, size_t *selection,
+		 size_t *n_selected);
+
+#endif /* RECORD_FILTER_H */
@@ -0,0 +1,117 @@
+/*
+ * Pipelined scans of an array of records,
+ * which overlap reading the file, decoding the records and consuming them.
+ * A reader thread maps the array, cuts it into batches,
+ * and prefetches the batches ahead of the decoders,
+ * or reads each batch by itself when the backend of the file
+ * copies chunks rather than mapping them;
+ * a pool of decoder threads converts each batch,
+ * eg. with a "struct copy_plan";
+ * and the calling thread consumes the decoded batches in file order.
+ * Batches are handed between the stages through lock-free queues,
+ * and only a fixed number of them are in flight,
+ * so that a slow consumer holds back the reader and decoders.
+ */
+#ifndef RECORD_PIPELINE_H
+#define RECORD_PIPELINE_H
+
+#include <file_structor.h>
+#include <copy_plan.h>
+
+#include <stddef.h>
+
+/* the default number of bytes of records in each batch */
+#define PIPELINE_BATCH_SIZE	(1 << 20)
+/* the default number of batches in flight */
+#define PIPELINE_DEPTH		16
+
+/*
+ * the work of a decoder thread on a batch of records
+ * arg:		the "decode_arg" of the pipeline, shared by every decoder
+ * records:	the raw records of the batch
+ * record_size:	the distance between raw records
+ * n_records:	the number of records in the batch
+ * decoded:	the buffer of the batch for the decoded records,
+ *		of "decoded_size" bytes for each record
+ * returns	FS_NO_ERROR on success, or an error stopping the pipeline
+ */
+typedef enum fs_status (*pipeline_decoder)(void *arg,
+					   struct file_struct *records,
+					   size_t record_size,
+					   size_t n_records, void *decoded);
+/*
+ * the work of the consuming thread on a decoded batch,
+ * which is called on the batches in the order of the file
+ * arg:		the "consume_arg" of the pipeline
+ * decoded:	the decoded records
+ * first:	the index of the first record of the batch in the array
+ * n_records:	the number of records in the batch
+ * returns	FS_NO_ERROR on success, or an error stopping the pipeline
+ */
+typedef enum fs_status (*pipeline_consumer)(void *arg, const void *decoded,
+					    size_t first, size_t n_records);
+
+/* the description of a pipelined scan */
+struct record_pipeline {
+	/* the location of the first record in the file */
+	off_t start_in_file;
+	/* the distance between records */
+	size_t record_size;
+	/* the number of records */
+	size_t n_records;
+	/*
+	 * the number of records in each batch,
+	 * or 0 for about "PIPELINE_BATCH_SIZE" bytes of them
+	 */
+	size_t batch_records;
+	/* the number of bytes of each decoded record */
+	size_t decoded_size;
+	/*
+	 * the number of batches in flight, at least 2,
+	 * or 0 for "PIPELINE_DEPTH"
+	 */
+	unsigned depth;
+	/*
+	 * the number of decoder threads,
+	 * or 0 for one per online processor beyond the reader and consumer
+	 */
+	unsigned n_decoders;
+	/* the decoding of each batch, and its argument */
+	pipeline_decoder decode;
+	void *decode_arg;
+	/* the consuming of each decoded batch, and its argument */
+	pipeline_consumer consume;
+	void *consume_arg;
+};
+
+/* the argument of "decode_with_plan" */
+struct plan_decoder {
+	/* the plan copying each record */
+	const struct copy_plan *plan;
+	/* the distance between decoded structs */
+	size_t dst_stride;
+};
+
+/*
+ * a "pipeline_decoder" applying a copy plan to each record of a batch,
+ * whose argument is a "struct plan_decoder"
+ */
+enum fs_status
+decode_with_plan(void *arg, struct file_struct *records, size_t record_size,
+		 size_t n_records, void *decoded);
+
+/*
+ * Run a pipelined scan over an array of records,
+ * returning once every batch has been consumed, or a stage failed.
+ * src_file:	the file containing the records
+ * pipeline:	the description of the scan
+ * returns	FS_NO_ERROR on success;
+ *		the error from mapping the records, or from the first stage
+ *			to fail, after which no more batches are consumed;
+ *		FSERR_ERRNO if the buffers or threads could not be created
+ */
+enum fs_status
+run_record_pipeline(struct file_structor *src_file,
+		    const struct record_pipeline *pipeline);
+
+#endif /* RECORD_PIPELINE_H */
@@ -0,0 +1,122 @@
+/*
+ * Incremental reloading of an array of decoded records
+ * from a file that is rewritten in place, or replaced, now and then.
+ * The records are cut into blocks, and a fingerprint of the raw bytes
+ * of each block is kept from the last load;
+ * a reload hashes the mapped blocks on several threads,
+ * and decodes again only the records of the blocks whose fingerprint changed,
+ * updating the decoded array in place.
+ * A file whose identity, size and modification time are unchanged
+ * is not read at all, so that most reloads cost a single "stat".
+ */
+#ifndef RECORD_RELOAD_H
+#define RECORD_RELOAD_H
+
+#include <file_structor.h>
+#include <record_pipeline.h>
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* the default number of bytes of records in each block */
+#define RELOAD_BLOCK_SIZE	(64 << 10)
+
+/* Hash every block, even if the file seems unchanged. */
+#define RELOAD_FORCE		1
+
+/*
+ * the state of an array of records decoded from a file,
+ * whose fields up to "n_threads" are set by the caller
+ * before "init_record_reload", and the rest by the reloads
+ */
+struct record_reload {
+	/* the location of the first record in the file */
+	off_t start_in_file;
+	/* the distance between records */
+	size_t record_size;
+	/*
+	 * the number of records in each block,
+	 * or 0 for about "RELOAD_BLOCK_SIZE" bytes of them
+	 */
+	size_t block_records;
+	/* the number of bytes of each decoded record */
+	size_t decoded_size;
+	/*
+	 * the decoding of the records of a block, and its argument,
+	 * eg. "decode_with_plan" and a "struct plan_decoder",
+	 * which may be called on several blocks at once
+	 */
+	pipeline_decoder decode;
+	void *decode_arg;
+	/* the number of threads, or 0 for one per online processor */
+	unsigned n_threads;
+
+	/* the path of the file */
+	char *path;
+	/*
+	 * the decoded records, of "decoded_size" bytes each,
+	 * which move when the file grows beyond "capacity" records
+	 */
+	void *decoded;
+	/* the number of complete records in the file at the last load */
+	size_t n_records;
+	/* the number of records "decoded" has room for */
+	size_t capacity;
+	/* the fingerprint of the raw bytes of each block at the last load */
+	uint64_t *fingerprints;
+	/*
+	 * whether each block was decoded by the last load,
+	 * for callers keeping more state derived from the records
+	 */
+	uint8_t *is_changed;
+	/* the number of blocks */
+	size_t n_blocks;
+	/* the number of blocks decoded by the last load */
+	size_t n_changed;
+	/* the identity, size and modification time at the last load */
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	/*
+	 * the time of the last load, from the coarse clock file times use:
+	 * a file modified at or after it may be changed again
+	 * without its modification time changing
+	 */
+	struct timespec loaded;
+};
+
+/*
+ * Load and decode every record of a file.
+ * to_init:	the reload whose fields up to "n_threads" are set
+ * path:	the path of the file, which is copied
+ * returns	FS_NO_ERROR on success;
+ *		the error from "reload_records"
+ */
+enum fs_status init_record_reload(struct record_reload *to_init,
+				  const char *path);
+/*
+ * Free the decoded records and fingerprints.
+ * to_teardown:	the reload to tear down
+ * returns	FS_NO_ERROR
+ */
+enum fs_status teardown_record_reload(struct record_reload *to_teardown);
+
+/*
+ * Decode again the records of the blocks that changed since the last load,
+ * along with any records the file gained;
+ * records the file lost are dropped from "n_records".
+ * Sets "n_changed" and "is_changed" to the blocks that were decoded.
+ * reload:	the reload to update
+ * flags:	"RELOAD_FORCE", or 0
+ * returns	FS_NO_ERROR on success, including when nothing changed;
+ *		FSERR_ERRNO if the file could not be found, opened or mapped,
+ *			or the decoded records could not be grown,
+ *			keeping the records from the last load;
+ *		the error from the decoder, after which the records
+ *			of the changed blocks are undefined,
+ *			until a later reload succeeds
+ */
+enum fs_status reload_records(struct record_reload *reload, int flags);
+
+#endif /* RECORD_RELOAD_H */
@@ -0,0 +1,108 @@
+/*
+ * Tools for searching an array of records in a file
+ * that is sorted by an integer key field,
+ * comparing keys directly on the mapped data.
+ * A sample of the keys is kept in memory in Eytzinger (breadth-first) order,
+ * so that the first levels of each search are cache-friendly
+ * and never fault in pages of the file.
+ */
+#ifndef RECORD_SEARCH_H
+#define RECORD_SEARCH_H
+
+#include <file_structor.h>
+
+#include <stddef.h>
+
+/* a sorted array of records, with a sample of its keys */
+struct sorted_records {
+	/* the mapped array of records */
+	struct file_struct records;
+	/* the distance between records */
+	size_t record_size;
+	/* the number of records */
+	size_t n_records;
+	/* the key field of each record, of 1 to 8 bytes */
+	struct fs_int_field key;
+	/* the number of records between samples */
+	size_t sample_step;
+	/* the number of samples */
+	size_t n_samples;
+	/*
+	 * the keys, as from "load_int_field_key",
+	 * of every "sample_step"th record, in Eytzinger order from index 1
+	 */
+	uint64_t *sample_keys;
+	/* the record index of each sample, in the same order */
+	size_t *sample_records;
+};
+
+/*
+ * Map a sorted array of records, and sample its keys.
+ * The records must be sorted by the key field,
+ * in increasing order of its values.
+ * to_init:		the sorted array to initialize
+ * src_file:		the file containing the records
+ * start_in_file:	the location of the first record in the file
+ * record_size:		the distance between records
+ * n_records:		the number of records
+ * key:			the key field of each record, of 1 to 8 bytes
+ * n_samples:		the number of keys to keep in memory,
+ *			or 0 for one for every 64 records
+ * returns		FS_NO_ERROR on success;
+ *			FSERR_OUT_OF_STRUCT if the key is outside of the record;
+ *			FSERR_ERRNO if "malloc" or "mmap" failed;
+ *			FSERR_OUT_OF_FILE if the array
+ *				is beyond the range of the file
+ */
+enum fs_status
+init_sorted_records(struct sorted_records *to_init,
+		    struct file_structor *src_file, off_t start_in_file,
+		    size_t record_size, size_t n_records,
+		    const struct fs_int_field *key, size_t n_samples);
+/*
+ * Unmap the records and free the samples.
+ * to_teardown:	the sorted array to tear down
+ * returns	the status from "teardown_file_struct"
+ */
+enum fs_status teardown_sorted_records(struct sorted_records *to_teardown);
+
+/*
+ * Find the first record whose key is not less than a value.
+ * The values are compared as "int64_t" if the key is signed,
+ * and as "uint64_t" otherwise.
+ * sorted:	the sorted array to search
+ * value:	the value to search for
+ * returns	the index of the record,
+ *		or the number of records if every key is less than "value"
+ */
+size_t sorted_lower_bound(const struct sorted_records *sorted, uint64_t value);
+/*
+ * Find the first record whose key is greater than a value.
+ * sorted:	the sorted array to search
+ * value:	the value to search for
+ * returns	the index of the record,
+ *		or the number of records if no key is greater than "value"
+ */
+size_t sorted_upper_bound(const struct sorted_records *sorted, uint64_t value);
+/*
+ * Find the records whose keys are in a range.
+ * sorted:	the sorted array to search
+ * low:		the lowest value in the range
+ * high:	the highest value in the range, inclusive
+ * first:	will be set to the index of the first record in the range
+ * end:		will be set to the index after the last record in the range,
+ *		which is "first" if there are none
+ */
+void sorted_range(const struct sorted_records *sorted, uint64_t low,
+		  uint64_t high, size_t *first, size_t *end);
+/*
+ * Find a record whose key equals a value.
+ * sorted:	the sorted array to search
+ * value:	the value to search for
+ * index:	will be set to the index of the first matching record
+ * returns	1 if a record was found; 0 otherwise
+ */
+int sorted_find(const struct sorted_records *sorted, uint64_t value,
+		size_t *index);
+
+#endif /* RECORD_SEARCH_H */
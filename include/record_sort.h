@@ -0,0 +1,59 @@
+/*
+ * External sorting of an array of records by an integer key field,
+ * for files much larger than memory.
+ * Runs of records that fit in a memory budget are sorted on several threads
+ * with a radix sort of their keys, loaded straight from the raw bytes,
+ * and written to a temporary file;
+ * the runs are then merged into the output file,
+ * reading each with a bounded-memory "struct stream_scan",
+ * and writing the output in large sequential writes.
+ */
+#ifndef RECORD_SORT_H
+#define RECORD_SORT_H
+
+#include <file_structor.h>
+
+#include <stddef.h>
+
+/* the suffix added to the output path to name the file of sorted runs */
+#define SORT_RUNS_SUFFIX	".runs"
+/* the smallest memory budget of a sort */
+#define SORT_MIN_BUDGET		(16 << 20)
+
+/*
+ * Sort an array of records by an integer key field into a new file,
+ * keeping records with equal keys in their original order.
+ * The output holds only the sorted records, one after another,
+ * and is written under a temporary name and renamed when complete,
+ * so that a failed sort leaves any file already there.
+ * If the array does not fit in one run,
+ * the runs are kept next to the output while they are merged,
+ * with "SORT_RUNS_SUFFIX" added to its path.
+ * src_file:		the file containing the records
+ * start_in_file:	the location of the first record in the file
+ * record_size:		the distance between records
+ * n_records:		the number of records
+ * key:			the key field of each record, of 1 to 8 bytes
+ * budget:		the most bytes of memory to use,
+ *			which is raised to "SORT_MIN_BUDGET";
+ *			the merge may go over it if there are so many runs
+ *			that each cannot get "STREAM_MIN_BUDGET" of it
+ * n_threads:		the number of threads sorting runs,
+ *			or 0 for one per online processor
+ * output_path:		the path of the sorted file to create,
+ *			replacing any file there
+ * returns		FS_NO_ERROR on success;
+ *			FSERR_OUT_OF_STRUCT if the key is outside of the record;
+ *			FSERR_OUT_OF_FILE if the array
+ *				is beyond the range of the file;
+ *			FSERR_ERRNO if reading, writing, syncing, renaming
+ *				or allocating failed,
+ *				with errno set by the failing function
+ */
+enum fs_status
+sort_record_file(struct file_structor *src_file, off_t start_in_file,
+		 size_t record_size, size_t n_records,
+		 const struct fs_int_field *key, size_t budget,
+		 unsigned n_threads, const char *output_path);
+
+#endif /* RECORD_SORT_H */
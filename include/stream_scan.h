@@ -0,0 +1,101 @@
+/*
+ * Sequential scans over an array of records in a file
+ * that keep the resident memory within a budget,
+ * however large the file is.
+ * The records are returned in batches from one mapping;
+ * the pages of each batch are released once the next one is requested,
+ * and the pages of the next batches are requested from the kernel ahead.
+ * When the backend of the file copies chunks rather than mapping them,
+ * each batch is read by itself as it is requested instead,
+ * and freed once the next one is.
+ */
+#ifndef STREAM_SCAN_H
+#define STREAM_SCAN_H
+
+#include <file_structor.h>
+
+#include <stddef.h>
+
+/*
+ * Also drop the released pages from the page cache of the file,
+ * so that they do not count against the memory limit of a container.
+ * Leave this out if other readers of the file would want them.
+ */
+#define STREAM_DROP_CACHE	1
+
+/* the smallest memory budget of a scan */
+#define STREAM_MIN_BUDGET	(1 << 20)
+
+/* the state of a bounded-memory scan */
+struct stream_scan {
+	/*
+	 * the mapping of every record,
+	 * or the chunk of the last batch if "reads_batches" is set
+	 */
+	struct file_struct records;
+	/* the file, and the location of the first record in it */
+	struct file_structor *src_file;
+	off_t start_in_file;
+	/* nonzero if each batch is read by itself, from "copies_chunks" */
+	int reads_batches;
+	/* the error that ended the scan early, or FS_NO_ERROR */
+	enum fs_status status;
+	/* the size of each record */
+	size_t record_size;
+	/* the number of records */
+	size_t n_records;
+	/* the number of records returned so far */
+	size_t n_returned;
+	/* the most records to return in each batch */
+	size_t batch_records;
+	/* the number of bytes of the mapping ahead of a batch to prefetch */
+	size_t prefetch_size;
+	/* the bytes of the records released so far */
+	size_t released;
+	/* the bytes of the records prefetched so far */
+	size_t prefetched;
+	/* "STREAM_DROP_CACHE", or 0 */
+	int flags;
+};
+
+/*
+ * Map an array of records to scan within a memory budget.
+ * A quarter of the budget is read in each batch,
+ * and up to half of it is prefetched ahead of the batch.
+ * to_init:		the scan to initialize
+ * src_file:		the file containing the records
+ * start_in_file:	the location of the first record in the file
+ * record_size:		the size of each record
+ * n_records:		the number of records
+ * budget:		the most bytes of the file to keep resident,
+ *			which is raised to "STREAM_MIN_BUDGET",
+ *			and to four records
+ * flags:		"STREAM_DROP_CACHE", or 0
+ * returns		FS_NO_ERROR on success;
+ *			FSERR_ERRNO if mapping the records failed;
+ *			FSERR_OUT_OF_FILE if the array
+ *				is beyond the range of the file
+ */
+enum fs_status
+init_stream_scan(struct stream_scan *to_init, struct file_structor *src_file,
+		 off_t start_in_file, size_t record_size, size_t n_records,
+		 size_t budget, int flags);
+/*
+ * Unmap the records.
+ * to_teardown:	the scan to tear down
+ * returns	the status from "teardown_file_struct"
+ */
+enum fs_status teardown_stream_scan(struct stream_scan *to_teardown);
+
+/*
+ * Get the next batch of records,
+ * releasing the pages of the batch returned before.
+ * scan:	the scan
+ * batch:	will be derived from the mapping to hold the records
+ * returns	the number of records in the batch,
+ *		or 0 at the end, or if reading the batch failed,
+ *		in which case its error is kept in "status"
+ */
+size_t stream_scan_next(struct stream_scan *scan, struct file_struct *batch);
+
+#endif /* STREAM_SCAN_H */
@@ -0,0 +1,127 @@
+/*
+ * One-time transcoding of a file of foreign-endian records
+ * into a sidecar file in the byte order of this machine,
+ * next to the source file with "NATIVE_SIDECAR_SUFFIX" added to its path.
+ * "open_native_file_structor" opens the sidecar instead of the source file
+ * while it matches the size and modification time of the source,
+ * and was transcoded with the layout the caller reads it with,
+ * so that later scans copy or point at the fields directly,
+ * instead of reversing their bytes on every pass.
+ * The sidecar holds the source file with the fields of the layout
+ * in machine order and every other byte unchanged,
+ * so that every offset is the same as in the source,
+ * followed by a "struct native_sidecar_trailer".
+ */
+#ifndef TRANSCODE_H
+#define TRANSCODE_H
+
+#include <file_structor.h>
+#include <copy_plan.h>
+#include <fs_common.h>
+
+#include <stddef.h>
+
+/* the suffix added to the path of a source file to find its sidecar */
+#define NATIVE_SIDECAR_SUFFIX		".native"
+/* the first bytes of the trailer of a native-endian sidecar */
+#define NATIVE_SIDECAR_MAGIC		"FSNATIV1"
+/* the byte order mark, which reads differently on other machines */
+#define NATIVE_SIDECAR_BYTE_ORDER	0x01020304u
+
+/* the trailer after the transcoded bytes of a native-endian sidecar */
+struct native_sidecar_trailer {
+	/* "NATIVE_SIDECAR_MAGIC", without its terminating null */
+	char magic[8];
+	/* "NATIVE_SIDECAR_BYTE_ORDER", in the byte order of the builder */
+	uint32_t byte_order;
+	uint32_t padding;
+	/* the size and modification time of the source when transcoded */
+	struct source_identity source;
+	/* the hash of the layout the sidecar was transcoded with */
+	uint64_t layout_hash;
+	uint64_t reserved[2];
+};
+
+/* the layout of the records to transcode */
+struct transcode_layout {
+	/*
+	 * the location of the first record in the file;
+	 * the bytes before it are copied unchanged
+	 */
+	off_t records_start;
+	/*
+	 * the distance between records;
+	 * the bytes after the last whole record are copied unchanged
+	 */
+	size_t record_size;
+	/*
+	 * the fields to put in machine order in each record,
+	 * as from "MEMBER_LAYOUT" or "ARRAY_MEMBER_LAYOUT",
+	 * of which only the source offset, size, width and byte order
+	 * are used, since the fields keep their places
+	 */
+	const struct member_layout *members;
+	/* the number of fields */
+	size_t n_members;
+};
+
+/*
+ * Transcode a file into its native-endian sidecar,
+ * unless it already has one that is valid and from the same layout.
+ * Batches of records are converted on several threads,
+ * and each is written with one large write at its offset in the sidecar,
+ * which is built under a temporary name and renamed when complete,
+ * so that a partial sidecar is never opened.
+ * path:	the path of the source file
+ * layout:	the layout of the records
+ * n_threads:	the number of threads, or 0 for one per online processor
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if a field is outside of the record;
+ *		FSERR_ERRNO if reading the source or writing the sidecar
+ *			failed, with errno set by the failing function
+ */
+enum fs_status
+transcode_file(const char *path, const struct transcode_layout *layout,
+	       unsigned n_threads);
+/*
+ * Open the native-endian sidecar of a file as its source wrapper,
+ * with "is_native" set, if the sidecar is valid
+ * and was transcoded with the same layout,
+ * or else the file itself, like "open_file_structor".
+ * The size of the wrapper leaves out the trailer of the sidecar,
+ * also when "refresh_file_structor" updates it.
+ * Only callers that find the byte order of each field
+ * with "native_member_endianness" may open sidecars,
+ * since the copying functions never check "is_native".
+ * to_open:	the source wrapper to initialize
+ * path:	the path of the source file, not of the sidecar
+ * layout:	the layout the caller reads the records with
+ * returns	the same as "open_file_structor"
+ */
+enum fs_status
+open_native_file_structor(struct file_structor *to_open, const char *path,
+			  const struct transcode_layout *layout);
+/*
+ * Find the byte order in which to copy a field
+ * from a source wrapper opened by "open_native_file_structor",
+ * which is that of the machine if the sidecar was opened.
+ * file:	the source wrapper
+ * member:	the field, which must be one of the members
+ *		of the layout the wrapper was opened with
+ * returns	the byte order to pass to the copying functions
+ */
+inline static enum endianness
+native_member_endianness(const struct file_structor *file,
+			 const struct member_layout *member)
+{
+	return file->is_native ? machine_endianness() : member->endianness;
+}
+/*
+ * Delete the native-endian sidecar of a file, if it has one.
+ * path:	the path of the source file, not of the sidecar
+ * returns	FS_NO_ERROR on success or if there was no sidecar;
+ *		FSERR_ERRNO if "unlink" failed
+ */
+enum fs_status remove_native_sidecar(const char *path);
+
+#endif /* TRANSCODE_H */
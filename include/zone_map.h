@@ -0,0 +1,175 @@
+/*
+ * Zone maps of files of records, for range filters that match few blocks,
+ * eg. a time range of a time series, and would otherwise read every page.
+ * A zone map keeps the smallest and largest value of some fields
+ * for each block of a fixed number of records,
+ * in a sidecar file next to the source file,
+ * named by adding "ZONE_MAP_SUFFIX" to its path.
+ * A scan consults the bounds of each block before mapping any of it,
+ * and only maps the runs of blocks that may hold matching records,
+ * so that its reads are proportional to the matching data,
+ * rather than to the size of the file.
+ */
+#ifndef ZONE_MAP_H
+#define ZONE_MAP_H
+
+#include <column_store.h>
+#include <fs_common.h>
+
+#include <stddef.h>
+
+/* the suffix added to the path of a source file to find its zone map */
+#define ZONE_MAP_SUFFIX		".zmap"
+/* the first bytes of a zone map */
+#define ZONE_MAP_MAGIC		"FSZMAP01"
+/* the byte order mark, which reads differently on other machines */
+#define ZONE_MAP_BYTE_ORDER	0x01020304u
+/* the location of the bounds in a zone map */
+#define ZONE_MAP_DATA_START	128
+/* the most bytes of records a scan maps at once */
+#define ZONE_SCAN_MAX_RUN	(8 << 20)
+
+/* the header at the start of a zone map */
+struct zone_map_header {
+	/* "ZONE_MAP_MAGIC", without its terminating null */
+	char magic[8];
+	/* "ZONE_MAP_BYTE_ORDER", in the byte order of the builder */
+	uint32_t byte_order;
+	/* the number of fields with bounds */
+	uint32_t n_fields;
+	/* the number of records, and the number in each block */
+	uint64_t n_records;
+	uint64_t block_records;
+	/* the size and modification time of the source when it was built */
+	struct source_identity source;
+	/* the hash of the record layout it was built from */
+	uint64_t layout_hash;
+	uint64_t reserved[8];
+};
+
+/* an opened zone map */
+struct zone_map {
+	/* the zone map file */
+	struct file_structor file;
+	/* the mapping of the whole zone map */
+	struct file_struct mapping;
+	/* the layout of the records it was built from */
+	const struct column_layout *layout;
+	/*
+	 * the bounds of each field in each block,
+	 * with those of the fields of a block next to each other
+	 */
+	const struct column_bounds *bounds;
+	/* the number of records, of records in each block, and of blocks */
+	size_t n_records;
+	size_t block_records;
+	size_t n_blocks;
+};
+
+/* a range of values a field of the matching records is in */
+struct zone_range {
+	/* the index of the field in the layout */
+	size_t field_i;
+	/* the smallest and largest values, inclusive, of the field's type */
+	union column_value min;
+	union column_value max;
+};
+
+/*
+ * the function called on each run of blocks a scan maps,
+ * which checks the records themselves, since a block that may match
+ * can still hold records that do not
+ * records:	the mapped records of the run
+ * first:	the index of the first record of the run in the file
+ * n_records:	the number of records in the run
+ * arg:		the argument given to "scan_zones"
+ * returns	FS_NO_ERROR to continue the scan, or an error to stop it
+ */
+typedef enum fs_status
+(*zone_visit_fn)(struct file_struct *records, size_t first, size_t n_records,
+		 void *arg);
+
+/*
+ * Build the zone map of a file of records,
+ * unless it already has a valid one from the same layout.
+ * The records are read once, in batches on several threads,
+ * and the zone map is written under a temporary name,
+ * and renamed when complete.
+ * path:	the path of the source file
+ * layout:	the layout of the records, whose fields must be scalars
+ *		from "INT_MEMBER_LAYOUT" or "FLOAT_MEMBER_LAYOUT",
+ *		and whose "block_values" is the number of records
+ *		in each block, which must not be 0
+ * n_threads:	the number of threads, or 0 for one per online processor
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if a field is outside of the record,
+ *			or has no order;
+ *		FSERR_ERRNO if reading the source or writing the zone map
+ *			failed, with errno set by the failing function
+ */
+enum fs_status
+build_zone_map(const char *path, const struct column_layout *layout,
+	       unsigned n_threads);
+/*
+ * Open and map the zone map of a file, checking it against the source file
+ * and the layout it should have been built from.
+ * to_open:	the zone map to open
+ * path:	the path of the source file, not of the zone map
+ * layout:	the layout of the records, which must outlive the zone map
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_BAD_SIDECAR if the zone map is missing, or not valid,
+ *			eg. because the source changed since it was built;
+ *		the error from mapping the zone map
+ */
+enum fs_status
+open_zone_map(struct zone_map *to_open, const char *path,
+	      const struct column_layout *layout);
+/*
+ * Unmap and close a zone map.
+ * to_close:	the zone map to close
+ * returns	the status from "close_file_structor"
+ */
+enum fs_status close_zone_map(struct zone_map *to_close);
+/*
+ * Delete the zone map of a file, if it has one.
+ * path:	the path of the source file
+ * returns	FS_NO_ERROR on success or if there was no zone map;
+ *		FSERR_ERRNO if "unlink" failed
+ */
+enum fs_status remove_zone_map(const char *path);
+
+/*
+ * Check if a block may hold records with every field in its range.
+ * map:		the zone map
+ * block_i:	the index of the block
+ * ranges:	the ranges of the fields
+ * n_ranges:	the number of ranges
+ * returns	1 if the block may match; 0 if it cannot;
+ *		-1 if a range is of a field outside of the layout
+ */
+int
+zone_may_match(const struct zone_map *map, size_t block_i,
+	       const struct zone_range *ranges, size_t n_ranges);
+/*
+ * Scan the records of a file that may have every field in its range,
+ * mapping only the runs of blocks that may match, in order,
+ * each up to "ZONE_SCAN_MAX_RUN" bytes, and visiting each run.
+ * src_file:	the source wrapper of the file the zone map is of
+ * map:		the zone map
+ * ranges:	the ranges of the fields
+ * n_ranges:	the number of ranges
+ * visit:	the function to call on each run
+ * arg:		the argument to pass to "visit"
+ * n_visited:	if not NULL, will be set to the number of blocks visited
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if a range is of a field
+ *			outside of the layout;
+ *		the error from mapping a run;
+ *		the error from "visit", which stops the scan
+ */
+enum fs_status
+scan_zones(struct file_structor *src_file, const struct zone_map *map,
+	   const struct zone_range *ranges, size_t n_ranges,
+	   zone_visit_fn visit, void *arg, size_t *n_visited);
+
+#endif /* ZONE_MAP_H */
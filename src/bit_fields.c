@@ -0,0 +1,372 @@
+#include <bit_fields.h>
+#include <logger.h>
+
+#include "fs_simd.h"
+
+/* the high bit of every byte of a word, which continues a varint */
+#define VARINT_CONTINUE_BITS	0x8080808080808080ull
+
+/*
+ * the number of leading whole records whose 8-byte window starting
+ * at the first byte of a field can be loaded
+ * without reading past the end of the chunk
+ * records:	the chunk holding the array of records
+ * record_size:	the distance between records
+ * offset:	the location of the window in each record
+ */
+static size_t
+window_records(const struct file_struct *records, size_t record_size,
+	       size_t offset)
+{
+	size_t n_records = records->size / record_size, n_windows;
+
+	if (offset + sizeof(uint64_t) > records->size) {
+		return 0;
+	}
+	n_windows = (records->size - offset - sizeof(uint64_t)) /
+		    record_size + 1;
+
+	return n_windows < n_records ? n_windows : n_records;
+}
+
+#ifdef FS_HAVE_AVX2
+/*
+ * Extract a bit field of consecutive records
+ * to 4 or 8-byte integers with AVX2.
+ * dst:		the destination array
+ * dst_width:	the number of bytes of each destination integer, 4 or 8
+ * data:	the start of the first record
+ * record_size:	the distance between records
+ * field:	the description of the field
+ * shift:	the location of the field in its 8-byte window
+ * swap:	nonzero if the window is not in machine order
+ * n_records:	the number of records, which must be a multiple of 4
+ */
+FS_AVX2_TARGET static void
+extract_avx2(uint8_t *dst, size_t dst_width, const uint8_t *data,
+	     size_t record_size, const struct fs_bit_field *field,
+	     unsigned shift, int swap, size_t n_records)
+{
+	const __m128i offsets = gather_offsets64(record_size,
+						 field->bit_offset / 8);
+	const __m128i shift_count = _mm_cvtsi32_si128(shift);
+	const __m256i mask = _mm256_set1_epi64x(
+		(long long) ((1ull << field->n_bits) - 1));
+	const __m256i sign = _mm256_set1_epi64x(
+		(long long) (1ull << (field->n_bits - 1)));
+	const __m256i low_halves = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+	size_t record_i;
+
+	for (record_i = 0; record_i < n_records; record_i += 4) {
+		__m256i lanes = gather_fields64(data + record_i * record_size,
+						offsets, swap);
+
+		lanes = _mm256_and_si256(_mm256_srl_epi64(lanes, shift_count),
+					 mask);
+		if (field->is_signed) {
+			lanes = _mm256_sub_epi64(_mm256_xor_si256(lanes, sign),
+						 sign);
+		}
+
+		if (dst_width == sizeof(uint64_t)) {
+			_mm256_storeu_si256((__m256i *) dst, lanes);
+		} else {
+			lanes = _mm256_permutevar8x32_epi32(lanes, low_halves);
+			_mm_storeu_si128((__m128i *) dst,
+					 _mm256_castsi256_si128(lanes));
+		}
+		dst += 4 * dst_width;
+	}
+}
+#endif
+
+enum fs_status
+extract_bit_field(struct file_struct *records, size_t record_size,
+		  const struct fs_bit_field *field, void *dst,
+		  size_t dst_width)
+{
+	const enum endianness window_order = field->order == LSB_FIRST ?
+					     LITTLE_END : BIG_END;
+	const int swap = window_order != machine_endianness();
+	const size_t first_byte = field->bit_offset / 8;
+	const uint64_t mask = (1ull << field->n_bits) - 1;
+	const uint64_t sign = 1ull << (field->n_bits - 1);
+	const uint8_t *data = records->data;
+	uint8_t *dst_bytes = dst;
+	size_t n_records, n_windows, record_i = 0;
+	unsigned shift = field->bit_offset % 8;
+
+	debug_assert(record_size > 0);
+	debug_assert(field->n_bits >= 1 &&
+		     field->n_bits <= BIT_FIELD_MAX_BITS);
+	debug_assert(dst_width >= 1 && dst_width <= 8);
+	if (bit_field_end(field) > record_size) {
+		printlg(ERROR_LEVEL,
+			"Bit field at bits %u-%u is outside of "
+			"records of size %u.\n",
+			(unsigned) field->bit_offset,
+			(unsigned) (field->bit_offset + field->n_bits),
+			(unsigned) record_size);
+		return FSERR_OUT_OF_STRUCT;
+	}
+	if (field->order == MSB_FIRST) {
+		shift = 64 - shift - field->n_bits;
+	}
+	n_records = records->size / record_size;
+	n_windows = window_records(records, record_size, first_byte);
+
+#ifdef FS_HAVE_AVX2
+	if ((dst_width == sizeof(uint32_t) || dst_width == sizeof(uint64_t)) &&
+	    fits_gather(record_size, first_byte, 4) && fs_has_avx2()) {
+		record_i = n_windows - n_windows % 4;
+		extract_avx2(dst_bytes, dst_width, data, record_size, field,
+			     shift, swap, record_i);
+	}
+#endif
+
+	for (; record_i < n_windows; record_i++) {
+		uint64_t bits;
+
+		memcpy(&bits, data + record_i * record_size + first_byte,
+		       sizeof(bits));
+		if (swap) {
+			bits = __builtin_bswap64(bits);
+		}
+		bits = bits >> shift & mask;
+		if (field->is_signed) {
+			bits = (bits ^ sign) - sign;
+		}
+		store_uint(dst_bytes + record_i * dst_width, bits, dst_width);
+	}
+	/* The last fields are too close to the end for a whole window. */
+	for (; record_i < n_records; record_i++) {
+		store_uint(dst_bytes + record_i * dst_width,
+			   load_bit_field(data + record_i * record_size,
+					  field),
+			   dst_width);
+	}
+
+	return FS_NO_ERROR;
+}
+
+#ifdef FS_HAVE_BMI2
+/*
+ * Reverse the order of the lanes of a word.
+ * lanes:	the word
+ * lane_width:	the number of bytes of each lane, 1, 2 or 4
+ * returns	the word with its first lane last
+ */
+inline static uint64_t reverse_lanes(uint64_t lanes, size_t lane_width)
+{
+	const uint64_t even_halves = 0x0000ffff0000ffffull;
+
+	if (lane_width == sizeof(uint8_t)) {
+		return __builtin_bswap64(lanes);
+	}
+	lanes = lanes >> 32 | lanes << 32;
+	if (lane_width == sizeof(uint16_t)) {
+		lanes = (lanes >> 16 & even_halves) |
+			(lanes & even_halves) << 16;
+	}
+
+	return lanes;
+}
+
+/*
+ * Unpack packed integers with BMI2,
+ * as many at a time as fill 8 bytes of the destination,
+ * spreading the bits of each group into its lanes with "pdep".
+ * The integers must fit in the destination,
+ * and each group in 8 bytes at any bit offset.
+ * dst:		the destination array, in little-endian machine order
+ * dst_width:	the number of bytes of each destination integer, 1, 2 or 4
+ * data:	the start of the packed array
+ * size:	the number of bytes that can be read from "data"
+ * n_bits:	the number of bits of each integer
+ * order:	the order of the bits of the array
+ * n_values:	the number of integers in the array
+ * returns	the number of integers unpacked
+ */
+FS_BMI2_TARGET static size_t
+unpack_bmi2(uint8_t *dst, size_t dst_width, const uint8_t *data,
+	    size_t size, unsigned n_bits, enum bit_order order,
+	    size_t n_values)
+{
+	const size_t n_lanes = sizeof(uint64_t) / dst_width;
+	const unsigned group_bits = n_lanes * n_bits;
+	const uint64_t value_mask = (1ull << n_bits) - 1;
+	uint64_t lane_masks = 0, lanes;
+	size_t lane_i, value_i;
+
+	for (lane_i = 0; lane_i < n_lanes; lane_i++) {
+		lane_masks |= value_mask << (8 * dst_width * lane_i);
+	}
+
+	for (value_i = 0; value_i + n_lanes <= n_values; value_i += n_lanes) {
+		const size_t bit_i = value_i * n_bits;
+
+		if (bit_i / 8 + sizeof(uint64_t) > size) {
+			break;
+		}
+		if (order == LSB_FIRST) {
+			/* "pdep" only takes as many bits as it deposits. */
+			lanes = _pdep_u64(load_uint(data + bit_i / 8,
+						    sizeof(uint64_t),
+						    LITTLE_END) >> bit_i % 8,
+					  lane_masks);
+		} else {
+			/* The first integer is the most significant. */
+			lanes = load_uint(data + bit_i / 8, sizeof(uint64_t),
+					  BIG_END) >>
+				(64 - bit_i % 8 - group_bits);
+			lanes = reverse_lanes(_pdep_u64(lanes, lane_masks),
+					      dst_width);
+		}
+		memcpy(dst + value_i * dst_width, &lanes, n_lanes * dst_width);
+	}
+
+	return value_i;
+}
+#endif
+
+enum fs_status
+unpack_bits(struct file_struct *src, off_t src_offset, unsigned n_bits,
+	    enum bit_order order, size_t n_values, void *dst,
+	    size_t dst_width)
+{
+	const size_t packed_size = (n_values * n_bits + 7) / 8;
+	const uint8_t *data = (const uint8_t *) src->data + src_offset;
+	struct fs_bit_field field = { 0, n_bits, order, 0 };
+	uint8_t *dst_bytes = dst;
+	size_t value_i = 0;
+
+	debug_assert(n_bits >= 1 && n_bits <= BIT_FIELD_MAX_BITS);
+	debug_assert(dst_width >= 1 && dst_width <= 8);
+	if (src_offset + packed_size > src->size) {
+		printlg(ERROR_LEVEL,
+			"Requesting %u packed integers in %u-%u, "
+			"but struct chunk only has data up to %u.\n",
+			(unsigned) n_values, (unsigned) src_offset,
+			(unsigned) (src_offset + packed_size),
+			(unsigned) src->size);
+		return FSERR_OUT_OF_STRUCT;
+	}
+
+#ifdef FS_HAVE_BMI2
+	/* Only lanes of powers of 2 fill a word, and can be reversed. */
+	if ((dst_width == 1 || dst_width == 2 || dst_width == 4) &&
+	    n_bits <= 8 * dst_width &&
+	    n_bits * (sizeof(uint64_t) / dst_width) <= BIT_FIELD_MAX_BITS &&
+	    fs_has_bmi2()) {
+		value_i = unpack_bmi2(dst_bytes, dst_width, data,
+				      src->size - src_offset, n_bits, order,
+				      n_values);
+	}
+#endif
+
+	for (; value_i < n_values; value_i++) {
+		field.bit_offset = value_i * n_bits;
+		store_uint(dst_bytes + value_i * dst_width,
+			   load_bit_field(data, &field), dst_width);
+	}
+
+	return FS_NO_ERROR;
+}
+
+#ifdef FS_HAVE_BMI2
+/*
+ * Decode varints with BMI2 while 8 bytes can be loaded,
+ * finding the end of each from the high bits of one load,
+ * and gathering its 7-bit groups with "pext".
+ * data:	the start of the chunk
+ * size:	the size of the chunk
+ * position:	the location of the first varint,
+ *		which will be set to the location after the last decoded
+ * dst:		will be filled with the decoded integers
+ * n_values:	the most varints to decode
+ * returns	the number of varints decoded
+ */
+FS_BMI2_TARGET static size_t
+decode_bmi2(const uint8_t *data, size_t size, size_t *position,
+	    uint64_t *dst, size_t n_values)
+{
+	size_t byte_i = *position, value_i = 0, n_bytes, lane_i;
+	uint64_t word, ends;
+
+	while (value_i < n_values && byte_i + sizeof(word) <= size) {
+		word = load_uint(data + byte_i, sizeof(word), LITTLE_END);
+		ends = ~word & VARINT_CONTINUE_BITS;
+
+		if (ends == VARINT_CONTINUE_BITS &&
+		    value_i + sizeof(word) <= n_values) {
+			/* Every byte is a varint of its own. */
+			for (lane_i = 0; lane_i < sizeof(word); lane_i++) {
+				dst[value_i + lane_i] =
+					(uint8_t) (word >> (8 * lane_i));
+			}
+			value_i += sizeof(word);
+			byte_i += sizeof(word);
+			continue;
+		}
+
+		if (ends != 0) {
+			n_bytes = __builtin_ctzll(ends) / 8 + 1;
+			dst[value_i] = _pext_u64(word, ~VARINT_CONTINUE_BITS >>
+						 (64 - 8 * n_bytes));
+		} else if (!(n_bytes = load_varint(data + byte_i,
+						   size - byte_i,
+						   &dst[value_i]))) {
+			/* Let the caller report the broken varint. */
+			break;
+		}
+		byte_i += n_bytes;
+		value_i++;
+	}
+	*position = byte_i;
+
+	return value_i;
+}
+#endif
+
+enum fs_status
+decode_varints(struct file_struct *src, off_t src_offset, uint64_t *dst,
+	       size_t *n_values, off_t *src_end)
+{
+	const uint8_t *data = src->data;
+	size_t byte_i = src_offset, value_i = 0, n_bytes;
+	enum fs_status status = FS_NO_ERROR;
+
+	if ((size_t) src_offset > src->size) {
+		printlg(ERROR_LEVEL,
+			"Requesting varints from %u, "
+			"but struct chunk only has data up to %u.\n",
+			(unsigned) src_offset, (unsigned) src->size);
+		return FSERR_OUT_OF_STRUCT;
+	}
+
+#ifdef FS_HAVE_BMI2
+	if (fs_has_bmi2()) {
+		value_i = decode_bmi2(data, src->size, &byte_i, dst,
+				      *n_values);
+	}
+#endif
+
+	for (; value_i < *n_values && byte_i < src->size; value_i++) {
+		n_bytes = load_varint(data + byte_i, src->size - byte_i,
+				      &dst[value_i]);
+		if (n_bytes == 0) {
+			printlg(ERROR_LEVEL,
+				"The varint at %u does not end within "
+				"%u bytes, or the struct chunk of size %u.\n",
+				(unsigned) byte_i, VARINT_MAX_BYTES,
+				(unsigned) src->size);
+			status = FSERR_OUT_OF_STRUCT;
+			break;
+		}
+		byte_i += n_bytes;
+	}
+	*n_values = value_i;
+	*src_end = byte_i;
+
+	return status;
+}
@@ -0,0 +1,690 @@
+#include <column_store.h>
+#include <fs_parallel.h>
+#include <fs_common.h>
+#include <logger.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* the most bytes of records each thread converts at once */
+#define COLUMN_BUFFER	(8 << 20)
+/* the alignment of the bounds after the values */
+#define BOUNDS_ALIGN	64
+
+_Static_assert(sizeof(struct column_header) == COLUMN_DATA_START,
+	       "The values must start right after the header.");
+
+/* the hash of a field and its records, to tell if a column is from it */
+static uint64_t field_hash(const struct column_layout *layout,
+			   const struct member_layout *member)
+{
+	uint64_t hash = mix_hash(layout->records_start, layout->record_size);
+
+	hash = mix_hash(hash, layout->block_values);
+	hash = mix_hash(hash, member->src_offset);
+	hash = mix_hash(hash, member->size);
+	hash = mix_hash(hash, member->width);
+	hash = mix_hash(hash, member->endianness);
+	hash = mix_hash(hash, member->conversion);
+
+	return mix_hash(hash, member->dst_width);
+}
+
+/*
+ * the path of a column of a file, which must be freed
+ * path:	the path of the source file
+ * column_i:	the index of the field of the column
+ * suffix:	a suffix to add after the index, eg. "", or "TMP_SUFFIX"
+ * returns	the path of the column, or NULL if "malloc" failed
+ */
+static char *column_path(const char *path, size_t column_i, const char *suffix)
+{
+	size_t length = strlen(path) + sizeof(COLUMN_SUFFIX) + 20 +
+			strlen(suffix);
+	char *with_suffix = malloc(length);
+
+	if (with_suffix != NULL) {
+		snprintf(with_suffix, length, "%s%s%u%s", path, COLUMN_SUFFIX,
+			 (unsigned) column_i, suffix);
+	}
+
+	return with_suffix;
+}
+
+/* the number of bytes of each value of the column of a field */
+static size_t member_value_size(const struct member_layout *member)
+{
+	if (member->conversion == MEMBER_BYTES) {
+		return member->size;
+	}
+
+	return member->size / member->width * member->dst_width;
+}
+
+/* Does the column of a field keep the bounds of each block? */
+static int
+has_bounds(const struct column_layout *layout,
+	   const struct member_layout *member)
+{
+	return layout->block_values > 0 &&
+	       member->conversion != MEMBER_BYTES &&
+	       member->size == member->width;
+}
+
+/* the location of the bounds of a column, after its values */
+static uint64_t bounds_start(size_t n_values, size_t value_size)
+{
+	uint64_t values_end = COLUMN_DATA_START + (uint64_t) n_values *
+			      value_size;
+
+	return (values_end + BOUNDS_ALIGN - 1) / BOUNDS_ALIGN * BOUNDS_ALIGN;
+}
+
+/*
+ * Load a converted value of a column with bounds.
+ * value:	the value in machine order
+ * conversion:	the conversion of the column
+ * value_size:	the number of bytes of the value
+ * returns	the value, widened
+ */
+static union column_value
+load_value(const uint8_t *value, enum member_conversion conversion,
+	   size_t value_size)
+{
+	union column_value loaded;
+
+	if (conversion == MEMBER_FLOAT) {
+		if (value_size == sizeof(float)) {
+			float single;
+
+			memcpy(&single, value, sizeof(single));
+			loaded.f = single;
+		} else {
+			memcpy(&loaded.f, value, sizeof(loaded.f));
+		}
+	} else {
+		loaded.u = load_uint(value, value_size, machine_endianness());
+		if (conversion == MEMBER_SIGNED) {
+			loaded.i = sign_extend(loaded.u, value_size);
+		}
+	}
+
+	return loaded;
+}
+
+void
+find_column_bounds(const void *values, size_t n_values,
+		   enum member_conversion conversion, size_t value_size,
+		   struct column_bounds *bounds)
+{
+	size_t value_i;
+
+	switch (conversion) {
+	case MEMBER_SIGNED:
+		bounds->min.i = INT64_MAX;
+		bounds->max.i = INT64_MIN;
+		break;
+	case MEMBER_FLOAT:
+		bounds->min.f = INFINITY;
+		bounds->max.f = -INFINITY;
+		break;
+	default:
+		bounds->min.u = UINT64_MAX;
+		bounds->max.u = 0;
+		break;
+	}
+
+	for (value_i = 0; value_i < n_values; value_i++) {
+		union column_value value = load_value((const uint8_t *) values +
+						      value_i * value_size,
+						      conversion, value_size);
+
+		switch (conversion) {
+		case MEMBER_SIGNED:
+			if (value.i < bounds->min.i) {
+				bounds->min.i = value.i;
+			}
+			if (value.i > bounds->max.i) {
+				bounds->max.i = value.i;
+			}
+			break;
+		case MEMBER_FLOAT:
+			if (value.f < bounds->min.f) {
+				bounds->min.f = value.f;
+			}
+			if (value.f > bounds->max.f) {
+				bounds->max.f = value.f;
+			}
+			break;
+		default:
+			if (value.u < bounds->min.u) {
+				bounds->min.u = value.u;
+			}
+			if (value.u > bounds->max.u) {
+				bounds->max.u = value.u;
+			}
+			break;
+		}
+	}
+}
+
+/*
+ * Read the header of a column file and check it
+ * against its source file and the field it should be built from.
+ * fd:		the descriptor of the column file
+ * column_size:	the size of the column file
+ * source:	the status of the source file
+ * layout:	the layout of the records
+ * member:	the field of the column
+ * header:	will be set to the header of the column
+ * returns	1 if the column is valid; 0 otherwise
+ */
+static int
+read_valid_header(int fd, off_t column_size, const struct stat *source,
+		  const struct column_layout *layout,
+		  const struct member_layout *member,
+		  struct column_header *header)
+{
+	uint64_t n_values = source->st_size > layout->records_start ?
+			    (source->st_size - layout->records_start) /
+			    layout->record_size : 0;
+	uint64_t n_blocks = 0;
+
+	if (pread(fd, header, sizeof(*header), 0) != sizeof(*header) ||
+	    memcmp(header->magic, COLUMN_MAGIC, sizeof(header->magic)) ||
+	    header->byte_order != COLUMN_BYTE_ORDER ||
+	    header->field_hash != field_hash(layout, member) ||
+	    header->value_size != member_value_size(member) ||
+	    header->n_values != n_values) {
+		return 0;
+	}
+	if (header->block_values > 0) {
+		n_blocks = (n_values + header->block_values - 1) /
+			   header->block_values;
+	}
+	if (header->bounds_start != bounds_start(n_values,
+						 header->value_size) ||
+	    (uint64_t) column_size != header->bounds_start +
+				      n_blocks * sizeof(struct column_bounds)) {
+		return 0;
+	}
+
+	return is_same_source(&header->source, source);
+}
+
+enum fs_status
+open_column(struct column *to_open, const char *path,
+	    const struct column_layout *layout, size_t column_i)
+{
+	char *col_path = column_path(path, column_i, "");
+	struct column_header header;
+	struct stat source;
+	enum fs_status status;
+
+	if (col_path == NULL) {
+		return FSERR_ERRNO;
+	}
+	status = open_file_structor(&to_open->file, col_path);
+	free(col_path);
+	if (status) {
+		return FSERR_BAD_SIDECAR;
+	}
+	if (stat(path, &source) ||
+	    !read_valid_header(to_open->file.fd, to_open->file.size, &source,
+			       layout, &layout->members[column_i], &header)) {
+		printlg(INFO_LEVEL, "Column %u of %s is not valid.\n",
+			(unsigned) column_i, path);
+		close_file_structor(&to_open->file);
+		return FSERR_BAD_SIDECAR;
+	}
+	if ((status = init_file_struct(&to_open->mapping, &to_open->file,
+				       to_open->file.size, 0))) {
+		close_file_structor(&to_open->file);
+		return status;
+	}
+
+	to_open->header = to_open->mapping.data;
+	to_open->values = (const uint8_t *) to_open->mapping.data +
+			  COLUMN_DATA_START;
+	to_open->n_values = header.n_values;
+	to_open->value_size = header.value_size;
+	to_open->block_values = header.block_values;
+	to_open->n_blocks = 0;
+	to_open->bounds = NULL;
+	if (header.block_values > 0) {
+		to_open->n_blocks = (header.n_values +
+				     header.block_values - 1) /
+				    header.block_values;
+		to_open->bounds = (const struct column_bounds *)
+				  ((const uint8_t *) to_open->mapping.data +
+				   header.bounds_start);
+	}
+
+	return FS_NO_ERROR;
+}
+
+enum fs_status close_column(struct column *to_close)
+{
+	teardown_file_struct(&to_close->mapping);
+
+	return close_file_structor(&to_close->file);
+}
+
+enum fs_status remove_columns(const char *path, size_t n_columns)
+{
+	enum fs_status status = FS_NO_ERROR;
+	size_t column_i;
+
+	for (column_i = 0; column_i < n_columns; column_i++) {
+		char *col_path = column_path(path, column_i, "");
+
+		if (col_path == NULL ||
+		    (unlink(col_path) && errno != ENOENT)) {
+			status = FSERR_ERRNO;
+		}
+		free(col_path);
+	}
+
+	return status;
+}
+
+/* a column being built */
+struct column_build {
+	/* the descriptor of the temporary column file */
+	int fd;
+	/* the plan converting the field into a value */
+	struct copy_plan plan;
+	/* the conversion and size of each value */
+	enum member_conversion conversion;
+	size_t value_size;
+	/* Does the column keep the bounds of each block? */
+	int has_bounds;
+	/* the location of the bounds */
+	uint64_t bounds_start;
+};
+
+/* the state shared by the threads building the columns of a file */
+struct column_work {
+	/* the source file */
+	struct file_structor *src_file;
+	/* the layout of the records */
+	const struct column_layout *layout;
+	/* the columns being built */
+	struct column_build *columns;
+	/* the number of records, and of records converted at once */
+	size_t n_records;
+	size_t batch;
+	/* the index of the next record to convert */
+	size_t next;
+};
+
+/*
+ * Convert a mapped batch of records into each column,
+ * and write the values and bounds of the batch.
+ * work:	the build
+ * raw:		the mapped records
+ * first:	the index of the first record of the batch
+ * n_records:	the number of records in the batch
+ * buffer:	a buffer for the values of "batch" records of any column
+ * returns	FS_NO_ERROR on success, or the error from writing
+ */
+static enum fs_status
+convert_batch(struct column_work *work, struct file_struct *raw, size_t first,
+	      size_t n_records, uint8_t *buffer)
+{
+	const size_t block_values = work->layout->block_values;
+	enum fs_status status = FS_NO_ERROR;
+	size_t column_i, value_i;
+
+	for (column_i = 0; !status && column_i < work->layout->n_members;
+	     column_i++) {
+		const struct column_build *column = &work->columns[column_i];
+
+		apply_copy_plan_array(&column->plan, buffer,
+				      column->value_size, raw, 0,
+				      work->layout->record_size, n_records);
+		status = write_all(column->fd, buffer,
+				   n_records * column->value_size,
+				   COLUMN_DATA_START +
+				   (off_t) (first * column->value_size));
+		if (!column->has_bounds) {
+			continue;
+		}
+		/* Batches start on blocks, so each block is in one batch. */
+		for (value_i = 0; !status && value_i < n_records;
+		     value_i += block_values) {
+			size_t n_block = n_records - value_i;
+			struct column_bounds bounds;
+
+			if (n_block > block_values) {
+				n_block = block_values;
+			}
+			find_column_bounds(buffer +
+					   value_i * column->value_size,
+					   n_block, column->conversion,
+					   column->value_size, &bounds);
+			status = write_all(column->fd, &bounds, sizeof(bounds),
+					   column->bounds_start +
+					   (first + value_i) / block_values *
+					   sizeof(bounds));
+		}
+	}
+
+	return status;
+}
+
+/* the worker for "build_columns", which converts batches of records */
+static enum fs_status convert_batches(void *arg, unsigned worker_i)
+{
+	struct column_work *work = arg;
+	size_t buffer_size = 0, column_i, first, n_claimed;
+	enum fs_status status = FS_NO_ERROR;
+	uint8_t *buffer;
+
+	(void) worker_i;
+
+	for (column_i = 0; column_i < work->layout->n_members; column_i++) {
+		if (buffer_size < work->columns[column_i].value_size) {
+			buffer_size = work->columns[column_i].value_size;
+		}
+	}
+	if ((buffer = malloc(buffer_size * work->batch)) == NULL) {
+		return FSERR_ERRNO;
+	}
+	while (!status && (n_claimed = claim_work(&work->next,
+						  work->n_records,
+						  work->batch, &first))) {
+		const size_t record_size = work->layout->record_size;
+		struct file_struct raw;
+
+		if ((status = init_file_struct(&raw, work->src_file,
+					       n_claimed * record_size,
+					       work->layout->records_start +
+					       (off_t) (first *
+							record_size)))) {
+			break;
+		}
+		status = convert_batch(work, &raw, first, n_claimed, buffer);
+		teardown_file_struct(&raw);
+	}
+	free(buffer);
+
+	return status;
+}
+
+/*
+ * Check that every field of a layout is inside the record.
+ * returns	FS_NO_ERROR if they are; FSERR_OUT_OF_STRUCT otherwise
+ */
+static enum fs_status check_layout(const struct column_layout *layout)
+{
+	size_t member_i;
+
+	for (member_i = 0; member_i < layout->n_members; member_i++) {
+		const struct member_layout *member = &layout->members[member_i];
+
+		if (member->src_offset + member->size > layout->record_size) {
+			printlg(ERROR_LEVEL,
+				"Column field at %u-%u is outside of "
+				"records of size %u.\n",
+				(unsigned) member->src_offset,
+				(unsigned) (member->src_offset + member->size),
+				(unsigned) layout->record_size);
+			return FSERR_OUT_OF_STRUCT;
+		}
+	}
+
+	return FS_NO_ERROR;
+}
+
+/*
+ * Check if every column of a file is valid and from the same layout.
+ * path:	the path of the source file
+ * layout:	the layout of the records
+ * returns	1 if they all are; 0 otherwise
+ */
+static int has_valid_columns(const char *path,
+			     const struct column_layout *layout)
+{
+	struct column_header header;
+	struct stat source, column;
+	size_t column_i;
+	int is_valid = stat(path, &source) == 0;
+
+	for (column_i = 0; is_valid && column_i < layout->n_members;
+	     column_i++) {
+		char *col_path = column_path(path, column_i, "");
+		int fd = col_path == NULL ? -1 : open(col_path, O_RDONLY);
+
+		free(col_path);
+		is_valid = fd >= 0 && fstat(fd, &column) == 0 &&
+			   read_valid_header(fd, column.st_size, &source,
+					     layout, &layout->members[column_i],
+					     &header);
+		if (fd >= 0) {
+			close(fd);
+		}
+	}
+
+	return is_valid;
+}
+
+/*
+ * Compile the plan converting the field of a column,
+ * and create its temporary file, with its header.
+ * column:	the column to start
+ * tmp_path:	the path of the temporary file
+ * layout:	the layout of the records
+ * member:	the field of the column
+ * source:	the status of the source file
+ * n_records:	the number of records
+ * returns	FS_NO_ERROR on success;
+ *		the error from "compile_copy_plan";
+ *		FSERR_ERRNO if the file could not be created,
+ *			in which case the plan is freed
+ */
+static enum fs_status
+start_column(struct column_build *column, const char *tmp_path,
+	     const struct column_layout *layout,
+	     const struct member_layout *member, const struct stat *source,
+	     size_t n_records)
+{
+	struct member_layout to_column = *member;
+	struct column_header header;
+	uint64_t n_blocks = 0;
+	enum fs_status status;
+
+	column->conversion = member->conversion;
+	column->value_size = member_value_size(member);
+	column->has_bounds = has_bounds(layout, member);
+	column->bounds_start = bounds_start(n_records, column->value_size);
+	if (column->has_bounds) {
+		n_blocks = (n_records + layout->block_values - 1) /
+			   layout->block_values;
+	}
+	to_column.dst_offset = 0;
+	if ((status = compile_copy_plan(&column->plan, &to_column, 1))) {
+		return status;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, COLUMN_MAGIC, sizeof(header.magic));
+	header.byte_order = COLUMN_BYTE_ORDER;
+	header.conversion = member->conversion;
+	header.value_size = column->value_size;
+	header.n_values = n_records;
+	header.block_values = column->has_bounds ? layout->block_values : 0;
+	header.bounds_start = column->bounds_start;
+	set_source_identity(&header.source, source);
+	header.field_hash = field_hash(layout, member);
+
+	column->fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (column->fd < 0 ||
+	    ftruncate(column->fd, column->bounds_start +
+		      n_blocks * sizeof(struct column_bounds)) ||
+	    write_all(column->fd, &header, sizeof(header), 0)) {
+		printlg(ERROR_LEVEL, "Unable to create column %s: %d\n",
+			tmp_path, errno);
+		if (column->fd >= 0) {
+			close(column->fd);
+			unlink(tmp_path);
+		}
+		free_copy_plan(&column->plan);
+		return FSERR_ERRNO;
+	}
+
+	return FS_NO_ERROR;
+}
+
+/*
+ * Convert the records into opened columns, and sync them.
+ * work:	the build, with every column started
+ * n_threads:	the number of threads, or 0 for one per online processor
+ * returns	FS_NO_ERROR on success, or the first error
+ */
+static enum fs_status fill_columns(struct column_work *work, unsigned n_threads)
+{
+	const struct column_layout *layout = work->layout;
+	enum fs_status status;
+	size_t column_i;
+
+	work->batch = COLUMN_BUFFER / layout->record_size;
+	if (layout->block_values > 0) {
+		work->batch = work->batch / layout->block_values *
+			      layout->block_values;
+		if (work->batch == 0) {
+			work->batch = layout->block_values;
+		}
+	}
+	if (work->batch == 0) {
+		work->batch = 1;
+	}
+	work->next = 0;
+
+	n_threads = fs_thread_count(n_threads);
+	if (work->n_records <= work->batch) {
+		n_threads = 1;
+	}
+	status = run_parallel(n_threads, convert_batches, work);
+	for (column_i = 0; !status && column_i < layout->n_members;
+	     column_i++) {
+		if (fsync(work->columns[column_i].fd)) {
+			printlg(ERROR_LEVEL, "Unable to sync a column: %d\n",
+				errno);
+			status = FSERR_ERRNO;
+		}
+	}
+
+	return status;
+}
+
+/*
+ * Rename the temporary files of the columns into place, or delete them.
+ * path:	the path of the source file
+ * n_columns:	the number of columns with a temporary file
+ * keep:	nonzero to rename them; 0 to delete them
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_ERRNO if a rename or "malloc" failed
+ */
+static enum fs_status
+finish_columns(const char *path, size_t n_columns, int keep)
+{
+	enum fs_status status = FS_NO_ERROR;
+	size_t column_i;
+
+	for (column_i = 0; column_i < n_columns; column_i++) {
+		char *tmp_path = column_path(path, column_i, TMP_SUFFIX);
+		char *col_path = column_path(path, column_i, "");
+
+		if (tmp_path == NULL || col_path == NULL) {
+			status = FSERR_ERRNO;
+		} else if (keep && !status && rename(tmp_path, col_path)) {
+			printlg(ERROR_LEVEL,
+				"Unable to rename column %s: %d\n",
+				tmp_path, errno);
+			status = FSERR_ERRNO;
+		}
+		if (tmp_path != NULL && (!keep || status)) {
+			unlink(tmp_path);
+		}
+		free(tmp_path);
+		free(col_path);
+	}
+
+	return status;
+}
+
+enum fs_status
+build_columns(const char *path, const struct column_layout *layout,
+	      unsigned n_threads)
+{
+	struct file_structor src_file;
+	struct column_work work;
+	struct stat source;
+	enum fs_status status, finished;
+	size_t column_i, n_started = 0;
+
+	debug_assert(layout->record_size > 0);
+	if ((status = check_layout(layout))) {
+		return status;
+	}
+	if (has_valid_columns(path, layout)) {
+		return FS_NO_ERROR;
+	}
+
+	if ((status = open_file_structor(&src_file, path))) {
+		return status;
+	}
+	if (fstat(src_file.fd, &source)) {
+		close_file_structor(&src_file);
+		return FSERR_ERRNO;
+	}
+	work.src_file = &src_file;
+	work.layout = layout;
+	work.n_records = src_file.size > layout->records_start ?
+			 (src_file.size - layout->records_start) /
+			 layout->record_size : 0;
+	work.columns = calloc(layout->n_members, sizeof(*work.columns));
+	if (work.columns == NULL) {
+		close_file_structor(&src_file);
+		return FSERR_ERRNO;
+	}
+
+	for (column_i = 0; !status && column_i < layout->n_members;
+	     column_i++) {
+		char *tmp_path = column_path(path, column_i, TMP_SUFFIX);
+
+		if (tmp_path == NULL) {
+			status = FSERR_ERRNO;
+			break;
+		}
+		if (!(status = start_column(&work.columns[column_i], tmp_path,
+					    layout, &layout->members[column_i],
+					    &source, work.n_records))) {
+			n_started++;
+		}
+		free(tmp_path);
+	}
+	if (!status) {
+		status = fill_columns(&work, n_threads);
+	}
+
+	for (column_i = 0; column_i < n_started; column_i++) {
+		close(work.columns[column_i].fd);
+		free_copy_plan(&work.columns[column_i].plan);
+	}
+	if ((finished = finish_columns(path, n_started, !status)) &&
+	    !status) {
+		status = finished;
+	}
+	free(work.columns);
+	close_file_structor(&src_file);
+
+	return status;
+}
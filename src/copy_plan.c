@@ -0,0 +1,301 @@
+#include <copy_plan.h>
+#include <logger.h>
+
+#include <stdlib.h>
+#include <errno.h>
+
+/*
+ * Find the kind of step needed to copy a member.
+ * member:	the layout of the member
+ * returns	a conversion if the member changes width,
+ *		otherwise COPY_OP_RUN if the bytes can be copied in order,
+ *		and the kind of swap for the element width if not
+ */
+static enum copy_op_type member_op_type(const struct member_layout *member)
+{
+	if (member->conversion != MEMBER_BYTES &&
+	    member->dst_width != member->width) {
+		return member->conversion == MEMBER_FLOAT ? COPY_OP_FLOAT :
+		       COPY_OP_INT;
+	}
+	if (member->width <= 1 ||
+	    member->endianness == machine_endianness()) {
+		return COPY_OP_RUN;
+	}
+
+	switch (member->width) {
+	case sizeof(uint16_t):
+		return COPY_OP_SWAP16;
+	case sizeof(uint32_t):
+		return COPY_OP_SWAP32;
+	case sizeof(uint64_t):
+		return COPY_OP_SWAP64;
+	default:
+		return COPY_OP_REVERSE;
+	}
+}
+
+/* "qsort" comparison of steps by their offsets in the raw data */
+static int compare_ops(const void *first, const void *second)
+{
+	const struct copy_op *first_op = first, *second_op = second;
+
+	if (first_op->src_offset != second_op->src_offset) {
+		return first_op->src_offset < second_op->src_offset ? -1 : 1;
+	}
+	return first_op->dst_offset < second_op->dst_offset ? -1 :
+	       first_op->dst_offset > second_op->dst_offset;
+}
+
+/* the number of bytes a step writes to the destination struct */
+static size_t op_dst_size(const struct copy_op *op)
+{
+	return op->size / op->width * op->dst_width;
+}
+
+/*
+ * Check if one step can be extended to also do the next one,
+ * ie. they do the same kind of copy,
+ * and the next one continues where the first ends in both structs.
+ */
+static int can_merge_ops(const struct copy_op *op, const struct copy_op *next)
+{
+	return op->type == next->type && op->width == next->width &&
+	       op->dst_width == next->dst_width &&
+	       op->endianness == next->endianness &&
+	       op->is_signed == next->is_signed &&
+	       op->src_offset + op->size == next->src_offset &&
+	       op->dst_offset + op_dst_size(op) == next->dst_offset;
+}
+
+enum fs_status
+compile_copy_plan(struct copy_plan *to_init,
+		  const struct member_layout *members, size_t n_members)
+{
+	size_t member_i, n_merged = 0;
+
+	to_init->n_ops = 0;
+	to_init->src_size = 0;
+	to_init->dst_size = 0;
+	to_init->ops = malloc(sizeof(*to_init->ops) *
+			      (n_members > 0 ? n_members : 1));
+	if (to_init->ops == NULL) {
+		printlg(ERROR_LEVEL, "Unable to allocate a plan of %u steps.\n",
+			(unsigned) n_members);
+		return FSERR_ERRNO;
+	}
+
+	for (member_i = 0; member_i < n_members; member_i++) {
+		const struct member_layout *member = &members[member_i];
+		struct copy_op *op = &to_init->ops[member_i];
+
+		debug_assert(member->width == 0 ||
+			     member->size % member->width == 0);
+		op->type = member_op_type(member);
+		op->src_offset = member->src_offset;
+		op->dst_offset = member->dst_offset;
+		op->size = member->size;
+		op->width = op->type == COPY_OP_RUN ? 1 : member->width;
+		op->dst_width = op->type == COPY_OP_INT ||
+				op->type == COPY_OP_FLOAT ? member->dst_width :
+				op->width;
+		op->endianness = member->endianness;
+		op->is_signed = member->conversion == MEMBER_SIGNED;
+		if (op->type != COPY_OP_INT && op->type != COPY_OP_FLOAT) {
+			/* Only conversions care about these. */
+			op->endianness = machine_endianness();
+			op->is_signed = 0;
+		}
+
+		if (member->src_offset + member->size > to_init->src_size) {
+			to_init->src_size = member->src_offset + member->size;
+		}
+		if (member->dst_offset + op_dst_size(op) > to_init->dst_size) {
+			to_init->dst_size = member->dst_offset +
+					    op_dst_size(op);
+		}
+	}
+
+	qsort(to_init->ops, n_members, sizeof(*to_init->ops), compare_ops);
+
+	for (member_i = 0; member_i < n_members; member_i++) {
+		struct copy_op *op = &to_init->ops[member_i];
+
+		if (n_merged > 0 &&
+		    can_merge_ops(&to_init->ops[n_merged - 1], op)) {
+			to_init->ops[n_merged - 1].size += op->size;
+		} else {
+			to_init->ops[n_merged++] = *op;
+		}
+	}
+	to_init->n_ops = n_merged;
+
+	return FS_NO_ERROR;
+}
+
+void free_copy_plan(struct copy_plan *to_free)
+{
+	free(to_free->ops);
+	to_free->ops = NULL;
+	to_free->n_ops = 0;
+}
+
+/*
+ * Run each step of a plan on one struct, without checking ranges.
+ * The swap loops have fixed widths,
+ * so that the compiler can turn them into vector shuffles.
+ * plan:	the compiled plan
+ * dst:		the pointer to the destination struct
+ * src:		the pointer to the raw struct
+ */
+static void
+run_copy_plan(const struct copy_plan *plan, uint8_t *dst, const uint8_t *src)
+{
+	size_t op_i;
+
+	for (op_i = 0; op_i < plan->n_ops; op_i++) {
+		const struct copy_op *op = &plan->ops[op_i];
+		uint8_t *op_dst = dst + op->dst_offset;
+		const uint8_t *op_src = src + op->src_offset;
+		size_t element_i;
+
+		switch (op->type) {
+		case COPY_OP_RUN:
+			memcpy(op_dst, op_src, op->size);
+			break;
+		case COPY_OP_SWAP16:
+			for (element_i = 0; element_i < op->size;
+			     element_i += sizeof(uint16_t)) {
+				uint16_t element;
+
+				memcpy(&element, op_src + element_i,
+				       sizeof(element));
+				element = __builtin_bswap16(element);
+				memcpy(op_dst + element_i, &element,
+				       sizeof(element));
+			}
+			break;
+		case COPY_OP_SWAP32:
+			for (element_i = 0; element_i < op->size;
+			     element_i += sizeof(uint32_t)) {
+				uint32_t element;
+
+				memcpy(&element, op_src + element_i,
+				       sizeof(element));
+				element = __builtin_bswap32(element);
+				memcpy(op_dst + element_i, &element,
+				       sizeof(element));
+			}
+			break;
+		case COPY_OP_SWAP64:
+			for (element_i = 0; element_i < op->size;
+			     element_i += sizeof(uint64_t)) {
+				uint64_t element;
+
+				memcpy(&element, op_src + element_i,
+				       sizeof(element));
+				element = __builtin_bswap64(element);
+				memcpy(op_dst + element_i, &element,
+				       sizeof(element));
+			}
+			break;
+		case COPY_OP_REVERSE:
+			for (element_i = 0; element_i < op->size;
+			     element_i += op->width) {
+				memcpy_rev(op_dst + element_i,
+					   (void *) (op_src + element_i),
+					   op->width);
+			}
+			break;
+		case COPY_OP_INT:
+			for (element_i = 0; element_i < op->size / op->width;
+			     element_i++) {
+				convert_int(op_dst + element_i * op->dst_width,
+					    op->dst_width,
+					    op_src + element_i * op->width,
+					    op->width, op->endianness,
+					    op->is_signed);
+			}
+			break;
+		case COPY_OP_FLOAT:
+			for (element_i = 0; element_i < op->size / op->width;
+			     element_i++) {
+				convert_float(op_dst +
+					      element_i * op->dst_width,
+					      op->dst_width,
+					      op_src + element_i * op->width,
+					      op->width, op->endianness);
+			}
+			break;
+		}
+	}
+}
+
+enum fs_status
+apply_copy_plan(const struct copy_plan *plan, void *dst,
+		struct file_struct *src, off_t src_start)
+{
+	return apply_copy_plan_array(plan, dst, 0, src, src_start, 0, 1);
+}
+
+enum fs_status
+apply_copy_plan_array(const struct copy_plan *plan, void *dst,
+		      size_t dst_stride, struct file_struct *src,
+		      off_t src_start, size_t src_stride, size_t n_structs)
+{
+	uint8_t *dst_struct = dst;
+	const uint8_t *src_struct;
+	size_t struct_i;
+
+	if (n_structs == 0) {
+		return FS_NO_ERROR;
+	}
+	if (src_start < 0 ||
+	    src_start + src_stride * (n_structs - 1) + plan->src_size >
+	    src->size) {
+		printlg(ERROR_LEVEL,
+			"Requesting %u structs of %u bytes from %u, "
+			"but struct chunk only has data up to %u.\n",
+			(unsigned) n_structs, (unsigned) plan->src_size,
+			(unsigned) src_start, (unsigned) src->size);
+		return FSERR_OUT_OF_STRUCT;
+	}
+
+	src_struct = (const uint8_t *) src->data + src_start;
+	for (struct_i = 0; struct_i < n_structs; struct_i++) {
+		run_copy_plan(plan, dst_struct, src_struct);
+		dst_struct += dst_stride;
+		src_struct += src_stride;
+	}
+
+	return FS_NO_ERROR;
+}
+
+enum fs_status
+apply_copy_plan_selected(const struct copy_plan *plan, void *dst,
+			 size_t dst_stride, struct file_struct *src,
+			 size_t src_stride, const size_t *selection,
+			 size_t n_selected)
+{
+	uint8_t *dst_struct = dst;
+	const uint8_t *src_data = src->data;
+	size_t selected_i;
+
+	for (selected_i = 0; selected_i < n_selected; selected_i++) {
+		size_t src_start = selection[selected_i] * src_stride;
+
+		if (src_start + plan->src_size > src->size) {
+			printlg(ERROR_LEVEL,
+				"Requesting struct %u of %u bytes, "
+				"but struct chunk only has data up to %u.\n",
+				(unsigned) selection[selected_i],
+				(unsigned) plan->src_size,
+				(unsigned) src->size);
+			return FSERR_OUT_OF_STRUCT;
+		}
+		run_copy_plan(plan, dst_struct, src_data + src_start);
+		dst_struct += dst_stride;
+	}
+
+	return FS_NO_ERROR;
+}
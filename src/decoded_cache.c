@@ -0,0 +1,371 @@
+#include <decoded_cache.h>
+#include <fs_common.h>
+#include <logger.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/* the smallest number of hash buckets of a shard */
+#define MIN_BUCKETS	16
+
+/* the hash of a key, mixed with the MurmurHash3 finalizer */
+static uint64_t
+hash_key(const struct file_structor *file, off_t offset,
+	 const struct copy_plan *plan)
+{
+	return mix_hash(0, (uintptr_t) file * 0x9e3779b97f4a7c15ull ^
+			   (uint64_t) offset ^ (uintptr_t) plan << 17);
+}
+
+/* the shard holding the keys with a hash */
+static struct decoded_shard *
+shard_of(struct decoded_cache *cache, uint64_t hash)
+{
+	return &cache->shards[(hash >> 32) % DECODED_CACHE_SHARDS];
+}
+
+/* the bytes an entry holds for a plan */
+static size_t entry_memory(const struct copy_plan *plan)
+{
+	return sizeof(struct decoded_entry) + plan->dst_size;
+}
+
+/* Find the entry of a key in a shard, or NULL if there is none. */
+static struct decoded_entry *
+find_entry(const struct decoded_shard *shard,
+	   const struct file_structor *file, off_t offset,
+	   const struct copy_plan *plan, uint64_t hash)
+{
+	struct decoded_entry *entry;
+
+	for (entry = shard->buckets[hash & (shard->n_buckets - 1)];
+	     entry != NULL; entry = entry->bucket_next) {
+		if (entry->hash == hash && entry->file == file &&
+		    entry->offset == offset && entry->plan == plan) {
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Double the buckets of a shard once it has more entries than buckets,
+ * keeping the old ones if the new ones cannot be allocated.
+ */
+static void grow_buckets(struct decoded_shard *shard)
+{
+	const size_t n_buckets = shard->n_buckets * 2;
+	struct decoded_entry **buckets, *entry, *next;
+	size_t bucket_i;
+
+	if (shard->n_entries <= shard->n_buckets ||
+	    (buckets = calloc(n_buckets, sizeof(*buckets))) == NULL) {
+		return;
+	}
+	for (bucket_i = 0; bucket_i < shard->n_buckets; bucket_i++) {
+		for (entry = shard->buckets[bucket_i]; entry != NULL;
+		     entry = next) {
+			next = entry->bucket_next;
+			entry->bucket_next =
+				buckets[entry->hash & (n_buckets - 1)];
+			buckets[entry->hash & (n_buckets - 1)] = entry;
+		}
+	}
+	free(shard->buckets);
+	shard->buckets = buckets;
+	shard->n_buckets = n_buckets;
+}
+
+/*
+ * Add an entry to the table of a shard,
+ * and to the clock ring just behind the hand,
+ * so that it is the last entry the hand considers.
+ */
+static void
+insert_entry(struct decoded_shard *shard, struct decoded_entry *entry)
+{
+	struct decoded_entry **bucket =
+		&shard->buckets[entry->hash & (shard->n_buckets - 1)];
+
+	entry->bucket_next = *bucket;
+	*bucket = entry;
+	if (shard->hand == NULL) {
+		entry->clock_prev = entry->clock_next = entry;
+		shard->hand = entry;
+	} else {
+		entry->clock_next = shard->hand;
+		entry->clock_prev = shard->hand->clock_prev;
+		entry->clock_prev->clock_next = entry;
+		shard->hand->clock_prev = entry;
+	}
+	shard->n_entries++;
+	shard->memory += entry_memory(entry->plan);
+	grow_buckets(shard);
+}
+
+/* Remove an entry from the table and the clock ring, and free it. */
+static void
+remove_entry(struct decoded_shard *shard, struct decoded_entry *entry)
+{
+	struct decoded_entry **link =
+		&shard->buckets[entry->hash & (shard->n_buckets - 1)];
+
+	while (*link != entry) {
+		link = &(*link)->bucket_next;
+	}
+	*link = entry->bucket_next;
+	if (entry->clock_next == entry) {
+		shard->hand = NULL;
+	} else {
+		entry->clock_prev->clock_next = entry->clock_next;
+		entry->clock_next->clock_prev = entry->clock_prev;
+		if (shard->hand == entry) {
+			shard->hand = entry->clock_next;
+		}
+	}
+	shard->n_entries--;
+	shard->memory -= entry_memory(entry->plan);
+	free(entry);
+}
+
+/*
+ * Move the clock hand of a shard until it is within its bound,
+ * clearing the reference of the entries hit since it last passed,
+ * and evicting the others.
+ */
+static void evict_entries(struct decoded_shard *shard, size_t max_memory)
+{
+	while (shard->memory > max_memory && shard->hand != NULL) {
+		struct decoded_entry *entry = shard->hand;
+
+		if (entry->is_referenced) {
+			entry->is_referenced = 0;
+			shard->hand = entry->clock_next;
+		} else {
+			remove_entry(shard, entry);
+			shard->n_evictions++;
+		}
+	}
+}
+
+/*
+ * Check if the file of an entry changed since its struct was decoded,
+ * removing the entry if it did.
+ * The file is checked with "fstat" while holding the lock of the shard,
+ * which is cheaper than finding the entry again after it,
+ * and happens at most once per interval for each struct.
+ * shard:	the shard, which is locked
+ * entry:	the entry, whose file has a descriptor
+ * returns	1 if the file is unchanged, or could not be checked;
+ *		0 if it changed, after the entry is removed
+ */
+static int check_entry(struct decoded_shard *shard,
+		       struct decoded_entry *entry)
+{
+	struct stat identity;
+
+	entry->checked_ns = coarse_now_ns();
+	if (fstat(entry->file->fd, &identity) ||
+	    ((uint64_t) identity.st_size == entry->size &&
+	     identity.st_mtim.tv_sec == entry->mtime_sec &&
+	     identity.st_mtim.tv_nsec == entry->mtime_nsec)) {
+		return 1;
+	}
+
+	shard->n_stale++;
+	remove_entry(shard, entry);
+
+	return 0;
+}
+
+/*
+ * Map a raw struct and decode it with a plan.
+ * file:	the source wrapper
+ * offset:	the location of the raw struct in the file
+ * plan:	the compiled plan of the struct
+ * dst:		will be filled with the decoded struct
+ * returns	FS_NO_ERROR on success;
+ *		the error from "init_file_struct" or "apply_copy_plan"
+ */
+static enum fs_status
+decode_struct(struct file_structor *file, off_t offset,
+	      const struct copy_plan *plan, void *dst)
+{
+	struct file_struct chunk;
+	enum fs_status status;
+
+	if ((status = init_file_struct(&chunk, file, plan->src_size,
+				       offset))) {
+		return status;
+	}
+	status = apply_copy_plan(plan, dst, &chunk, 0);
+	teardown_file_struct(&chunk);
+
+	return status;
+}
+
+enum fs_status
+init_decoded_cache(struct decoded_cache *to_init, size_t max_memory,
+		   unsigned recheck_ms)
+{
+	size_t shard_i;
+
+	for (shard_i = 0; shard_i < DECODED_CACHE_SHARDS; shard_i++) {
+		struct decoded_shard *shard = &to_init->shards[shard_i];
+
+		shard->buckets = calloc(MIN_BUCKETS, sizeof(*shard->buckets));
+		if (shard->buckets == NULL) {
+			while (shard_i-- > 0) {
+				free(to_init->shards[shard_i].buckets);
+				pthread_mutex_destroy(
+					&to_init->shards[shard_i].lock);
+			}
+			return FSERR_ERRNO;
+		}
+		pthread_mutex_init(&shard->lock, NULL);
+		shard->n_buckets = MIN_BUCKETS;
+		shard->n_entries = 0;
+		shard->memory = 0;
+		shard->hand = NULL;
+		shard->n_hits = 0;
+		shard->n_misses = 0;
+		shard->n_stale = 0;
+		shard->n_evictions = 0;
+	}
+	to_init->shard_memory = max_memory / DECODED_CACHE_SHARDS;
+	to_init->recheck_ns = (uint64_t) recheck_ms * 1000000;
+
+	return FS_NO_ERROR;
+}
+
+void teardown_decoded_cache(struct decoded_cache *to_teardown)
+{
+	size_t shard_i;
+
+	for (shard_i = 0; shard_i < DECODED_CACHE_SHARDS; shard_i++) {
+		struct decoded_shard *shard = &to_teardown->shards[shard_i];
+
+		while (shard->hand != NULL) {
+			remove_entry(shard, shard->hand);
+		}
+		free(shard->buckets);
+		shard->buckets = NULL;
+		pthread_mutex_destroy(&shard->lock);
+	}
+}
+
+enum fs_status
+decode_cached(struct decoded_cache *cache, struct file_structor *file,
+	      off_t offset, const struct copy_plan *plan, void *dst)
+{
+	const uint64_t hash = hash_key(file, offset, plan);
+	struct decoded_shard *shard = shard_of(cache, hash);
+	struct decoded_entry *entry;
+	struct stat identity;
+	uint64_t file_size;
+	enum fs_status status;
+	int has_identity;
+
+	pthread_mutex_lock(&shard->lock);
+	if ((entry = find_entry(shard, file, offset, plan, hash)) != NULL) {
+		if (entry->file_size != (uint64_t) file->size) {
+			shard->n_stale++;
+			remove_entry(shard, entry);
+		} else if (file->fd < 0 ||
+			   coarse_now_ns() - entry->checked_ns <
+			   cache->recheck_ns ||
+			   check_entry(shard, entry)) {
+			memcpy(dst, entry->decoded, plan->dst_size);
+			entry->is_referenced = 1;
+			shard->n_hits++;
+			pthread_mutex_unlock(&shard->lock);
+			return FS_NO_ERROR;
+		}
+	}
+	shard->n_misses++;
+	pthread_mutex_unlock(&shard->lock);
+
+	/* The status comes first, so a change during decoding is noticed. */
+	file_size = file->size;
+	has_identity = file->fd >= 0 && fstat(file->fd, &identity) == 0;
+	if ((status = decode_struct(file, offset, plan, dst))) {
+		return status;
+	}
+	if (entry_memory(plan) > cache->shard_memory ||
+	    (entry = malloc(entry_memory(plan))) == NULL) {
+		/* The struct is decoded, even if it cannot be kept. */
+		return FS_NO_ERROR;
+	}
+	entry->file = file;
+	entry->offset = offset;
+	entry->plan = plan;
+	entry->hash = hash;
+	entry->file_size = file_size;
+	entry->size = has_identity ? (uint64_t) identity.st_size : 0;
+	entry->mtime_sec = has_identity ? identity.st_mtim.tv_sec : 0;
+	entry->mtime_nsec = has_identity ? identity.st_mtim.tv_nsec : 0;
+	entry->is_referenced = 0;
+	entry->checked_ns = coarse_now_ns();
+	entry->decoded = entry + 1;
+	memcpy(entry->decoded, dst, plan->dst_size);
+
+	pthread_mutex_lock(&shard->lock);
+	if (find_entry(shard, file, offset, plan, hash) != NULL) {
+		/* Another thread decoded the struct first. */
+		pthread_mutex_unlock(&shard->lock);
+		free(entry);
+		return FS_NO_ERROR;
+	}
+	insert_entry(shard, entry);
+	evict_entries(shard, cache->shard_memory);
+	pthread_mutex_unlock(&shard->lock);
+
+	return FS_NO_ERROR;
+}
+
+void invalidate_decoded(struct decoded_cache *cache,
+			const struct file_structor *file)
+{
+	size_t shard_i, bucket_i;
+
+	for (shard_i = 0; shard_i < DECODED_CACHE_SHARDS; shard_i++) {
+		struct decoded_shard *shard = &cache->shards[shard_i];
+
+		pthread_mutex_lock(&shard->lock);
+		for (bucket_i = 0; bucket_i < shard->n_buckets; bucket_i++) {
+			struct decoded_entry *entry = shard->buckets[bucket_i];
+
+			while (entry != NULL) {
+				struct decoded_entry *next = entry->bucket_next;
+
+				if (entry->file == file) {
+					remove_entry(shard, entry);
+				}
+				entry = next;
+			}
+		}
+		pthread_mutex_unlock(&shard->lock);
+	}
+}
+
+void get_decoded_cache_stats(struct decoded_cache *cache,
+			     struct decoded_cache_stats *stats)
+{
+	size_t shard_i;
+
+	memset(stats, 0, sizeof(*stats));
+	for (shard_i = 0; shard_i < DECODED_CACHE_SHARDS; shard_i++) {
+		struct decoded_shard *shard = &cache->shards[shard_i];
+
+		pthread_mutex_lock(&shard->lock);
+		stats->n_hits += shard->n_hits;
+		stats->n_misses += shard->n_misses;
+		stats->n_stale += shard->n_stale;
+		stats->n_evictions += shard->n_evictions;
+		stats->n_entries += shard->n_entries;
+		stats->memory += shard->memory;
+		pthread_mutex_unlock(&shard->lock);
+	}
+}
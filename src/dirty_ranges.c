@@ -0,0 +1,183 @@
+#include <dirty_ranges.h>
+#include <logger.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <errno.h>
+
+/* the number of pages in each word of a bitmap */
+#define WORD_PAGES	64
+
+/*
+ * Find the first page at or after a page whose bit has a value.
+ * bitmap:	the bitmap
+ * n_pages:	the number of pages in the bitmap
+ * page_i:	the page to start from
+ * is_set:	nonzero to find a dirty page, or 0 to find a clean one
+ * returns	the page, or "n_pages" if there is none
+ */
+static size_t
+find_page(const uint64_t *bitmap, size_t n_pages, size_t page_i, int is_set)
+{
+	const uint64_t flip = is_set ? 0 : ~0ull;
+	size_t word_i = page_i / WORD_PAGES;
+	uint64_t word;
+
+	if (page_i >= n_pages) {
+		return n_pages;
+	}
+
+	word = (bitmap[word_i] ^ flip) & ~0ull << page_i % WORD_PAGES;
+	while (word == 0) {
+		word_i++;
+		if (word_i * WORD_PAGES >= n_pages) {
+			return n_pages;
+		}
+		word = bitmap[word_i] ^ flip;
+	}
+	page_i = word_i * WORD_PAGES + __builtin_ctzll(word);
+
+	return page_i < n_pages ? page_i : n_pages;
+}
+
+/* Clear the bits of the pages in [start, end). */
+static void clear_pages(uint64_t *bitmap, size_t start, size_t end)
+{
+	size_t page_i;
+
+	for (page_i = start; page_i < end; page_i++) {
+		bitmap[page_i / WORD_PAGES] &= ~(1ull << page_i % WORD_PAGES);
+	}
+}
+
+enum fs_status
+init_dirty_ranges(struct dirty_ranges *to_init, struct file_struct *chunk,
+		  size_t max_gap)
+{
+	size_t n_words;
+
+	to_init->chunk = chunk;
+	to_init->size = chunk->size;
+	to_init->page_size = sysconf(_SC_PAGE_SIZE);
+	to_init->start_adjustment = (uintptr_t) chunk->data %
+				    to_init->page_size;
+	to_init->n_pages = (to_init->start_adjustment + chunk->size +
+			    to_init->page_size - 1) / to_init->page_size;
+	to_init->n_dirty = 0;
+	to_init->max_gap = max_gap;
+	to_init->n_syncs = 0;
+	to_init->n_synced_pages = 0;
+
+	n_words = (to_init->n_pages + WORD_PAGES - 1) / WORD_PAGES;
+	to_init->bitmap = calloc(n_words > 0 ? n_words : 1,
+				 sizeof(*to_init->bitmap));
+	if (to_init->bitmap == NULL) {
+		printlg(ERROR_LEVEL,
+			"Unable to allocate the dirty bitmap of %u pages.\n",
+			(unsigned) to_init->n_pages);
+		return FSERR_ERRNO;
+	}
+
+	return FS_NO_ERROR;
+}
+
+void teardown_dirty_ranges(struct dirty_ranges *to_teardown)
+{
+	free(to_teardown->bitmap);
+	to_teardown->bitmap = NULL;
+	to_teardown->n_pages = 0;
+	to_teardown->n_dirty = 0;
+	to_teardown->chunk = NULL;
+}
+
+enum fs_status
+mark_dirty(struct dirty_ranges *dirty, off_t offset, size_t size)
+{
+	size_t page_i, end_page;
+
+	if (offset < 0 || offset + size > dirty->size) {
+		printlg(ERROR_LEVEL,
+			"Marking data in %u-%u, "
+			"but struct chunk only has data up to %u.\n",
+			(unsigned) offset, (unsigned) (offset + size),
+			(unsigned) dirty->size);
+		return FSERR_OUT_OF_STRUCT;
+	}
+	if (size == 0) {
+		return FS_NO_ERROR;
+	}
+
+	page_i = (dirty->start_adjustment + offset) / dirty->page_size;
+	end_page = (dirty->start_adjustment + offset + size - 1) /
+		   dirty->page_size;
+	for (; page_i <= end_page; page_i++) {
+		uint64_t *word = &dirty->bitmap[page_i / WORD_PAGES];
+		uint64_t bit = 1ull << page_i % WORD_PAGES;
+
+		if (!(*word & bit)) {
+			*word |= bit;
+			dirty->n_dirty++;
+		}
+	}
+
+	return FS_NO_ERROR;
+}
+
+enum fs_status flush_dirty(struct dirty_ranges *dirty, enum dirty_flush flush)
+{
+	uint8_t *first_page = (uint8_t *) dirty->chunk->data -
+			      dirty->start_adjustment;
+	int is_memory = dirty->chunk->src_file->memory != NULL;
+	size_t start = find_page(dirty->bitmap, dirty->n_pages, 0, 1);
+
+	while (start < dirty->n_pages) {
+		size_t end = find_page(dirty->bitmap, dirty->n_pages, start, 0);
+		size_t next;
+
+		/* Merge the next runs while the gaps before them are small. */
+		for (;;) {
+			next = find_page(dirty->bitmap, dirty->n_pages, end, 1);
+			if (next >= dirty->n_pages ||
+			    next - end > dirty->max_gap) {
+				break;
+			}
+			end = find_page(dirty->bitmap, dirty->n_pages, next, 0);
+		}
+
+		if (!is_memory) {
+			if (msync(first_page + start * dirty->page_size,
+				  (end - start) * dirty->page_size,
+				  flush == FLUSH_SYNC ? MS_SYNC : MS_ASYNC)) {
+				printlg(ERROR_LEVEL,
+					"Unable to flush range %u-%u "
+					"of struct chunk: %d\n",
+					(unsigned) (start * dirty->page_size),
+					(unsigned) (end * dirty->page_size),
+					errno);
+				return FSERR_ERRNO;
+			}
+			dirty->n_syncs++;
+			dirty->n_synced_pages += end - start;
+		}
+
+		/* Only the dirty pages of the run are counted as cleaned. */
+		for (; start < end; start = find_page(dirty->bitmap,
+						      dirty->n_pages, start,
+						      1)) {
+			size_t run_end = find_page(dirty->bitmap,
+						   dirty->n_pages, start, 0);
+
+			if (run_end > end) {
+				run_end = end;
+			}
+			clear_pages(dirty->bitmap, start, run_end);
+			dirty->n_dirty -= run_end - start;
+			start = run_end;
+		}
+		start = next;
+	}
+
+	return FS_NO_ERROR;
+}
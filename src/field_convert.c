@@ -0,0 +1,323 @@
+#include <field_convert.h>
+#include <logger.h>
+
+#include "fs_simd.h"
+
+/*
+ * Check that a field is inside of each record.
+ * offset:	the location of the field in each record
+ * width:	the number of bytes of the field
+ * record_size:	the distance between records
+ * returns	FS_NO_ERROR if the field is inside the record;
+ *		FSERR_OUT_OF_STRUCT otherwise
+ */
+static enum fs_status
+check_field(size_t offset, size_t width, size_t record_size)
+{
+	if (offset + width > record_size) {
+		printlg(ERROR_LEVEL,
+			"Converted field at %u-%u is outside of "
+			"records of size %u.\n",
+			(unsigned) offset, (unsigned) (offset + width),
+			(unsigned) record_size);
+		return FSERR_OUT_OF_STRUCT;
+	}
+
+	return FS_NO_ERROR;
+}
+
+/*
+ * the number of leading records whose field can be gathered
+ * as a whole number of lanes,
+ * without the gathered loads reading past the end of the chunk
+ * records:	the chunk holding the array of records
+ * record_size:	the distance between records
+ * offset:	the location of the field in each record
+ * load_width:	the number of bytes each lane loads, 4 or 8
+ * n_lanes:	the number of records gathered at once
+ */
+static size_t
+gatherable_records(const struct file_struct *records, size_t record_size,
+		   size_t offset, size_t load_width, size_t n_lanes)
+{
+	size_t n_records;
+
+	if (offset + load_width > records->size ||
+	    !fits_gather(record_size, offset, n_lanes)) {
+		return 0;
+	}
+	n_records = (records->size - offset - load_width) / record_size + 1;
+
+	return n_records - n_records % n_lanes;
+}
+
+#ifdef FS_HAVE_AVX2
+/*
+ * Convert an integer field of 1 to 4 bytes of consecutive records
+ * to 4 or 8-byte integers with AVX2.
+ * dst:		the destination array
+ * dst_width:	the number of bytes of each destination integer, 4 or 8
+ * data:	the start of the first record
+ * record_size:	the distance between records
+ * field:	the description of the field
+ * n_records:	the number of records, which must be a multiple of 8
+ */
+FS_AVX2_TARGET static void
+convert_avx2_32(uint8_t *dst, size_t dst_width, const uint8_t *data,
+		size_t record_size, const struct fs_int_field *field,
+		size_t n_records)
+{
+	const int swap = field->endianness != machine_endianness();
+	const unsigned unused_bits = 32 - 8 * field->width;
+	const __m128i shift = _mm_cvtsi32_si128(unused_bits);
+	const __m256i offsets = gather_offsets32(record_size, field->offset);
+	const __m256i mask = _mm256_set1_epi32(
+		(int) (UINT32_MAX >> unused_bits));
+	const __m256i sign = _mm256_set1_epi32(
+		(int) ((uint32_t) 1 << (8 * field->width - 1)));
+	size_t record_i;
+
+	for (record_i = 0; record_i < n_records; record_i += 8) {
+		__m256i lanes = gather_fields32(data + record_i * record_size,
+						offsets, swap);
+
+		/* The field is in the high bytes once big-endian is swapped. */
+		lanes = swap ? _mm256_srl_epi32(lanes, shift) :
+			       _mm256_and_si256(lanes, mask);
+		if (field->is_signed) {
+			lanes = _mm256_sub_epi32(_mm256_xor_si256(lanes, sign),
+						 sign);
+		}
+
+		if (dst_width == sizeof(uint32_t)) {
+			_mm256_storeu_si256((__m256i *) dst, lanes);
+		} else {
+			__m128i low = _mm256_castsi256_si128(lanes);
+			__m128i high = _mm256_extracti128_si256(lanes, 1);
+
+			_mm256_storeu_si256((__m256i *) dst,
+					    field->is_signed ?
+					    _mm256_cvtepi32_epi64(low) :
+					    _mm256_cvtepu32_epi64(low));
+			_mm256_storeu_si256((__m256i *) (dst + 32),
+					    field->is_signed ?
+					    _mm256_cvtepi32_epi64(high) :
+					    _mm256_cvtepu32_epi64(high));
+		}
+		dst += 8 * dst_width;
+	}
+}
+
+/*
+ * Convert an integer field of 5 to 8 bytes of consecutive records
+ * to 4 or 8-byte integers with AVX2.
+ * dst:		the destination array
+ * dst_width:	the number of bytes of each destination integer, 4 or 8
+ * data:	the start of the first record
+ * record_size:	the distance between records
+ * field:	the description of the field
+ * n_records:	the number of records, which must be a multiple of 4
+ */
+FS_AVX2_TARGET static void
+convert_avx2_64(uint8_t *dst, size_t dst_width, const uint8_t *data,
+		size_t record_size, const struct fs_int_field *field,
+		size_t n_records)
+{
+	const int swap = field->endianness != machine_endianness();
+	const unsigned unused_bits = 64 - 8 * field->width;
+	const __m128i shift = _mm_cvtsi32_si128(unused_bits);
+	const __m128i offsets = gather_offsets64(record_size, field->offset);
+	const __m256i mask = _mm256_set1_epi64x(
+		(long long) (UINT64_MAX >> unused_bits));
+	const __m256i sign = _mm256_set1_epi64x(
+		(long long) ((uint64_t) 1 << (8 * field->width - 1)));
+	const __m256i evens = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+	size_t record_i;
+
+	for (record_i = 0; record_i < n_records; record_i += 4) {
+		__m256i lanes = gather_fields64(data + record_i * record_size,
+						offsets, swap);
+
+		lanes = swap ? _mm256_srl_epi64(lanes, shift) :
+			       _mm256_and_si256(lanes, mask);
+		if (field->is_signed) {
+			lanes = _mm256_sub_epi64(_mm256_xor_si256(lanes, sign),
+						 sign);
+		}
+
+		if (dst_width == sizeof(uint64_t)) {
+			_mm256_storeu_si256((__m256i *) dst, lanes);
+		} else {
+			lanes = _mm256_permutevar8x32_epi32(lanes, evens);
+			_mm_storeu_si128((__m128i *) dst,
+					 _mm256_castsi256_si128(lanes));
+		}
+		dst += 4 * dst_width;
+	}
+}
+
+/*
+ * Convert a "float" field of consecutive records
+ * to "float"s or "double"s with AVX2.
+ * dst:		the destination array
+ * dst_width:	the size of each destination number
+ * data:	the start of the first record
+ * record_size:	the distance between records
+ * offset:	the location of the field in each record
+ * swap:	nonzero to reverse the bytes of each field
+ * n_records:	the number of records, which must be a multiple of 8
+ */
+FS_AVX2_TARGET static void
+convert_avx2_float(uint8_t *dst, size_t dst_width, const uint8_t *data,
+		   size_t record_size, size_t offset, int swap,
+		   size_t n_records)
+{
+	const __m256i offsets = gather_offsets32(record_size, offset);
+	size_t record_i;
+
+	for (record_i = 0; record_i < n_records; record_i += 8) {
+		__m256 lanes = _mm256_castsi256_ps(
+			gather_fields32(data + record_i * record_size,
+					offsets, swap));
+
+		if (dst_width == sizeof(float)) {
+			_mm256_storeu_ps((float *) dst, lanes);
+		} else {
+			_mm256_storeu_pd((double *) dst, _mm256_cvtps_pd(
+				_mm256_castps256_ps128(lanes)));
+			_mm256_storeu_pd((double *) (dst + 32),
+					 _mm256_cvtps_pd(
+					 _mm256_extractf128_ps(lanes, 1)));
+		}
+		dst += 8 * dst_width;
+	}
+}
+
+/*
+ * Convert a "double" field of consecutive records
+ * to "float"s or "double"s with AVX2.
+ * dst:		the destination array
+ * dst_width:	the size of each destination number
+ * data:	the start of the first record
+ * record_size:	the distance between records
+ * offset:	the location of the field in each record
+ * swap:	nonzero to reverse the bytes of each field
+ * n_records:	the number of records, which must be a multiple of 4
+ */
+FS_AVX2_TARGET static void
+convert_avx2_double(uint8_t *dst, size_t dst_width, const uint8_t *data,
+		    size_t record_size, size_t offset, int swap,
+		    size_t n_records)
+{
+	const __m128i offsets = gather_offsets64(record_size, offset);
+	size_t record_i;
+
+	for (record_i = 0; record_i < n_records; record_i += 4) {
+		__m256d lanes = _mm256_castsi256_pd(
+			gather_fields64(data + record_i * record_size,
+					offsets, swap));
+
+		if (dst_width == sizeof(double)) {
+			_mm256_storeu_pd((double *) dst, lanes);
+		} else {
+			_mm_storeu_ps((float *) dst, _mm256_cvtpd_ps(lanes));
+		}
+		dst += 4 * dst_width;
+	}
+}
+#endif
+
+enum fs_status
+extract_int_field(struct file_struct *records, size_t record_size,
+		  const struct fs_int_field *field, void *dst,
+		  size_t dst_width)
+{
+	const uint8_t *data = records->data;
+	uint8_t *dst_bytes = dst;
+	size_t n_records, record_i = 0;
+	enum fs_status status;
+
+	debug_assert(record_size > 0);
+	debug_assert(field->width >= 1 && field->width <= 8);
+	debug_assert(dst_width >= 1 && dst_width <= 8);
+	if ((status = check_field(field->offset, field->width, record_size))) {
+		return status;
+	}
+	n_records = records->size / record_size;
+
+#ifdef FS_HAVE_AVX2
+	if ((dst_width == sizeof(uint32_t) || dst_width == sizeof(uint64_t)) &&
+	    fs_has_avx2()) {
+		if (field->width <= sizeof(uint32_t)) {
+			record_i = gatherable_records(records, record_size,
+						      field->offset,
+						      sizeof(uint32_t), 8);
+			convert_avx2_32(dst_bytes, dst_width, data,
+					record_size, field, record_i);
+		} else {
+			record_i = gatherable_records(records, record_size,
+						      field->offset,
+						      sizeof(uint64_t), 4);
+			convert_avx2_64(dst_bytes, dst_width, data,
+					record_size, field, record_i);
+		}
+	}
+#endif
+
+	for (; record_i < n_records; record_i++) {
+		convert_int(dst_bytes + record_i * dst_width, dst_width,
+			    data + record_i * record_size + field->offset,
+			    field->width, field->endianness, field->is_signed);
+	}
+
+	return FS_NO_ERROR;
+}
+
+enum fs_status
+extract_float_field(struct file_struct *records, size_t record_size,
+		    size_t offset, size_t src_width,
+		    enum endianness endianness, void *dst, size_t dst_width)
+{
+	const uint8_t *data = records->data;
+	uint8_t *dst_bytes = dst;
+	size_t n_records, record_i = 0;
+	enum fs_status status;
+
+	debug_assert(record_size > 0);
+	debug_assert(src_width == sizeof(float) ||
+		     src_width == sizeof(double));
+	debug_assert(dst_width == sizeof(float) ||
+		     dst_width == sizeof(double));
+	if ((status = check_field(offset, src_width, record_size))) {
+		return status;
+	}
+	n_records = records->size / record_size;
+
+#ifdef FS_HAVE_AVX2
+	if (fs_has_avx2()) {
+		const int swap = endianness != machine_endianness();
+
+		if (src_width == sizeof(float)) {
+			record_i = gatherable_records(records, record_size,
+						      offset, src_width, 8);
+			convert_avx2_float(dst_bytes, dst_width, data,
+					   record_size, offset, swap,
+					   record_i);
+		} else {
+			record_i = gatherable_records(records, record_size,
+						      offset, src_width, 4);
+			convert_avx2_double(dst_bytes, dst_width, data,
+					    record_size, offset, swap,
+					    record_i);
+		}
+	}
+#endif
+
+	for (; record_i < n_records; record_i++) {
+		convert_float(dst_bytes + record_i * dst_width, dst_width,
+			      data + record_i * record_size + offset,
+			      src_width, endianness);
+	}
+
+	return FS_NO_ERROR;
+}
@@ -0,0 +1,199 @@
+#include <file_batch.h>
+#include <logger.h>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+/* a request, with its range and its place in the caller's order */
+struct sorted_request {
+	off_t start;
+	off_t end;
+	size_t request_i;
+};
+
+static int compare_requests(const void *a, const void *b)
+{
+	const struct sorted_request *request_a = a, *request_b = b;
+
+	if (request_a->start != request_b->start) {
+		return request_a->start < request_b->start ? -1 : 1;
+	}
+	return (request_a->end > request_b->end) -
+	       (request_a->end < request_b->end);
+}
+
+/*
+ * Sort the requests by their location in the file, checking their ranges.
+ * src_file:	the source wrapper
+ * requests:	the requests, in the caller's order
+ * n_requests:	the number of requests
+ * sorted:	will be filled with the sorted requests
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_FILE if any request is beyond the file
+ */
+static enum fs_status
+sort_requests(const struct file_structor *src_file,
+	      const struct chunk_request *requests, size_t n_requests,
+	      struct sorted_request *sorted)
+{
+	size_t request_i;
+
+	for (request_i = 0; request_i < n_requests; request_i++) {
+		const struct chunk_request *request = &requests[request_i];
+
+		if (request->start_in_file < 0 || request->size < 0 ||
+		    request->start_in_file + request->size > src_file->size) {
+			printlg(ERROR_LEVEL,
+				"Requesting struct chunk in %u-%u, "
+				"but file only has data up to %u.\n",
+				(unsigned) request->start_in_file,
+				(unsigned) (request->start_in_file +
+					    request->size),
+				(unsigned) src_file->size);
+			return FSERR_OUT_OF_FILE;
+		}
+		sorted[request_i].start = request->start_in_file;
+		sorted[request_i].end = request->start_in_file + request->size;
+		sorted[request_i].request_i = request_i;
+	}
+	qsort(sorted, n_requests, sizeof(*sorted), compare_requests);
+
+	return FS_NO_ERROR;
+}
+
+/*
+ * Map a run of sorted requests, and derive their chunks from the mapping.
+ * mapping:	the mapping to initialize
+ * src_file:	the source wrapper
+ * run:		the first sorted request of the run
+ * n_run:	the number of requests in the run
+ * end:		the end of the furthest request in the run
+ * chunks:	the chunks of the caller, in the caller's order
+ * returns	the status from "init_file_struct"
+ */
+static enum fs_status
+map_run(struct file_struct *mapping, struct file_structor *src_file,
+	const struct sorted_request *run, size_t n_run, off_t end,
+	struct file_struct *chunks)
+{
+	enum fs_status status;
+	size_t run_i;
+
+	/*
+	 * Empty runs are given one byte, since "mmap" needs one,
+	 * unless they are at the end of the file,
+	 * where they are left with no data, like a torn down chunk.
+	 */
+	if (end == run->start && end < src_file->size) {
+		end++;
+	}
+	if (end == run->start) {
+		mapping->src_file = src_file;
+		mapping->size = 0;
+		mapping->start_in_file = run->start;
+		mapping->data = NULL;
+		mapping->mapping_start = NULL;
+	} else if ((status = init_file_struct(mapping, src_file,
+					      end - run->start,
+					      run->start))) {
+		return status;
+	}
+
+	for (run_i = 0; run_i < n_run; run_i++) {
+		derive_file_struct(&chunks[run[run_i].request_i], mapping,
+				   run[run_i].end - run[run_i].start,
+				   run[run_i].start - run->start);
+	}
+
+	return FS_NO_ERROR;
+}
+
+enum fs_status
+init_file_batch(struct file_batch *to_init, struct file_structor *src_file,
+		const struct chunk_request *requests, size_t n_requests,
+		struct file_struct *chunks, size_t max_gap)
+{
+	const off_t page_size = sysconf(_SC_PAGE_SIZE);
+	struct sorted_request *sorted;
+	enum fs_status status;
+	size_t run_start = 0, request_i;
+	off_t run_end;
+
+	to_init->n_mappings = 0;
+	to_init->mappings = NULL;
+	if (n_requests == 0) {
+		return FS_NO_ERROR;
+	}
+
+	sorted = malloc(sizeof(*sorted) * n_requests);
+	/* There are at most as many mappings as requests. */
+	to_init->mappings = malloc(sizeof(*to_init->mappings) * n_requests);
+	if (sorted == NULL || to_init->mappings == NULL) {
+		printlg(ERROR_LEVEL, "Unable to allocate a batch of %u.\n",
+			(unsigned) n_requests);
+		free(sorted);
+		free(to_init->mappings);
+		to_init->mappings = NULL;
+		return FSERR_ERRNO;
+	}
+	if ((status = sort_requests(src_file, requests, n_requests, sorted))) {
+		free(sorted);
+		free(to_init->mappings);
+		to_init->mappings = NULL;
+		return status;
+	}
+
+	run_end = sorted[0].end;
+	for (request_i = 1; request_i <= n_requests; request_i++) {
+		off_t mapped_end = (run_end + page_size - 1) / page_size *
+				   page_size;
+
+		if (request_i < n_requests &&
+		    sorted[request_i].start / page_size * page_size <=
+		    mapped_end + (off_t) max_gap) {
+			if (sorted[request_i].end > run_end) {
+				run_end = sorted[request_i].end;
+			}
+			continue;
+		}
+
+		if ((status = map_run(&to_init->mappings[to_init->n_mappings],
+				      src_file, &sorted[run_start],
+				      request_i - run_start, run_end,
+				      chunks))) {
+			teardown_file_batch(to_init);
+			free(sorted);
+			return status;
+		}
+		to_init->n_mappings++;
+
+		if (request_i < n_requests) {
+			run_start = request_i;
+			run_end = sorted[request_i].end;
+		}
+	}
+
+	free(sorted);
+
+	return FS_NO_ERROR;
+}
+
+enum fs_status teardown_file_batch(struct file_batch *to_teardown)
+{
+	enum fs_status status = FS_NO_ERROR, mapping_status;
+	size_t mapping_i;
+
+	for (mapping_i = 0; mapping_i < to_teardown->n_mappings;
+	     mapping_i++) {
+		mapping_status =
+			teardown_file_struct(&to_teardown->mappings[mapping_i]);
+		if (status == FS_NO_ERROR) {
+			status = mapping_status;
+		}
+	}
+	free(to_teardown->mappings);
+	to_teardown->mappings = NULL;
+	to_teardown->n_mappings = 0;
+
+	return status;
+}
@@ -0,0 +1,173 @@
+#include <file_chase.h>
+#include <logger.h>
+
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* the largest number of cache lines to prefetch from each target struct */
+#define MAX_PREFETCH_LINES	4
+/* the assumed size of a cache line */
+#define CACHE_LINE_SIZE		64
+
+/*
+ * Find where an offset field points to in the root chunk.
+ * root:	the chunk containing both structs
+ * from:	the chunk containing the offset field
+ * link:	the description of the offset field
+ * target:	will be set to the location of the target in "root"
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if the offset field is outside of "from",
+ *			or the target struct is outside of "root"
+ */
+static enum fs_status
+locate_link_target(struct file_struct *root, struct file_struct *from,
+		   const struct chase_link *link, off_t *target)
+{
+	off_t from_start = from->start_in_file - root->start_in_file;
+	off_t base;
+	int64_t offset;
+
+	if (link->field.offset + link->field.width > from->size) {
+		printlg(ERROR_LEVEL,
+			"Offset field at %u-%u is outside of "
+			"struct of size %u.\n",
+			(unsigned) link->field.offset,
+			(unsigned) (link->field.offset + link->field.width),
+			(unsigned) from->size);
+		return FSERR_OUT_OF_STRUCT;
+	}
+	offset = (int64_t) load_int_field(from->data, &link->field);
+
+	switch (link->base) {
+	case CHASE_FROM_FIELD:
+		base = from_start + link->field.offset;
+		break;
+	case CHASE_FROM_STRUCT:
+		base = from_start;
+		break;
+	default:
+		base = 0;
+		break;
+	}
+
+	*target = base + offset;
+	if (*target < 0 ||
+	    (uint64_t) (*target + link->target_size) > root->size) {
+		printlg(ERROR_LEVEL,
+			"Offset points to %lld-%lld, "
+			"but root chunk only has data up to %u.\n",
+			(long long) *target,
+			(long long) (*target + link->target_size),
+			(unsigned) root->size);
+		return FSERR_OUT_OF_STRUCT;
+	}
+
+	return FS_NO_ERROR;
+}
+
+enum fs_status
+follow_file_struct(struct file_struct *to_init, struct file_struct *root,
+		   struct file_struct *from, const struct chase_link *link)
+{
+	off_t target;
+	enum fs_status status;
+
+	if ((status = locate_link_target(root, from, link, &target))) {
+		return status;
+	}
+
+	return derive_file_struct(to_init, root, link->target_size, target);
+}
+
+/*
+ * Prefetch the start of the next struct of a traversal.
+ * root:	the chunk containing the struct
+ * start:	the location of the struct in "root"
+ * size:	the size of the struct
+ * flags:	the "enum chase_flags" choosing how far to prefetch
+ */
+static void
+prefetch_target(struct file_struct *root, off_t start, off_t size, int flags)
+{
+	uint8_t *target = (uint8_t *) root->data + start;
+	off_t n_lines = (size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE;
+	off_t line_i;
+
+	if (flags & CHASE_PREFETCH_PAGES) {
+		uintptr_t page_size = sysconf(_SC_PAGE_SIZE);
+		uintptr_t page_start = (uintptr_t) target & ~(page_size - 1);
+		uintptr_t page_end = (uintptr_t) target + size;
+
+		madvise((void *) page_start, page_end - page_start,
+			MADV_WILLNEED);
+	}
+
+	if (n_lines > MAX_PREFETCH_LINES) {
+		n_lines = MAX_PREFETCH_LINES;
+	}
+	for (line_i = 0; line_i < n_lines; line_i++) {
+		__builtin_prefetch(target + line_i * CACHE_LINE_SIZE, 0, 0);
+	}
+}
+
+enum fs_status
+run_file_chases(struct file_struct *root, struct file_chase *chases,
+		size_t n_chases, chase_step_fn step, int flags)
+{
+	enum fs_status first_status = FS_NO_ERROR;
+	size_t n_active = 0, chase_i;
+
+	for (chase_i = 0; chase_i < n_chases; chase_i++) {
+		struct file_chase *chase = &chases[chase_i];
+
+		chase->status = FS_NO_ERROR;
+		chase->next_link = step(chase);
+		if (chase->next_link != NULL) {
+			n_active++;
+		}
+	}
+
+	while (n_active > 0) {
+		/* Locate and prefetch every next struct before using any. */
+		for (chase_i = 0; chase_i < n_chases; chase_i++) {
+			struct file_chase *chase = &chases[chase_i];
+
+			if (chase->next_link == NULL) {
+				continue;
+			}
+			if ((chase->status =
+			     locate_link_target(root, &chase->current,
+						chase->next_link,
+						&chase->next_start))) {
+				continue;
+			}
+			prefetch_target(root, chase->next_start,
+					chase->next_link->target_size, flags);
+		}
+
+		/* Then move every traversal, and choose its next link. */
+		for (chase_i = 0; chase_i < n_chases; chase_i++) {
+			struct file_chase *chase = &chases[chase_i];
+
+			if (chase->next_link == NULL) {
+				continue;
+			}
+			if (chase->status == FS_NO_ERROR) {
+				derive_file_struct(&chase->current, root,
+						   chase->next_link->target_size,
+						   chase->next_start);
+				chase->next_link = step(chase);
+			} else {
+				chase->next_link = NULL;
+				if (first_status == FS_NO_ERROR) {
+					first_status = chase->status;
+				}
+			}
+			if (chase->next_link == NULL) {
+				n_active--;
+			}
+		}
+	}
+
+	return first_status;
+}
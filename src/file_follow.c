@@ -0,0 +1,195 @@
+#include <file_follow.h>
+#include <fs_common.h>
+#include <logger.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <time.h>
+#include <unistd.h>
+
+/* the size of the buffer for draining inotify events */
+#define EVENT_BUFFER_SIZE	4096
+
+enum fs_status
+init_file_follower(struct file_follower *to_init,
+		   struct file_structor *src_file, const char *path,
+		   off_t start_in_file, size_t record_size)
+{
+	debug_assert(record_size > 0);
+
+	to_init->src_file = src_file;
+	to_init->start_in_file = start_in_file;
+	to_init->record_size = record_size;
+	to_init->records.data = NULL;
+	to_init->records.mapping_start = NULL;
+	to_init->n_records = 0;
+	to_init->n_returned = 0;
+	to_init->inotify_fd = -1;
+
+	if (path != NULL) {
+		to_init->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (to_init->inotify_fd < 0 ||
+		    inotify_add_watch(to_init->inotify_fd, path,
+				      IN_MODIFY | IN_CLOSE_WRITE) < 0) {
+			printlg(ERROR_LEVEL, "Unable to watch file %s: %d\n",
+				path, errno);
+			if (to_init->inotify_fd >= 0) {
+				close(to_init->inotify_fd);
+				to_init->inotify_fd = -1;
+			}
+			return FSERR_ERRNO;
+		}
+	}
+
+	return FS_NO_ERROR;
+}
+
+enum fs_status teardown_file_follower(struct file_follower *to_teardown)
+{
+	if (to_teardown->inotify_fd >= 0) {
+		close(to_teardown->inotify_fd);
+		to_teardown->inotify_fd = -1;
+	}
+	to_teardown->n_records = 0;
+	to_teardown->n_returned = 0;
+
+	return teardown_file_struct(&to_teardown->records);
+}
+
+/*
+ * Refresh the size of the file,
+ * and map or extend the mapping to every complete record.
+ * follower:	the follower of the file
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_FILE if the file was truncated;
+ *		FSERR_ERRNO if "fstat", "mmap" or "mremap" failed
+ */
+static enum fs_status update_records(struct file_follower *follower)
+{
+	struct file_structor *src_file = follower->src_file;
+	enum fs_status status;
+	size_t n_records = 0;
+
+	if ((status = refresh_file_structor(src_file))) {
+		return status;
+	}
+	if (follower->records.mapping_start == NULL &&
+	    src_file->memory == NULL) {
+		/* The refresh dropped the copy the records pointed into. */
+		teardown_file_struct(&follower->records);
+	}
+	if (src_file->size > follower->start_in_file) {
+		n_records = (src_file->size - follower->start_in_file) /
+			    follower->record_size;
+	}
+
+	if (n_records < follower->n_records) {
+		printlg(ERROR_LEVEL,
+			"The followed file was truncated from %u records to "
+			"%u.\n", (unsigned) follower->n_records,
+			(unsigned) n_records);
+		return FSERR_OUT_OF_FILE;
+	} else if (n_records == follower->n_records) {
+		return FS_NO_ERROR;
+	}
+
+	if (follower->records.data == NULL) {
+		status = init_file_struct(&follower->records, src_file,
+					  n_records * follower->record_size,
+					  follower->start_in_file);
+	} else {
+		status = extend_file_struct(&follower->records,
+					    n_records * follower->record_size);
+	}
+	if (status == FS_NO_ERROR) {
+		follower->n_records = n_records;
+	}
+
+	return status;
+}
+
+/*
+ * Wait until the file may have been written,
+ * with inotify if the follower has it, or by sleeping for a poll interval.
+ * follower:	the follower of the file
+ * timeout_ms:	the longest time to wait, or "FOLLOW_FOREVER"
+ * returns	FS_NO_ERROR on success, including timeouts;
+ *		FSERR_ERRNO if "poll" or "read" failed
+ */
+static enum fs_status wait_for_write(struct file_follower *follower,
+				     int timeout_ms)
+{
+	if (follower->inotify_fd < 0) {
+		struct timespec interval;
+
+		if (timeout_ms == FOLLOW_FOREVER ||
+		    timeout_ms > FOLLOW_POLL_MS) {
+			timeout_ms = FOLLOW_POLL_MS;
+		}
+		interval.tv_sec = 0;
+		interval.tv_nsec = (long) timeout_ms * 1000000;
+		nanosleep(&interval, NULL);
+	} else {
+		struct pollfd watch = { follower->inotify_fd, POLLIN, 0 };
+		char events[EVENT_BUFFER_SIZE];
+
+		if (poll(&watch, 1, timeout_ms) < 0 && errno != EINTR) {
+			printlg(ERROR_LEVEL, "Unable to wait for inotify: %d\n",
+				errno);
+			return FSERR_ERRNO;
+		}
+		/* Drain the events, since the size is what matters. */
+		while (read(follower->inotify_fd, events, sizeof(events)) > 0) {
+		}
+		if (errno != EAGAIN && errno != EINTR) {
+			printlg(ERROR_LEVEL, "Unable to read inotify: %d\n",
+				errno);
+			return FSERR_ERRNO;
+		}
+	}
+
+	return FS_NO_ERROR;
+}
+
+enum fs_status
+follow_records(struct file_follower *follower, int timeout_ms,
+	       struct file_struct *batch, size_t *n_new)
+{
+	/* in milliseconds of the monotonic clock */
+	const int64_t deadline = (int64_t) (now_ns() / 1000000) +
+				 (timeout_ms > 0 ? timeout_ms : 0);
+	enum fs_status status;
+
+	*n_new = 0;
+	for (;;) {
+		int64_t remaining;
+
+		if ((status = update_records(follower))) {
+			return status;
+		}
+		if (follower->n_records > follower->n_returned) {
+			break;
+		}
+
+		if (timeout_ms == FOLLOW_FOREVER) {
+			remaining = FOLLOW_FOREVER;
+		} else {
+			remaining = deadline - (int64_t) (now_ns() / 1000000);
+			if (remaining <= 0) {
+				return FS_NO_ERROR;
+			}
+		}
+		if ((status = wait_for_write(follower, remaining))) {
+			return status;
+		}
+	}
+
+	*n_new = follower->n_records - follower->n_returned;
+	derive_file_struct(batch, &follower->records,
+			   *n_new * follower->record_size,
+			   follower->n_returned * follower->record_size);
+	follower->n_returned = follower->n_records;
+
+	return FS_NO_ERROR;
+}
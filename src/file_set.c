@@ -0,0 +1,364 @@
+#include <file_set.h>
+#include <fs_parallel.h>
+#include <logger.h>
+
+#include <stdlib.h>
+#include <errno.h>
+#include <glob.h>
+
+/* the number of paths each thread opens before claiming more */
+#define OPEN_BATCH	64
+
+/* the shared state of the threads opening a set */
+struct open_work {
+	/* the set being opened */
+	struct file_set *set;
+	/* the paths of the shards */
+	const char *const *paths;
+	/* the index of the next path to open */
+	size_t next;
+	/* the first error, and the errno that came with it */
+	enum fs_status status;
+	int saved_errno;
+};
+
+/*
+ * Keep an error from opening a shard, with its errno,
+ * unless another shard already failed.
+ * work:	the shared state of the threads
+ * status:	the error
+ */
+static void save_open_error(struct open_work *work, enum fs_status status)
+{
+	enum fs_status no_error = FS_NO_ERROR;
+	int open_errno = errno;
+
+	if (__atomic_compare_exchange_n(&work->status, &no_error, status, 0,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		work->saved_errno = open_errno;
+	}
+}
+
+/*
+ * the worker for "open_file_set", which opens batches of shards
+ * until there are none left, or any opening failed
+ */
+static enum fs_status open_shards(void *arg, unsigned worker_i)
+{
+	struct open_work *work = arg;
+	size_t start, n_claimed;
+
+	(void) worker_i;
+
+	while ((n_claimed = claim_work(&work->next, work->set->n_files,
+				       OPEN_BATCH, &start))) {
+		size_t file_i;
+
+		for (file_i = start; file_i < start + n_claimed; file_i++) {
+			enum fs_status status;
+
+			if (__atomic_load_n(&work->status, __ATOMIC_RELAXED)) {
+				return FS_NO_ERROR;
+			}
+			status = open_file_structor(&work->set->files[file_i],
+						    work->paths[file_i]);
+			if (status) {
+				save_open_error(work, status);
+				return FS_NO_ERROR;
+			}
+		}
+	}
+
+	return FS_NO_ERROR;
+}
+
+/*
+ * Close every shard that has been opened, and free the arrays of the set.
+ * set:		the set to release
+ * returns	FS_NO_ERROR on success,
+ *		or the first error from "close_file_structor"
+ */
+static enum fs_status release_file_set(struct file_set *set)
+{
+	enum fs_status status = FS_NO_ERROR;
+	size_t file_i;
+
+	if (set->files != NULL) {
+		for (file_i = 0; file_i < set->n_files; file_i++) {
+			enum fs_status close_status;
+
+			close_status = close_file_structor(&set->files[file_i]);
+			if (status == FS_NO_ERROR) {
+				status = close_status;
+			}
+		}
+	}
+	free(set->files);
+	free(set->starts);
+	set->files = NULL;
+	set->starts = NULL;
+	set->n_files = 0;
+	set->size = 0;
+
+	return status;
+}
+
+enum fs_status
+open_file_set(struct file_set *to_open, const char *const *paths,
+	      size_t n_paths, unsigned n_threads)
+{
+	struct open_work work;
+	size_t file_i;
+	off_t logical_start = 0;
+
+	to_open->n_files = n_paths;
+	to_open->size = 0;
+	to_open->files = malloc(sizeof(*to_open->files) * (n_paths + 1));
+	to_open->starts = malloc(sizeof(*to_open->starts) * (n_paths + 1));
+	if (to_open->files == NULL || to_open->starts == NULL) {
+		printlg(ERROR_LEVEL, "Unable to allocate a set of %u files.\n",
+			(unsigned) n_paths);
+		free(to_open->files);
+		free(to_open->starts);
+		to_open->files = NULL;
+		to_open->starts = NULL;
+		to_open->n_files = 0;
+		return FSERR_ERRNO;
+	}
+	for (file_i = 0; file_i < n_paths; file_i++) {
+		init_closed_file_structor(&to_open->files[file_i]);
+	}
+
+	work.set = to_open;
+	work.paths = paths;
+	work.next = 0;
+	work.status = FS_NO_ERROR;
+	work.saved_errno = 0;
+	if (n_paths < OPEN_BATCH * 2) {
+		n_threads = 1;
+	}
+	run_parallel(n_threads, open_shards, &work);
+
+	if (work.status) {
+		release_file_set(to_open);
+		errno = work.saved_errno;
+		return work.status;
+	}
+
+	for (file_i = 0; file_i < n_paths; file_i++) {
+		to_open->starts[file_i] = logical_start;
+		logical_start += to_open->files[file_i].size;
+	}
+	to_open->starts[n_paths] = logical_start;
+	to_open->size = logical_start;
+
+	return FS_NO_ERROR;
+}
+
+enum fs_status
+open_file_set_glob(struct file_set *to_open, const char *pattern,
+		   unsigned n_threads)
+{
+	glob_t matches;
+	enum fs_status status;
+	int glob_status = glob(pattern, 0, NULL, &matches);
+
+	if (glob_status) {
+		printlg(ERROR_LEVEL, "No files could be found matching %s.\n",
+			pattern);
+		if (glob_status == GLOB_NOSPACE) {
+			errno = ENOMEM;
+		} else if (glob_status == GLOB_NOMATCH) {
+			errno = ENOENT;
+		}
+		globfree(&matches);
+		return FSERR_ERRNO;
+	}
+
+	status = open_file_set(to_open, (const char *const *) matches.gl_pathv,
+			       matches.gl_pathc, n_threads);
+	globfree(&matches);
+
+	return status;
+}
+
+enum fs_status close_file_set(struct file_set *to_close)
+{
+	return release_file_set(to_close);
+}
+
+enum fs_status
+locate_in_file_set(struct file_set *set, off_t logical_start, size_t *file_i,
+		   off_t *start_in_file)
+{
+	size_t low = 0, high = set->n_files;
+
+	if (logical_start < 0 || logical_start >= set->size) {
+		printlg(ERROR_LEVEL,
+			"Requesting logical offset %llu, "
+			"but set only has data up to %llu.\n",
+			(unsigned long long) logical_start,
+			(unsigned long long) set->size);
+		return FSERR_OUT_OF_FILE;
+	}
+
+	/* find the last shard starting at or before the offset */
+	while (high - low > 1) {
+		size_t middle = low + (high - low) / 2;
+
+		if (set->starts[middle] <= logical_start) {
+			low = middle;
+		} else {
+			high = middle;
+		}
+	}
+	/* skip past any empty shards starting at the same offset */
+	while (set->starts[low + 1] <= logical_start) {
+		low++;
+	}
+
+	*file_i = low;
+	*start_in_file = logical_start - set->starts[low];
+
+	return FS_NO_ERROR;
+}
+
+enum fs_status
+init_file_set_struct(struct file_struct *to_init, struct file_set *set,
+		     off_t size, off_t logical_start)
+{
+	size_t file_i;
+	off_t start_in_file;
+	enum fs_status status;
+
+	if ((status = locate_in_file_set(set, logical_start, &file_i,
+					 &start_in_file))) {
+		return status;
+	}
+	if (logical_start + size > set->starts[file_i + 1]) {
+		if (logical_start + size > set->size) {
+			printlg(ERROR_LEVEL,
+				"Requesting logical chunk in %llu-%llu, "
+				"but set only has data up to %llu.\n",
+				(unsigned long long) logical_start,
+				(unsigned long long) (logical_start + size),
+				(unsigned long long) set->size);
+			return FSERR_OUT_OF_FILE;
+		}
+		printlg(ERROR_LEVEL,
+			"Logical chunk in %llu-%llu crosses the end "
+			"of shard %u at %llu.\n",
+			(unsigned long long) logical_start,
+			(unsigned long long) (logical_start + size),
+			(unsigned) file_i,
+			(unsigned long long) set->starts[file_i + 1]);
+		return FSERR_SPANS_FILES;
+	}
+
+	return init_file_struct(to_init, &set->files[file_i], size,
+				start_in_file);
+}
+
+/* the shared state of the threads scanning a set */
+struct scan_work {
+	/* the set being scanned */
+	struct file_set *set;
+	/* the size of each record */
+	size_t record_size;
+	/* the visiting function, and its argument */
+	file_set_record_fn visit;
+	void *arg;
+	/* the index of the next shard to scan */
+	size_t next;
+	/* set once any thread fails, to stop the others */
+	int stop;
+};
+
+/*
+ * Visit every record in a single shard.
+ * work:	the state of the scan
+ * file_i:	the index of the shard
+ * returns	FS_NO_ERROR on success, or the error stopping the scan
+ */
+static enum fs_status scan_shard(struct scan_work *work, size_t file_i)
+{
+	struct file_structor *shard = &work->set->files[file_i];
+	off_t n_records = shard->size / work->record_size;
+	off_t shard_start = work->set->starts[file_i];
+	struct file_struct mapped_shard;
+	enum fs_status status;
+	off_t record_i;
+
+	if (n_records == 0) {
+		return FS_NO_ERROR;
+	}
+	if ((status = init_file_struct(&mapped_shard, shard,
+				       n_records * work->record_size, 0))) {
+		return status;
+	}
+
+	for (record_i = 0; record_i < n_records; record_i++) {
+		off_t start_in_file = record_i * work->record_size;
+		struct file_struct record;
+
+		if (__atomic_load_n(&work->stop, __ATOMIC_RELAXED)) {
+			break;
+		}
+		derive_file_struct(&record, &mapped_shard, work->record_size,
+				   start_in_file);
+		if ((status = work->visit(&record, shard_start + start_in_file,
+					  work->arg))) {
+			break;
+		}
+	}
+
+	teardown_file_struct(&mapped_shard);
+
+	return status;
+}
+
+/*
+ * the worker for "scan_file_set", which scans one shard at a time
+ * until there are none left, or any scan failed
+ */
+static enum fs_status scan_shards(void *arg, unsigned worker_i)
+{
+	struct scan_work *work = arg;
+	size_t file_i;
+
+	(void) worker_i;
+
+	while (!__atomic_load_n(&work->stop, __ATOMIC_RELAXED) &&
+	       claim_work(&work->next, work->set->n_files, 1, &file_i)) {
+		enum fs_status status;
+
+		if ((status = scan_shard(work, file_i))) {
+			__atomic_store_n(&work->stop, 1, __ATOMIC_RELAXED);
+			return status;
+		}
+	}
+
+	return FS_NO_ERROR;
+}
+
+enum fs_status
+scan_file_set(struct file_set *set, size_t record_size, unsigned n_threads,
+	      file_set_record_fn visit, void *arg)
+{
+	struct scan_work work;
+
+	debug_assert(record_size > 0);
+
+	work.set = set;
+	work.record_size = record_size;
+	work.visit = visit;
+	work.arg = arg;
+	work.next = 0;
+	work.stop = 0;
+	n_threads = fs_thread_count(n_threads);
+	if (n_threads > set->n_files) {
+		n_threads = set->n_files > 0 ? set->n_files : 1;
+	}
+
+	return run_parallel(n_threads, scan_shards, &work);
+}
@@ -1,17 +1,34 @@
 #include <file_structor.h>
+#include <readahead.h>
+#include <io_backend.h>
 #include <logger.h>
 
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
-#include <sys/mman.h>
-#include <errno.h>
 
-enum fs_status
-open_file_structor(struct file_structor *to_open, const char *path)
+void init_closed_file_structor(struct file_structor *to_init)
 {
-	to_open->fd = open(path, O_RDONLY);
+	memset(to_init, 0, sizeof(*to_init));
+	to_init->fd = -1;
+	set_adaptive_readahead(to_init, 0);
+	to_init->backend = get_io_backend(IO_BACKEND_MMAP);
+}
+
+/*
+ * Open a source file with the given flags, and find its size.
+ * to_open:	the source wrapper to initialize
+ * path:	the path of the source file
+ * flags:	the flags to pass to "open"
+ * returns	the same as "open_file_structor"
+ */
+static enum fs_status
+open_with_flags(struct file_structor *to_open, const char *path, int flags)
+{
+	init_closed_file_structor(to_open);
+	to_open->fd = open(path, flags);
 	if (to_open->fd < 0) {
 		printlg(ERROR_LEVEL, "Unable to open file %s.\n", path);
 		return FSERR_ERRNO;
@@ -28,14 +45,44 @@ open_file_structor(struct file_structor *to_open, const char *path)
 		}
 
 		to_open->size = size_stat.st_size;
+		to_open->is_writable = (flags & O_ACCMODE) == O_RDWR;
+		set_adaptive_readahead(to_open, READAHEAD_MAX_DISTANCE);
 
 		return FS_NO_ERROR;
 	}
 }
 
+enum fs_status
+open_file_structor(struct file_structor *to_open, const char *path)
+{
+	return open_with_flags(to_open, path, O_RDONLY);
+}
+
+enum fs_status
+open_writable_file_structor(struct file_structor *to_open, const char *path)
+{
+	return open_with_flags(to_open, path, O_RDWR);
+}
+
+enum fs_status
+open_memory_structor(struct file_structor *to_open, void *memory,
+		     size_t size)
+{
+	init_closed_file_structor(to_open);
+	to_open->size = size;
+	to_open->memory = memory;
+	set_io_backend(to_open, IO_BACKEND_MEMORY);
+
+	return FS_NO_ERROR;
+}
+
 enum fs_status close_file_structor(struct file_structor *to_close)
 {
 	if (to_close->fd < 0) {
+		if (to_close->memory != NULL) {
+			to_close->memory = NULL;
+			to_close->size = 0;
+		}
 		return FS_NO_ERROR;
 	}
 
@@ -45,8 +92,47 @@ enum fs_status close_file_structor(struct file_structor *to_close)
 		return FSERR_ERRNO;
 	}
 
-	to_close->fd = -1;
-	to_close->size = 0;
+	/* The memory of a file is a copy loaded by its backend. */
+	free(to_close->memory);
+	init_closed_file_structor(to_close);
+
+	return FS_NO_ERROR;
+}
+
+enum fs_status refresh_file_structor(struct file_structor *to_refresh)
+{
+	struct stat size_stat;
+	off_t size;
+
+	if (to_refresh->fd < 0) {
+		return FS_NO_ERROR;
+	}
+	if (fstat(to_refresh->fd, &size_stat)) {
+		printlg(ERROR_LEVEL,
+			"Unable to find the size of file descriptor %d.\n",
+			to_refresh->fd);
+		return FSERR_ERRNO;
+	}
+	size = size_stat.st_size > to_refresh->trailer_size ?
+	       size_stat.st_size - to_refresh->trailer_size : 0;
+
+	if (to_refresh->memory != NULL && size != to_refresh->size) {
+		/*
+		 * Choose the backend again, which reloads the copy,
+		 * or maps the file if it grew too large to load automatically.
+		 */
+		const enum io_backend_kind kind = to_refresh->backend->kind;
+		enum fs_status status;
+
+		free(to_refresh->memory);
+		to_refresh->memory = NULL;
+		to_refresh->size = size;
+		if ((status = set_io_backend(to_refresh, kind))) {
+			to_refresh->backend = get_io_backend(IO_BACKEND_MMAP);
+		}
+		return status;
+	}
+	to_refresh->size = size;
 
 	return FS_NO_ERROR;
 }
@@ -55,7 +141,8 @@ enum fs_status
 init_file_struct(struct file_struct *to_init, struct file_structor *src_file,
 		 off_t size, off_t start_in_file)
 {
-	off_t start_adjustment, adjusted_start;
+	const struct io_backend *backend;
+	enum fs_status status;
 
 	if (start_in_file + size > src_file->size) {
 		printlg(ERROR_LEVEL,
@@ -67,25 +154,17 @@ init_file_struct(struct file_struct *to_init, struct file_structor *src_file,
 		return FSERR_OUT_OF_FILE;
 	}
 
-	start_adjustment = start_in_file % sysconf(_SC_PAGE_SIZE);
-	adjusted_start = start_in_file - start_adjustment;
-
-	to_init->mapping_start = mmap(NULL, (size_t) size,
-				      PROT_READ, MAP_SHARED,
-				      src_file->fd, adjusted_start);
+	if (src_file->memory != NULL) {
+		backend = get_io_backend(IO_BACKEND_MEMORY);
+	} else {
+		observe_access(src_file, start_in_file, size);
+		backend = src_file->backend;
+	}
 
-	if (to_init->mapping_start == MAP_FAILED) {
-		printlg(ERROR_LEVEL,
-			"Could not map from file %d to range %u-%u: %d.\n",
-			src_file->fd,
-			(unsigned) start_in_file,
-			(unsigned) (start_in_file + size), errno);
-		to_init->mapping_start = NULL;
-		to_init->data = NULL;
-		return -1;
+	if ((status = backend->map(to_init, src_file, size, start_in_file))) {
+		return status;
 	}
 
-	to_init->data = to_init->mapping_start + start_adjustment;
 	to_init->src_file = src_file;
 	to_init->size = size;
 	to_init->start_in_file = start_in_file;
@@ -116,21 +195,48 @@ derive_file_struct(struct file_struct *to_init, struct file_struct *big_struct,
 	return FS_NO_ERROR;
 }
 
+enum fs_status extend_file_struct(struct file_struct *to_extend, off_t size)
+{
+	if (to_extend->mapping_start == NULL &&
+	    (to_extend->src_file == NULL ||
+	     to_extend->src_file->memory == NULL)) {
+		printlg(ERROR_LEVEL,
+			"Only chunks with their own mapping "
+			"can be extended.\n");
+		return FSERR_OUT_OF_STRUCT;
+	}
+	if (to_extend->start_in_file + size > to_extend->src_file->size) {
+		printlg(ERROR_LEVEL,
+			"Extending struct chunk to %u-%u, "
+			"but file only has data up to %u.\n",
+			(unsigned) to_extend->start_in_file,
+			(unsigned) (to_extend->start_in_file + size),
+			(unsigned) to_extend->src_file->size);
+		return FSERR_OUT_OF_FILE;
+	}
+
+	if (to_extend->mapping_start == NULL) {
+		/* The copy may have been reloaded by a refresh. */
+		to_extend->data = (uint8_t *) to_extend->src_file->memory +
+				  to_extend->start_in_file;
+		to_extend->size = size;
+		return FS_NO_ERROR;
+	}
+
+	return to_extend->backend->extend(to_extend, size);
+}
+
 enum fs_status teardown_file_struct(struct file_struct *to_teardown)
 {
 	if (to_teardown->data == NULL) {
 		return FS_NO_ERROR;
 	} else {
 		if (to_teardown->mapping_start != NULL) {
-			if (munmap(to_teardown->mapping_start,
-				   to_teardown->size)) {
-				printlg(WARNING_LEVEL,
-					"Unable to unmap memory range %p-%p: "
-					"%d\n",
-					to_teardown->data,
-					to_teardown->data + to_teardown->size,
-					errno);
-				return -1;
+			enum fs_status status =
+				to_teardown->backend->release(to_teardown);
+
+			if (status) {
+				return status;
 			}
 			to_teardown->mapping_start = NULL;
 		}
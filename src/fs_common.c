@@ -0,0 +1,67 @@
+#include <fs_common.h>
+#include <logger.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+char *add_suffix(const char *path, const char *suffix)
+{
+	size_t path_length = strlen(path);
+	char *with_suffix = malloc(path_length + strlen(suffix) + 1);
+
+	if (with_suffix != NULL) {
+		memcpy(with_suffix, path, path_length);
+		strcpy(with_suffix + path_length, suffix);
+	}
+
+	return with_suffix;
+}
+
+enum fs_status
+write_all(int fd, const void *buffer, size_t size, off_t offset)
+{
+	const uint8_t *bytes = buffer;
+
+	while (size > 0) {
+		ssize_t written = pwrite(fd, bytes, size, offset);
+
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			printlg(ERROR_LEVEL,
+				"Unable to write to file descriptor %d: %d\n",
+				fd, errno);
+			return FSERR_ERRNO;
+		}
+		bytes += written;
+		size -= written;
+		offset += written;
+	}
+
+	return FS_NO_ERROR;
+}
+
+enum fs_status
+finish_tmp_file(int fd, const char *tmp_path, const char *path,
+		enum fs_status status)
+{
+	if (!status && fsync(fd)) {
+		printlg(ERROR_LEVEL, "Unable to sync %s: %d\n", tmp_path,
+			errno);
+		status = FSERR_ERRNO;
+	}
+	close(fd);
+	if (!status && rename(tmp_path, path)) {
+		printlg(ERROR_LEVEL, "Unable to rename %s: %d\n", tmp_path,
+			errno);
+		status = FSERR_ERRNO;
+	}
+	if (status) {
+		unlink(tmp_path);
+	}
+
+	return status;
+}
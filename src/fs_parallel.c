@@ -0,0 +1,90 @@
+#include <fs_parallel.h>
+#include <logger.h>
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+unsigned fs_thread_count(unsigned n_threads)
+{
+	if (n_threads == 0) {
+		long n_online = sysconf(_SC_NPROCESSORS_ONLN);
+
+		n_threads = n_online > 0 ? (unsigned) n_online : 1;
+	}
+
+	return n_threads;
+}
+
+/* the state of a single thread started by "run_parallel" */
+struct worker_thread {
+	/* the thread running the worker */
+	pthread_t thread;
+	/* the function to run, and its shared argument */
+	fs_worker worker;
+	void *arg;
+	/* the index passed to the worker */
+	unsigned worker_i;
+	/* the value returned by the worker */
+	enum fs_status status;
+};
+
+/*
+ * the "pthread_create" entry point for each worker
+ * thread_arg:	the "struct worker_thread" for this thread
+ * returns	NULL
+ */
+static void *run_worker_thread(void *thread_arg)
+{
+	struct worker_thread *thread = thread_arg;
+
+	thread->status = thread->worker(thread->arg, thread->worker_i);
+
+	return NULL;
+}
+
+enum fs_status run_parallel(unsigned n_threads, fs_worker worker, void *arg)
+{
+	struct worker_thread *threads;
+	unsigned n_started, thread_i;
+	enum fs_status status;
+
+	n_threads = fs_thread_count(n_threads);
+	if (n_threads == 1) {
+		return worker(arg, 0);
+	}
+
+	threads = calloc(n_threads - 1, sizeof(*threads));
+	if (threads == NULL) {
+		printlg(WARNING_LEVEL, "Unable to allocate %u threads; "
+				       "running on one thread.\n", n_threads);
+		return worker(arg, 0);
+	}
+
+	for (n_started = 0; n_started < n_threads - 1; n_started++) {
+		struct worker_thread *thread = &threads[n_started];
+
+		thread->worker = worker;
+		thread->arg = arg;
+		thread->worker_i = n_started + 1;
+		if (pthread_create(&thread->thread, NULL, run_worker_thread,
+				   thread)) {
+			printlg(WARNING_LEVEL,
+				"Could only start %u of %u threads.\n",
+				n_started + 1, n_threads);
+			break;
+		}
+	}
+
+	status = worker(arg, 0);
+
+	for (thread_i = 0; thread_i < n_started; thread_i++) {
+		pthread_join(threads[thread_i].thread, NULL);
+		if (status == FS_NO_ERROR) {
+			status = threads[thread_i].status;
+		}
+	}
+	free(threads);
+
+	return status;
+}
@@ -0,0 +1,60 @@
+#include <fs_queue.h>
+
+#include <stdlib.h>
+
+/* the smallest power of 2 of at least a capacity, and at least 2 */
+static size_t ring_size(size_t capacity)
+{
+	size_t size = 2;
+
+	while (size < capacity) {
+		size *= 2;
+	}
+
+	return size;
+}
+
+enum fs_status init_spsc_queue(struct spsc_queue *to_init, size_t capacity)
+{
+	size_t size = ring_size(capacity);
+
+	to_init->slots = malloc(sizeof(*to_init->slots) * size);
+	if (to_init->slots == NULL) {
+		return FSERR_ERRNO;
+	}
+	to_init->mask = size - 1;
+	to_init->head = 0;
+	to_init->tail = 0;
+
+	return FS_NO_ERROR;
+}
+
+void free_spsc_queue(struct spsc_queue *to_free)
+{
+	free(to_free->slots);
+	to_free->slots = NULL;
+}
+
+enum fs_status init_mpmc_queue(struct mpmc_queue *to_init, size_t capacity)
+{
+	size_t size = ring_size(capacity), cell_i;
+
+	to_init->cells = malloc(sizeof(*to_init->cells) * size);
+	if (to_init->cells == NULL) {
+		return FSERR_ERRNO;
+	}
+	for (cell_i = 0; cell_i < size; cell_i++) {
+		to_init->cells[cell_i].sequence = cell_i;
+	}
+	to_init->mask = size - 1;
+	to_init->head = 0;
+	to_init->tail = 0;
+
+	return FS_NO_ERROR;
+}
+
+void free_mpmc_queue(struct mpmc_queue *to_free)
+{
+	free(to_free->cells);
+	to_free->cells = NULL;
+}
@@ -0,0 +1,142 @@
+/*
+ * private helpers for the vectorized kernels,
+ * which are only used when the machine supports them at run time
+ */
+#ifndef FS_SIMD_H
+#define FS_SIMD_H
+
+#include <file_structor.h>
+
+#include <stdint.h>
+#include <limits.h>
+
+#if defined(__x86_64__)
+/* AVX2 kernels can be compiled, though the machine may not support them. */
+#define FS_HAVE_AVX2	1
+
+#include <immintrin.h>
+
+/* the attribute for functions that use AVX2 */
+#define FS_AVX2_TARGET	__attribute__((target("avx2")))
+
+/*
+ * Check if the machine supports AVX2.
+ * returns	nonzero if the AVX2 kernels can be used
+ */
+inline static int fs_has_avx2()
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+/* BMI2 kernels can be compiled, though the machine may not support them. */
+#define FS_HAVE_BMI2	1
+
+/* the attribute for functions that use BMI2 */
+#define FS_BMI2_TARGET	__attribute__((target("bmi2")))
+
+/*
+ * Check if the machine supports BMI2, for "pext" and "pdep".
+ * returns	nonzero if the BMI2 kernels can be used
+ */
+inline static int fs_has_bmi2()
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("bmi2");
+}
+
+/*
+ * Check if the offsets used to gather a field
+ * from several consecutive records fit in 32-bit indices.
+ * record_size:	the distance between records
+ * offset:	the location of the field in each record
+ * n_lanes:	the number of records gathered at once
+ * returns	nonzero if the gather indices fit
+ */
+inline static int
+fits_gather(size_t record_size, size_t offset, size_t n_lanes)
+{
+	return record_size <= (INT_MAX - offset) / n_lanes;
+}
+
+/*
+ * Gather a 4-byte field from 8 consecutive records.
+ * base:	the start of the first record
+ * offsets:	the offset of the field in each of the records from "base",
+ *		from "gather_offsets32"
+ * swap:	nonzero to reverse the bytes of each field
+ * returns	the fields in machine order
+ */
+FS_AVX2_TARGET inline static __m256i
+gather_fields32(const uint8_t *base, __m256i offsets, int swap)
+{
+	__m256i lanes = _mm256_i32gather_epi32((const int *) base, offsets, 1);
+
+	if (swap) {
+		const __m256i reverse = _mm256_setr_epi8(
+			3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+			3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+		lanes = _mm256_shuffle_epi8(lanes, reverse);
+	}
+
+	return lanes;
+}
+
+/*
+ * the offsets for gathering a 4-byte field from 8 consecutive records
+ * record_size:	the distance between records
+ * offset:	the location of the field in each record
+ */
+FS_AVX2_TARGET inline static __m256i
+gather_offsets32(size_t record_size, size_t offset)
+{
+	int stride = (int) record_size, start = (int) offset;
+
+	return _mm256_setr_epi32(start, start + stride, start + 2 * stride,
+				 start + 3 * stride, start + 4 * stride,
+				 start + 5 * stride, start + 6 * stride,
+				 start + 7 * stride);
+}
+
+/*
+ * Gather an 8-byte field from 4 consecutive records.
+ * base:	the start of the first record
+ * offsets:	the offset of the field in each of the records from "base",
+ *		from "gather_offsets64"
+ * swap:	nonzero to reverse the bytes of each field
+ * returns	the fields in machine order
+ */
+FS_AVX2_TARGET inline static __m256i
+gather_fields64(const uint8_t *base, __m128i offsets, int swap)
+{
+	__m256i lanes = _mm256_i32gather_epi64((const long long *) base,
+					       offsets, 1);
+
+	if (swap) {
+		const __m256i reverse = _mm256_setr_epi8(
+			7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+			7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+
+		lanes = _mm256_shuffle_epi8(lanes, reverse);
+	}
+
+	return lanes;
+}
+
+/*
+ * the offsets for gathering an 8-byte field from 4 consecutive records
+ * record_size:	the distance between records
+ * offset:	the location of the field in each record
+ */
+FS_AVX2_TARGET inline static __m128i
+gather_offsets64(size_t record_size, size_t offset)
+{
+	int stride = (int) record_size, start = (int) offset;
+
+	return _mm_setr_epi32(start, start + stride, start + 2 * stride,
+			      start + 3 * stride);
+}
+#endif
+
+#endif /* FS_SIMD_H */
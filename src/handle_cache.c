@@ -0,0 +1,385 @@
+/* for "statx" */
+#define _GNU_SOURCE
+
+#include <handle_cache.h>
+#include <io_backend.h>
+#include <fs_common.h>
+#include <logger.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+/* the smallest number of hash buckets */
+#define MIN_BUCKETS	16
+/* the fields of "statx" used to tell if a file changed */
+#define STATX_IDENTITY	(STATX_INO | STATX_SIZE | STATX_MTIME)
+
+/* the FNV-1a hash of a path */
+static uint64_t hash_path(const char *path)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+
+	for (; *path != '\0'; path++) {
+		hash ^= (uint8_t) *path;
+		hash *= 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
+/*
+ * Find the identity, size and modification time of a file.
+ * path:	the path of the file
+ * identity:	will be set by "statx"
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_ERRNO if "statx" failed
+ */
+static enum fs_status stat_path(const char *path, struct statx *identity)
+{
+	if (statx(AT_FDCWD, path, 0, STATX_IDENTITY, identity)) {
+		printlg(ERROR_LEVEL, "Unable to find the status of %s: %d\n",
+			path, errno);
+		return FSERR_ERRNO;
+	}
+
+	return FS_NO_ERROR;
+}
+
+/* Check if the file of an entry is still the one described by "statx". */
+static int
+is_same_file(const struct cached_file *entry, const struct statx *identity)
+{
+	return entry->dev == makedev(identity->stx_dev_major,
+				     identity->stx_dev_minor) &&
+	       entry->ino == identity->stx_ino &&
+	       entry->size == identity->stx_size &&
+	       entry->mtime_sec == identity->stx_mtime.tv_sec &&
+	       entry->mtime_nsec == identity->stx_mtime.tv_nsec;
+}
+
+/* Close the file of an entry, and free the entry. */
+static void destroy_entry(struct cached_file *entry)
+{
+	if (entry->mapping != NULL) {
+		munmap(entry->mapping, entry->file.size);
+	} else {
+		close_file_structor(&entry->file);
+	}
+	free(entry->path);
+	free(entry);
+}
+
+/*
+ * Open a file into a new entry, mapping it whole if it is small enough.
+ * path:	the path of the file
+ * hash:	the hash of the path
+ * map_limit:	the largest size of the files to map whole, or 0 for none
+ * entry:	will be set to the new entry, with no reference
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_ERRNO if opening or mapping the file failed
+ */
+static enum fs_status
+open_entry(const char *path, uint64_t hash, size_t map_limit,
+	   struct cached_file **entry)
+{
+	struct cached_file *opened = calloc(1, sizeof(*opened));
+	struct statx identity;
+	enum fs_status status;
+
+	if (opened == NULL || (opened->path = strdup(path)) == NULL) {
+		free(opened);
+		return FSERR_ERRNO;
+	}
+	/* The status comes first, so a change during the open is noticed. */
+	if ((status = stat_path(path, &identity)) ||
+	    (status = open_file_structor(&opened->file, path))) {
+		free(opened->path);
+		free(opened);
+		return status;
+	}
+
+	opened->hash = hash;
+	opened->dev = makedev(identity.stx_dev_major, identity.stx_dev_minor);
+	opened->ino = identity.stx_ino;
+	opened->size = identity.stx_size;
+	opened->mtime_sec = identity.stx_mtime.tv_sec;
+	opened->mtime_nsec = identity.stx_mtime.tv_nsec;
+	opened->checked_ns = coarse_now_ns();
+
+	if (opened->file.size > 0 && (size_t) opened->file.size <= map_limit) {
+		void *mapping = mmap(NULL, opened->file.size, PROT_READ,
+				     MAP_SHARED, opened->file.fd, 0);
+
+		if (mapping != MAP_FAILED) {
+			close(opened->file.fd);
+			opened->file.fd = -1;
+			opened->file.memory = mapping;
+			set_io_backend(&opened->file, IO_BACKEND_MEMORY);
+			opened->mapping = mapping;
+		} else {
+			printlg(WARNING_LEVEL,
+				"Unable to map %s whole, keeping it open: %d\n",
+				path, errno);
+		}
+	}
+	*entry = opened;
+
+	return FS_NO_ERROR;
+}
+
+/* Find the entry of a path in the table, or NULL if there is none. */
+static struct cached_file *
+find_entry(const struct handle_cache *cache, const char *path, uint64_t hash)
+{
+	struct cached_file *entry;
+
+	for (entry = cache->buckets[hash & (cache->n_buckets - 1)];
+	     entry != NULL; entry = entry->bucket_next) {
+		if (entry->hash == hash && !strcmp(entry->path, path)) {
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+/* Move an entry to the front of the LRU list. */
+static void touch_entry(struct handle_cache *cache, struct cached_file *entry)
+{
+	if (entry->lru_prev != NULL) {
+		entry->lru_prev->lru_next = entry->lru_next;
+		entry->lru_next->lru_prev = entry->lru_prev;
+	}
+	entry->lru_prev = &cache->lru;
+	entry->lru_next = cache->lru.lru_next;
+	cache->lru.lru_next->lru_prev = entry;
+	cache->lru.lru_next = entry;
+}
+
+/* Remove an entry from the table and the LRU list, without freeing it. */
+static void unlink_entry(struct handle_cache *cache, struct cached_file *entry)
+{
+	struct cached_file **link =
+		&cache->buckets[entry->hash & (cache->n_buckets - 1)];
+
+	while (*link != entry) {
+		link = &(*link)->bucket_next;
+	}
+	*link = entry->bucket_next;
+	entry->lru_prev->lru_next = entry->lru_next;
+	entry->lru_next->lru_prev = entry->lru_prev;
+	entry->lru_prev = entry->lru_next = NULL;
+	cache->n_files--;
+}
+
+/*
+ * Remove an entry from the table, freeing it unless it is held,
+ * in which case its last release frees it.
+ * returns	the entry if it should be destroyed once unlocked, or NULL
+ */
+static struct cached_file *
+detach_entry(struct handle_cache *cache, struct cached_file *entry)
+{
+	unlink_entry(cache, entry);
+	if (entry->refs > 0) {
+		entry->is_detached = 1;
+		return NULL;
+	}
+
+	return entry;
+}
+
+/*
+ * Evict the least recently used files that are not held,
+ * until the cache is within its bound.
+ * The evicted entries are chained through "bucket_next",
+ * so that they can be destroyed without holding the lock.
+ * returns	the chain of evicted entries
+ */
+static struct cached_file *evict_files(struct handle_cache *cache)
+{
+	struct cached_file *entry = cache->lru.lru_prev, *evicted = NULL;
+
+	while (cache->n_files > cache->max_files && entry != &cache->lru) {
+		struct cached_file *older = entry->lru_prev;
+
+		if (entry->refs == 0) {
+			unlink_entry(cache, entry);
+			entry->bucket_next = evicted;
+			evicted = entry;
+			cache->n_evictions++;
+		}
+		entry = older;
+	}
+
+	return evicted;
+}
+
+/* Destroy a chain of entries from "evict_files". */
+static void destroy_chain(struct cached_file *chain)
+{
+	while (chain != NULL) {
+		struct cached_file *next = chain->bucket_next;
+
+		destroy_entry(chain);
+		chain = next;
+	}
+}
+
+enum fs_status
+init_handle_cache(struct handle_cache *to_init, size_t max_files,
+		  size_t map_limit, unsigned recheck_ms)
+{
+	size_t n_buckets = MIN_BUCKETS;
+
+	debug_assert(max_files > 0);
+	while (n_buckets < 2 * max_files) {
+		n_buckets *= 2;
+	}
+	to_init->buckets = calloc(n_buckets, sizeof(*to_init->buckets));
+	if (to_init->buckets == NULL) {
+		return FSERR_ERRNO;
+	}
+	pthread_mutex_init(&to_init->lock, NULL);
+	to_init->n_buckets = n_buckets;
+	to_init->max_files = max_files;
+	to_init->map_limit = map_limit;
+	to_init->recheck_ns = (uint64_t) recheck_ms * 1000000;
+	to_init->n_files = 0;
+	to_init->lru.lru_prev = to_init->lru.lru_next = &to_init->lru;
+	to_init->n_hits = 0;
+	to_init->n_misses = 0;
+	to_init->n_stale = 0;
+	to_init->n_evictions = 0;
+
+	return FS_NO_ERROR;
+}
+
+void teardown_handle_cache(struct handle_cache *to_teardown)
+{
+	while (to_teardown->lru.lru_next != &to_teardown->lru) {
+		struct cached_file *entry = to_teardown->lru.lru_next;
+
+		debug_assert(entry->refs == 0);
+		unlink_entry(to_teardown, entry);
+		destroy_entry(entry);
+	}
+	free(to_teardown->buckets);
+	to_teardown->buckets = NULL;
+	pthread_mutex_destroy(&to_teardown->lock);
+}
+
+/*
+ * Check if the file of a held entry changed since it was opened,
+ * detaching the entry from the cache if it did.
+ * The lock is released during the check.
+ * cache:	the cache, which is locked
+ * entry:	the entry, which the caller holds
+ * returns	1 if the file is unchanged, or could not be checked;
+ *		0 if it changed, after the caller's reference is dropped
+ */
+static int check_entry(struct handle_cache *cache, struct cached_file *entry)
+{
+	struct statx identity;
+	int is_same;
+
+	/* Other threads skip the check while it is running. */
+	entry->checked_ns = coarse_now_ns();
+	pthread_mutex_unlock(&cache->lock);
+	is_same = stat_path(entry->path, &identity) ||
+		  is_same_file(entry, &identity);
+	pthread_mutex_lock(&cache->lock);
+	if (is_same) {
+		return 1;
+	}
+
+	if (!entry->is_detached) {
+		cache->n_stale++;
+		detach_entry(cache, entry);
+	}
+	if (--entry->refs == 0) {
+		pthread_mutex_unlock(&cache->lock);
+		destroy_entry(entry);
+		pthread_mutex_lock(&cache->lock);
+	}
+
+	return 0;
+}
+
+enum fs_status
+acquire_cached_file(struct handle_cache *cache, const char *path,
+		    struct file_structor **file)
+{
+	const uint64_t hash = hash_path(path);
+	struct cached_file *entry, *opened, *evicted;
+	enum fs_status status;
+
+	pthread_mutex_lock(&cache->lock);
+	if ((entry = find_entry(cache, path, hash)) != NULL) {
+		entry->refs++;
+		touch_entry(cache, entry);
+		if (coarse_now_ns() - entry->checked_ns < cache->recheck_ns ||
+		    check_entry(cache, entry)) {
+			cache->n_hits++;
+			pthread_mutex_unlock(&cache->lock);
+			*file = &entry->file;
+			return FS_NO_ERROR;
+		}
+	}
+	cache->n_misses++;
+	pthread_mutex_unlock(&cache->lock);
+
+	if ((status = open_entry(path, hash, cache->map_limit, &opened))) {
+		return status;
+	}
+
+	pthread_mutex_lock(&cache->lock);
+	if ((entry = find_entry(cache, path, hash)) != NULL) {
+		/* Another thread opened the file first. */
+		entry->refs++;
+		touch_entry(cache, entry);
+		pthread_mutex_unlock(&cache->lock);
+		destroy_entry(opened);
+		*file = &entry->file;
+		return FS_NO_ERROR;
+	}
+	opened->refs = 1;
+	opened->bucket_next = cache->buckets[hash & (cache->n_buckets - 1)];
+	cache->buckets[hash & (cache->n_buckets - 1)] = opened;
+	touch_entry(cache, opened);
+	cache->n_files++;
+	evicted = evict_files(cache);
+	pthread_mutex_unlock(&cache->lock);
+
+	destroy_chain(evicted);
+	*file = &opened->file;
+
+	return FS_NO_ERROR;
+}
+
+void release_cached_file(struct handle_cache *cache,
+			 struct file_structor *file)
+{
+	struct cached_file *entry = (struct cached_file *) file;
+	struct cached_file *to_destroy = NULL;
+
+	pthread_mutex_lock(&cache->lock);
+	debug_assert(entry->refs > 0);
+	if (--entry->refs == 0) {
+		if (entry->is_detached) {
+			entry->bucket_next = NULL;
+			to_destroy = entry;
+		} else {
+			to_destroy = evict_files(cache);
+		}
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	destroy_chain(to_destroy);
+}
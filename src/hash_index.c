@@ -0,0 +1,457 @@
+#include <hash_index.h>
+#include <fs_parallel.h>
+#include <fs_common.h>
+#include <logger.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* the number of records each thread inserts before claiming more */
+#define INSERT_BATCH	(1 << 14)
+/*
+ * the number of records whose slots are prefetched
+ * before the first of them is inserted
+ */
+#define INSERT_GROUP	16
+/* the smallest number of slots in a table */
+#define MIN_SLOTS	16
+
+_Static_assert(sizeof(struct hash_index_header) % 64 == 0,
+	       "The slots must start on a cache line.");
+
+/*
+ * Mix the bits of a key, so that close keys land in distant slots.
+ * This is the finalizer of MurmurHash3.
+ * key:		the key to hash
+ * returns	the hash of the key
+ */
+inline static uint64_t hash_key(uint64_t key)
+{
+	return mix_hash(0, key);
+}
+
+/* the state shared by the threads building an index */
+struct build_work {
+	/* the key field */
+	const struct fs_int_field *key;
+	/* the mapped records */
+	const uint8_t *data;
+	/* the location of the first record in the file */
+	uint64_t records_start;
+	/* the distance between records */
+	size_t record_size;
+	/* the number of records */
+	size_t n_records;
+	/* the index of the next record to insert */
+	size_t next;
+	/* the slots being filled */
+	struct hash_index_slot *slots;
+	/* the number of slots minus 1 */
+	uint64_t slot_mask;
+};
+
+/*
+ * Insert a record into the first empty slot from its hash,
+ * claiming the slot atomically, since other threads may be probing it.
+ * Only the claiming thread writes the key,
+ * which nobody reads until the build is over.
+ */
+static void
+insert_record(struct build_work *work, uint64_t key, uint64_t slot_i,
+	      uint64_t record_start)
+{
+	for (;; slot_i = (slot_i + 1) & work->slot_mask) {
+		struct hash_index_slot *slot = &work->slots[slot_i];
+		uint64_t empty = HASH_INDEX_EMPTY;
+
+		if (__atomic_load_n(&slot->record_start, __ATOMIC_RELAXED) ==
+		    HASH_INDEX_EMPTY &&
+		    __atomic_compare_exchange_n(&slot->record_start, &empty,
+						record_start, 0,
+						__ATOMIC_RELAXED,
+						__ATOMIC_RELAXED)) {
+			slot->key = key;
+			return;
+		}
+	}
+}
+
+/*
+ * the worker for "build_hash_index", which inserts batches of records,
+ * prefetching the slots of a group of them before inserting any
+ */
+static enum fs_status insert_batches(void *arg, unsigned worker_i)
+{
+	struct build_work *work = arg;
+	uint64_t keys[INSERT_GROUP], slots[INSERT_GROUP];
+	size_t start, n_claimed;
+
+	(void) worker_i;
+
+	while ((n_claimed = claim_work(&work->next, work->n_records,
+				       INSERT_BATCH, &start))) {
+		size_t end = start + n_claimed, group_start;
+
+		for (group_start = start; group_start < end;
+		     group_start += INSERT_GROUP) {
+			size_t group_size = end - group_start, group_i;
+
+			if (group_size > INSERT_GROUP) {
+				group_size = INSERT_GROUP;
+			}
+			for (group_i = 0; group_i < group_size; group_i++) {
+				size_t record_i = group_start + group_i;
+
+				keys[group_i] = load_int_field_key(
+					work->data +
+					record_i * work->record_size,
+					work->key);
+				slots[group_i] = hash_key(keys[group_i]) &
+						 work->slot_mask;
+				__builtin_prefetch(&work->slots[slots[group_i]],
+						   1);
+			}
+			for (group_i = 0; group_i < group_size; group_i++) {
+				size_t record_i = group_start + group_i;
+
+				insert_record(work, keys[group_i],
+					      slots[group_i],
+					      work->records_start +
+					      record_i * work->record_size);
+			}
+		}
+	}
+
+	return FS_NO_ERROR;
+}
+
+/*
+ * Choose the number of slots, keeping the table at most half full.
+ * n_records:	the number of records to index
+ * returns	a power of 2
+ */
+static uint64_t slot_count(size_t n_records)
+{
+	uint64_t n_slots = MIN_SLOTS;
+
+	while (n_slots < (uint64_t) n_records * 2) {
+		n_slots *= 2;
+	}
+
+	return n_slots;
+}
+
+/*
+ * Fill a created sidecar file with the index of a mapped array of records.
+ * fd:		the descriptor of the sidecar file, sized to "index_size"
+ * index_size:	the size of the header and slots
+ * work:	the build, with every field set but "slots"
+ * header:	the header to write, with every field set but "magic"
+ * n_threads:	the number of threads, or 0 for one per online processor
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_ERRNO if "mmap" or "munmap" failed
+ */
+static enum fs_status
+fill_index(int fd, size_t index_size, struct build_work *work,
+	   const struct hash_index_header *header, unsigned n_threads)
+{
+	struct hash_index_header *mapped_header;
+	void *mapping = mmap(NULL, index_size, PROT_READ | PROT_WRITE,
+			     MAP_SHARED, fd, 0);
+
+	if (mapping == MAP_FAILED) {
+		printlg(ERROR_LEVEL, "Unable to map the index: %d\n", errno);
+		return FSERR_ERRNO;
+	}
+
+	mapped_header = mapping;
+	work->slots = (struct hash_index_slot *) (mapped_header + 1);
+	memset(work->slots, 0xff, header->n_slots * sizeof(*work->slots));
+
+	n_threads = fs_thread_count(n_threads);
+	if (work->n_records <= INSERT_BATCH) {
+		n_threads = 1;
+	}
+	run_parallel(n_threads, insert_batches, work);
+
+	/* The magic is written last, so a partial index never opens. */
+	*mapped_header = *header;
+	memcpy(mapped_header->magic, HASH_INDEX_MAGIC,
+	       sizeof(mapped_header->magic));
+
+	if (munmap(mapping, index_size)) {
+		printlg(WARNING_LEVEL, "Unable to unmap the index: %d\n",
+			errno);
+		return FSERR_ERRNO;
+	}
+
+	return FS_NO_ERROR;
+}
+
+/*
+ * Find the status of the source file of an index,
+ * with the size it has in its wrapper,
+ * and no modification time if it is a memory source.
+ * src_file:	the source file
+ * source:	will be set to its status
+ * returns	0 on success; -1 if "fstat" failed
+ */
+static int
+stat_source(const struct file_structor *src_file, struct stat *source)
+{
+	memset(source, 0, sizeof(*source));
+	if (src_file->fd >= 0 && fstat(src_file->fd, source)) {
+		return -1;
+	}
+	source->st_size = src_file->size;
+
+	return 0;
+}
+
+enum fs_status
+build_hash_index(struct file_structor *src_file, off_t start_in_file,
+		 size_t record_size, size_t n_records,
+		 const struct fs_int_field *key, unsigned n_threads,
+		 const char *index_path)
+{
+	struct hash_index_header header;
+	struct file_struct records;
+	struct build_work work;
+	struct stat source;
+	enum fs_status status;
+	size_t index_size;
+	char *tmp_path;
+	int fd;
+
+	if (key->width < 1 || key->width > sizeof(uint64_t) ||
+	    key->offset + key->width > record_size) {
+		printlg(ERROR_LEVEL,
+			"Key field at %u-%u does not fit in a 64-bit key, or "
+			"is outside of records of size %u.\n",
+			(unsigned) key->offset,
+			(unsigned) (key->offset + key->width),
+			(unsigned) record_size);
+		return FSERR_OUT_OF_STRUCT;
+	}
+	if (stat_source(src_file, &source)) {
+		return FSERR_ERRNO;
+	}
+
+	records.data = NULL;
+	if (n_records > 0 &&
+	    (status = init_file_struct(&records, src_file,
+				       record_size * n_records,
+				       start_in_file))) {
+		return status;
+	}
+
+	memset(&header, 0, sizeof(header));
+	header.byte_order = HASH_INDEX_BYTE_ORDER;
+	header.key_offset = key->offset;
+	header.key_width = key->width;
+	header.key_endianness = key->endianness;
+	header.key_is_signed = key->is_signed;
+	set_source_identity(&header.source, &source);
+	header.records_start = start_in_file;
+	header.record_size = record_size;
+	header.n_records = n_records;
+	header.n_slots = slot_count(n_records);
+	index_size = sizeof(header) +
+		     header.n_slots * sizeof(struct hash_index_slot);
+
+	work.key = key;
+	work.data = records.data;
+	work.records_start = start_in_file;
+	work.record_size = record_size;
+	work.n_records = n_records;
+	work.next = 0;
+	work.slot_mask = header.n_slots - 1;
+
+	tmp_path = add_suffix(index_path, TMP_SUFFIX);
+	if (tmp_path == NULL) {
+		status = FSERR_ERRNO;
+	} else if ((fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC,
+			      0644)) < 0) {
+		printlg(ERROR_LEVEL, "Unable to create index %s: %d\n",
+			tmp_path, errno);
+		status = FSERR_ERRNO;
+	} else {
+		if (ftruncate(fd, index_size)) {
+			printlg(ERROR_LEVEL, "Unable to size index %s: %d\n",
+				tmp_path, errno);
+			status = FSERR_ERRNO;
+		} else {
+			status = fill_index(fd, index_size, &work, &header,
+					    n_threads);
+		}
+		status = finish_tmp_file(fd, tmp_path, index_path, status);
+	}
+	free(tmp_path);
+	teardown_file_struct(&records);
+
+	return status;
+}
+
+/*
+ * Check that a mapped sidecar is a whole, valid index of a source file.
+ * index:	the index, with its mapping and header set
+ * src_file:	the source file
+ * returns	1 if the index is valid; 0 otherwise
+ */
+static int
+check_index(const struct hash_index *index,
+	    const struct file_structor *src_file)
+{
+	const struct hash_index_header *header = index->header;
+	struct stat source;
+
+	if (index->mapping.size < sizeof(*header) ||
+	    memcmp(header->magic, HASH_INDEX_MAGIC, sizeof(header->magic))) {
+		printlg(ERROR_LEVEL, "The sidecar is not a hash index.\n");
+		return 0;
+	}
+	if (header->byte_order != HASH_INDEX_BYTE_ORDER) {
+		printlg(ERROR_LEVEL,
+			"The hash index was built on a machine "
+			"of another byte order.\n");
+		return 0;
+	}
+	if (stat_source(src_file, &source) ||
+	    !is_same_source(&header->source, &source)) {
+		printlg(ERROR_LEVEL,
+			"The source file changed since the hash index "
+			"was built from it.\n");
+		return 0;
+	}
+	if (header->n_slots == 0 ||
+	    (header->n_slots & (header->n_slots - 1)) ||
+	    header->n_slots != (index->mapping.size - sizeof(*header)) /
+			       sizeof(*index->slots)) {
+		printlg(ERROR_LEVEL, "The hash index has a bad size.\n");
+		return 0;
+	}
+	/* Lookups end at an empty slot, so there must be one. */
+	if (header->n_records >= header->n_slots) {
+		printlg(ERROR_LEVEL,
+			"The hash index has %llu records in %llu slots.\n",
+			(unsigned long long) header->n_records,
+			(unsigned long long) header->n_slots);
+		return 0;
+	}
+	if (header->key_width < 1 || header->key_width > sizeof(uint64_t) ||
+	    (header->key_endianness != BIG_END &&
+	     header->key_endianness != LITTLE_END) ||
+	    header->key_is_signed > 1) {
+		printlg(ERROR_LEVEL, "The hash index has a bad key field.\n");
+		return 0;
+	}
+
+	return 1;
+}
+
+enum fs_status open_hash_index(struct hash_index *to_open,
+			       const char *index_path,
+			       struct file_structor *src_file)
+{
+	enum fs_status status;
+
+	if ((status = open_file_structor(&to_open->sidecar, index_path))) {
+		return status;
+	}
+	if (to_open->sidecar.size < (off_t) sizeof(*to_open->header)) {
+		printlg(ERROR_LEVEL, "The sidecar %s is too small.\n",
+			index_path);
+		close_file_structor(&to_open->sidecar);
+		return FSERR_BAD_SIDECAR;
+	}
+	if ((status = init_file_struct(&to_open->mapping, &to_open->sidecar,
+				       to_open->sidecar.size, 0))) {
+		close_file_structor(&to_open->sidecar);
+		return status;
+	}
+
+	to_open->header = to_open->mapping.data;
+	to_open->slots = (const struct hash_index_slot *) (to_open->header + 1);
+	if (!check_index(to_open, src_file)) {
+		close_hash_index(to_open);
+		return FSERR_BAD_SIDECAR;
+	}
+	to_open->key.offset = to_open->header->key_offset;
+	to_open->key.width = to_open->header->key_width;
+	to_open->key.endianness = to_open->header->key_endianness;
+	to_open->key.is_signed = to_open->header->key_is_signed;
+
+	return FS_NO_ERROR;
+}
+
+enum fs_status close_hash_index(struct hash_index *to_close)
+{
+	enum fs_status teardown_status, close_status;
+
+	teardown_status = teardown_file_struct(&to_close->mapping);
+	close_status = close_file_structor(&to_close->sidecar);
+	to_close->header = NULL;
+	to_close->slots = NULL;
+
+	return teardown_status ? teardown_status : close_status;
+}
+
+/*
+ * Find the records with a value of the key,
+ * probing from the slot of its hash until an empty slot,
+ * and at most every slot, in case the sidecar has none.
+ * index:		the open index
+ * value:		the value of the key
+ * record_starts:	will be set to the locations of the records found
+ * max_records:		the most locations to set
+ * count_all:		nonzero to count every record with the value;
+ *			0 to stop after "max_records"
+ * returns		the number of records found
+ */
+static size_t
+find_records(const struct hash_index *index, uint64_t value,
+	     off_t *record_starts, size_t max_records, int count_all)
+{
+	const uint64_t slot_mask = index->header->n_slots - 1;
+	uint64_t key = int_field_key(value, &index->key);
+	uint64_t slot_i = hash_key(key) & slot_mask;
+	uint64_t n_probed;
+	size_t n_found = 0;
+
+	for (n_probed = 0; n_probed <= slot_mask;
+	     n_probed++, slot_i = (slot_i + 1) & slot_mask) {
+		const struct hash_index_slot *slot = &index->slots[slot_i];
+
+		if (slot->record_start == HASH_INDEX_EMPTY) {
+			break;
+		}
+		if (slot->key == key) {
+			if (n_found < max_records) {
+				record_starts[n_found] = slot->record_start;
+			}
+			n_found++;
+			if (!count_all && n_found == max_records) {
+				break;
+			}
+		}
+	}
+
+	return n_found;
+}
+
+int hash_index_find(const struct hash_index *index, uint64_t value,
+		    off_t *record_start)
+{
+	return find_records(index, value, record_start, 1, 0) > 0;
+}
+
+size_t hash_index_find_all(const struct hash_index *index, uint64_t value,
+			   off_t *record_starts, size_t max_records)
+{
+	return find_records(index, value, record_starts, max_records, 1);
+}
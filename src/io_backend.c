@@ -0,0 +1,529 @@
+/* for "mremap" */
+#define _GNU_SOURCE
+
+#include <io_backend.h>
+#include <readahead.h>
+#include <fs_common.h>
+#include <logger.h>
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <errno.h>
+
+/* the size of the smallest class of chunk sizes */
+#define COST_CLASS_MIN_SIZE	4096
+/* the weight of a new time in the average, as a shift */
+#define COST_WEIGHT_SHIFT	3
+/*
+ * the weight of the time of the backend not in use,
+ * which is timed rarely, so that the average does not lag behind
+ */
+#define COST_PROBE_SHIFT	1
+/* the most times the average a new time counts as */
+#define COST_OUTLIER_FACTOR	2
+/*
+ * the alignment of the buffers of copied chunks,
+ * whose data is as far from it as the chunk is in the file,
+ * so that data aligned in the file is aligned in memory
+ */
+#define PREAD_ALIGNMENT		64
+
+static const struct io_backend mmap_backend;
+static const struct io_backend pread_backend;
+static const struct io_backend memory_backend;
+static const struct io_backend auto_backend;
+
+/*
+ * Allocate a buffer for a copied chunk.
+ * size:		the size of the chunk
+ * start_in_file:	the location of the chunk in the file
+ * returns		the buffer, aligned to "PREAD_ALIGNMENT"; NULL on error
+ */
+static void *alloc_chunk_buffer(off_t size, off_t start_in_file)
+{
+	void *buffer;
+	/* Empty chunks still get a buffer, so that they can be released. */
+	int error = posix_memalign(&buffer, PREAD_ALIGNMENT,
+				   size + start_in_file % PREAD_ALIGNMENT + 1);
+
+	if (error) {
+		printlg(ERROR_LEVEL,
+			"Could not allocate %u bytes to read range %u-%u.\n",
+			(unsigned) size, (unsigned) start_in_file,
+			(unsigned) (start_in_file + size));
+		errno = error;
+		return NULL;
+	}
+
+	return buffer;
+}
+
+/*
+ * Read a range of a file into a buffer, retrying short reads.
+ * fd:		the descriptor of the file
+ * buffer:	the buffer to read into
+ * size:	the number of bytes to read
+ * start:	the location of the range in the file
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_ERRNO if "pread" failed, with errno set by it;
+ *		FSERR_OUT_OF_FILE if the file ended first
+ */
+static enum fs_status
+read_fully(int fd, void *buffer, size_t size, off_t start)
+{
+	uint8_t *bytes = buffer;
+
+	while (size > 0) {
+		ssize_t n_read = pread(fd, bytes, size, start);
+
+		if (n_read < 0 && errno == EINTR) {
+			continue;
+		} else if (n_read < 0) {
+			printlg(ERROR_LEVEL,
+				"Could not read from file %d at %u: %d.\n",
+				fd, (unsigned) start, errno);
+			return FSERR_ERRNO;
+		} else if (n_read == 0) {
+			printlg(ERROR_LEVEL,
+				"File %d ended at %u, before the %u bytes "
+				"requested.\n", fd, (unsigned) start,
+				(unsigned) size);
+			return FSERR_OUT_OF_FILE;
+		}
+		bytes += n_read;
+		size -= n_read;
+		start += n_read;
+	}
+
+	return FS_NO_ERROR;
+}
+
+static enum fs_status
+map_mmap(struct file_struct *to_init, struct file_structor *src_file,
+	 off_t size, off_t start_in_file)
+{
+	off_t start_adjustment = start_in_file % sysconf(_SC_PAGE_SIZE);
+	off_t adjusted_start = start_in_file - start_adjustment;
+
+	to_init->mapping_start = mmap(NULL, (size_t) (size + start_adjustment),
+				      src_file->is_writable ?
+				      PROT_READ | PROT_WRITE : PROT_READ,
+				      MAP_SHARED, src_file->fd, adjusted_start);
+
+	if (to_init->mapping_start == MAP_FAILED) {
+		printlg(ERROR_LEVEL,
+			"Could not map from file %d to range %u-%u: %d.\n",
+			src_file->fd,
+			(unsigned) start_in_file,
+			(unsigned) (start_in_file + size), errno);
+		to_init->mapping_start = NULL;
+		to_init->data = NULL;
+		return FSERR_ERRNO;
+	}
+
+	to_init->data = to_init->mapping_start + start_adjustment;
+	to_init->backend = &mmap_backend;
+
+	return FS_NO_ERROR;
+}
+
+static enum fs_status extend_mmap(struct file_struct *to_extend, off_t size)
+{
+	size_t start_adjustment = (uint8_t *) to_extend->data -
+				  (uint8_t *) to_extend->mapping_start;
+	void *new_mapping = mremap(to_extend->mapping_start,
+				   to_extend->size + start_adjustment,
+				   size + start_adjustment, MREMAP_MAYMOVE);
+
+	if (new_mapping == MAP_FAILED) {
+		printlg(ERROR_LEVEL,
+			"Could not extend mapping of range %u-%u to %u: %d.\n",
+			(unsigned) to_extend->start_in_file,
+			(unsigned) (to_extend->start_in_file +
+				    to_extend->size),
+			(unsigned) (to_extend->start_in_file + size), errno);
+		return FSERR_ERRNO;
+	}
+
+	to_extend->mapping_start = new_mapping;
+	to_extend->data = (uint8_t *) new_mapping + start_adjustment;
+	to_extend->size = size;
+
+	return FS_NO_ERROR;
+}
+
+static enum fs_status release_mmap(struct file_struct *to_release)
+{
+	size_t start_adjustment = to_release->data - to_release->mapping_start;
+
+	if (munmap(to_release->mapping_start,
+		   to_release->size + start_adjustment)) {
+		printlg(WARNING_LEVEL,
+			"Unable to unmap memory range %p-%p: %d\n",
+			to_release->data,
+			to_release->data + to_release->size, errno);
+		return FSERR_ERRNO;
+	}
+
+	return FS_NO_ERROR;
+}
+
+static enum fs_status
+map_pread(struct file_struct *to_init, struct file_structor *src_file,
+	  off_t size, off_t start_in_file)
+{
+	uint8_t *buffer = alloc_chunk_buffer(size, start_in_file);
+	uint8_t *data;
+	enum fs_status status;
+
+	to_init->mapping_start = NULL;
+	to_init->data = NULL;
+	if (buffer == NULL) {
+		return FSERR_ERRNO;
+	}
+	data = buffer + start_in_file % PREAD_ALIGNMENT;
+	if ((status = read_fully(src_file->fd, data, size, start_in_file))) {
+		free(buffer);
+		return status;
+	}
+
+	to_init->mapping_start = buffer;
+	to_init->data = data;
+	to_init->backend = &pread_backend;
+
+	return FS_NO_ERROR;
+}
+
+static enum fs_status extend_pread(struct file_struct *to_extend, off_t size)
+{
+	uint8_t *buffer, *data;
+	enum fs_status status;
+
+	if ((uint64_t) size <= to_extend->size) {
+		to_extend->size = size;
+		return FS_NO_ERROR;
+	}
+
+	/* "realloc" would not keep the alignment. */
+	buffer = alloc_chunk_buffer(size, to_extend->start_in_file);
+	if (buffer == NULL) {
+		return FSERR_ERRNO;
+	}
+	data = buffer + to_extend->start_in_file % PREAD_ALIGNMENT;
+	if ((status = read_fully(to_extend->src_file->fd,
+				 data + to_extend->size,
+				 size - to_extend->size,
+				 to_extend->start_in_file + to_extend->size))) {
+		free(buffer);
+		return status;
+	}
+	memcpy(data, to_extend->data, to_extend->size);
+	free(to_extend->mapping_start);
+
+	to_extend->mapping_start = buffer;
+	to_extend->data = data;
+	to_extend->size = size;
+
+	return FS_NO_ERROR;
+}
+
+static enum fs_status release_pread(struct file_struct *to_release)
+{
+	free(to_release->mapping_start);
+
+	return FS_NO_ERROR;
+}
+
+static enum fs_status
+map_memory(struct file_struct *to_init, struct file_structor *src_file,
+	   off_t size, off_t start_in_file)
+{
+	(void) size;
+
+	to_init->mapping_start = NULL;
+	to_init->data = (uint8_t *) src_file->memory + start_in_file;
+	to_init->backend = &memory_backend;
+
+	return FS_NO_ERROR;
+}
+
+static enum fs_status extend_memory(struct file_struct *to_extend, off_t size)
+{
+	to_extend->size = size;
+
+	return FS_NO_ERROR;
+}
+
+static enum fs_status release_memory(struct file_struct *to_release)
+{
+	(void) to_release;
+
+	return FS_NO_ERROR;
+}
+
+/* the index of the class of a chunk size up to "IO_AUTO_PREAD_MAX" */
+static size_t cost_class(off_t size)
+{
+	off_t class_size = COST_CLASS_MIN_SIZE;
+	size_t class_i = 0;
+
+	while (class_size < size && class_i < IO_COST_CLASSES - 1) {
+		class_size *= 2;
+		class_i++;
+	}
+
+	return class_i;
+}
+
+/*
+ * Add the time taken to read a chunk to the average of its class,
+ * unless another thread is updating the costs.
+ * costs:	the costs of the source wrapper
+ * cost:	the costs of the class of the chunk
+ * is_mmap:	nonzero if the chunk was mapped; 0 if it was copied
+ * ns:		the nanoseconds taken
+ * shift:	the weight of the time in the average, as a shift
+ */
+static void
+record_cost(struct io_costs *costs, struct io_cost_class *cost, int is_mmap,
+	    uint64_t ns, unsigned shift)
+{
+	uint64_t *average = is_mmap ? &cost->mmap_ns : &cost->pread_ns;
+	uint32_t *n_samples = is_mmap ? &cost->n_mmap_samples :
+				       &cost->n_pread_samples;
+
+	if (__atomic_test_and_set(&costs->is_busy, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+
+	if (*n_samples == 0) {
+		__atomic_store_n(average, ns, __ATOMIC_RELAXED);
+	} else {
+		/* A chunk delayed by something else counts for little. */
+		if (ns > *average * COST_OUTLIER_FACTOR) {
+			ns = *average * COST_OUTLIER_FACTOR;
+		}
+		__atomic_store_n(average,
+				 *average - (*average >> shift) + (ns >> shift),
+				 __ATOMIC_RELAXED);
+	}
+	if (*n_samples < UINT32_MAX) {
+		__atomic_store_n(n_samples, *n_samples + 1, __ATOMIC_RELAXED);
+	}
+
+	__atomic_clear(&costs->is_busy, __ATOMIC_RELEASE);
+}
+
+/*
+ * Map a chunk and touch each of its pages, timing both,
+ * which is what mapping a chunk costs, unlike the "mmap" alone,
+ * since the page faults come later.
+ * The pages are faulted in for the caller,
+ * which gets the chunk that was timed.
+ * to_init:		the chunk to map
+ * src_file:		the source wrapper
+ * size:		the size of the chunk
+ * start_in_file:	the location of the chunk in the file
+ * ns:			will be set to the nanoseconds taken
+ * returns		the status from "map_mmap"
+ */
+static enum fs_status
+map_timed_mmap(struct file_struct *to_init, struct file_structor *src_file,
+	       off_t size, off_t start_in_file, uint64_t *ns)
+{
+	const size_t page_size = sysconf(_SC_PAGE_SIZE);
+	const uint64_t start = now_ns();
+	const volatile uint8_t *page;
+	const uint8_t *end;
+	enum fs_status status;
+
+	if ((status = map_mmap(to_init, src_file, size, start_in_file))) {
+		return status;
+	}
+	end = (uint8_t *) to_init->data + size;
+	for (page = to_init->mapping_start; (const uint8_t *) page < end;
+	     page += page_size) {
+		(void) *page;
+	}
+	*ns = now_ns() - start;
+
+	return FS_NO_ERROR;
+}
+
+static enum fs_status
+map_auto(struct file_struct *to_init, struct file_structor *src_file,
+	 off_t size, off_t start_in_file)
+{
+	struct io_costs *costs = &src_file->costs;
+	struct io_cost_class *cost;
+	uint64_t n_chunks, start, ns;
+	uint32_t n_mmap_samples, n_pread_samples;
+	int is_on_stride, use_mmap, is_timed, is_probe = 0;
+	enum fs_status status;
+
+	/* Copies would not reach the file, and large ones cost memory. */
+	if (src_file->is_writable || size > IO_AUTO_PREAD_MAX) {
+		__atomic_fetch_add(&costs->n_mmaps, 1, __ATOMIC_RELAXED);
+		return map_mmap(to_init, src_file, size, start_in_file);
+	}
+
+	is_on_stride = __atomic_load_n(&src_file->pattern.n_hits,
+				       __ATOMIC_RELAXED) >= READAHEAD_MIN_HITS;
+	cost = &costs->classes[is_on_stride][cost_class(size)];
+	n_chunks = __atomic_fetch_add(&cost->n_chunks, 1, __ATOMIC_RELAXED);
+	n_mmap_samples = __atomic_load_n(&cost->n_mmap_samples,
+					 __ATOMIC_RELAXED);
+	n_pread_samples = __atomic_load_n(&cost->n_pread_samples,
+					  __ATOMIC_RELAXED);
+
+	if (n_mmap_samples < IO_AUTO_MIN_SAMPLES ||
+	    n_pread_samples < IO_AUTO_MIN_SAMPLES) {
+		use_mmap = n_mmap_samples <= n_pread_samples;
+		is_timed = 1;
+	} else {
+		use_mmap = __atomic_load_n(&cost->mmap_ns, __ATOMIC_RELAXED) <
+			   __atomic_load_n(&cost->pread_ns, __ATOMIC_RELAXED);
+		if (n_chunks % IO_AUTO_SAMPLE_INTERVAL == 0) {
+			use_mmap = !use_mmap;
+			is_probe = 1;
+		}
+		/* Copies are always timed, and mappings twice an interval. */
+		is_timed = n_chunks % (IO_AUTO_SAMPLE_INTERVAL / 2) == 0;
+	}
+
+	if (use_mmap) {
+		__atomic_fetch_add(&costs->n_mmaps, 1, __ATOMIC_RELAXED);
+		if (!is_timed) {
+			return map_mmap(to_init, src_file, size,
+					start_in_file);
+		}
+		if ((status = map_timed_mmap(to_init, src_file, size,
+					     start_in_file, &ns))) {
+			return status;
+		}
+		record_cost(costs, cost, 1, ns, is_probe ?
+			    COST_PROBE_SHIFT : COST_WEIGHT_SHIFT);
+
+		return FS_NO_ERROR;
+	}
+
+	__atomic_fetch_add(&costs->n_preads, 1, __ATOMIC_RELAXED);
+	start = now_ns();
+	if ((status = map_pread(to_init, src_file, size, start_in_file))) {
+		return status;
+	}
+	record_cost(costs, cost, 0, now_ns() - start,
+		    is_probe ? COST_PROBE_SHIFT : COST_WEIGHT_SHIFT);
+
+	return FS_NO_ERROR;
+}
+
+static const struct io_backend mmap_backend = {
+	"mmap", IO_BACKEND_MMAP, map_mmap, extend_mmap, release_mmap
+};
+
+static const struct io_backend pread_backend = {
+	"pread", IO_BACKEND_PREAD, map_pread, extend_pread, release_pread
+};
+
+static const struct io_backend memory_backend = {
+	"memory", IO_BACKEND_MEMORY, map_memory, extend_memory, release_memory
+};
+
+/* Chunks read by the automatic backend keep the backend that read them. */
+static const struct io_backend auto_backend = {
+	"auto", IO_BACKEND_AUTO, map_auto, extend_mmap, release_mmap
+};
+
+const struct io_backend *get_io_backend(enum io_backend_kind kind)
+{
+	switch (kind) {
+	case IO_BACKEND_PREAD:
+		return &pread_backend;
+	case IO_BACKEND_MEMORY:
+		return &memory_backend;
+	case IO_BACKEND_AUTO:
+		return &auto_backend;
+	default:
+		return &mmap_backend;
+	}
+}
+
+/*
+ * Read the whole file of a source wrapper into memory.
+ * file:	the source wrapper
+ * returns	the same as "set_io_backend"
+ */
+static enum fs_status load_file(struct file_structor *file)
+{
+	void *memory;
+	enum fs_status status;
+	/* The copy is aligned like a mapping of the whole file. */
+	int error = posix_memalign(&memory, sysconf(_SC_PAGE_SIZE),
+				   file->size > 0 ? (size_t) file->size : 1);
+
+	if (error) {
+		printlg(ERROR_LEVEL,
+			"Could not allocate %u bytes to load file %d.\n",
+			(unsigned) file->size, file->fd);
+		errno = error;
+		return FSERR_ERRNO;
+	}
+	if ((status = read_fully(file->fd, memory, file->size, 0))) {
+		free(memory);
+		return status;
+	}
+	file->memory = memory;
+
+	return FS_NO_ERROR;
+}
+
+enum fs_status
+set_io_backend(struct file_structor *file, enum io_backend_kind kind)
+{
+	int is_loaded, should_load;
+
+	if (file->fd < 0) {
+		if (kind == IO_BACKEND_MMAP || kind == IO_BACKEND_PREAD) {
+			printlg(ERROR_LEVEL,
+				"The %s backend needs a file, "
+				"not a memory source.\n",
+				get_io_backend(kind)->name);
+			errno = EBADF;
+			return FSERR_ERRNO;
+		}
+		file->backend = get_io_backend(kind);
+		return FS_NO_ERROR;
+	}
+	if (file->is_writable &&
+	    (kind == IO_BACKEND_PREAD || kind == IO_BACKEND_MEMORY)) {
+		printlg(ERROR_LEVEL,
+			"The %s backend cannot write to file %d.\n",
+			get_io_backend(kind)->name, file->fd);
+		errno = EINVAL;
+		return FSERR_ERRNO;
+	}
+
+	is_loaded = file->memory != NULL;
+	should_load = kind == IO_BACKEND_MEMORY ||
+		      (kind == IO_BACKEND_AUTO && !file->is_writable &&
+		       file->size <= IO_AUTO_LOAD_MAX);
+	if (should_load && !is_loaded) {
+		enum fs_status status = load_file(file);
+
+		if (status) {
+			return status;
+		}
+	} else if (!should_load && is_loaded) {
+		free(file->memory);
+		file->memory = NULL;
+	}
+
+	if (kind == IO_BACKEND_AUTO) {
+		memset(&file->costs, 0, sizeof(file->costs));
+	}
+	file->backend = get_io_backend(kind);
+
+	return FS_NO_ERROR;
+}
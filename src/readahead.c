@@ -0,0 +1,139 @@
+#include <readahead.h>
+#include <logger.h>
+
+#include <fcntl.h>
+
+void set_adaptive_readahead(struct file_structor *file, unsigned max_distance)
+{
+	struct access_pattern *pattern = &file->pattern;
+
+	pattern->is_busy = 0;
+	pattern->max_distance = max_distance;
+	pattern->last_start = 0;
+	pattern->last_size = 0;
+	pattern->stride = 0;
+	pattern->n_hits = 0;
+	pattern->distance = 0;
+	pattern->n_ahead = 0;
+	pattern->n_readaheads = 0;
+}
+
+/* the most strides to read ahead of chunks of a size */
+static unsigned
+distance_limit(const struct access_pattern *pattern, off_t size)
+{
+	off_t step = pattern->stride < 0 ? -pattern->stride : pattern->stride;
+	off_t limit;
+
+	if (step < size) {
+		step = size;
+	}
+	limit = step > 0 ? READAHEAD_MAX_BYTES / step : 0;
+	if (limit < 1) {
+		limit = 1;
+	}
+
+	return limit < pattern->max_distance ? limit : pattern->max_distance;
+}
+
+/* Ask the kernel to read a range of a file, clamped to the file. */
+static void
+read_range(struct file_structor *file, off_t start, off_t end)
+{
+	if (start < 0) {
+		start = 0;
+	}
+	if (end > file->size) {
+		end = file->size;
+	}
+	if (start >= end) {
+		return;
+	}
+
+	posix_fadvise(file->fd, start, end - start, POSIX_FADV_WILLNEED);
+	file->pattern.n_readaheads++;
+}
+
+/*
+ * Read ahead the chunks predicted between the ones already read ahead
+ * and the reading distance.
+ * file:	the source wrapper, whose pattern follows a stride
+ * start:	the location of the last chunk
+ * size:	the size of the last chunk
+ */
+static void read_ahead(struct file_structor *file, off_t start, off_t size)
+{
+	struct access_pattern *pattern = &file->pattern;
+	off_t stride = pattern->stride;
+	off_t gap = (stride < 0 ? -stride : stride) - size;
+	off_t first = start + (off_t) (pattern->n_ahead + 1) * stride;
+	off_t last = start + (off_t) pattern->distance * stride;
+	off_t chunk_start;
+
+	if (pattern->n_ahead >= pattern->distance) {
+		return;
+	}
+	pattern->n_ahead = pattern->distance;
+
+	if (gap <= READAHEAD_MAX_GAP) {
+		if (stride > 0) {
+			read_range(file, first, last + size);
+		} else {
+			read_range(file, last, first + size);
+		}
+		return;
+	}
+	for (chunk_start = first;
+	     stride > 0 ? chunk_start <= last : chunk_start >= last;
+	     chunk_start += stride) {
+		if (chunk_start < 0 || chunk_start >= file->size) {
+			break;
+		}
+		read_range(file, chunk_start, chunk_start + size);
+	}
+}
+
+void observe_access(struct file_structor *file, off_t start, off_t size)
+{
+	struct access_pattern *pattern = &file->pattern;
+	off_t stride;
+
+	if (file->memory != NULL || pattern->max_distance == 0 ||
+	    __atomic_test_and_set(&pattern->is_busy, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+
+	stride = start - pattern->last_start;
+	if (stride != 0 && stride == pattern->stride &&
+	    size == pattern->last_size) {
+		unsigned limit = distance_limit(pattern, size);
+
+		pattern->n_hits++;
+		if (pattern->n_ahead > 0) {
+			pattern->n_ahead--;
+		}
+		if (pattern->n_hits == READAHEAD_MIN_HITS &&
+		    pattern->distance < READAHEAD_MIN_DISTANCE) {
+			pattern->distance = READAHEAD_MIN_DISTANCE;
+		} else if (pattern->n_hits > READAHEAD_MIN_HITS) {
+			pattern->distance *= 2;
+		}
+		if (pattern->distance > limit) {
+			pattern->distance = limit;
+		}
+		/* Read ahead in batches, once half the distance is used. */
+		if (pattern->n_hits >= READAHEAD_MIN_HITS &&
+		    pattern->n_ahead <= pattern->distance / 2) {
+			read_ahead(file, start, size);
+		}
+	} else {
+		pattern->stride = stride;
+		pattern->n_hits = 0;
+		pattern->n_ahead = 0;
+		pattern->distance /= 2;
+	}
+	pattern->last_start = start;
+	pattern->last_size = size;
+
+	__atomic_clear(&pattern->is_busy, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,424 @@
+#include <record_aggregate.h>
+#include <fs_parallel.h>
+#include <logger.h>
+
+#include "fs_simd.h"
+
+#include <stdlib.h>
+
+/* the number of records each thread aggregates before claiming more */
+#define AGGREGATE_BATCH	(1 << 16)
+
+/*
+ * the aggregate of a field while it is being computed,
+ * with the extremes kept as keys, so that they compare as unsigned
+ */
+struct key_aggregate {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min_key;
+	uint64_t max_key;
+};
+
+/* Set a key aggregate to that of no records. */
+static void init_key_aggregate(struct key_aggregate *to_init)
+{
+	to_init->count = 0;
+	to_init->sum = 0;
+	to_init->min_key = UINT64_MAX;
+	to_init->max_key = 0;
+}
+
+/* Add the aggregate of other records to a key aggregate. */
+static void
+merge_key_aggregates(struct key_aggregate *into,
+		     const struct key_aggregate *from)
+{
+	into->count += from->count;
+	into->sum += from->sum;
+	if (from->min_key < into->min_key) {
+		into->min_key = from->min_key;
+	}
+	if (from->max_key > into->max_key) {
+		into->max_key = from->max_key;
+	}
+}
+
+/* Add a single value to a key aggregate. */
+inline static void
+add_value(struct key_aggregate *into, uint64_t value,
+	  const struct fs_int_field *field)
+{
+	uint64_t key = int_field_key(value, field);
+
+	into->count++;
+	into->sum += value;
+	if (key < into->min_key) {
+		into->min_key = key;
+	}
+	if (key > into->max_key) {
+		into->max_key = key;
+	}
+}
+
+void init_field_aggregate(struct field_aggregate *to_init)
+{
+	to_init->count = 0;
+	to_init->sum = 0;
+	to_init->min = 0;
+	to_init->max = 0;
+}
+
+void merge_field_aggregates(struct field_aggregate *into,
+			    const struct field_aggregate *from,
+			    const struct fs_int_field *field)
+{
+	if (from->count == 0) {
+		return;
+	}
+	if (into->count == 0 ||
+	    int_field_key(from->min, field) < int_field_key(into->min, field)) {
+		into->min = from->min;
+	}
+	if (into->count == 0 ||
+	    int_field_key(from->max, field) > int_field_key(into->max, field)) {
+		into->max = from->max;
+	}
+	into->count += from->count;
+	into->sum += from->sum;
+}
+
+/*
+ * Convert a finished key aggregate into the values of the field.
+ * result:	the aggregate to set
+ * keys:	the finished key aggregate
+ * field:	the description of the field
+ */
+static void
+finish_aggregate(struct field_aggregate *result,
+		 const struct key_aggregate *keys,
+		 const struct fs_int_field *field)
+{
+	init_field_aggregate(result);
+	if (keys->count > 0) {
+		/* converting to and from keys is the same operation */
+		result->count = keys->count;
+		result->sum = keys->sum;
+		result->min = int_field_key(keys->min_key, field);
+		result->max = int_field_key(keys->max_key, field);
+	}
+}
+
+/*
+ * Check that a field is inside each record.
+ * field:	the description of the field
+ * record_size:	the distance between records
+ * returns	FS_NO_ERROR if the field is inside the record;
+ *		FSERR_OUT_OF_STRUCT otherwise
+ */
+static enum fs_status
+check_field(const struct fs_int_field *field, size_t record_size)
+{
+	if (field->offset + field->width > record_size) {
+		printlg(ERROR_LEVEL,
+			"Aggregated field at %u-%u is outside of "
+			"records of size %u.\n",
+			(unsigned) field->offset,
+			(unsigned) (field->offset + field->width),
+			(unsigned) record_size);
+		return FSERR_OUT_OF_STRUCT;
+	}
+
+	return FS_NO_ERROR;
+}
+
+#ifdef FS_HAVE_AVX2
+/*
+ * Aggregate a 4-byte field of consecutive records with AVX2.
+ * into:	the aggregate to add to
+ * field:	the description of the field
+ * data:	the start of the first record
+ * record_size:	the distance between records
+ * n_records:	the number of records, which must be a multiple of 8
+ */
+FS_AVX2_TARGET static void
+aggregate_avx2_32(struct key_aggregate *into, const struct fs_int_field *field,
+		  const uint8_t *data, size_t record_size, size_t n_records)
+{
+	const int swap = field->endianness != machine_endianness();
+	const __m256i offsets = gather_offsets32(record_size, field->offset);
+	__m256i sums = _mm256_setzero_si256();
+	__m256i mins = _mm256_set1_epi32(field->is_signed ? INT32_MAX : -1);
+	__m256i maxes = _mm256_set1_epi32(field->is_signed ? INT32_MIN : 0);
+	int32_t lane_mins[8], lane_maxes[8];
+	uint64_t lane_sums[4];
+	size_t record_i, lane_i;
+
+	for (record_i = 0; record_i < n_records; record_i += 8) {
+		__m256i lanes = gather_fields32(data + record_i * record_size,
+						offsets, swap);
+		__m128i low = _mm256_castsi256_si128(lanes);
+		__m128i high = _mm256_extracti128_si256(lanes, 1);
+
+		if (field->is_signed) {
+			sums = _mm256_add_epi64(sums,
+						_mm256_cvtepi32_epi64(low));
+			sums = _mm256_add_epi64(sums,
+						_mm256_cvtepi32_epi64(high));
+			mins = _mm256_min_epi32(mins, lanes);
+			maxes = _mm256_max_epi32(maxes, lanes);
+		} else {
+			sums = _mm256_add_epi64(sums,
+						_mm256_cvtepu32_epi64(low));
+			sums = _mm256_add_epi64(sums,
+						_mm256_cvtepu32_epi64(high));
+			mins = _mm256_min_epu32(mins, lanes);
+			maxes = _mm256_max_epu32(maxes, lanes);
+		}
+	}
+
+	_mm256_storeu_si256((__m256i *) lane_sums, sums);
+	_mm256_storeu_si256((__m256i *) lane_mins, mins);
+	_mm256_storeu_si256((__m256i *) lane_maxes, maxes);
+	for (lane_i = 0; lane_i < 4; lane_i++) {
+		into->sum += lane_sums[lane_i];
+	}
+	for (lane_i = 0; lane_i < 8; lane_i++) {
+		uint64_t min = field->is_signed ?
+			       (uint64_t) (int64_t) lane_mins[lane_i] :
+			       (uint32_t) lane_mins[lane_i];
+		uint64_t max = field->is_signed ?
+			       (uint64_t) (int64_t) lane_maxes[lane_i] :
+			       (uint32_t) lane_maxes[lane_i];
+		uint64_t min_key = int_field_key(min, field);
+		uint64_t max_key = int_field_key(max, field);
+
+		if (min_key < into->min_key) {
+			into->min_key = min_key;
+		}
+		if (max_key > into->max_key) {
+			into->max_key = max_key;
+		}
+	}
+	into->count += n_records;
+}
+
+/*
+ * Aggregate an 8-byte field of consecutive records with AVX2.
+ * into:	the aggregate to add to
+ * field:	the description of the field
+ * data:	the start of the first record
+ * record_size:	the distance between records
+ * n_records:	the number of records, which must be a multiple of 4
+ */
+FS_AVX2_TARGET static void
+aggregate_avx2_64(struct key_aggregate *into, const struct fs_int_field *field,
+		  const uint8_t *data, size_t record_size, size_t n_records)
+{
+	const int swap = field->endianness != machine_endianness();
+	/* Compare keys as signed lanes, by flipping the sign bit back. */
+	const __m256i flips = _mm256_set1_epi64x(
+		field->is_signed ? 0 : (long long) ((uint64_t) 1 << 63));
+	const __m128i offsets = gather_offsets64(record_size, field->offset);
+	__m256i sums = _mm256_setzero_si256();
+	__m256i mins = _mm256_set1_epi64x(INT64_MAX);
+	__m256i maxes = _mm256_set1_epi64x(INT64_MIN);
+	int64_t lane_mins[4], lane_maxes[4];
+	uint64_t lane_sums[4];
+	size_t record_i, lane_i;
+
+	for (record_i = 0; record_i < n_records; record_i += 4) {
+		__m256i lanes = gather_fields64(data + record_i * record_size,
+						offsets, swap);
+		__m256i ordered = _mm256_xor_si256(lanes, flips);
+
+		sums = _mm256_add_epi64(sums, lanes);
+		mins = _mm256_blendv_epi8(mins, ordered,
+					  _mm256_cmpgt_epi64(mins, ordered));
+		maxes = _mm256_blendv_epi8(maxes, ordered,
+					   _mm256_cmpgt_epi64(ordered, maxes));
+	}
+
+	mins = _mm256_xor_si256(mins, flips);
+	maxes = _mm256_xor_si256(maxes, flips);
+	_mm256_storeu_si256((__m256i *) lane_sums, sums);
+	_mm256_storeu_si256((__m256i *) lane_mins, mins);
+	_mm256_storeu_si256((__m256i *) lane_maxes, maxes);
+	for (lane_i = 0; lane_i < 4; lane_i++) {
+		uint64_t min_key = int_field_key(lane_mins[lane_i], field);
+		uint64_t max_key = int_field_key(lane_maxes[lane_i], field);
+
+		into->sum += lane_sums[lane_i];
+		if (min_key < into->min_key) {
+			into->min_key = min_key;
+		}
+		if (max_key > into->max_key) {
+			into->max_key = max_key;
+		}
+	}
+	into->count += n_records;
+}
+#endif
+
+/*
+ * Aggregate a field of consecutive records.
+ * into:	the aggregate to add to
+ * field:	the description of the field
+ * data:	the start of the first record
+ * record_size:	the distance between records
+ * n_records:	the number of records
+ */
+static void
+aggregate_range(struct key_aggregate *into, const struct fs_int_field *field,
+		const uint8_t *data, size_t record_size, size_t n_records)
+{
+	size_t record_i = 0;
+
+#ifdef FS_HAVE_AVX2
+	if (fits_gather(record_size, field->offset, 8) && fs_has_avx2()) {
+		if (field->width == sizeof(uint32_t) && n_records >= 8) {
+			record_i = n_records - n_records % 8;
+			aggregate_avx2_32(into, field, data, record_size,
+					  record_i);
+		} else if (field->width == sizeof(uint64_t) &&
+			   n_records >= 4) {
+			record_i = n_records - n_records % 4;
+			aggregate_avx2_64(into, field, data, record_size,
+					  record_i);
+		}
+	}
+#endif
+
+	for (; record_i < n_records; record_i++) {
+		add_value(into, load_int_field(data + record_i * record_size,
+					       field),
+			  field);
+	}
+}
+
+/* the shared state of the threads aggregating an array */
+struct aggregate_work {
+	/* the field to aggregate */
+	const struct fs_int_field *field;
+	/* the start of the first record */
+	const uint8_t *data;
+	/* the distance between records */
+	size_t record_size;
+	/* the number of records */
+	size_t n_records;
+	/* the index of the next record to aggregate */
+	size_t next;
+	/* the aggregate of each thread */
+	struct key_aggregate *partials;
+};
+
+/*
+ * the worker for "aggregate_field", which aggregates batches of records
+ * until there are none left, and then stores its partial aggregate.
+ * The partial is kept on the stack until then,
+ * since those of the threads share cache lines.
+ */
+static enum fs_status aggregate_batches(void *arg, unsigned worker_i)
+{
+	struct aggregate_work *work = arg;
+	struct key_aggregate partial;
+	size_t start, n_claimed;
+
+	init_key_aggregate(&partial);
+	while ((n_claimed = claim_work(&work->next, work->n_records,
+				       AGGREGATE_BATCH, &start))) {
+		aggregate_range(&partial, work->field,
+				work->data + start * work->record_size,
+				work->record_size, n_claimed);
+	}
+	work->partials[worker_i] = partial;
+
+	return FS_NO_ERROR;
+}
+
+enum fs_status
+aggregate_field(struct file_struct *records, size_t record_size,
+		const struct fs_int_field *field, unsigned n_threads,
+		struct field_aggregate *result)
+{
+	struct aggregate_work work;
+	struct key_aggregate total;
+	enum fs_status status;
+	unsigned thread_i;
+
+	debug_assert(record_size > 0);
+	if ((status = check_field(field, record_size))) {
+		return status;
+	}
+
+	work.field = field;
+	work.data = records->data;
+	work.record_size = record_size;
+	work.n_records = records->size / record_size;
+	work.next = 0;
+
+	n_threads = fs_thread_count(n_threads);
+	if (work.n_records <= AGGREGATE_BATCH) {
+		n_threads = 1;
+	}
+	work.partials = malloc(sizeof(*work.partials) * n_threads);
+	if (work.partials == NULL) {
+		struct key_aggregate single;
+
+		init_key_aggregate(&single);
+		aggregate_range(&single, field, work.data, record_size,
+				work.n_records);
+		finish_aggregate(result, &single, field);
+		return FS_NO_ERROR;
+	}
+	for (thread_i = 0; thread_i < n_threads; thread_i++) {
+		init_key_aggregate(&work.partials[thread_i]);
+	}
+
+	run_parallel(n_threads, aggregate_batches, &work);
+
+	init_key_aggregate(&total);
+	for (thread_i = 0; thread_i < n_threads; thread_i++) {
+		merge_key_aggregates(&total, &work.partials[thread_i]);
+	}
+	free(work.partials);
+	finish_aggregate(result, &total, field);
+
+	return FS_NO_ERROR;
+}
+
+enum fs_status
+aggregate_selected(struct file_struct *records, size_t record_size,
+		   const struct fs_int_field *field, const size_t *selection,
+		   size_t n_selected, struct field_aggregate *result)
+{
+	size_t n_records = records->size / record_size;
+	const uint8_t *data = records->data;
+	struct key_aggregate total;
+	enum fs_status status;
+	size_t selected_i;
+
+	debug_assert(record_size > 0);
+	if ((status = check_field(field, record_size))) {
+		return status;
+	}
+
+	init_key_aggregate(&total);
+	for (selected_i = 0; selected_i < n_selected; selected_i++) {
+		size_t record_i = selection[selected_i];
+
+		if (record_i >= n_records) {
+			printlg(ERROR_LEVEL,
+				"Selected record %u is past the end of the "
+				"%u records.\n",
+				(unsigned) record_i, (unsigned) n_records);
+			return FSERR_OUT_OF_STRUCT;
+		}
+		add_value(&total, load_int_field(data + record_i * record_size,
+						 field),
+			  field);
+	}
+	finish_aggregate(result, &total, field);
+
+	return FS_NO_ERROR;
+}
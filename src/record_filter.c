@@ -0,0 +1,442 @@
+#include <record_filter.h>
+#include <logger.h>
+
+#include "fs_simd.h"
+
+#include <stdlib.h>
+#include <errno.h>
+
+/* the bit that is flipped to turn signed values into keys */
+#define SIGN_BIT	((uint64_t) 1 << 63)
+/* the largest number of set values tested with vector comparisons */
+#define MAX_VECTOR_SET	8
+
+/* a predicate turned into key ranges, ready for testing */
+struct compiled_predicate {
+	/* the field to test */
+	const struct fs_int_field *field;
+	/* Is it a set test, rather than a range? */
+	int is_set;
+	/* Can no value of the field match? */
+	int is_empty;
+	/* the lowest and highest keys in the range */
+	uint64_t low_key;
+	uint64_t high_key;
+	/* the sorted, distinct keys of the set, within the field's range */
+	uint64_t *keys;
+	/* the number of keys in the set */
+	size_t n_keys;
+};
+
+/*
+ * Find the range of keys that a field can hold.
+ * field:	the description of the field
+ * low_key:	will be set to the lowest key
+ * high_key:	will be set to the highest key
+ */
+static void
+field_key_range(const struct fs_int_field *field, uint64_t *low_key,
+		uint64_t *high_key)
+{
+	unsigned n_bits = field->width * 8;
+
+	if (n_bits >= 64) {
+		*low_key = 0;
+		*high_key = UINT64_MAX;
+	} else if (field->is_signed) {
+		*low_key = (-((uint64_t) 1 << (n_bits - 1))) ^ SIGN_BIT;
+		*high_key = (((uint64_t) 1 << (n_bits - 1)) - 1) ^ SIGN_BIT;
+	} else {
+		*low_key = 0;
+		*high_key = ((uint64_t) 1 << n_bits) - 1;
+	}
+}
+
+/* "qsort" comparison of keys */
+static int compare_keys(const void *first, const void *second)
+{
+	uint64_t first_key = *(const uint64_t *) first;
+	uint64_t second_key = *(const uint64_t *) second;
+
+	return first_key < second_key ? -1 : first_key > second_key;
+}
+
+/*
+ * Turn a predicate into key ranges, dropping values the field cannot hold.
+ * compiled:	the compiled predicate to initialize
+ * predicate:	the predicate to compile
+ * record_size:	the distance between records
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_OUT_OF_STRUCT if the field is outside of the record;
+ *		FSERR_ERRNO if "malloc" failed
+ */
+static enum fs_status
+compile_predicate(struct compiled_predicate *compiled,
+		  const struct record_predicate *predicate, size_t record_size)
+{
+	const struct fs_int_field *field = &predicate->field;
+	uint64_t field_low, field_high;
+
+	if (field->offset + field->width > record_size) {
+		printlg(ERROR_LEVEL,
+			"Filtered field at %u-%u is outside of "
+			"records of size %u.\n",
+			(unsigned) field->offset,
+			(unsigned) (field->offset + field->width),
+			(unsigned) record_size);
+		return FSERR_OUT_OF_STRUCT;
+	}
+
+	field_key_range(field, &field_low, &field_high);
+	compiled->field = field;
+	compiled->keys = NULL;
+	compiled->n_keys = 0;
+	compiled->is_set = predicate->type == PREDICATE_IN_SET;
+
+	if (compiled->is_set) {
+		size_t value_i;
+
+		compiled->keys = malloc(sizeof(*compiled->keys) *
+					(predicate->n_values + 1));
+		if (compiled->keys == NULL) {
+			printlg(ERROR_LEVEL, "Unable to allocate a set of %u "
+					     "values.\n",
+				(unsigned) predicate->n_values);
+			return FSERR_ERRNO;
+		}
+		for (value_i = 0; value_i < predicate->n_values; value_i++) {
+			uint64_t key = int_field_key(predicate->values[value_i],
+						     field);
+
+			if (key >= field_low && key <= field_high) {
+				compiled->keys[compiled->n_keys++] = key;
+			}
+		}
+		qsort(compiled->keys, compiled->n_keys, sizeof(uint64_t),
+		      compare_keys);
+		if (compiled->n_keys > 0) {
+			size_t n_distinct = 1, key_i;
+
+			for (key_i = 1; key_i < compiled->n_keys; key_i++) {
+				if (compiled->keys[key_i] !=
+				    compiled->keys[n_distinct - 1]) {
+					compiled->keys[n_distinct++] =
+						compiled->keys[key_i];
+				}
+			}
+			compiled->n_keys = n_distinct;
+		}
+		compiled->is_empty = compiled->n_keys == 0;
+	} else {
+		uint64_t high = predicate->type == PREDICATE_RANGE ?
+				predicate->high : predicate->low;
+
+		compiled->low_key = int_field_key(predicate->low, field);
+		compiled->high_key = int_field_key(high, field);
+		if (compiled->low_key < field_low) {
+			compiled->low_key = field_low;
+		}
+		if (compiled->high_key > field_high) {
+			compiled->high_key = field_high;
+		}
+		compiled->is_empty = compiled->low_key > compiled->high_key;
+	}
+
+	return FS_NO_ERROR;
+}
+
+/*
+ * Test a single raw record against a compiled predicate.
+ * compiled:	the compiled predicate
+ * record:	the start of the raw record
+ * returns	nonzero if the record matches
+ */
+static int
+test_record(const struct compiled_predicate *compiled, const uint8_t *record)
+{
+	uint64_t key = load_int_field_key(record, compiled->field);
+
+	if (compiled->is_set) {
+		size_t low = 0, high = compiled->n_keys;
+
+		while (low < high) {
+			size_t middle = low + (high - low) / 2;
+
+			if (compiled->keys[middle] < key) {
+				low = middle + 1;
+			} else {
+				high = middle;
+			}
+		}
+		return low < compiled->n_keys && compiled->keys[low] == key;
+	}
+
+	return key >= compiled->low_key && key <= compiled->high_key;
+}
+
+#ifdef FS_HAVE_AVX2
+/*
+ * Convert a key back into the value of a field,
+ * as it would be loaded into a vector lane.
+ */
+static uint64_t key_lane_value(uint64_t key, const struct fs_int_field *field)
+{
+	return field->is_signed ? key ^ SIGN_BIT : key;
+}
+
+/*
+ * Test 4-byte fields of every record in a range with AVX2.
+ * compiled:	the compiled predicate, with a 4-byte field
+ * data:	the start of the first record of the array
+ * record_size:	the distance between records
+ * n_records:	the number of records to test, from the first
+ * selection:	the array to append matching indices to
+ * returns	the number of indices appended,
+ *		with any records after the last multiple of 8 left untested
+ */
+FS_AVX2_TARGET static size_t
+filter_avx2_32(const struct compiled_predicate *compiled, const uint8_t *data,
+	       size_t record_size, size_t n_records, size_t *selection)
+{
+	const struct fs_int_field *field = compiled->field;
+	const int swap = field->endianness != machine_endianness();
+	const uint32_t flip = field->is_signed ? 0 : 0x80000000;
+	const __m256i flips = _mm256_set1_epi32((int) flip);
+	const __m256i offsets = gather_offsets32(record_size, field->offset);
+	__m256i low = _mm256_set1_epi32(
+		(int) ((uint32_t) key_lane_value(compiled->low_key, field) ^
+		       flip));
+	__m256i high = _mm256_set1_epi32(
+		(int) ((uint32_t) key_lane_value(compiled->high_key, field) ^
+		       flip));
+	__m256i set_values[MAX_VECTOR_SET];
+	size_t n_selected = 0, record_i, key_i;
+
+	for (key_i = 0; compiled->is_set && key_i < compiled->n_keys; key_i++) {
+		set_values[key_i] = _mm256_set1_epi32(
+			(int) key_lane_value(compiled->keys[key_i], field));
+	}
+
+	for (record_i = 0; record_i + 8 <= n_records; record_i += 8) {
+		__m256i lanes = gather_fields32(data + record_i * record_size,
+						offsets, swap);
+		__m256i matches;
+		unsigned mask;
+
+		if (compiled->is_set) {
+			matches = _mm256_setzero_si256();
+			for (key_i = 0; key_i < compiled->n_keys; key_i++) {
+				matches = _mm256_or_si256(matches,
+					_mm256_cmpeq_epi32(lanes,
+							   set_values[key_i]));
+			}
+		} else {
+			lanes = _mm256_xor_si256(lanes, flips);
+			matches = _mm256_or_si256(
+				_mm256_cmpgt_epi32(low, lanes),
+				_mm256_cmpgt_epi32(lanes, high));
+			matches = _mm256_xor_si256(matches,
+						   _mm256_set1_epi32(-1));
+		}
+
+		mask = _mm256_movemask_ps(_mm256_castsi256_ps(matches));
+		while (mask) {
+			selection[n_selected++] = record_i +
+						  __builtin_ctz(mask);
+			mask &= mask - 1;
+		}
+	}
+
+	return n_selected;
+}
+
+/*
+ * Test 8-byte fields of every record in a range with AVX2.
+ * compiled:	the compiled predicate, with an 8-byte field
+ * data:	the start of the first record of the array
+ * record_size:	the distance between records
+ * n_records:	the number of records to test, from the first
+ * selection:	the array to append matching indices to
+ * returns	the number of indices appended,
+ *		with any records after the last multiple of 4 left untested
+ */
+FS_AVX2_TARGET static size_t
+filter_avx2_64(const struct compiled_predicate *compiled, const uint8_t *data,
+	       size_t record_size, size_t n_records, size_t *selection)
+{
+	const struct fs_int_field *field = compiled->field;
+	const int swap = field->endianness != machine_endianness();
+	const uint64_t flip = field->is_signed ? 0 : SIGN_BIT;
+	const __m256i flips = _mm256_set1_epi64x((long long) flip);
+	const __m128i offsets = gather_offsets64(record_size, field->offset);
+	__m256i low = _mm256_set1_epi64x(
+		(long long) (key_lane_value(compiled->low_key, field) ^ flip));
+	__m256i high = _mm256_set1_epi64x(
+		(long long) (key_lane_value(compiled->high_key, field) ^
+			     flip));
+	__m256i set_values[MAX_VECTOR_SET];
+	size_t n_selected = 0, record_i, key_i;
+
+	for (key_i = 0; compiled->is_set && key_i < compiled->n_keys; key_i++) {
+		set_values[key_i] = _mm256_set1_epi64x(
+			(long long) key_lane_value(compiled->keys[key_i],
+						   field));
+	}
+
+	for (record_i = 0; record_i + 4 <= n_records; record_i += 4) {
+		__m256i lanes = gather_fields64(data + record_i * record_size,
+						offsets, swap);
+		__m256i matches;
+		unsigned mask;
+
+		if (compiled->is_set) {
+			matches = _mm256_setzero_si256();
+			for (key_i = 0; key_i < compiled->n_keys; key_i++) {
+				matches = _mm256_or_si256(matches,
+					_mm256_cmpeq_epi64(lanes,
+							   set_values[key_i]));
+			}
+		} else {
+			lanes = _mm256_xor_si256(lanes, flips);
+			matches = _mm256_or_si256(
+				_mm256_cmpgt_epi64(low, lanes),
+				_mm256_cmpgt_epi64(lanes, high));
+			matches = _mm256_xor_si256(matches,
+						   _mm256_set1_epi64x(-1));
+		}
+
+		mask = _mm256_movemask_pd(_mm256_castsi256_pd(matches));
+		while (mask) {
+			selection[n_selected++] = record_i +
+						  __builtin_ctz(mask);
+			mask &= mask - 1;
+		}
+	}
+
+	return n_selected;
+}
+#endif
+
+/*
+ * Test every record in an array against a compiled predicate.
+ * compiled:	the compiled predicate
+ * data:	the start of the first record
+ * record_size:	the distance between records
+ * n_records:	the number of records
+ * selection:	will be filled with the indices of the matching records
+ * returns	the number of matching records
+ */
+static size_t
+scan_predicate(const struct compiled_predicate *compiled, const uint8_t *data,
+	       size_t record_size, size_t n_records, size_t *selection)
+{
+	size_t n_selected = 0, record_i = 0;
+
+	if (compiled->is_empty) {
+		return 0;
+	}
+
+#ifdef FS_HAVE_AVX2
+	if ((!compiled->is_set || compiled->n_keys <= MAX_VECTOR_SET) &&
+	    fits_gather(record_size, compiled->field->offset, 8) &&
+	    fs_has_avx2()) {
+		if (compiled->field->width == sizeof(uint32_t)) {
+			n_selected = filter_avx2_32(compiled, data,
+						    record_size, n_records,
+						    selection);
+			record_i = n_records - n_records % 8;
+		} else if (compiled->field->width == sizeof(uint64_t)) {
+			n_selected = filter_avx2_64(compiled, data,
+						    record_size, n_records,
+						    selection);
+			record_i = n_records - n_records % 4;
+		}
+	}
+#endif
+
+	for (; record_i < n_records; record_i++) {
+		if (test_record(compiled, data + record_i * record_size)) {
+			selection[n_selected++] = record_i;
+		}
+	}
+
+	return n_selected;
+}
+
+enum fs_status
+filter_records(struct file_struct *records, size_t record_size,
+	       const struct record_predicate *predicates, size_t n_predicates,
+	       size_t *selection, size_t *n_selected)
+{
+	size_t n_records = records->size / record_size;
+	struct compiled_predicate compiled;
+	enum fs_status status;
+	size_t predicate_i;
+
+	debug_assert(record_size > 0);
+
+	if (n_predicates == 0) {
+		size_t record_i;
+
+		for (record_i = 0; record_i < n_records; record_i++) {
+			selection[record_i] = record_i;
+		}
+		*n_selected = n_records;
+		return FS_NO_ERROR;
+	}
+
+	if ((status = compile_predicate(&compiled, &predicates[0],
+					record_size))) {
+		return status;
+	}
+	*n_selected = scan_predicate(&compiled, records->data, record_size,
+				     n_records, selection);
+	free(compiled.keys);
+
+	for (predicate_i = 1; predicate_i < n_predicates; predicate_i++) {
+		if ((status = refine_selection(records, record_size,
+					       &predicates[predicate_i],
+					       selection, n_selected))) {
+			return status;
+		}
+	}
+
+	return FS_NO_ERROR;
+}
+
+enum fs_status
+refine_selection(struct file_struct *records, size_t record_size,
+		 const struct record_predicate *predicate, size_t *selection,
+		 size_t *n_selected)
+{
+	size_t n_records = records->size / record_size;
+	const uint8_t *data = records->data;
+	struct compiled_predicate compiled;
+	size_t n_kept = 0, selected_i;
+	enum fs_status status;
+
+	if ((status = compile_predicate(&compiled, predicate, record_size))) {
+		return status;
+	}
+
+	for (selected_i = 0; selected_i < *n_selected; selected_i++) {
+		size_t record_i = selection[selected_i];
+
+		if (record_i >= n_records) {
+			printlg(ERROR_LEVEL,
+				"Selected record %u is past the end of the "
+				"%u records.\n",
+				(unsigned) record_i, (unsigned) n_records);
+			free(compiled.keys);
+			return FSERR_OUT_OF_STRUCT;
+		}
+		if (!compiled.is_empty &&
+		    test_record(&compiled, data + record_i * record_size)) {
+			selection[n_kept++] = record_i;
+		}
+	}
+	*n_selected = n_kept;
+	free(compiled.keys);
+
+	return FS_NO_ERROR;
+}
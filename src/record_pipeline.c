@@ -0,0 +1,426 @@
+#include <record_pipeline.h>
+#include <fs_parallel.h>
+#include <fs_queue.h>
+#include <io_backend.h>
+#include <logger.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* a batch of records in flight */
+struct pipeline_batch {
+	/*
+	 * the raw records, derived from the mapping of the whole array,
+	 * or read by themselves if "reads_batches" is set
+	 */
+	struct file_struct records;
+	/* the index of the batch, and of its first record */
+	size_t batch_i;
+	size_t first;
+	/* the number of records */
+	size_t n_records;
+	/* the decoded records */
+	void *decoded;
+	/* the status from decoding the batch */
+	enum fs_status status;
+};
+
+/* the state shared by the stages of a pipeline */
+struct pipeline_state {
+	/* the description of the scan */
+	const struct record_pipeline *pipeline;
+	/* the file containing the records */
+	struct file_structor *src_file;
+	/* nonzero if each batch is read by itself, from "copies_chunks" */
+	int reads_batches;
+	/* the mapping of the whole array, unless "reads_batches" is set */
+	struct file_struct records;
+	/* the number of records in each batch, and of batches */
+	size_t batch_records;
+	size_t n_batches;
+	/* the number of batches in flight, and of decoder threads */
+	unsigned depth;
+	unsigned n_decoders;
+	/* the batches, and the decoded records of all of them */
+	struct pipeline_batch *batches;
+	uint8_t *decoded;
+	/* the batches given back by the consumer to the reader */
+	struct spsc_queue free_batches;
+	/*
+	 * the batches from the reader to the decoders,
+	 * followed by a NULL for each decoder once there are no more
+	 */
+	struct mpmc_queue raw_batches;
+	/* the decoded batches, in any order */
+	struct mpmc_queue decoded_batches;
+	/* the location in "records" up to which pages were prefetched */
+	size_t prefetched;
+	/* nonzero once the consumer stopped, so the reader should stop */
+	int is_stopped;
+};
+
+/*
+ * Ask the kernel to read the pages of the records ahead of the decoders.
+ * state:	the pipeline
+ * end:		the location in "records" up to which to prefetch
+ */
+static void prefetch_records(struct pipeline_state *state, size_t end)
+{
+	const struct record_pipeline *pipeline = state->pipeline;
+	const size_t page_size = sysconf(_SC_PAGE_SIZE);
+	uint8_t *mapping_start = state->records.mapping_start;
+	size_t adjustment, start;
+
+	if (end > pipeline->n_records * pipeline->record_size) {
+		end = pipeline->n_records * pipeline->record_size;
+	}
+	if (state->reads_batches) {
+		if (end > state->prefetched) {
+			posix_fadvise(state->src_file->fd,
+				      pipeline->start_in_file +
+				      state->prefetched,
+				      end - state->prefetched,
+				      POSIX_FADV_WILLNEED);
+			state->prefetched = end;
+		}
+		return;
+	}
+	/* Chunks of memory sources have no pages of their own. */
+	if (mapping_start == NULL) {
+		return;
+	}
+	adjustment = (uint8_t *) state->records.data - mapping_start;
+	start = (state->prefetched + adjustment) / page_size * page_size;
+	if (end + adjustment <= start) {
+		return;
+	}
+
+	madvise(mapping_start + start, end + adjustment - start,
+		MADV_WILLNEED);
+	state->prefetched = end;
+}
+
+/* Push an item to a multi-producer queue, waiting while it is full. */
+static void push_waiting(struct mpmc_queue *queue, void *item)
+{
+	unsigned spins = 0;
+
+	while (!mpmc_push(queue, item)) {
+		queue_backoff(&spins);
+	}
+}
+
+/*
+ * the reader thread, which cuts the array into batches
+ * as the consumer gives them back, and prefetches them,
+ * or reads each batch by itself, freeing the chunk it held before
+ */
+static void *read_batches(void *arg)
+{
+	struct pipeline_state *state = arg;
+	const size_t record_size = state->pipeline->record_size;
+	const size_t batch_size = state->batch_records * record_size;
+	enum fs_status status = FS_NO_ERROR;
+	size_t batch_i;
+	unsigned decoder_i;
+
+	for (batch_i = 0; !status && batch_i < state->n_batches; batch_i++) {
+		struct pipeline_batch *batch;
+		void *item = NULL;
+		unsigned spins = 0;
+
+		while (!spsc_pop(&state->free_batches, &item)) {
+			if (__atomic_load_n(&state->is_stopped,
+					    __ATOMIC_ACQUIRE)) {
+				break;
+			}
+			queue_backoff(&spins);
+		}
+		if ((batch = item) == NULL) {
+			break;
+		}
+
+		batch->batch_i = batch_i;
+		batch->first = batch_i * state->batch_records;
+		batch->n_records = state->pipeline->n_records - batch->first;
+		if (batch->n_records > state->batch_records) {
+			batch->n_records = state->batch_records;
+		}
+		/* Keep the pages of every batch in flight on their way. */
+		prefetch_records(state, (batch_i + state->depth) * batch_size);
+		if (state->reads_batches) {
+			off_t start_in_file = state->pipeline->start_in_file +
+					      (off_t) (batch_i * batch_size);
+			size_t size = batch->n_records * record_size;
+
+			teardown_file_struct(&batch->records);
+			status = init_file_struct(&batch->records,
+						  state->src_file, size,
+						  start_in_file);
+		} else {
+			derive_file_struct(&batch->records, &state->records,
+					   batch->n_records * record_size,
+					   batch_i * batch_size);
+		}
+		/* The consumer stops at the batch that could not be read. */
+		batch->status = status;
+		push_waiting(&state->raw_batches, batch);
+	}
+
+	for (decoder_i = 0; decoder_i < state->n_decoders; decoder_i++) {
+		push_waiting(&state->raw_batches, NULL);
+	}
+
+	return NULL;
+}
+
+/* a decoder thread, which decodes batches until it pops a NULL */
+static void *decode_batches(void *arg)
+{
+	struct pipeline_state *state = arg;
+	const struct record_pipeline *pipeline = state->pipeline;
+
+	for (;;) {
+		struct pipeline_batch *batch;
+		unsigned spins = 0;
+		void *item;
+
+		while (!mpmc_pop(&state->raw_batches, &item)) {
+			queue_backoff(&spins);
+		}
+		if ((batch = item) == NULL) {
+			return NULL;
+		}
+
+		if (!batch->status) {
+			batch->status = pipeline->decode(pipeline->decode_arg,
+							 &batch->records,
+							 pipeline->record_size,
+							 batch->n_records,
+							 batch->decoded);
+		}
+		push_waiting(&state->decoded_batches, batch);
+	}
+}
+
+/*
+ * Consume the decoded batches in order on the calling thread,
+ * holding those that arrive early until their turn.
+ * state:	the pipeline
+ * pending:	an array of "depth" NULL pointers,
+ *		for the batches that arrived early
+ * returns	FS_NO_ERROR on success, or the first error of a batch
+ */
+static enum fs_status
+consume_batches(struct pipeline_state *state,
+		struct pipeline_batch **pending)
+{
+	const struct record_pipeline *pipeline = state->pipeline;
+	enum fs_status status = FS_NO_ERROR;
+	size_t next = 0;
+
+	while (!status && next < state->n_batches) {
+		struct pipeline_batch *batch;
+		unsigned spins = 0;
+		void *item;
+
+		while (!mpmc_pop(&state->decoded_batches, &item)) {
+			queue_backoff(&spins);
+		}
+		batch = item;
+		pending[batch->batch_i % state->depth] = batch;
+
+		while (!status &&
+		       (batch = pending[next % state->depth]) != NULL) {
+			pending[next % state->depth] = NULL;
+			if (!(status = batch->status)) {
+				status = pipeline->consume(
+					pipeline->consume_arg, batch->decoded,
+					batch->first, batch->n_records);
+			}
+			spsc_push(&state->free_batches, batch);
+			next++;
+		}
+	}
+
+	return status;
+}
+
+enum fs_status
+decode_with_plan(void *arg, struct file_struct *records, size_t record_size,
+		 size_t n_records, void *decoded)
+{
+	const struct plan_decoder *decoder = arg;
+
+	return apply_copy_plan_array(decoder->plan, decoded,
+				     decoder->dst_stride, records, 0,
+				     record_size, n_records);
+}
+
+/*
+ * Allocate the batches and queues of a pipeline.
+ * state:	the pipeline, with its sizes set
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_ERRNO if "malloc" failed, having freed everything
+ */
+static enum fs_status init_stages(struct pipeline_state *state)
+{
+	const size_t decoded_batch = state->batch_records *
+				     state->pipeline->decoded_size;
+	unsigned batch_i;
+
+	state->batches = malloc(sizeof(*state->batches) * state->depth);
+	state->decoded = malloc(decoded_batch * state->depth + 1);
+	state->free_batches.slots = NULL;
+	state->raw_batches.cells = NULL;
+	state->decoded_batches.cells = NULL;
+	if (state->batches == NULL || state->decoded == NULL ||
+	    init_spsc_queue(&state->free_batches, state->depth) ||
+	    init_mpmc_queue(&state->raw_batches,
+			    state->depth + state->n_decoders) ||
+	    init_mpmc_queue(&state->decoded_batches, state->depth)) {
+		free(state->batches);
+		free(state->decoded);
+		free_spsc_queue(&state->free_batches);
+		free_mpmc_queue(&state->raw_batches);
+		free_mpmc_queue(&state->decoded_batches);
+		return FSERR_ERRNO;
+	}
+
+	for (batch_i = 0; batch_i < state->depth; batch_i++) {
+		state->batches[batch_i].records.data = NULL;
+		state->batches[batch_i].decoded = state->decoded +
+						  batch_i * decoded_batch;
+		spsc_push(&state->free_batches, &state->batches[batch_i]);
+	}
+
+	return FS_NO_ERROR;
+}
+
+/*
+ * Free the batches and queues of a pipeline,
+ * and the chunks of the batches read by themselves.
+ */
+static void free_stages(struct pipeline_state *state)
+{
+	unsigned batch_i;
+
+	for (batch_i = 0; batch_i < state->depth; batch_i++) {
+		teardown_file_struct(&state->batches[batch_i].records);
+	}
+	free(state->batches);
+	free(state->decoded);
+	free_spsc_queue(&state->free_batches);
+	free_mpmc_queue(&state->raw_batches);
+	free_mpmc_queue(&state->decoded_batches);
+}
+
+/*
+ * Start the threads of a pipeline, consume its batches, and join them.
+ * state:	the pipeline, with its stages initialized
+ * returns	FS_NO_ERROR on success, or the first error
+ */
+static enum fs_status run_stages(struct pipeline_state *state)
+{
+	pthread_t *decoders = malloc(sizeof(*decoders) * state->n_decoders);
+	struct pipeline_batch **pending = calloc(state->depth,
+						 sizeof(*pending));
+	enum fs_status status = FS_NO_ERROR;
+	unsigned n_started = 0, decoder_i;
+	pthread_t reader;
+
+	if (decoders == NULL || pending == NULL) {
+		free(decoders);
+		free(pending);
+		return FSERR_ERRNO;
+	}
+	while (n_started < state->n_decoders &&
+	       !pthread_create(&decoders[n_started], NULL, decode_batches,
+			       state)) {
+		n_started++;
+	}
+	/* The reader ends as many decoders as could be started. */
+	state->n_decoders = n_started;
+
+	if (n_started == 0 ||
+	    pthread_create(&reader, NULL, read_batches, state)) {
+		printlg(ERROR_LEVEL, "Unable to start the pipeline threads.\n");
+		for (decoder_i = 0; decoder_i < n_started; decoder_i++) {
+			push_waiting(&state->raw_batches, NULL);
+		}
+		status = FSERR_ERRNO;
+	} else {
+		status = consume_batches(state, pending);
+		__atomic_store_n(&state->is_stopped, 1, __ATOMIC_RELEASE);
+		pthread_join(reader, NULL);
+	}
+
+	for (decoder_i = 0; decoder_i < n_started; decoder_i++) {
+		pthread_join(decoders[decoder_i], NULL);
+	}
+	free(decoders);
+	free(pending);
+
+	return status;
+}
+
+enum fs_status
+run_record_pipeline(struct file_structor *src_file,
+		    const struct record_pipeline *pipeline)
+{
+	struct pipeline_state state;
+	enum fs_status status;
+
+	debug_assert(pipeline->record_size > 0);
+	if (pipeline->n_records == 0) {
+		return FS_NO_ERROR;
+	}
+
+	state.pipeline = pipeline;
+	state.batch_records = pipeline->batch_records;
+	if (state.batch_records == 0) {
+		state.batch_records = PIPELINE_BATCH_SIZE /
+				      pipeline->record_size;
+		if (state.batch_records == 0) {
+			state.batch_records = 1;
+		}
+	}
+	state.n_batches = (pipeline->n_records + state.batch_records - 1) /
+			  state.batch_records;
+	state.depth = pipeline->depth ? pipeline->depth : PIPELINE_DEPTH;
+	debug_assert(state.depth >= 2);
+	state.n_decoders = pipeline->n_decoders;
+	if (state.n_decoders == 0) {
+		state.n_decoders = fs_thread_count(0);
+		state.n_decoders = state.n_decoders > 2 ?
+				   state.n_decoders - 2 : 1;
+	}
+	state.prefetched = 0;
+	state.is_stopped = 0;
+	state.src_file = src_file;
+	state.reads_batches = copies_chunks(src_file);
+	state.records.data = NULL;
+	state.records.mapping_start = NULL;
+
+	if (!state.reads_batches &&
+	    (status = init_file_struct(&state.records, src_file,
+				       pipeline->record_size *
+				       pipeline->n_records,
+				       pipeline->start_in_file))) {
+		return status;
+	}
+	if ((status = init_stages(&state))) {
+		teardown_file_struct(&state.records);
+		return status;
+	}
+
+	status = run_stages(&state);
+
+	free_stages(&state);
+	teardown_file_struct(&state.records);
+
+	return status;
+}
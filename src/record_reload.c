@@ -0,0 +1,337 @@
+#include <record_reload.h>
+#include <fs_parallel.h>
+#include <logger.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+/* the multipliers of the fingerprint, from xxHash */
+#define PRIME_1		0x9e3779b185ebca87ull
+#define PRIME_2		0xc2b2ae3d27d4eb4full
+/* the number of independent lanes of the fingerprint */
+#define N_LANES		4
+
+/* Rotate a value left by some bits. */
+inline static uint64_t rotate_left(uint64_t value, unsigned bits)
+{
+	return value << bits | value >> (64 - bits);
+}
+
+/*
+ * Hash the raw bytes of a block,
+ * mixing 4 words at a time in independent lanes
+ * so that the multiplications of each word overlap.
+ * This only needs to tell a changed block from the same block,
+ * not to resist a chosen collision.
+ * data:	the bytes of the block
+ * size:	the number of bytes, which is also hashed
+ * returns	the fingerprint, which is never 0
+ */
+static uint64_t block_fingerprint(const uint8_t *data, size_t size)
+{
+	uint64_t lanes[N_LANES] = {
+		PRIME_1 + PRIME_2, PRIME_2, 0, -PRIME_1
+	};
+	uint64_t hash = size * PRIME_1, word;
+	size_t byte_i = 0, lane_i;
+
+	for (; byte_i + N_LANES * sizeof(word) <= size;
+	     byte_i += N_LANES * sizeof(word)) {
+		for (lane_i = 0; lane_i < N_LANES; lane_i++) {
+			memcpy(&word, data + byte_i + lane_i * sizeof(word),
+			       sizeof(word));
+			lanes[lane_i] = rotate_left(lanes[lane_i] +
+						    word * PRIME_2, 31) *
+					PRIME_1;
+		}
+	}
+	for (lane_i = 0; lane_i < N_LANES; lane_i++) {
+		hash = (hash ^ rotate_left(lanes[lane_i], 7 * lane_i + 1)) *
+		       PRIME_1 + PRIME_2;
+	}
+	for (; byte_i < size; byte_i++) {
+		hash = rotate_left(hash ^ data[byte_i] * PRIME_2, 11) *
+		       PRIME_1;
+	}
+
+	hash ^= hash >> 33;
+	hash *= PRIME_2;
+	hash ^= hash >> 29;
+
+	return hash != 0 ? hash : 1;
+}
+
+/* the state shared by the threads of a reload */
+struct reload_work {
+	/* the reload being done */
+	struct record_reload *reload;
+	/* the mapping of every record */
+	struct file_struct *records;
+	/* the number of records */
+	size_t n_records;
+	/* the index of the next block to check */
+	size_t next;
+	/* the number of blocks decoded */
+	size_t n_changed;
+};
+
+/*
+ * Check the fingerprint of a block,
+ * and decode its records if it changed.
+ * work:	the reload
+ * block_i:	the index of the block
+ * returns	FS_NO_ERROR on success, or the error from the decoder
+ */
+static enum fs_status check_block(struct reload_work *work, size_t block_i)
+{
+	struct record_reload *reload = work->reload;
+	const size_t record_size = reload->record_size;
+	const size_t first = block_i * reload->block_records;
+	size_t n_records = work->n_records - first;
+	struct file_struct block;
+	uint64_t fingerprint;
+	enum fs_status status;
+
+	if (n_records > reload->block_records) {
+		n_records = reload->block_records;
+	}
+	fingerprint = block_fingerprint((const uint8_t *) work->records->data +
+					first * record_size,
+					n_records * record_size);
+	if (fingerprint == reload->fingerprints[block_i]) {
+		reload->is_changed[block_i] = 0;
+		return FS_NO_ERROR;
+	}
+
+	reload->is_changed[block_i] = 1;
+	derive_file_struct(&block, work->records, n_records * record_size,
+			   first * record_size);
+	if ((status = reload->decode(reload->decode_arg, &block, record_size,
+				     n_records,
+				     (uint8_t *) reload->decoded +
+				     first * reload->decoded_size))) {
+		/* Decode the block again on the next reload. */
+		reload->fingerprints[block_i] = 0;
+		return status;
+	}
+	reload->fingerprints[block_i] = fingerprint;
+	__atomic_fetch_add(&work->n_changed, 1, __ATOMIC_RELAXED);
+
+	return FS_NO_ERROR;
+}
+
+/* the worker for "reload_records", which checks blocks until none are left */
+static enum fs_status check_blocks(void *arg, unsigned worker_i)
+{
+	struct reload_work *work = arg;
+	enum fs_status status = FS_NO_ERROR;
+	size_t block_i;
+
+	(void) worker_i;
+
+	while (!status && claim_work(&work->next, work->reload->n_blocks, 1,
+				     &block_i)) {
+		status = check_block(work, block_i);
+	}
+
+	return status;
+}
+
+/*
+ * Make room for the decoded records and fingerprints of an array,
+ * keeping those of the records already loaded.
+ * Blocks the array did not have get no fingerprint,
+ * so that they are decoded.
+ * reload:	the reload to grow
+ * n_records:	the number of records in the array
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_ERRNO if the memory could not be allocated,
+ *			leaving the reload unchanged
+ */
+static enum fs_status grow_reload(struct record_reload *reload,
+				  size_t n_records)
+{
+	size_t n_blocks = (n_records + reload->block_records - 1) /
+			  reload->block_records;
+	uint64_t *fingerprints;
+	uint8_t *is_changed;
+
+	if (n_records > reload->capacity) {
+		size_t capacity = reload->capacity + reload->capacity / 2;
+		void *decoded;
+
+		if (capacity < n_records) {
+			capacity = n_records;
+		}
+		decoded = realloc(reload->decoded,
+				  capacity * reload->decoded_size);
+		if (decoded == NULL) {
+			printlg(ERROR_LEVEL,
+				"Unable to allocate %u decoded records.\n",
+				(unsigned) capacity);
+			return FSERR_ERRNO;
+		}
+		reload->decoded = decoded;
+		reload->capacity = capacity;
+	}
+	if (n_blocks > reload->n_blocks) {
+		fingerprints = realloc(reload->fingerprints,
+				       sizeof(*fingerprints) * n_blocks);
+		if (fingerprints == NULL) {
+			return FSERR_ERRNO;
+		}
+		reload->fingerprints = fingerprints;
+		is_changed = realloc(reload->is_changed, n_blocks);
+		if (is_changed == NULL) {
+			return FSERR_ERRNO;
+		}
+		reload->is_changed = is_changed;
+		memset(fingerprints + reload->n_blocks, 0,
+		       sizeof(*fingerprints) *
+		       (n_blocks - reload->n_blocks));
+	}
+	reload->n_blocks = n_blocks;
+
+	return FS_NO_ERROR;
+}
+
+/*
+ * Check if a file is the same as at the last load,
+ * and was last modified early enough before it
+ * that a change since would have changed its modification time.
+ */
+static int is_unchanged(const struct record_reload *reload,
+			const struct stat *identity)
+{
+	return identity->st_dev == reload->dev &&
+	       identity->st_ino == reload->ino &&
+	       identity->st_size == reload->size &&
+	       identity->st_mtim.tv_sec == reload->mtime.tv_sec &&
+	       identity->st_mtim.tv_nsec == reload->mtime.tv_nsec &&
+	       (reload->mtime.tv_sec < reload->loaded.tv_sec ||
+		(reload->mtime.tv_sec == reload->loaded.tv_sec &&
+		 reload->mtime.tv_nsec < reload->loaded.tv_nsec));
+}
+
+enum fs_status reload_records(struct record_reload *reload, int flags)
+{
+	struct reload_work work;
+	struct file_structor file;
+	struct file_struct records;
+	struct timespec loaded;
+	struct stat identity;
+	enum fs_status status;
+	size_t n_records = 0;
+
+	/* Anything written from now on gets at least this time. */
+	clock_gettime(CLOCK_REALTIME_COARSE, &loaded);
+	if (stat(reload->path, &identity)) {
+		printlg(ERROR_LEVEL, "Unable to find the status of %s: %d\n",
+			reload->path, errno);
+		return FSERR_ERRNO;
+	}
+	if (!(flags & RELOAD_FORCE) && is_unchanged(reload, &identity)) {
+		if (reload->n_blocks > 0) {
+			memset(reload->is_changed, 0, reload->n_blocks);
+		}
+		reload->n_changed = 0;
+		return FS_NO_ERROR;
+	}
+
+	if ((status = open_file_structor(&file, reload->path))) {
+		return status;
+	}
+	if (file.size > reload->start_in_file) {
+		n_records = (file.size - reload->start_in_file) /
+			    reload->record_size;
+	}
+	if ((status = grow_reload(reload, n_records))) {
+		goto close;
+	}
+	reload->n_records = n_records;
+	reload->n_changed = 0;
+	if (n_records == 0) {
+		goto loaded;
+	}
+	if ((status = init_file_struct(&records, &file,
+				    n_records * reload->record_size,
+				    reload->start_in_file))) {
+		goto close;
+	}
+
+	work.reload = reload;
+	work.records = &records;
+	work.n_records = n_records;
+	work.next = 0;
+	work.n_changed = 0;
+	status = run_parallel(reload->n_threads, check_blocks, &work);
+	reload->n_changed = work.n_changed;
+	teardown_file_struct(&records);
+	if (status) {
+		goto close;
+	}
+
+loaded:
+	/* The file may have changed since "stat", so use its descriptor. */
+	if (fstat(file.fd, &identity) == 0) {
+		reload->dev = identity.st_dev;
+		reload->ino = identity.st_ino;
+		reload->size = identity.st_size;
+		reload->mtime = identity.st_mtim;
+		reload->loaded = loaded;
+	}
+close:
+	close_file_structor(&file);
+
+	return status;
+}
+
+enum fs_status init_record_reload(struct record_reload *to_init,
+				  const char *path)
+{
+	enum fs_status status;
+
+	if (to_init->block_records == 0) {
+		to_init->block_records = RELOAD_BLOCK_SIZE /
+					 to_init->record_size;
+		if (to_init->block_records == 0) {
+			to_init->block_records = 1;
+		}
+	}
+	to_init->n_threads = fs_thread_count(to_init->n_threads);
+	to_init->decoded = NULL;
+	to_init->n_records = 0;
+	to_init->capacity = 0;
+	to_init->fingerprints = NULL;
+	to_init->is_changed = NULL;
+	to_init->n_blocks = 0;
+	to_init->n_changed = 0;
+	/* No file has inode 0, so the first load is never skipped. */
+	to_init->ino = 0;
+	if ((to_init->path = strdup(path)) == NULL) {
+		return FSERR_ERRNO;
+	}
+
+	if ((status = reload_records(to_init, RELOAD_FORCE))) {
+		teardown_record_reload(to_init);
+	}
+
+	return status;
+}
+
+enum fs_status teardown_record_reload(struct record_reload *to_teardown)
+{
+	free(to_teardown->path);
+	free(to_teardown->decoded);
+	free(to_teardown->fingerprints);
+	free(to_teardown->is_changed);
+	to_teardown->path = NULL;
+	to_teardown->decoded = NULL;
+	to_teardown->fingerprints = NULL;
+	to_teardown->is_changed = NULL;
+
+	return FS_NO_ERROR;
+}
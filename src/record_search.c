@@ -0,0 +1,211 @@
+#include <record_search.h>
+#include <logger.h>
+
+#include <stdlib.h>
+
+/* the default number of records between samples */
+#define DEFAULT_SAMPLE_STEP	64
+/*
+ * the number of Eytzinger levels to prefetch ahead,
+ * so that 16 keys, or two cache lines, are fetched at a time
+ */
+#define PREFETCH_LEVELS		4
+
+/*
+ * Load the key of a record.
+ * sorted:	the sorted array
+ * record_i:	the index of the record
+ * returns	the key, as from "load_int_field_key"
+ */
+inline static uint64_t
+record_key(const struct sorted_records *sorted, size_t record_i)
+{
+	return load_int_field_key((const uint8_t *) sorted->records.data +
+				  record_i * sorted->record_size,
+				  &sorted->key);
+}
+
+/*
+ * Fill the samples in Eytzinger order, by visiting the implicit tree
+ * rooted at "node" in order.
+ * sorted:	the sorted array, with the samples allocated
+ * sample_i:	the index, in sorted order, of the next sample to place
+ * node:	the index of the subtree's root in the Eytzinger arrays
+ * returns	the index of the next sample to place after the subtree
+ */
+static size_t
+fill_samples(struct sorted_records *sorted, size_t sample_i, size_t node)
+{
+	if (node <= sorted->n_samples) {
+		size_t record_i;
+
+		sample_i = fill_samples(sorted, sample_i, node * 2);
+		record_i = sample_i * sorted->sample_step;
+		sorted->sample_keys[node] = record_key(sorted, record_i);
+		sorted->sample_records[node] = record_i;
+		sample_i = fill_samples(sorted, sample_i + 1, node * 2 + 1);
+	}
+
+	return sample_i;
+}
+
+enum fs_status
+init_sorted_records(struct sorted_records *to_init,
+		    struct file_structor *src_file, off_t start_in_file,
+		    size_t record_size, size_t n_records,
+		    const struct fs_int_field *key, size_t n_samples)
+{
+	enum fs_status status;
+
+	to_init->record_size = record_size;
+	to_init->n_records = n_records;
+	to_init->key = *key;
+	to_init->sample_step = 1;
+	to_init->n_samples = 0;
+	to_init->sample_keys = NULL;
+	to_init->sample_records = NULL;
+	to_init->records.data = NULL;
+	to_init->records.mapping_start = NULL;
+
+	if (key->width < 1 || key->width > sizeof(uint64_t) ||
+	    key->offset + key->width > record_size) {
+		printlg(ERROR_LEVEL,
+			"Key field at %u-%u does not fit in a 64-bit key, or "
+			"is outside of records of size %u.\n",
+			(unsigned) key->offset,
+			(unsigned) (key->offset + key->width),
+			(unsigned) record_size);
+		return FSERR_OUT_OF_STRUCT;
+	}
+	if (n_records == 0) {
+		return FS_NO_ERROR;
+	}
+
+	if ((status = init_file_struct(&to_init->records, src_file,
+				       record_size * n_records,
+				       start_in_file))) {
+		return status;
+	}
+
+	if (n_samples == 0) {
+		n_samples = n_records / DEFAULT_SAMPLE_STEP;
+	}
+	if (n_samples == 0) {
+		n_samples = 1;
+	} else if (n_samples > n_records) {
+		n_samples = n_records;
+	}
+	to_init->sample_step = (n_records + n_samples - 1) / n_samples;
+	to_init->n_samples = (n_records + to_init->sample_step - 1) /
+			     to_init->sample_step;
+
+	to_init->sample_keys = malloc(sizeof(*to_init->sample_keys) *
+				      (to_init->n_samples + 1));
+	to_init->sample_records = malloc(sizeof(*to_init->sample_records) *
+					 (to_init->n_samples + 1));
+	if (to_init->sample_keys == NULL || to_init->sample_records == NULL) {
+		printlg(ERROR_LEVEL, "Unable to allocate %u key samples.\n",
+			(unsigned) to_init->n_samples);
+		teardown_sorted_records(to_init);
+		return FSERR_ERRNO;
+	}
+	fill_samples(to_init, 0, 1);
+
+	return FS_NO_ERROR;
+}
+
+enum fs_status teardown_sorted_records(struct sorted_records *to_teardown)
+{
+	free(to_teardown->sample_keys);
+	free(to_teardown->sample_records);
+	to_teardown->sample_keys = NULL;
+	to_teardown->sample_records = NULL;
+	to_teardown->n_samples = 0;
+	to_teardown->n_records = 0;
+
+	return teardown_file_struct(&to_teardown->records);
+}
+
+/*
+ * Find the first record whose key is not less than a key.
+ * sorted:	the sorted array to search
+ * key:		the key to search for, as from "int_field_key"
+ * returns	the index of the record,
+ *		or the number of records if every key is less than "key"
+ */
+static size_t
+lower_bound_key(const struct sorted_records *sorted, uint64_t key)
+{
+	const uint64_t *sample_keys = sorted->sample_keys;
+	size_t node = 1, low, high;
+
+	if (sorted->n_records == 0) {
+		return 0;
+	}
+
+	/* Find the first sample that is not less than the key. */
+	while (node <= sorted->n_samples) {
+		__builtin_prefetch(sample_keys + (node << PREFETCH_LEVELS));
+		node = node * 2 + (sample_keys[node] < key);
+	}
+	node >>= __builtin_ffsll(~node);
+
+	/* The answer is after the sample before it, and up to it. */
+	if (node == 0) {
+		low = (sorted->n_samples - 1) * sorted->sample_step + 1;
+		high = sorted->n_records;
+	} else {
+		high = sorted->sample_records[node];
+		low = high == 0 ? 0 : high - sorted->sample_step + 1;
+	}
+
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+
+		if (record_key(sorted, middle) < key) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+
+	return low;
+}
+
+size_t sorted_lower_bound(const struct sorted_records *sorted, uint64_t value)
+{
+	return lower_bound_key(sorted, int_field_key(value, &sorted->key));
+}
+
+size_t sorted_upper_bound(const struct sorted_records *sorted, uint64_t value)
+{
+	uint64_t key = int_field_key(value, &sorted->key);
+
+	if (key == UINT64_MAX) {
+		return sorted->n_records;
+	}
+
+	return lower_bound_key(sorted, key + 1);
+}
+
+void sorted_range(const struct sorted_records *sorted, uint64_t low,
+		  uint64_t high, size_t *first, size_t *end)
+{
+	*first = sorted_lower_bound(sorted, low);
+	*end = sorted_upper_bound(sorted, high);
+	if (*end < *first) {
+		*end = *first;
+	}
+}
+
+int sorted_find(const struct sorted_records *sorted, uint64_t value,
+		size_t *index)
+{
+	uint64_t key = int_field_key(value, &sorted->key);
+	size_t record_i = lower_bound_key(sorted, key);
+
+	*index = record_i;
+
+	return record_i < sorted->n_records &&
+	       record_key(sorted, record_i) == key;
+}
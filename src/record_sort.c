@@ -0,0 +1,588 @@
+#include <record_sort.h>
+#include <stream_scan.h>
+#include <fs_parallel.h>
+#include <fs_common.h>
+#include <logger.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* the number of bits sorted by each pass of the radix sort */
+#define RADIX_BITS	8
+/* the number of buckets of each pass */
+#define N_BUCKETS	(1 << RADIX_BITS)
+
+/* the key of a record, and its index in its run */
+struct sort_entry {
+	uint64_t key;
+	uint64_t index;
+};
+
+/*
+ * Load the key of a record as an unsigned integer of the key's width
+ * in the same order as the key,
+ * so that the radix sort has no more passes than the key has bytes.
+ * record:	the raw record
+ * key:		the description of the key field
+ * returns	the key, with the sign bit flipped if it is signed
+ */
+inline static uint64_t
+radix_key(const uint8_t *record, const struct fs_int_field *key)
+{
+	uint64_t value = load_uint(record + key->offset, key->width,
+				   key->endianness);
+
+	if (key->is_signed) {
+		value ^= (uint64_t) 1 << (8 * key->width - 1);
+	}
+
+	return value;
+}
+
+/*
+ * Sort entries by the digits of their first 8 bytes
+ * with a least significant digit radix sort,
+ * which keeps entries with equal digits in order,
+ * skipping the passes whose digit is the same for every entry.
+ * This is inlined for each size of entry,
+ * so that moving an entry is a single copy.
+ * entries:	the entries to sort, each starting with its "uint64_t" key
+ * scratch:	a buffer of as many entries
+ * n_entries:	the number of entries
+ * entry_size:	the size of each entry
+ * shift:	the lowest bit of the key to sort by
+ * width:	the number of bytes of the key to sort by, from "shift"
+ * returns	"entries" or "scratch", whichever holds the sorted entries
+ */
+inline static __attribute__((always_inline)) void *
+radix_sort_entries(void *entries, void *scratch, size_t n_entries,
+		   size_t entry_size, unsigned shift, size_t width)
+{
+	static __thread size_t counts[sizeof(uint64_t)][N_BUCKETS];
+	uint8_t *src = entries, *dst = scratch, *swap;
+	size_t entry_i, digit_i, bucket_i;
+	uint64_t key;
+
+	memset(counts, 0, sizeof(counts));
+	for (entry_i = 0; entry_i < n_entries; entry_i++) {
+		memcpy(&key, src + entry_i * entry_size, sizeof(key));
+		key >>= shift;
+		for (digit_i = 0; digit_i < width; digit_i++) {
+			counts[digit_i][(key >> (digit_i * RADIX_BITS)) &
+					(N_BUCKETS - 1)]++;
+		}
+	}
+
+	for (digit_i = 0; digit_i < width; digit_i++) {
+		const unsigned digit_shift = shift + digit_i * RADIX_BITS;
+		size_t *digit_counts = counts[digit_i], total = 0;
+
+		memcpy(&key, src, sizeof(key));
+		if (digit_counts[(key >> digit_shift) & (N_BUCKETS - 1)] ==
+		    n_entries) {
+			continue;
+		}
+		for (bucket_i = 0; bucket_i < N_BUCKETS; bucket_i++) {
+			size_t count = digit_counts[bucket_i];
+
+			digit_counts[bucket_i] = total;
+			total += count;
+		}
+		for (entry_i = 0; entry_i < n_entries; entry_i++) {
+			const uint8_t *entry = src + entry_i * entry_size;
+			size_t bucket;
+
+			memcpy(&key, entry, sizeof(key));
+			bucket = (key >> digit_shift) & (N_BUCKETS - 1);
+			memcpy(dst + digit_counts[bucket]++ * entry_size, entry,
+			       entry_size);
+		}
+		swap = src;
+		src = dst;
+		dst = swap;
+	}
+
+	return src;
+}
+
+/* Sort entries with a key and an index by their key. */
+static struct sort_entry *
+radix_sort(struct sort_entry *entries, struct sort_entry *scratch,
+	   size_t n_entries, size_t width)
+{
+	return radix_sort_entries(entries, scratch, n_entries,
+				  sizeof(*entries), 0, width);
+}
+
+/*
+ * Sort keys packed above their indices, in "index_bits" bits,
+ * which moves half as many bytes as sorting "struct sort_entry"s.
+ */
+static uint64_t *
+radix_sort_packed(uint64_t *entries, uint64_t *scratch, size_t n_entries,
+		  unsigned index_bits, size_t width)
+{
+	return radix_sort_entries(entries, scratch, n_entries,
+				  sizeof(*entries), index_bits, width);
+}
+
+/* the state shared by the threads sorting runs */
+struct run_work {
+	/* the file containing the records */
+	struct file_structor *src_file;
+	/* the location of the first record */
+	off_t start_in_file;
+	/* the distance between records, and the number of them */
+	size_t record_size;
+	size_t n_records;
+	/* the key field */
+	const struct fs_int_field *key;
+	/* the most records in each run, and the number of runs */
+	size_t run_records;
+	size_t n_runs;
+	/*
+	 * the number of bits of the index of a record in a run,
+	 * or 0 if it does not fit below the key in a "uint64_t"
+	 */
+	unsigned index_bits;
+	/* the index of the next run to sort */
+	size_t next;
+	/* the descriptor of the file to write the sorted runs to */
+	int runs_fd;
+};
+
+/*
+ * Sort a run of records and write it at its place in the file of runs.
+ * work:	the sort
+ * run_i:	the index of the run
+ * entries:	a buffer of "run_records" entries
+ * scratch:	another buffer of "run_records" entries
+ * sorted:	a buffer of "run_records" records
+ * returns	FS_NO_ERROR on success, or the error from mapping or writing
+ */
+static enum fs_status
+sort_run(struct run_work *work, size_t run_i, struct sort_entry *entries,
+	 struct sort_entry *scratch, uint8_t *sorted)
+{
+	const size_t record_size = work->record_size;
+	const size_t first = run_i * work->run_records;
+	size_t n_records = work->n_records - first, record_i;
+	struct sort_entry *order;
+	struct file_struct run;
+	const uint8_t *data;
+	enum fs_status status;
+
+	if (n_records > work->run_records) {
+		n_records = work->run_records;
+	}
+	if ((status = init_file_struct(&run, work->src_file,
+				       n_records * record_size,
+				       work->start_in_file +
+				       (off_t) (first * record_size)))) {
+		return status;
+	}
+	data = run.data;
+
+	if (work->index_bits > 0) {
+		const unsigned index_bits = work->index_bits;
+		const uint64_t index_mask = ((uint64_t) 1 << index_bits) - 1;
+		uint64_t *packed = (uint64_t *) entries, *packed_order;
+
+		for (record_i = 0; record_i < n_records; record_i++) {
+			packed[record_i] = radix_key(data + record_i *
+						     record_size, work->key) <<
+					   index_bits | record_i;
+		}
+		packed_order = radix_sort_packed(packed, (uint64_t *) scratch,
+						 n_records, index_bits,
+						 work->key->width);
+		for (record_i = 0; record_i < n_records; record_i++) {
+			memcpy(sorted + record_i * record_size,
+			       data + (packed_order[record_i] & index_mask) *
+			       record_size, record_size);
+		}
+	} else {
+		for (record_i = 0; record_i < n_records; record_i++) {
+			entries[record_i].key = radix_key(data + record_i *
+							  record_size,
+							  work->key);
+			entries[record_i].index = record_i;
+		}
+		order = radix_sort(entries, scratch, n_records,
+				   work->key->width);
+		for (record_i = 0; record_i < n_records; record_i++) {
+			memcpy(sorted + record_i * record_size,
+			       data + order[record_i].index * record_size,
+			       record_size);
+		}
+	}
+	teardown_file_struct(&run);
+
+	return write_all(work->runs_fd, sorted, n_records * record_size,
+			 (off_t) (first * record_size));
+}
+
+/* the worker for "sort_record_file", which sorts runs until none are left */
+static enum fs_status sort_runs(void *arg, unsigned worker_i)
+{
+	struct run_work *work = arg;
+	struct sort_entry *entries = malloc(sizeof(*entries) *
+					    work->run_records);
+	struct sort_entry *scratch = malloc(sizeof(*scratch) *
+					    work->run_records);
+	uint8_t *sorted = malloc(work->run_records * work->record_size);
+	enum fs_status status = FS_NO_ERROR;
+	size_t run_i;
+
+	(void) worker_i;
+
+	if (entries == NULL || scratch == NULL || sorted == NULL) {
+		status = FSERR_ERRNO;
+	}
+	while (!status && claim_work(&work->next, work->n_runs, 1, &run_i)) {
+		status = sort_run(work, run_i, entries, scratch, sorted);
+	}
+	free(entries);
+	free(scratch);
+	free(sorted);
+
+	return status;
+}
+
+/* the position of the merge in a sorted run */
+struct run_cursor {
+	/* the scan of the run */
+	struct stream_scan scan;
+	/* the current batch of the run, and its number of records */
+	struct file_struct batch;
+	size_t n_batch;
+	/* the index of the current record in the batch */
+	size_t position;
+};
+
+/* the key of the current record of a run, in the heap of the merge */
+struct merge_entry {
+	uint64_t key;
+	size_t run_i;
+};
+
+/* the state of the merge of the sorted runs */
+struct run_merge {
+	/* the cursor of each run */
+	struct run_cursor *cursors;
+	/*
+	 * a binary heap of the runs that are not done,
+	 * holding their keys so that sifting does not read the cursors
+	 */
+	struct merge_entry *heap;
+	size_t heap_size;
+	/* the distance between records */
+	size_t record_size;
+	/* the key field */
+	const struct fs_int_field *key;
+};
+
+/* the current record of a cursor */
+inline static const uint8_t *
+cursor_record(const struct run_merge *merge, const struct run_cursor *cursor)
+{
+	return (const uint8_t *) cursor->batch.data +
+	       cursor->position * merge->record_size;
+}
+
+/*
+ * Move a cursor to the next record of its run.
+ * merge:	the merge
+ * cursor:	the cursor to move
+ * entry:	the entry of the run in the heap, whose key to update
+ * returns	1 if there is a next record; 0 if the run is done
+ */
+static int
+advance_cursor(struct run_merge *merge, struct run_cursor *cursor,
+	       struct merge_entry *entry)
+{
+	if (++cursor->position == cursor->n_batch) {
+		cursor->n_batch = stream_scan_next(&cursor->scan,
+						   &cursor->batch);
+		cursor->position = 0;
+		if (cursor->n_batch == 0) {
+			return 0;
+		}
+	}
+	entry->key = radix_key(cursor_record(merge, cursor), merge->key);
+
+	return 1;
+}
+
+/*
+ * Check if the current record of a run comes before that of another,
+ * taking the run with the lower index first for equal keys,
+ * so that the merge keeps equal keys in their original order.
+ */
+inline static int
+entry_before(const struct merge_entry *entry, const struct merge_entry *other)
+{
+	return entry->key < other->key ||
+	       (entry->key == other->key && entry->run_i < other->run_i);
+}
+
+/* Move the entry at a place in the heap down to its place. */
+static void sift_down(struct run_merge *merge, size_t place)
+{
+	struct merge_entry *heap = merge->heap;
+	struct merge_entry entry = heap[place];
+
+	for (;;) {
+		size_t child = 2 * place + 1;
+
+		if (child >= merge->heap_size) {
+			break;
+		}
+		if (child + 1 < merge->heap_size &&
+		    entry_before(&heap[child + 1], &heap[child])) {
+			child++;
+		}
+		if (!entry_before(&heap[child], &entry)) {
+			break;
+		}
+		heap[place] = heap[child];
+		place = child;
+	}
+	heap[place] = entry;
+}
+
+/*
+ * Start a scan of each sorted run, and build the heap of their first keys.
+ * merge:	the merge, with every field set but the cursors and heap
+ * work:	the sort, whose runs are now in "runs_file"
+ * runs_file:	the file of sorted runs
+ * scan_budget:	the memory budget of the scan of each run
+ * returns	FS_NO_ERROR on success, or the error from starting a scan
+ */
+static enum fs_status
+start_merge(struct run_merge *merge, const struct run_work *work,
+	    struct file_structor *runs_file, size_t scan_budget)
+{
+	enum fs_status status = FS_NO_ERROR;
+	size_t run_i, place;
+
+	merge->heap_size = 0;
+	for (run_i = 0; !status && run_i < work->n_runs; run_i++) {
+		struct run_cursor *cursor = &merge->cursors[run_i];
+		size_t first = run_i * work->run_records;
+		size_t n_records = work->n_records - first;
+
+		if (n_records > work->run_records) {
+			n_records = work->run_records;
+		}
+		if ((status = init_stream_scan(&cursor->scan, runs_file,
+					       first * work->record_size,
+					       work->record_size, n_records,
+					       scan_budget,
+					       STREAM_DROP_CACHE))) {
+			break;
+		}
+		cursor->n_batch = stream_scan_next(&cursor->scan,
+						   &cursor->batch);
+		cursor->position = 0;
+		merge->heap[merge->heap_size].key =
+			radix_key(cursor_record(merge, cursor), merge->key);
+		merge->heap[merge->heap_size++].run_i = run_i;
+	}
+
+	for (place = merge->heap_size / 2; place-- > 0;) {
+		sift_down(merge, place);
+	}
+
+	return status;
+}
+
+/*
+ * Merge the sorted runs into the output file.
+ * work:	the sort, whose runs are now in "runs_file"
+ * runs_file:	the file of sorted runs
+ * budget:	the most bytes of memory to use
+ * out_fd:	the descriptor of the output file
+ * returns	FS_NO_ERROR on success;
+ *		the error from scanning the runs or writing the output
+ */
+static enum fs_status
+merge_runs(const struct run_work *work, struct file_structor *runs_file,
+	   size_t budget, int out_fd)
+{
+	const size_t record_size = work->record_size;
+	/* A quarter of the budget buffers the output, the rest the runs. */
+	const size_t out_records = budget / 4 / record_size + 1;
+	uint8_t *out = malloc(out_records * record_size);
+	size_t n_out = 0, run_i;
+	off_t written = 0;
+	struct run_merge merge;
+	enum fs_status status;
+
+	merge.cursors = calloc(work->n_runs, sizeof(*merge.cursors));
+	merge.heap = malloc(sizeof(*merge.heap) * work->n_runs);
+	merge.record_size = record_size;
+	merge.key = work->key;
+	if (out == NULL || merge.cursors == NULL || merge.heap == NULL) {
+		status = FSERR_ERRNO;
+	} else {
+		status = start_merge(&merge, work, runs_file,
+				     budget / 4 * 3 / work->n_runs);
+	}
+
+	while (!status && merge.heap_size > 0) {
+		struct run_cursor *cursor = &merge.cursors[merge.heap[0].run_i];
+
+		memcpy(out + n_out * record_size,
+		       cursor_record(&merge, cursor), record_size);
+		if (++n_out == out_records) {
+			status = write_all(out_fd, out, n_out * record_size,
+					   written);
+			written += n_out * record_size;
+			n_out = 0;
+		}
+		if (!advance_cursor(&merge, cursor, &merge.heap[0])) {
+			merge.heap[0] = merge.heap[--merge.heap_size];
+		}
+		if (merge.heap_size > 0) {
+			sift_down(&merge, 0);
+		}
+	}
+	if (!status && n_out > 0) {
+		status = write_all(out_fd, out, n_out * record_size, written);
+	}
+
+	for (run_i = 0; merge.cursors != NULL && run_i < work->n_runs;
+	     run_i++) {
+		if (merge.cursors[run_i].scan.records.data != NULL) {
+			teardown_stream_scan(&merge.cursors[run_i].scan);
+		}
+	}
+	free(merge.cursors);
+	free(merge.heap);
+	free(out);
+
+	return status;
+}
+
+/*
+ * Sort the runs into a separate file, and merge them into the output.
+ * work:	the sort, with every field set but "runs_fd"
+ * budget:	the most bytes of memory to use
+ * n_threads:	the number of threads sorting runs
+ * out_fd:	the descriptor of the output file
+ * runs_path:	the path of the file of sorted runs
+ * returns	FS_NO_ERROR on success, or the first error
+ */
+static enum fs_status
+sort_and_merge(struct run_work *work, size_t budget, unsigned n_threads,
+	       int out_fd, const char *runs_path)
+{
+	struct file_structor runs_file;
+	enum fs_status status;
+
+	work->runs_fd = open(runs_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (work->runs_fd < 0) {
+		printlg(ERROR_LEVEL, "Unable to create %s: %d\n", runs_path,
+			errno);
+		return FSERR_ERRNO;
+	}
+	if (!(status = run_parallel(n_threads, sort_runs, work)) &&
+	    !(status = open_file_structor(&runs_file, runs_path))) {
+		status = merge_runs(work, &runs_file, budget, out_fd);
+		close_file_structor(&runs_file);
+	}
+	close(work->runs_fd);
+	unlink(runs_path);
+
+	return status;
+}
+
+enum fs_status
+sort_record_file(struct file_structor *src_file, off_t start_in_file,
+		 size_t record_size, size_t n_records,
+		 const struct fs_int_field *key, size_t budget,
+		 unsigned n_threads, const char *output_path)
+{
+	struct run_work work;
+	enum fs_status status;
+	char *runs_path, *tmp_path;
+	int out_fd;
+
+	if (key->width < 1 || key->width > sizeof(uint64_t) ||
+	    key->offset + key->width > record_size) {
+		printlg(ERROR_LEVEL,
+			"Key field at %u-%u does not fit in a 64-bit key, or "
+			"is outside of records of size %u.\n",
+			(unsigned) key->offset,
+			(unsigned) (key->offset + key->width),
+			(unsigned) record_size);
+		return FSERR_OUT_OF_STRUCT;
+	}
+	if (start_in_file < 0 ||
+	    (uint64_t) start_in_file + (uint64_t) record_size * n_records >
+	    (uint64_t) src_file->size) {
+		return FSERR_OUT_OF_FILE;
+	}
+	if (budget < SORT_MIN_BUDGET) {
+		budget = SORT_MIN_BUDGET;
+	}
+	n_threads = fs_thread_count(n_threads);
+
+	work.src_file = src_file;
+	work.start_in_file = start_in_file;
+	work.record_size = record_size;
+	work.n_records = n_records;
+	work.key = key;
+	/* Each record of a run is mapped, copied, and has 2 entries. */
+	work.run_records = budget / n_threads /
+			   (2 * record_size + 2 * sizeof(struct sort_entry));
+	if (work.run_records == 0) {
+		work.run_records = 1;
+	}
+	work.n_runs = (n_records + work.run_records - 1) / work.run_records;
+	work.next = 0;
+	work.index_bits = 1;
+	while (work.index_bits < 64 &&
+	       work.run_records > (uint64_t) 1 << work.index_bits) {
+		work.index_bits++;
+	}
+	if (work.index_bits + 8 * key->width > 64) {
+		work.index_bits = 0;
+	}
+	if (work.n_runs < n_threads) {
+		n_threads = work.n_runs > 0 ? work.n_runs : 1;
+	}
+
+	/* The output is written under a temporary name until it is sorted. */
+	if ((tmp_path = add_suffix(output_path, TMP_SUFFIX)) == NULL) {
+		return FSERR_ERRNO;
+	}
+	out_fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (out_fd < 0) {
+		printlg(ERROR_LEVEL, "Unable to create %s: %d\n", tmp_path,
+			errno);
+		free(tmp_path);
+		return FSERR_ERRNO;
+	}
+
+	if (work.n_runs <= 1) {
+		/* A single run is sorted straight into the output. */
+		work.runs_fd = out_fd;
+		status = run_parallel(1, sort_runs, &work);
+	} else if ((runs_path = add_suffix(output_path,
+					   SORT_RUNS_SUFFIX)) == NULL) {
+		status = FSERR_ERRNO;
+	} else {
+		status = sort_and_merge(&work, budget, n_threads, out_fd,
+					runs_path);
+		free(runs_path);
+	}
+	status = finish_tmp_file(out_fd, tmp_path, output_path, status);
+	free(tmp_path);
+
+	return status;
+}
@@ -0,0 +1,217 @@
+#include <stream_scan.h>
+#include <io_backend.h>
+#include <logger.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*
+ * the largest folio the page cache may hold a file in,
+ * since "posix_fadvise" keeps folios that straddle the range:
+ * the cache is dropped from this far behind the released pages,
+ * so that a folio straddling two releases is dropped by the second
+ */
+#define CACHE_RELEASE_OVERLAP	(1 << 21)
+
+enum fs_status
+init_stream_scan(struct stream_scan *to_init, struct file_structor *src_file,
+		 off_t start_in_file, size_t record_size, size_t n_records,
+		 size_t budget, int flags)
+{
+	enum fs_status status;
+
+	debug_assert(record_size > 0);
+
+	if (budget < STREAM_MIN_BUDGET) {
+		budget = STREAM_MIN_BUDGET;
+	}
+	if (budget < record_size * 4) {
+		budget = record_size * 4;
+	}
+
+	to_init->record_size = record_size;
+	to_init->n_records = n_records;
+	to_init->n_returned = 0;
+	to_init->batch_records = budget / 4 / record_size;
+	to_init->prefetch_size = budget / 2;
+	to_init->released = 0;
+	to_init->prefetched = 0;
+	to_init->flags = flags;
+	to_init->records.data = NULL;
+	to_init->records.mapping_start = NULL;
+	to_init->src_file = src_file;
+	to_init->start_in_file = start_in_file;
+	to_init->reads_batches = copies_chunks(src_file);
+	to_init->status = FS_NO_ERROR;
+
+	if (n_records == 0) {
+		return FS_NO_ERROR;
+	}
+	if (to_init->reads_batches) {
+		/* Each batch is checked again when it is read. */
+		return start_in_file + (off_t) (record_size * n_records) >
+		       src_file->size ? FSERR_OUT_OF_FILE : FS_NO_ERROR;
+	}
+	if ((status = init_file_struct(&to_init->records, src_file,
+				       record_size * n_records,
+				       start_in_file))) {
+		return status;
+	}
+	if (to_init->records.mapping_start != NULL) {
+		madvise(to_init->records.mapping_start,
+			(uint8_t *) to_init->records.data +
+			to_init->records.size -
+			(uint8_t *) to_init->records.mapping_start,
+			MADV_SEQUENTIAL);
+	}
+
+	return FS_NO_ERROR;
+}
+
+enum fs_status teardown_stream_scan(struct stream_scan *to_teardown)
+{
+	to_teardown->n_records = 0;
+	to_teardown->n_returned = 0;
+
+	return teardown_file_struct(&to_teardown->records);
+}
+
+/*
+ * Drop a range of released records from the page cache of the file,
+ * starting "CACHE_RELEASE_OVERLAP" before it.
+ * scan:	the scan
+ * file_start:	the location in the file that "start" and "end" are from
+ * start:	the start of the range
+ * end:		the end of the range
+ */
+static void
+drop_cache(struct stream_scan *scan, off_t file_start, size_t start,
+	   size_t end)
+{
+	size_t cache_start = start > CACHE_RELEASE_OVERLAP ?
+			     start - CACHE_RELEASE_OVERLAP : 0;
+
+	posix_fadvise(scan->src_file->fd, file_start + cache_start,
+		      end - cache_start, POSIX_FADV_DONTNEED);
+}
+
+/*
+ * Release the whole pages of the mapping before a location.
+ * scan:	the scan
+ * end:		the location in "records" up to which to release
+ */
+static void release_pages(struct stream_scan *scan, size_t end)
+{
+	const size_t page_size = sysconf(_SC_PAGE_SIZE);
+	uint8_t *mapping_start = scan->records.mapping_start;
+	size_t adjustment = (uint8_t *) scan->records.data - mapping_start;
+	size_t start = scan->released + adjustment;
+
+	/* Only whole pages are released, which the next batch cannot need. */
+	end = (end + adjustment) / page_size * page_size;
+	start = start / page_size * page_size;
+	if (end <= start) {
+		return;
+	}
+
+	madvise(mapping_start + start, end - start, MADV_DONTNEED);
+	if (scan->flags & STREAM_DROP_CACHE) {
+		drop_cache(scan, scan->start_in_file - adjustment, start, end);
+	}
+	scan->released = end - adjustment;
+}
+
+/*
+ * Free the chunk of the batch returned before, of a scan reading batches.
+ * scan:	the scan
+ * end:		the end of the batch in the records
+ */
+static void release_batch(struct stream_scan *scan, size_t end)
+{
+	teardown_file_struct(&scan->records);
+	if (scan->flags & STREAM_DROP_CACHE) {
+		drop_cache(scan, scan->start_in_file, scan->released, end);
+	}
+	scan->released = end;
+}
+
+/*
+ * Ask the kernel to read the pages ahead of the current batch.
+ * scan:	the scan
+ * end:		the location in "records" up to which to prefetch
+ */
+static void prefetch_pages(struct stream_scan *scan, size_t end)
+{
+	const size_t page_size = sysconf(_SC_PAGE_SIZE);
+	uint8_t *mapping_start = scan->records.mapping_start;
+	size_t adjustment, start;
+
+	if (end > scan->n_records * scan->record_size) {
+		end = scan->n_records * scan->record_size;
+	}
+	if (scan->reads_batches) {
+		if (end > scan->prefetched) {
+			posix_fadvise(scan->src_file->fd,
+				      scan->start_in_file + scan->prefetched,
+				      end - scan->prefetched,
+				      POSIX_FADV_WILLNEED);
+			scan->prefetched = end;
+		}
+		return;
+	}
+	adjustment = (uint8_t *) scan->records.data - mapping_start;
+	start = (scan->prefetched + adjustment) / page_size * page_size;
+	end += adjustment;
+	if (end <= start) {
+		return;
+	}
+
+	madvise(mapping_start + start, end - start, MADV_WILLNEED);
+	scan->prefetched = end - adjustment;
+}
+
+size_t stream_scan_next(struct stream_scan *scan, struct file_struct *batch)
+{
+	size_t n_batch = scan->n_records - scan->n_returned;
+	size_t batch_start = scan->n_returned * scan->record_size;
+	/* Chunks of memory sources have no pages of their own. */
+	int has_pages = scan->reads_batches ||
+			scan->records.mapping_start != NULL;
+
+	if (has_pages && scan->n_returned > 0) {
+		if (scan->reads_batches) {
+			release_batch(scan, batch_start);
+		} else {
+			release_pages(scan, batch_start);
+		}
+	}
+	if (n_batch == 0 || scan->status) {
+		return 0;
+	}
+	if (n_batch > scan->batch_records) {
+		n_batch = scan->batch_records;
+	}
+
+	if (has_pages) {
+		prefetch_pages(scan, batch_start + n_batch * scan->record_size +
+				     scan->prefetch_size);
+	}
+	if (scan->reads_batches) {
+		scan->status = init_file_struct(&scan->records, scan->src_file,
+						n_batch * scan->record_size,
+						scan->start_in_file +
+						(off_t) batch_start);
+		if (scan->status) {
+			return 0;
+		}
+		derive_file_struct(batch, &scan->records,
+				   n_batch * scan->record_size, 0);
+	} else {
+		derive_file_struct(batch, &scan->records,
+				   n_batch * scan->record_size, batch_start);
+	}
+	scan->n_returned += n_batch;
+
+	return n_batch;
+}
@@ -0,0 +1,382 @@
+#include <transcode.h>
+#include <fs_parallel.h>
+#include <fs_common.h>
+#include <readahead.h>
+#include <logger.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* the most bytes of records each thread converts and writes at once */
+#define TRANSCODE_BUFFER	(8 << 20)
+
+/* the hash of a layout, to tell if a sidecar was built from it */
+static uint64_t layout_hash(const struct transcode_layout *layout)
+{
+	uint64_t hash = mix_hash(layout->records_start, layout->record_size);
+	size_t member_i;
+
+	for (member_i = 0; member_i < layout->n_members; member_i++) {
+		const struct member_layout *member = &layout->members[member_i];
+
+		hash = mix_hash(hash, member->src_offset);
+		hash = mix_hash(hash, member->size);
+		hash = mix_hash(hash, member->width);
+		hash = mix_hash(hash, member->endianness);
+	}
+
+	return hash;
+}
+
+/*
+ * Open the sidecar of a source file if it is valid,
+ * and was transcoded with a layout.
+ * path:	the path of the source file
+ * layout:	the layout the sidecar must have been transcoded with
+ * trailer:	will be set to the trailer of the sidecar
+ * returns	the descriptor of the sidecar, or -1 if it is not valid
+ */
+static int open_valid_sidecar(const char *path,
+			      const struct transcode_layout *layout,
+			      struct native_sidecar_trailer *trailer)
+{
+	char *sidecar_path = add_suffix(path, NATIVE_SIDECAR_SUFFIX);
+	struct stat source_stat, sidecar_stat;
+	int fd;
+
+	if (sidecar_path == NULL) {
+		return -1;
+	}
+	fd = open(sidecar_path, O_RDONLY);
+	free(sidecar_path);
+	if (fd < 0) {
+		return -1;
+	}
+
+	if (stat(path, &source_stat) || fstat(fd, &sidecar_stat) ||
+	    sidecar_stat.st_size != source_stat.st_size +
+				    (off_t) sizeof(*trailer) ||
+	    pread(fd, trailer, sizeof(*trailer), source_stat.st_size) !=
+	    (ssize_t) sizeof(*trailer) ||
+	    memcmp(trailer->magic, NATIVE_SIDECAR_MAGIC,
+		   sizeof(trailer->magic)) ||
+	    trailer->byte_order != NATIVE_SIDECAR_BYTE_ORDER) {
+		close(fd);
+		return -1;
+	}
+	if (!is_same_source(&trailer->source, &source_stat)) {
+		printlg(INFO_LEVEL,
+			"Ignoring the native sidecar of %s, "
+			"which changed since it was transcoded.\n", path);
+		close(fd);
+		return -1;
+	}
+	if (trailer->layout_hash != layout_hash(layout)) {
+		printlg(INFO_LEVEL,
+			"Ignoring the native sidecar of %s, "
+			"which was transcoded with another layout.\n", path);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+enum fs_status
+open_native_file_structor(struct file_structor *to_open, const char *path,
+			  const struct transcode_layout *layout)
+{
+	struct native_sidecar_trailer trailer;
+	int fd = open_valid_sidecar(path, layout, &trailer);
+
+	if (fd < 0) {
+		return open_file_structor(to_open, path);
+	}
+
+	init_closed_file_structor(to_open);
+	to_open->fd = fd;
+	to_open->size = trailer.source.size;
+	to_open->is_native = 1;
+	to_open->trailer_size = sizeof(trailer);
+	set_adaptive_readahead(to_open, READAHEAD_MAX_DISTANCE);
+
+	return FS_NO_ERROR;
+}
+
+enum fs_status remove_native_sidecar(const char *path)
+{
+	char *sidecar_path = add_suffix(path, NATIVE_SIDECAR_SUFFIX);
+	int failed;
+
+	if (sidecar_path == NULL) {
+		return FSERR_ERRNO;
+	}
+	failed = unlink(sidecar_path) && errno != ENOENT;
+	free(sidecar_path);
+
+	return failed ? FSERR_ERRNO : FS_NO_ERROR;
+}
+
+/*
+ * Copy a range of the source file to the sidecar unchanged.
+ * src_file:	the source file
+ * fd:		the descriptor of the sidecar
+ * start:	the location of the range in both files
+ * size:	the number of bytes
+ * returns	FS_NO_ERROR on success, or the error from mapping or writing
+ */
+static enum fs_status
+copy_range(struct file_structor *src_file, int fd, off_t start, size_t size)
+{
+	struct file_struct range;
+	enum fs_status status;
+
+	if (size == 0) {
+		return FS_NO_ERROR;
+	}
+	if ((status = init_file_struct(&range, src_file, size, start))) {
+		return status;
+	}
+	status = write_all(fd, range.data, size, start);
+	teardown_file_struct(&range);
+
+	return status;
+}
+
+/* the state shared by the threads transcoding a file */
+struct transcode_work {
+	/* the source file */
+	struct file_structor *src_file;
+	/* the descriptor of the sidecar being written */
+	int fd;
+	/* the plan putting the fields in machine order, in place */
+	const struct copy_plan *plan;
+	/* the location of the first record */
+	off_t records_start;
+	/* the distance between records */
+	size_t record_size;
+	/* the number of records, and of records converted at once */
+	size_t n_records;
+	size_t batch;
+	/* the index of the next record to convert */
+	size_t next;
+};
+
+/*
+ * the worker for "transcode_file", which maps batches of records,
+ * converts them in its own buffer and writes the buffer to the sidecar
+ */
+static enum fs_status transcode_batches(void *arg, unsigned worker_i)
+{
+	struct transcode_work *work = arg;
+	uint8_t *buffer = malloc(work->batch * work->record_size);
+	enum fs_status status = FS_NO_ERROR;
+	size_t start, n_claimed;
+
+	(void) worker_i;
+
+	if (buffer == NULL) {
+		return FSERR_ERRNO;
+	}
+	while (!status && (n_claimed = claim_work(&work->next,
+						  work->n_records,
+						  work->batch, &start))) {
+		off_t batch_start = work->records_start +
+				    (off_t) (start * work->record_size);
+		size_t batch_size = n_claimed * work->record_size;
+		struct file_struct raw;
+
+		if ((status = init_file_struct(&raw, work->src_file,
+					       batch_size, batch_start))) {
+			break;
+		}
+		memcpy(buffer, raw.data, batch_size);
+		apply_copy_plan_array(work->plan, buffer, work->record_size,
+				      &raw, 0, work->record_size, n_claimed);
+		teardown_file_struct(&raw);
+		status = write_all(work->fd, buffer, batch_size, batch_start);
+	}
+	free(buffer);
+
+	return status;
+}
+
+/*
+ * Check that every field of a layout is a byte copy inside the record.
+ * returns	FS_NO_ERROR if they are; FSERR_OUT_OF_STRUCT otherwise
+ */
+static enum fs_status check_layout(const struct transcode_layout *layout)
+{
+	size_t member_i;
+
+	for (member_i = 0; member_i < layout->n_members; member_i++) {
+		const struct member_layout *member = &layout->members[member_i];
+
+		debug_assert(member->conversion == MEMBER_BYTES);
+		if (member->src_offset + member->size > layout->record_size) {
+			printlg(ERROR_LEVEL,
+				"Transcoded field at %u-%u is outside of "
+				"records of size %u.\n",
+				(unsigned) member->src_offset,
+				(unsigned) (member->src_offset + member->size),
+				(unsigned) layout->record_size);
+			return FSERR_OUT_OF_STRUCT;
+		}
+	}
+
+	return FS_NO_ERROR;
+}
+
+/*
+ * Compile the plan that puts the fields of a layout in machine order,
+ * leaving each where it is.
+ * to_init:	the plan to initialize
+ * layout:	the layout of the records
+ * returns	the status from "compile_copy_plan"
+ */
+static enum fs_status
+compile_in_place_plan(struct copy_plan *to_init,
+		      const struct transcode_layout *layout)
+{
+	struct member_layout *members =
+		malloc(sizeof(*members) * (layout->n_members + 1));
+	enum fs_status status;
+	size_t member_i;
+
+	if (members == NULL) {
+		return FSERR_ERRNO;
+	}
+	for (member_i = 0; member_i < layout->n_members; member_i++) {
+		members[member_i] = layout->members[member_i];
+		members[member_i].dst_offset = members[member_i].src_offset;
+	}
+	status = compile_copy_plan(to_init, members, layout->n_members);
+	free(members);
+
+	return status;
+}
+
+/*
+ * Write the transcoded file and its trailer to an opened sidecar.
+ * src_file:	the source file
+ * fd:		the descriptor of the sidecar
+ * layout:	the layout of the records
+ * trailer:	the trailer to write after the transcoded bytes
+ * n_threads:	the number of threads, or 0 for one per online processor
+ * returns	FS_NO_ERROR on success, or the first error
+ */
+static enum fs_status
+fill_sidecar(struct file_structor *src_file, int fd,
+	     const struct transcode_layout *layout,
+	     const struct native_sidecar_trailer *trailer, unsigned n_threads)
+{
+	struct transcode_work work;
+	struct copy_plan plan;
+	enum fs_status status;
+	off_t header_end = 0, records_end = 0;
+
+	work.src_file = src_file;
+	work.fd = fd;
+	work.plan = &plan;
+	work.records_start = layout->records_start;
+	work.record_size = layout->record_size;
+	work.n_records = src_file->size > layout->records_start ?
+			 (src_file->size - layout->records_start) /
+			 layout->record_size : 0;
+	work.batch = TRANSCODE_BUFFER / layout->record_size;
+	if (work.batch == 0) {
+		work.batch = 1;
+	}
+	work.next = 0;
+	/* Without whole records, the whole file is copied unchanged. */
+	if (work.n_records > 0) {
+		header_end = layout->records_start;
+		records_end = layout->records_start +
+			      (off_t) (work.n_records * layout->record_size);
+	}
+
+	if ((status = compile_in_place_plan(&plan, layout))) {
+		return status;
+	}
+	n_threads = fs_thread_count(n_threads);
+	if (work.n_records <= work.batch) {
+		n_threads = 1;
+	}
+	if (!(status = copy_range(src_file, fd, 0, header_end)) &&
+	    !(status = copy_range(src_file, fd, records_end,
+				  src_file->size - records_end)) &&
+	    !(status = run_parallel(n_threads, transcode_batches, &work))) {
+		status = write_all(fd, trailer, sizeof(*trailer),
+				   src_file->size);
+	}
+	free_copy_plan(&plan);
+
+	return status;
+}
+
+enum fs_status
+transcode_file(const char *path, const struct transcode_layout *layout,
+	       unsigned n_threads)
+{
+	struct native_sidecar_trailer trailer;
+	struct file_structor src_file;
+	char *sidecar_path, *tmp_path;
+	struct stat source_stat;
+	enum fs_status status;
+	int fd;
+
+	debug_assert(layout->record_size > 0);
+	if ((status = check_layout(layout))) {
+		return status;
+	}
+	fd = open_valid_sidecar(path, layout, &trailer);
+	if (fd >= 0) {
+		close(fd);
+		return FS_NO_ERROR;
+	}
+
+	if ((status = open_file_structor(&src_file, path))) {
+		return status;
+	}
+	if (fstat(src_file.fd, &source_stat)) {
+		close_file_structor(&src_file);
+		return FSERR_ERRNO;
+	}
+	memset(&trailer, 0, sizeof(trailer));
+	memcpy(trailer.magic, NATIVE_SIDECAR_MAGIC, sizeof(trailer.magic));
+	trailer.byte_order = NATIVE_SIDECAR_BYTE_ORDER;
+	set_source_identity(&trailer.source, &source_stat);
+	trailer.layout_hash = layout_hash(layout);
+
+	sidecar_path = add_suffix(path, NATIVE_SIDECAR_SUFFIX);
+	tmp_path = sidecar_path == NULL ? NULL :
+		   add_suffix(sidecar_path, TMP_SUFFIX);
+	if (tmp_path == NULL) {
+		status = FSERR_ERRNO;
+	} else if ((fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC,
+			      0644)) < 0) {
+		printlg(ERROR_LEVEL, "Unable to create sidecar %s: %d\n",
+			tmp_path, errno);
+		status = FSERR_ERRNO;
+	} else {
+		if (ftruncate(fd, src_file.size + sizeof(trailer))) {
+			printlg(ERROR_LEVEL,
+				"Unable to size sidecar %s: %d\n",
+				tmp_path, errno);
+			status = FSERR_ERRNO;
+		} else {
+			status = fill_sidecar(&src_file, fd, layout, &trailer,
+					      n_threads);
+		}
+		status = finish_tmp_file(fd, tmp_path, sidecar_path, status);
+	}
+	free(tmp_path);
+	free(sidecar_path);
+	close_file_structor(&src_file);
+
+	return status;
+}
@@ -0,0 +1,580 @@
+#include <zone_map.h>
+#include <fs_parallel.h>
+#include <fs_common.h>
+#include <logger.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* the most bytes of records each thread reads at once */
+#define ZONE_BUFFER	(8 << 20)
+
+_Static_assert(sizeof(struct zone_map_header) == ZONE_MAP_DATA_START,
+	       "The bounds must start right after the header.");
+
+/* the hash of a layout, to tell if a zone map is from it */
+static uint64_t layout_hash(const struct column_layout *layout)
+{
+	uint64_t hash = mix_hash(layout->records_start, layout->record_size);
+	size_t member_i;
+
+	hash = mix_hash(hash, layout->block_values);
+	for (member_i = 0; member_i < layout->n_members; member_i++) {
+		const struct member_layout *member = &layout->members[member_i];
+
+		hash = mix_hash(hash, member->src_offset);
+		hash = mix_hash(hash, member->size);
+		hash = mix_hash(hash, member->width);
+		hash = mix_hash(hash, member->endianness);
+		hash = mix_hash(hash, member->conversion);
+		hash = mix_hash(hash, member->dst_width);
+	}
+
+	return hash;
+}
+
+/*
+ * the path of the zone map of a file, which must be freed
+ * path:	the path of the source file
+ * suffix:	a suffix to add after "ZONE_MAP_SUFFIX", eg. "TMP_SUFFIX"
+ * returns	the path of the zone map, or NULL if "malloc" failed
+ */
+static char *zone_map_path(const char *path, const char *suffix)
+{
+	size_t length = strlen(path) + sizeof(ZONE_MAP_SUFFIX) +
+			strlen(suffix);
+	char *with_suffix = malloc(length);
+
+	if (with_suffix != NULL) {
+		snprintf(with_suffix, length, "%s%s%s", path, ZONE_MAP_SUFFIX,
+			 suffix);
+	}
+
+	return with_suffix;
+}
+
+/* the number of records of a layout in a file of a size */
+static size_t
+count_records(const struct column_layout *layout, uint64_t file_size)
+{
+	return file_size > (uint64_t) layout->records_start ?
+	       (file_size - layout->records_start) / layout->record_size : 0;
+}
+
+/* the number of blocks of a layout holding a number of records */
+static size_t
+count_blocks(const struct column_layout *layout, size_t n_records)
+{
+	return (n_records + layout->block_values - 1) / layout->block_values;
+}
+
+/* the size of the zone map of a number of blocks */
+static uint64_t
+zone_map_size(const struct column_layout *layout, size_t n_blocks)
+{
+	return ZONE_MAP_DATA_START + (uint64_t) n_blocks * layout->n_members *
+				     sizeof(struct column_bounds);
+}
+
+/*
+ * Read the header of a zone map and check it
+ * against its source file and the layout it should be built from.
+ * fd:		the descriptor of the zone map
+ * map_size:	the size of the zone map
+ * source:	the status of the source file
+ * layout:	the layout of the records
+ * header:	will be set to the header of the zone map
+ * returns	1 if the zone map is valid; 0 otherwise
+ */
+static int
+read_valid_header(int fd, off_t map_size, const struct stat *source,
+		  const struct column_layout *layout,
+		  struct zone_map_header *header)
+{
+	size_t n_records = count_records(layout, source->st_size);
+
+	return pread(fd, header, sizeof(*header), 0) == sizeof(*header) &&
+	       !memcmp(header->magic, ZONE_MAP_MAGIC, sizeof(header->magic)) &&
+	       header->byte_order == ZONE_MAP_BYTE_ORDER &&
+	       header->n_fields == layout->n_members &&
+	       header->block_records == layout->block_values &&
+	       header->layout_hash == layout_hash(layout) &&
+	       header->n_records == n_records &&
+	       (uint64_t) map_size ==
+	       zone_map_size(layout, count_blocks(layout, n_records)) &&
+	       is_same_source(&header->source, source);
+}
+
+enum fs_status
+open_zone_map(struct zone_map *to_open, const char *path,
+	      const struct column_layout *layout)
+{
+	char *map_path = zone_map_path(path, "");
+	struct zone_map_header header;
+	struct stat source;
+	enum fs_status status;
+
+	if (map_path == NULL) {
+		return FSERR_ERRNO;
+	}
+	status = open_file_structor(&to_open->file, map_path);
+	free(map_path);
+	if (status) {
+		return FSERR_BAD_SIDECAR;
+	}
+	if (stat(path, &source) ||
+	    !read_valid_header(to_open->file.fd, to_open->file.size, &source,
+			       layout, &header)) {
+		printlg(INFO_LEVEL, "The zone map of %s is not valid.\n", path);
+		close_file_structor(&to_open->file);
+		return FSERR_BAD_SIDECAR;
+	}
+	if ((status = init_file_struct(&to_open->mapping, &to_open->file,
+				       to_open->file.size, 0))) {
+		close_file_structor(&to_open->file);
+		return status;
+	}
+
+	to_open->layout = layout;
+	to_open->bounds = (const struct column_bounds *)
+			  ((const uint8_t *) to_open->mapping.data +
+			   ZONE_MAP_DATA_START);
+	to_open->n_records = header.n_records;
+	to_open->block_records = header.block_records;
+	to_open->n_blocks = count_blocks(layout, header.n_records);
+
+	return FS_NO_ERROR;
+}
+
+enum fs_status close_zone_map(struct zone_map *to_close)
+{
+	teardown_file_struct(&to_close->mapping);
+
+	return close_file_structor(&to_close->file);
+}
+
+enum fs_status remove_zone_map(const char *path)
+{
+	char *map_path = zone_map_path(path, "");
+	enum fs_status status = FS_NO_ERROR;
+
+	if (map_path == NULL || (unlink(map_path) && errno != ENOENT)) {
+		status = FSERR_ERRNO;
+	}
+	free(map_path);
+
+	return status;
+}
+
+/* the state shared by the threads building a zone map */
+struct zone_work {
+	/* the source file */
+	struct file_structor *src_file;
+	/* the layout of the records */
+	const struct column_layout *layout;
+	/* the plan converting each field into a value */
+	struct copy_plan *plans;
+	/* the bounds of each field in each block */
+	struct column_bounds *bounds;
+	/* the number of records, and of records read at once */
+	size_t n_records;
+	size_t batch;
+	/* the index of the next record to read */
+	size_t next;
+};
+
+/*
+ * Find the bounds of every field in each block of a mapped batch.
+ * work:	the build
+ * raw:		the mapped records
+ * first:	the index of the first record of the batch,
+ *		which starts a block
+ * n_records:	the number of records in the batch
+ * buffer:	a buffer for the values of "batch" records of any field
+ */
+static void
+bound_batch(struct zone_work *work, struct file_struct *raw, size_t first,
+	    size_t n_records, uint8_t *buffer)
+{
+	const struct column_layout *layout = work->layout;
+	size_t field_i, value_i;
+
+	for (field_i = 0; field_i < layout->n_members; field_i++) {
+		const struct member_layout *member = &layout->members[field_i];
+		const size_t value_size = member->dst_width;
+
+		apply_copy_plan_array(&work->plans[field_i], buffer,
+				      value_size, raw, 0, layout->record_size,
+				      n_records);
+		for (value_i = 0; value_i < n_records;
+		     value_i += layout->block_values) {
+			size_t block_i = (first + value_i) /
+					 layout->block_values;
+			size_t n_block = n_records - value_i;
+
+			if (n_block > layout->block_values) {
+				n_block = layout->block_values;
+			}
+			find_column_bounds(buffer + value_i * value_size,
+					   n_block, member->conversion,
+					   value_size,
+					   &work->bounds[block_i *
+							 layout->n_members +
+							 field_i]);
+		}
+	}
+}
+
+/* the worker for "build_zone_map", which reads batches of records */
+static enum fs_status bound_batches(void *arg, unsigned worker_i)
+{
+	struct zone_work *work = arg;
+	const size_t record_size = work->layout->record_size;
+	enum fs_status status = FS_NO_ERROR;
+	size_t first, n_claimed;
+	uint8_t *buffer;
+
+	(void) worker_i;
+
+	if ((buffer = malloc(sizeof(uint64_t) * work->batch)) == NULL) {
+		return FSERR_ERRNO;
+	}
+	while (!status && (n_claimed = claim_work(&work->next,
+						  work->n_records,
+						  work->batch, &first))) {
+		struct file_struct raw;
+
+		if ((status = init_file_struct(&raw, work->src_file,
+					       n_claimed * record_size,
+					       work->layout->records_start +
+					       (off_t) (first *
+							record_size)))) {
+			break;
+		}
+		bound_batch(work, &raw, first, n_claimed, buffer);
+		teardown_file_struct(&raw);
+	}
+	free(buffer);
+
+	return status;
+}
+
+/*
+ * Check that every field of a layout is an ordered scalar
+ * inside the record.
+ * returns	FS_NO_ERROR if they are; FSERR_OUT_OF_STRUCT otherwise
+ */
+static enum fs_status check_layout(const struct column_layout *layout)
+{
+	size_t member_i;
+
+	for (member_i = 0; member_i < layout->n_members; member_i++) {
+		const struct member_layout *member = &layout->members[member_i];
+
+		if (member->src_offset + member->size > layout->record_size) {
+			printlg(ERROR_LEVEL,
+				"Zone map field at %u-%u is outside of "
+				"records of size %u.\n",
+				(unsigned) member->src_offset,
+				(unsigned) (member->src_offset + member->size),
+				(unsigned) layout->record_size);
+			return FSERR_OUT_OF_STRUCT;
+		}
+		if (member->conversion == MEMBER_BYTES ||
+		    member->size != member->width) {
+			printlg(ERROR_LEVEL,
+				"Zone map field at %u has no order, "
+				"and needs an integer or float layout.\n",
+				(unsigned) member->src_offset);
+			return FSERR_OUT_OF_STRUCT;
+		}
+	}
+
+	return FS_NO_ERROR;
+}
+
+/*
+ * Write a zone map under a temporary name, and rename it into place.
+ * path:	the path of the source file
+ * layout:	the layout of the records
+ * source:	the status of the source file
+ * n_records:	the number of records
+ * bounds:	the bounds of each field in each block
+ * returns	FS_NO_ERROR on success;
+ *		FSERR_ERRNO if writing or renaming failed
+ */
+static enum fs_status
+write_zone_map(const char *path, const struct column_layout *layout,
+	       const struct stat *source, size_t n_records,
+	       const struct column_bounds *bounds)
+{
+	char *tmp_path = zone_map_path(path, TMP_SUFFIX);
+	char *map_path = zone_map_path(path, "");
+	const uint64_t size = zone_map_size(layout,
+					    count_blocks(layout, n_records));
+	struct zone_map_header header;
+	enum fs_status status = FSERR_ERRNO;
+	int fd = -1;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, ZONE_MAP_MAGIC, sizeof(header.magic));
+	header.byte_order = ZONE_MAP_BYTE_ORDER;
+	header.n_fields = layout->n_members;
+	header.n_records = n_records;
+	header.block_records = layout->block_values;
+	set_source_identity(&header.source, source);
+	header.layout_hash = layout_hash(layout);
+
+	if (tmp_path != NULL && map_path != NULL) {
+		fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	}
+	if (fd >= 0) {
+		status = write_all(fd, &header, sizeof(header), 0);
+		if (!status) {
+			status = write_all(fd, bounds,
+					   size - ZONE_MAP_DATA_START,
+					   ZONE_MAP_DATA_START);
+		}
+		status = finish_tmp_file(fd, tmp_path, map_path, status);
+	}
+	if (status) {
+		printlg(ERROR_LEVEL, "Unable to write the zone map of %s: %d\n",
+			path, errno);
+	}
+	free(tmp_path);
+	free(map_path);
+
+	return status;
+}
+
+/*
+ * Check if a zone map of a file is valid and from the same layout.
+ * path:	the path of the source file
+ * layout:	the layout of the records
+ * returns	1 if it is; 0 otherwise
+ */
+static int
+has_valid_zone_map(const char *path, const struct column_layout *layout)
+{
+	char *map_path = zone_map_path(path, "");
+	struct zone_map_header header;
+	struct stat source, map;
+	int fd = map_path == NULL ? -1 : open(map_path, O_RDONLY);
+	int is_valid = fd >= 0 && stat(path, &source) == 0 &&
+		       fstat(fd, &map) == 0 &&
+		       read_valid_header(fd, map.st_size, &source, layout,
+					 &header);
+
+	if (fd >= 0) {
+		close(fd);
+	}
+	free(map_path);
+
+	return is_valid;
+}
+
+enum fs_status
+build_zone_map(const char *path, const struct column_layout *layout,
+	       unsigned n_threads)
+{
+	struct file_structor src_file;
+	struct zone_work work;
+	struct stat source;
+	enum fs_status status;
+	size_t field_i, n_compiled = 0;
+
+	debug_assert(layout->record_size > 0 && layout->block_values > 0);
+	if ((status = check_layout(layout))) {
+		return status;
+	}
+	if (has_valid_zone_map(path, layout)) {
+		return FS_NO_ERROR;
+	}
+
+	if ((status = open_file_structor(&src_file, path))) {
+		return status;
+	}
+	if (fstat(src_file.fd, &source)) {
+		close_file_structor(&src_file);
+		return FSERR_ERRNO;
+	}
+	work.src_file = &src_file;
+	work.layout = layout;
+	work.n_records = count_records(layout, src_file.size);
+	work.plans = calloc(layout->n_members, sizeof(*work.plans));
+	work.bounds = calloc(count_blocks(layout, work.n_records) *
+			     layout->n_members + 1, sizeof(*work.bounds));
+	if (work.plans == NULL || work.bounds == NULL) {
+		status = FSERR_ERRNO;
+	}
+	for (field_i = 0; !status && field_i < layout->n_members; field_i++) {
+		struct member_layout to_value = layout->members[field_i];
+
+		to_value.dst_offset = 0;
+		if (!(status = compile_copy_plan(&work.plans[field_i],
+						 &to_value, 1))) {
+			n_compiled++;
+		}
+	}
+
+	/* Batches start on blocks, so each block is in one batch. */
+	work.batch = ZONE_BUFFER / sizeof(uint64_t) / layout->block_values *
+		     layout->block_values;
+	if (work.batch == 0) {
+		work.batch = layout->block_values;
+	}
+	work.next = 0;
+	n_threads = fs_thread_count(n_threads);
+	if (work.n_records <= work.batch) {
+		n_threads = 1;
+	}
+	if (!status) {
+		status = run_parallel(n_threads, bound_batches, &work);
+	}
+	if (!status) {
+		status = write_zone_map(path, layout, &source, work.n_records,
+					work.bounds);
+	}
+
+	for (field_i = 0; field_i < n_compiled; field_i++) {
+		free_copy_plan(&work.plans[field_i]);
+	}
+	free(work.plans);
+	free(work.bounds);
+	close_file_structor(&src_file);
+
+	return status;
+}
+
+/*
+ * Check that every range is of a field of the layout of a zone map.
+ * returns	1 if they are; 0 otherwise
+ */
+static int
+check_ranges(const struct zone_map *map, const struct zone_range *ranges,
+	     size_t n_ranges)
+{
+	size_t range_i;
+
+	for (range_i = 0; range_i < n_ranges; range_i++) {
+		if (ranges[range_i].field_i >= map->layout->n_members) {
+			printlg(ERROR_LEVEL,
+				"Range %u is of field %u, "
+				"but the layout has %u fields.\n",
+				(unsigned) range_i,
+				(unsigned) ranges[range_i].field_i,
+				(unsigned) map->layout->n_members);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* "zone_may_match", for ranges already checked */
+static int
+block_may_match(const struct zone_map *map, size_t block_i,
+		const struct zone_range *ranges, size_t n_ranges)
+{
+	const size_t n_fields = map->layout->n_members;
+	size_t range_i;
+
+	for (range_i = 0; range_i < n_ranges; range_i++) {
+		const struct zone_range *range = &ranges[range_i];
+		const struct column_bounds *bounds =
+			&map->bounds[block_i * n_fields + range->field_i];
+
+		switch (map->layout->members[range->field_i].conversion) {
+		case MEMBER_SIGNED:
+			if (bounds->max.i < range->min.i ||
+			    bounds->min.i > range->max.i) {
+				return 0;
+			}
+			break;
+		case MEMBER_FLOAT:
+			if (bounds->max.f < range->min.f ||
+			    bounds->min.f > range->max.f) {
+				return 0;
+			}
+			break;
+		default:
+			if (bounds->max.u < range->min.u ||
+			    bounds->min.u > range->max.u) {
+				return 0;
+			}
+			break;
+		}
+	}
+
+	return 1;
+}
+
+int
+zone_may_match(const struct zone_map *map, size_t block_i,
+	       const struct zone_range *ranges, size_t n_ranges)
+{
+	if (!check_ranges(map, ranges, n_ranges)) {
+		return -1;
+	}
+
+	return block_may_match(map, block_i, ranges, n_ranges);
+}
+
+enum fs_status
+scan_zones(struct file_structor *src_file, const struct zone_map *map,
+	   const struct zone_range *ranges, size_t n_ranges,
+	   zone_visit_fn visit, void *arg, size_t *n_visited)
+{
+	const size_t record_size = map->layout->record_size;
+	size_t max_run = ZONE_SCAN_MAX_RUN / (map->block_records *
+					      record_size);
+	size_t block_i = 0, visited = 0;
+	enum fs_status status = FS_NO_ERROR;
+
+	if (!check_ranges(map, ranges, n_ranges)) {
+		return FSERR_OUT_OF_STRUCT;
+	}
+	if (max_run == 0) {
+		max_run = 1;
+	}
+	while (!status && block_i < map->n_blocks) {
+		size_t run_start = block_i, first, end;
+		struct file_struct records;
+
+		if (!block_may_match(map, block_i, ranges, n_ranges)) {
+			block_i++;
+			continue;
+		}
+		do {
+			block_i++;
+		} while (block_i < map->n_blocks &&
+			 block_i - run_start < max_run &&
+			 block_may_match(map, block_i, ranges, n_ranges));
+
+		first = run_start * map->block_records;
+		end = block_i * map->block_records;
+		if (end > map->n_records) {
+			end = map->n_records;
+		}
+		if ((status = init_file_struct(&records, src_file,
+					       (end - first) * record_size,
+					       map->layout->records_start +
+					       (off_t) (first *
+							record_size)))) {
+			break;
+		}
+		status = visit(&records, first, end - first, arg);
+		teardown_file_struct(&records);
+		visited += block_i - run_start;
+	}
+	if (n_visited != NULL) {
+		*n_visited = visited;
+	}
+
+	return status;
+}
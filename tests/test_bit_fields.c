@@ -0,0 +1,427 @@
+/* tests reading bit fields, packed integers and varints */
+#include <bit_fields.h>
+
+#include <logger.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Each test record has 3 bit fields, the last ending at its last bit,
+ * and fields of different bit orders do not share a byte.
+ */
+#define RECORD_SIZE	11
+/* the number of records, which is not a multiple of any vector width */
+#define N_RECORDS	1003
+/* the bytes after the last record, too few for another */
+#define PARTIAL_SIZE	5
+/* the number of integers in the packed arrays and varint streams */
+#define N_VALUES	1001
+/* the bytes before the packed arrays and varint streams */
+#define PACKED_START	3
+
+static const struct fs_bit_field record_fields[] = {
+	{ 3, 19, LSB_FIRST, 1 },
+	{ 24, 57, MSB_FIRST, 0 },
+	{ 8 * RECORD_SIZE - 1, 1, MSB_FIRST, 1 },
+};
+#define N_FIELDS	(sizeof(record_fields) / sizeof(*record_fields))
+
+/* the next pseudo-random number of a sequence */
+static uint64_t next_random(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+/*
+ * Write the low bits of an integer one bit at a time.
+ * dst:		the start of the destination
+ * bit_offset:	the location of the first bit
+ * n_bits:	the number of bits to write
+ * order:	the order of the bits
+ * value:	the integer
+ */
+static void
+put_bits(uint8_t *dst, size_t bit_offset, unsigned n_bits,
+	 enum bit_order order, uint64_t value)
+{
+	unsigned bit_i;
+
+	for (bit_i = 0; bit_i < n_bits; bit_i++) {
+		size_t stream_i = bit_offset + bit_i;
+		unsigned value_bit = order == LSB_FIRST ? bit_i :
+				     n_bits - 1 - bit_i;
+		uint8_t byte_bit = order == LSB_FIRST ?
+				   1 << stream_i % 8 : 0x80 >> stream_i % 8;
+
+		if (value >> value_bit & 1) {
+			dst[stream_i / 8] |= byte_bit;
+		} else {
+			dst[stream_i / 8] &= ~byte_bit;
+		}
+	}
+}
+
+/*
+ * Encode an integer as a varint.
+ * dst:		the destination, with room for "VARINT_MAX_BYTES"
+ * value:	the integer
+ * returns	the number of bytes written
+ */
+static size_t put_varint(uint8_t *dst, uint64_t value)
+{
+	size_t byte_i = 0;
+
+	while (value >= 0x80) {
+		dst[byte_i++] = (uint8_t) (value | 0x80);
+		value >>= 7;
+	}
+	dst[byte_i++] = (uint8_t) value;
+
+	return byte_i;
+}
+
+/*
+ * the value of a field, as "load_bit_field" should return it
+ * raw:		the raw bits, which may have more than the field
+ * field:	the description of the field
+ */
+static uint64_t field_value(uint64_t raw, const struct fs_bit_field *field)
+{
+	uint64_t value = raw & ((1ull << field->n_bits) - 1);
+
+	if (field->is_signed && value >> (field->n_bits - 1)) {
+		value |= ~0ull << field->n_bits;
+	}
+
+	return value;
+}
+
+/* Fields should be loaded in each bit order, and sign-extended. */
+static int test_load_bit_field()
+{
+	/* 1011 0101  0011 1100 */
+	uint8_t bytes[] = { 0xb5, 0x3c };
+	const struct fs_bit_field lsb_low = { 0, 3, LSB_FIRST, 1 };
+	const struct fs_bit_field lsb_across = { 4, 6, LSB_FIRST, 0 };
+	const struct fs_bit_field msb_inside = { 2, 4, MSB_FIRST, 1 };
+	const struct fs_bit_field msb_across = { 4, 6, MSB_FIRST, 0 };
+	const struct fs_bit_field past_end = { 12, 5, MSB_FIRST, 0 };
+	struct file_structor structor;
+	struct file_struct chunk;
+	uint16_t copied = 0;
+	int ret;
+
+	open_memory_structor(&structor, bytes, sizeof(bytes));
+	init_file_struct(&chunk, &structor, sizeof(bytes), 0);
+	ret = (int64_t) load_bit_field(bytes, &lsb_low) == -3 &&
+	      load_bit_field(bytes, &lsb_across) == 0x0b &&
+	      (int64_t) load_bit_field(bytes, &msb_inside) == -3 &&
+	      load_bit_field(bytes, &msb_across) == 0x14 &&
+	      copy_bit_section(&copied, 0, sizeof(copied), &chunk, 0,
+			       &msb_across) == FS_NO_ERROR &&
+	      copied == 0x14 &&
+	      copy_bit_section(&copied, 0, sizeof(copied), &chunk, 0,
+			       &past_end) == FSERR_OUT_OF_STRUCT;
+	teardown_file_struct(&chunk);
+	close_file_structor(&structor);
+
+	return ret;
+}
+
+/* Every field of every record should be extracted, to any width. */
+static int test_extract_bit_field()
+{
+	const size_t dst_widths[] = { sizeof(uint16_t), sizeof(uint32_t),
+				      sizeof(uint64_t) };
+	const size_t size = RECORD_SIZE * N_RECORDS + PARTIAL_SIZE;
+	uint8_t *raw = calloc(size, 1);
+	uint64_t *expected = malloc(sizeof(*expected) * N_FIELDS * N_RECORDS);
+	uint8_t *dst = malloc(sizeof(uint64_t) * N_RECORDS);
+	struct file_structor structor;
+	struct file_struct records;
+	uint64_t state = 0x2545f4914f6cdd1dull;
+	size_t record_i, field_i, width_i;
+	int ret = 1;
+
+	memset(raw, 0xa5, size);
+	for (record_i = 0; record_i < N_RECORDS; record_i++) {
+		for (field_i = 0; field_i < N_FIELDS; field_i++) {
+			const struct fs_bit_field *field =
+				&record_fields[field_i];
+			uint64_t value = next_random(&state);
+
+			put_bits(raw + record_i * RECORD_SIZE,
+				 field->bit_offset, field->n_bits,
+				 field->order, value);
+			expected[field_i * N_RECORDS + record_i] =
+				field_value(value, field);
+		}
+	}
+	open_memory_structor(&structor, raw, size);
+	init_file_struct(&records, &structor, size, 0);
+
+	for (field_i = 0; ret && field_i < N_FIELDS; field_i++) {
+		for (width_i = 0; ret && width_i < 3; width_i++) {
+			const size_t dst_width = dst_widths[width_i];
+
+			memset(dst, 0, sizeof(uint64_t) * N_RECORDS);
+			ret = extract_bit_field(&records, RECORD_SIZE,
+						&record_fields[field_i], dst,
+						dst_width) == FS_NO_ERROR;
+			for (record_i = 0; ret && record_i < N_RECORDS;
+			     record_i++) {
+				uint64_t value = 0;
+
+				store_uint(&value,
+					   expected[field_i * N_RECORDS +
+						    record_i], dst_width);
+				ret = !memcmp(dst + record_i * dst_width,
+					      &value, dst_width);
+			}
+			if (!ret) {
+				printlg(ERROR_LEVEL,
+					"Field %u of record %u is wrong "
+					"in %u bytes.\n", (unsigned) field_i,
+					(unsigned) record_i - 1,
+					(unsigned) dst_width);
+			}
+		}
+	}
+
+	teardown_file_struct(&records);
+	close_file_structor(&structor);
+	free(raw);
+	free(expected);
+	free(dst);
+
+	return ret;
+}
+
+/* A field past the end of the record should be an error. */
+static int test_field_outside()
+{
+	const struct fs_bit_field outside = {
+		8 * RECORD_SIZE - 3, 4, LSB_FIRST, 0
+	};
+	uint8_t raw[RECORD_SIZE * 2] = { 0 };
+	uint32_t dst[2];
+	struct file_structor structor;
+	struct file_struct records;
+	int ret;
+
+	open_memory_structor(&structor, raw, sizeof(raw));
+	init_file_struct(&records, &structor, sizeof(raw), 0);
+	ret = extract_bit_field(&records, RECORD_SIZE, &outside, dst,
+				sizeof(*dst)) == FSERR_OUT_OF_STRUCT;
+	teardown_file_struct(&records);
+	close_file_structor(&structor);
+
+	return ret;
+}
+
+/*
+ * Check unpacking a packed array of a width into integers of another.
+ * n_bits:	the number of bits of each packed integer
+ * order:	the order of the bits
+ * dst_width:	the number of bytes of each unpacked integer
+ * returns	1 if every integer is unpacked; 0 otherwise
+ */
+static int
+check_unpack(unsigned n_bits, enum bit_order order, size_t dst_width)
+{
+	const size_t size = PACKED_START + (N_VALUES * n_bits + 7) / 8;
+	uint8_t *raw = calloc(size, 1);
+	uint64_t *values = malloc(sizeof(*values) * N_VALUES);
+	uint8_t *dst = malloc(dst_width * N_VALUES + sizeof(uint64_t));
+	struct fs_bit_field field = { 0, n_bits, order, 0 };
+	struct file_structor structor;
+	struct file_struct packed;
+	uint64_t state = n_bits * 0x9e3779b97f4a7c15ull + order;
+	size_t value_i;
+	int ret;
+
+	for (value_i = 0; value_i < N_VALUES; value_i++) {
+		values[value_i] = field_value(next_random(&state), &field);
+		put_bits(raw + PACKED_START, value_i * n_bits, n_bits, order,
+			 values[value_i]);
+	}
+	open_memory_structor(&structor, raw, size);
+	init_file_struct(&packed, &structor, size, 0);
+
+	/* Nothing should be written past the last integer. */
+	memset(dst + dst_width * N_VALUES, 0xa5, sizeof(uint64_t));
+	ret = unpack_bits(&packed, PACKED_START, n_bits, order, N_VALUES, dst,
+			  dst_width) == FS_NO_ERROR;
+	for (value_i = 0; ret && value_i < N_VALUES; value_i++) {
+		uint64_t value = 0;
+
+		store_uint(&value, values[value_i], dst_width);
+		ret = !memcmp(dst + value_i * dst_width, &value, dst_width);
+	}
+	if (!ret) {
+		printlg(ERROR_LEVEL,
+			"Integer %u of %u bits is wrong in %u bytes.\n",
+			(unsigned) value_i - 1, n_bits, (unsigned) dst_width);
+	}
+	for (value_i = 0; ret && value_i < sizeof(uint64_t); value_i++) {
+		if (dst[dst_width * N_VALUES + value_i] != 0xa5) {
+			printlg(ERROR_LEVEL,
+				"%u bits were unpacked past %u bytes.\n",
+				n_bits, (unsigned) dst_width);
+			ret = 0;
+		}
+	}
+	ret = ret && unpack_bits(&packed, PACKED_START + 1, n_bits, order,
+				 N_VALUES, dst, dst_width) ==
+		     FSERR_OUT_OF_STRUCT;
+
+	teardown_file_struct(&packed);
+	close_file_structor(&structor);
+	free(raw);
+	free(values);
+	free(dst);
+
+	return ret;
+}
+
+/* Packed arrays of any width should be unpacked in either bit order. */
+static int test_unpack_bits()
+{
+	const unsigned bit_widths[] = { 1, 3, 7, 8, 13, 16, 27, 32, 57 };
+	size_t width_i, dst_width;
+	int ret = 1;
+
+	for (width_i = 0; width_i < sizeof(bit_widths) / sizeof(*bit_widths);
+	     width_i++) {
+		for (dst_width = 1; dst_width <= 8; dst_width++) {
+			if (bit_widths[width_i] > 8 * dst_width) {
+				continue;
+			}
+			ret &= check_unpack(bit_widths[width_i], LSB_FIRST,
+					    dst_width) &&
+			       check_unpack(bit_widths[width_i], MSB_FIRST,
+					    dst_width);
+		}
+	}
+
+	return ret;
+}
+
+/*
+ * Varints of every length should be decoded,
+ * stopping at the end of the chunk.
+ */
+static int test_decode_varints()
+{
+	uint8_t *raw = malloc(PACKED_START + N_VALUES * VARINT_MAX_BYTES);
+	uint64_t *values = malloc(sizeof(*values) * N_VALUES);
+	uint64_t *dst = malloc(sizeof(*dst) * (N_VALUES + 1));
+	struct file_structor structor;
+	struct file_struct stream;
+	uint64_t state = 0x853c49e6748fea9bull;
+	size_t size = PACKED_START, value_i, n_values;
+	off_t end, middle = 0;
+	int ret;
+
+	for (value_i = 0; value_i < N_VALUES; value_i++) {
+		/* Mostly runs of 1-byte varints, and some of every length. */
+		uint64_t value = next_random(&state);
+
+		if (value_i % 64 < 40) {
+			value &= 0x7f;
+		} else {
+			value >>= value % 64;
+		}
+		values[value_i] = value;
+		size += put_varint(raw + size, value);
+		if (value_i == N_VALUES / 2) {
+			middle = size;
+		}
+	}
+	open_memory_structor(&structor, raw, size);
+	init_file_struct(&stream, &structor, size, 0);
+
+	n_values = N_VALUES + 1;
+	ret = decode_varints(&stream, PACKED_START, dst, &n_values, &end) ==
+	      FS_NO_ERROR && n_values == N_VALUES && end == (off_t) size &&
+	      !memcmp(dst, values, sizeof(*values) * N_VALUES);
+	n_values = N_VALUES / 2 + 1;
+	ret = ret && decode_varints(&stream, PACKED_START, dst, &n_values,
+				    &end) == FS_NO_ERROR &&
+	      n_values == N_VALUES / 2 + 1 && end == middle &&
+	      zigzag_decode(0) == 0 && zigzag_decode(1) == -1 &&
+	      zigzag_decode(4) == 2 && zigzag_decode(~0ull) == INT64_MIN;
+
+	teardown_file_struct(&stream);
+	close_file_structor(&structor);
+	free(raw);
+	free(values);
+	free(dst);
+
+	return ret;
+}
+
+/* Cut off and overlong varints should stop the stream with an error. */
+static int test_broken_varints()
+{
+	uint8_t raw[32];
+	uint64_t dst[8];
+	struct file_structor structor;
+	struct file_struct stream;
+	size_t size, n_values;
+	off_t end;
+	int ret;
+
+	/* 2 varints, then one cut off by the end of the chunk */
+	size = put_varint(raw, 300);
+	size += put_varint(raw + size, 1);
+	put_varint(raw + size, 1ull << 40);
+	size += 3;
+	open_memory_structor(&structor, raw, size);
+	init_file_struct(&stream, &structor, size, 0);
+	n_values = 8;
+	ret = decode_varints(&stream, 0, dst, &n_values, &end) ==
+	      FSERR_OUT_OF_STRUCT && n_values == 2 && dst[0] == 300 &&
+	      dst[1] == 1 && end == (off_t) size - 3;
+	teardown_file_struct(&stream);
+	close_file_structor(&structor);
+
+	/* a varint still going after "VARINT_MAX_BYTES" */
+	memset(raw, 0x81, sizeof(raw));
+	open_memory_structor(&structor, raw, sizeof(raw));
+	init_file_struct(&stream, &structor, sizeof(raw), 0);
+	n_values = 8;
+	ret = ret && decode_varints(&stream, 0, dst, &n_values, &end) ==
+		     FSERR_OUT_OF_STRUCT && n_values == 0 && end == 0;
+	teardown_file_struct(&stream);
+	close_file_structor(&structor);
+
+	return ret;
+}
+
+#define N_BIT_TESTS	6
+static int (*bit_tests[N_BIT_TESTS])() = {
+	test_load_bit_field, test_extract_bit_field, test_field_outside,
+	test_unpack_bits, test_decode_varints, test_broken_varints
+};
+
+int main()
+{
+	size_t test_i;
+
+	for (test_i = 0; test_i < N_BIT_TESTS; test_i++) {
+		printlg(INFO_LEVEL, "Testing bit fields: %u...\n",
+			(unsigned) test_i);
+		if (bit_tests[test_i]()) {
+			printlg(INFO_LEVEL, "Passed!\n");
+		} else {
+			printlg(ERROR_LEVEL, "Failed!\n");
+		}
+	}
+
+	return 0;
+}
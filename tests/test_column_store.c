@@ -0,0 +1,348 @@
+/* tests converting records into columns of single fields */
+#include <column_store.h>
+
+#include <logger.h>
+#include "test_common.h"
+
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define COLUMN_TEST_FILE	TEST_TMP_FILE("column")
+/* the bytes before the first record */
+#define HEADER_SIZE		16
+/*
+ * Each record has a big-endian 8-byte ID, a big-endian signed 3-byte
+ * counter, a big-endian "float" weight, an array of 3 little-endian 2-byte
+ * values, and padding up to 40 bytes.
+ */
+#define ID_START		0
+#define COUNTER_START		8
+#define COUNTER_WIDTH		3
+#define WEIGHT_START		11
+#define VALUES_START		15
+#define N_VALUES		3
+#define RECORD_SIZE		40
+/* the number of records, followed by a partial record */
+#define N_RECORDS		10000
+#define PARTIAL_SIZE		7
+/* the number of records in each block with bounds */
+#define BLOCK_VALUES		1000
+
+/* the index of each column in "column_members" */
+enum test_column {
+	ID_COLUMN,
+	COUNTER_COLUMN,
+	WEIGHT_COLUMN,
+	VALUES_COLUMN,
+	N_COLUMNS
+};
+
+static const struct member_layout column_members[N_COLUMNS] = {
+	{ ID_START, 0, sizeof(uint64_t), sizeof(uint64_t), BIG_END,
+	  MEMBER_BYTES, 0 },
+	{ COUNTER_START, 0, COUNTER_WIDTH, COUNTER_WIDTH, BIG_END,
+	  MEMBER_SIGNED, sizeof(int32_t) },
+	{ WEIGHT_START, 0, sizeof(float), sizeof(float), BIG_END,
+	  MEMBER_FLOAT, sizeof(double) },
+	{ VALUES_START, 0, N_VALUES * sizeof(uint16_t), sizeof(uint16_t),
+	  LITTLE_END, MEMBER_BYTES, 0 },
+};
+static const struct column_layout record_layout = {
+	HEADER_SIZE, RECORD_SIZE, column_members, N_COLUMNS, BLOCK_VALUES
+};
+
+/* the fields of each record */
+static uint64_t record_id(size_t record_i)
+{
+	return record_i * 0x9e3779b97f4a7c15ull;
+}
+static int32_t record_counter(size_t record_i, int32_t generation)
+{
+	return (int32_t) ((record_i * 7919) % 20001) - 10000 + generation;
+}
+static float record_weight(size_t record_i)
+{
+	return (float) record_i / 4 - 100;
+}
+static uint16_t record_value(size_t record_i, unsigned value_i)
+{
+	return (uint16_t) (record_i + value_i * 1000);
+}
+
+/*
+ * Store the low bytes of an integer in a byte order.
+ * dst:		the destination
+ * value:	the integer
+ * width:	the number of bytes to store
+ * endianness:	the byte order to store them in
+ */
+static void
+put_bytes(uint8_t *dst, uint64_t value, size_t width,
+	  enum endianness endianness)
+{
+	size_t byte_i;
+
+	for (byte_i = 0; byte_i < width; byte_i++) {
+		uint8_t byte = (uint8_t) (value >> (8 * byte_i));
+
+		if (endianness == LITTLE_END) {
+			dst[byte_i] = byte;
+		} else {
+			dst[width - 1 - byte_i] = byte;
+		}
+	}
+}
+
+/*
+ * Write the test file, replacing any file there.
+ * generation:	added to every counter, and to the size of the partial
+ *		record, so that the file changes size too
+ * returns	1 on success; 0 otherwise
+ */
+static int write_test_file(int32_t generation)
+{
+	size_t size = HEADER_SIZE + N_RECORDS * RECORD_SIZE + PARTIAL_SIZE +
+		      generation;
+	uint8_t *bytes = calloc(size, 1);
+	size_t record_i;
+	int ret;
+
+	if (bytes == NULL) {
+		return 0;
+	}
+	for (record_i = 0; record_i < N_RECORDS; record_i++) {
+		uint8_t *record = bytes + HEADER_SIZE + record_i * RECORD_SIZE;
+		float weight = record_weight(record_i);
+		uint32_t weight_bits;
+		unsigned value_i;
+
+		memcpy(&weight_bits, &weight, sizeof(weight_bits));
+		put_bytes(record + ID_START, record_id(record_i),
+			  sizeof(uint64_t), BIG_END);
+		put_bytes(record + COUNTER_START,
+			  (uint32_t) record_counter(record_i, generation),
+			  COUNTER_WIDTH, BIG_END);
+		put_bytes(record + WEIGHT_START, weight_bits, sizeof(float),
+			  BIG_END);
+		for (value_i = 0; value_i < N_VALUES; value_i++) {
+			put_bytes(record + VALUES_START +
+				  value_i * sizeof(uint16_t),
+				  record_value(record_i, value_i),
+				  sizeof(uint16_t), LITTLE_END);
+		}
+	}
+
+	ret = write_test_file_bytes(COLUMN_TEST_FILE, bytes, size);
+	free(bytes);
+
+	return ret;
+}
+
+/*
+ * Open every column of the test file.
+ * columns:	will be set to the opened columns
+ * returns	1 on success; 0 otherwise, with no column open
+ */
+static int open_test_columns(struct column *columns)
+{
+	size_t column_i;
+
+	for (column_i = 0; column_i < N_COLUMNS; column_i++) {
+		if (open_column(&columns[column_i], COLUMN_TEST_FILE,
+				&record_layout, column_i)) {
+			while (column_i-- > 0) {
+				close_column(&columns[column_i]);
+			}
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* Close every column of the test file. */
+static void close_test_columns(struct column *columns)
+{
+	size_t column_i;
+
+	for (column_i = 0; column_i < N_COLUMNS; column_i++) {
+		close_column(&columns[column_i]);
+	}
+}
+
+/*
+ * Check the values of every column.
+ * columns:	the opened columns
+ * generation:	the generation of the test file
+ * returns	1 if every value is correct; 0 otherwise
+ */
+static int check_values(const struct column *columns, int32_t generation)
+{
+	const uint64_t *ids = COLUMN_ARRAY(&columns[ID_COLUMN], uint64_t);
+	const int32_t *counters = COLUMN_ARRAY(&columns[COUNTER_COLUMN],
+					       int32_t);
+	const double *weights = COLUMN_ARRAY(&columns[WEIGHT_COLUMN], double);
+	const uint16_t *values = columns[VALUES_COLUMN].values;
+	size_t record_i;
+	unsigned value_i;
+
+	if (ids == NULL || counters == NULL || weights == NULL ||
+	    COLUMN_ARRAY(&columns[WEIGHT_COLUMN], float) != NULL ||
+	    columns[VALUES_COLUMN].value_size != N_VALUES * sizeof(uint16_t)) {
+		printlg(ERROR_LEVEL, "A column has the wrong value size.\n");
+		return 0;
+	}
+	for (record_i = 0; record_i < N_RECORDS; record_i++) {
+		if (ids[record_i] != record_id(record_i) ||
+		    counters[record_i] != record_counter(record_i,
+							 generation) ||
+		    weights[record_i] != record_weight(record_i)) {
+			printlg(ERROR_LEVEL, "Record %u is wrong.\n",
+				(unsigned) record_i);
+			return 0;
+		}
+		for (value_i = 0; value_i < N_VALUES; value_i++) {
+			if (values[record_i * N_VALUES + value_i] !=
+			    record_value(record_i, value_i)) {
+				return 0;
+			}
+		}
+	}
+
+	return 1;
+}
+
+/* Columns should hold the converted fields of every whole record. */
+static int test_build_columns()
+{
+	struct column columns[N_COLUMNS];
+	size_t column_i;
+	int ret = 1;
+
+	if (!write_test_file(0) ||
+	    build_columns(COLUMN_TEST_FILE, &record_layout, 2) ||
+	    !open_test_columns(columns)) {
+		return 0;
+	}
+	for (column_i = 0; column_i < N_COLUMNS; column_i++) {
+		ret &= columns[column_i].n_values == N_RECORDS &&
+		       (uintptr_t) columns[column_i].values % 64 == 0;
+	}
+	ret = ret && check_values(columns, 0);
+	close_test_columns(columns);
+
+	return ret;
+}
+
+/* Numeric scalar columns should have the bounds of each block. */
+static int test_bounds()
+{
+	struct column columns[N_COLUMNS];
+	const struct column *counter = &columns[COUNTER_COLUMN];
+	const struct column *weight = &columns[WEIGHT_COLUMN];
+	size_t block_i, record_i;
+	int ret;
+
+	if (!open_test_columns(columns)) {
+		return 0;
+	}
+	ret = columns[ID_COLUMN].bounds == NULL &&
+	      columns[VALUES_COLUMN].bounds == NULL &&
+	      counter->n_blocks == N_RECORDS / BLOCK_VALUES &&
+	      weight->n_blocks == N_RECORDS / BLOCK_VALUES;
+	for (block_i = 0; ret && block_i < counter->n_blocks; block_i++) {
+		int64_t min = INT64_MAX, max = INT64_MIN;
+
+		for (record_i = block_i * BLOCK_VALUES;
+		     record_i < (block_i + 1) * BLOCK_VALUES; record_i++) {
+			int32_t value = record_counter(record_i, 0);
+
+			min = value < min ? value : min;
+			max = value > max ? value : max;
+		}
+		ret = counter->bounds[block_i].min.i == min &&
+		      counter->bounds[block_i].max.i == max &&
+		      weight->bounds[block_i].min.f ==
+		      record_weight(block_i * BLOCK_VALUES) &&
+		      weight->bounds[block_i].max.f ==
+		      record_weight((block_i + 1) * BLOCK_VALUES - 1);
+	}
+	close_test_columns(columns);
+
+	return ret;
+}
+
+/* Building valid columns again should not rewrite them. */
+static int test_build_once()
+{
+	struct stat before, after;
+
+	return stat(COLUMN_TEST_FILE COLUMN_SUFFIX "0", &before) == 0 &&
+	       build_columns(COLUMN_TEST_FILE, &record_layout, 0) ==
+	       FS_NO_ERROR &&
+	       stat(COLUMN_TEST_FILE COLUMN_SUFFIX "0", &after) == 0 &&
+	       before.st_ino == after.st_ino &&
+	       before.st_mtim.tv_nsec == after.st_mtim.tv_nsec;
+}
+
+/* Columns should not be opened once their source changes. */
+static int test_stale_columns()
+{
+	struct column columns[N_COLUMNS];
+	struct column column;
+	int ret;
+
+	if (!write_test_file(3) ||
+	    open_column(&column, COLUMN_TEST_FILE, &record_layout,
+			COUNTER_COLUMN) != FSERR_BAD_SIDECAR ||
+	    build_columns(COLUMN_TEST_FILE, &record_layout, 0) ||
+	    !open_test_columns(columns)) {
+		return 0;
+	}
+	ret = check_values(columns, 3);
+	close_test_columns(columns);
+
+	return ret;
+}
+
+/* A field outside of the records should be an error. */
+static int test_field_outside()
+{
+	const struct member_layout outside = {
+		RECORD_SIZE - 2, 0, sizeof(uint32_t), sizeof(uint32_t),
+		BIG_END, MEMBER_BYTES, 0
+	};
+	const struct column_layout layout = {
+		HEADER_SIZE, RECORD_SIZE, &outside, 1, 0
+	};
+
+	return build_columns(COLUMN_TEST_FILE, &layout, 0) ==
+	       FSERR_OUT_OF_STRUCT;
+}
+
+#define N_COLUMN_TESTS	5
+static int (*column_tests[N_COLUMN_TESTS])() = {
+	test_build_columns, test_bounds, test_build_once, test_stale_columns,
+	test_field_outside
+};
+
+int main()
+{
+	size_t test_i;
+
+	for (test_i = 0; test_i < N_COLUMN_TESTS; test_i++) {
+		printlg(INFO_LEVEL, "Testing columns: %u...\n",
+			(unsigned) test_i);
+		if (column_tests[test_i]()) {
+			printlg(INFO_LEVEL, "Passed!\n");
+		} else {
+			printlg(ERROR_LEVEL, "Failed!\n");
+		}
+	}
+
+	remove_columns(COLUMN_TEST_FILE, N_COLUMNS);
+	unlink(COLUMN_TEST_FILE);
+
+	return 0;
+}
@@ -0,0 +1,44 @@
+/* shared helpers for the tests */
+#ifndef TEST_COMMON_H
+#define TEST_COMMON_H
+
+#include <logger.h>
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/*
+ * the path of a file a test writes, in the working directory
+ * name:	the name of the test file, as a string literal
+ */
+#define TEST_TMP_FILE(name)	name "_test.tmp"
+
+/*
+ * Write a test file, replacing any file there.
+ * path:	the path of the file
+ * bytes:	the contents of the file,
+ *		or NULL to leave it sparse, reading as zeros
+ * size:	the number of bytes
+ * returns	1 on success; 0 otherwise
+ */
+inline static int
+write_test_file_bytes(const char *path, const void *bytes, size_t size)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	int ret = fd >= 0 &&
+		  (bytes == NULL ? ftruncate(fd, size) == 0 :
+		   write(fd, bytes, size) == (ssize_t) size);
+
+	if (!ret) {
+		printlg(ERROR_LEVEL, "Unable to write %s.\n", path);
+	}
+	if (fd >= 0) {
+		close(fd);
+	}
+
+	return ret;
+}
+
+#endif /* TEST_COMMON_H */
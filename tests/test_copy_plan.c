@@ -0,0 +1,201 @@
+/* tests copying packed structs from a file into aligned structs */
+#include <copy_plan.h>
+
+#include <logger.h>
+
+#include <stdlib.h>
+
+/*
+ * The test file holds an array of packed records,
+ * each with a 1-byte tag, a big-endian 4-byte value,
+ * a little-endian 2-byte count and a big-endian 8-byte ID,
+ * with no padding in between.
+ */
+#define PACKED_TEST_FILE	"test_inputs/packed_test"
+/* the offsets of the members in each packed record */
+#define TAG_START		0
+#define VALUE_START		(TAG_START + sizeof(uint8_t))
+#define COUNT_START		(VALUE_START + sizeof(uint32_t))
+#define ID_START		(COUNT_START + sizeof(uint16_t))
+/* the size of each packed record */
+#define PACKED_SIZE		(ID_START + sizeof(uint64_t))
+/* the number of records in the file */
+#define N_RECORDS		3
+
+/* the aligned struct in memory */
+struct host_record {
+	uint8_t tag;
+	uint32_t value;
+	uint16_t count;
+	uint64_t id;
+};
+
+#define N_RECORD_MEMBERS	4
+static const struct member_layout record_layout[N_RECORD_MEMBERS] = {
+	MEMBER_LAYOUT(struct host_record, id, ID_START, BIG_END),
+	MEMBER_LAYOUT(struct host_record, tag, TAG_START, BIG_END),
+	MEMBER_LAYOUT(struct host_record, count, COUNT_START, LITTLE_END),
+	MEMBER_LAYOUT(struct host_record, value, VALUE_START, BIG_END),
+};
+
+/*
+ * Check that a copied record has the values of the one at the index.
+ * record:	the copied record
+ * record_i:	the index of the record in the file
+ * returns	1 if the values are correct; 0 otherwise
+ */
+static int check_record(struct host_record *record, unsigned record_i)
+{
+	if (record->tag != record_i + 1 ||
+	    record->value != 0x10203040 + record_i ||
+	    record->count != 0x0102 + record_i ||
+	    record->id != 0x0001020304050607ULL + record_i) {
+		printlg(ERROR_LEVEL,
+			"Record %u has tag %u, value 0x%x, count 0x%x "
+			"and ID 0x%llx.\n",
+			record_i, (unsigned) record->tag,
+			(unsigned) record->value, (unsigned) record->count,
+			(unsigned long long) record->id);
+		return 0;
+	}
+
+	return 1;
+}
+
+/* All the records should be copied by one run of the plan. */
+static int test_plan_array(struct file_struct *input)
+{
+	struct copy_plan plan;
+	struct host_record records[N_RECORDS];
+	enum fs_status status;
+	unsigned record_i;
+	int ret = 1;
+
+	if (compile_copy_plan(&plan, record_layout, N_RECORD_MEMBERS)) {
+		return 0;
+	}
+	status = apply_copy_plan_array(&plan, records, sizeof(*records),
+				       input, 0, PACKED_SIZE, N_RECORDS);
+	free_copy_plan(&plan);
+
+	if (status) {
+		printlg(ERROR_LEVEL, "Unexpected copy error: %d.\n", status);
+		return 0;
+	}
+	for (record_i = 0; record_i < N_RECORDS; record_i++) {
+		ret &= check_record(&records[record_i], record_i);
+	}
+
+	return ret;
+}
+
+/* Copying past the last record should fail before copying anything. */
+static int test_plan_out_of_range(struct file_struct *input)
+{
+	struct copy_plan plan;
+	struct host_record records[N_RECORDS + 1];
+	enum fs_status status;
+
+	if (compile_copy_plan(&plan, record_layout, N_RECORD_MEMBERS)) {
+		return 0;
+	}
+	status = apply_copy_plan_array(&plan, records, sizeof(*records),
+				       input, 0, PACKED_SIZE, N_RECORDS + 1);
+	free_copy_plan(&plan);
+
+	if (status != FSERR_OUT_OF_STRUCT) {
+		printlg(ERROR_LEVEL, "Expected error %d, but got %d.\n",
+			FSERR_OUT_OF_STRUCT, status);
+		return 0;
+	}
+
+	return 1;
+}
+
+/* A single member should be copied from its packed offset. */
+static int test_copy_member_from(struct file_struct *input)
+{
+	struct host_record record = {0, 0, 0, 0};
+	enum fs_status status;
+
+	if ((status = COPY_MEMBER_FROM(&record, input, struct host_record, id,
+				       PACKED_SIZE + ID_START, BIG_END))) {
+		printlg(ERROR_LEVEL, "Unexpected copy error: %d.\n", status);
+		return 0;
+	}
+	if (record.id != 0x0001020304050608) {
+		printlg(ERROR_LEVEL, "Expected ID 0x0001020304050608, "
+				     "but got 0x%llx.\n",
+			(unsigned long long) record.id);
+		return 0;
+	}
+
+	return 1;
+}
+
+/* the struct for checking that adjacent members are merged */
+struct adjacent_arrays {
+	char first[4];
+	char second[4];
+};
+
+/* Members that are adjacent in both layouts should be copied together. */
+static int test_plan_coalescing(struct file_struct *input)
+{
+	const struct member_layout adjacent_layout[2] = {
+		ARRAY_MEMBER_LAYOUT(struct adjacent_arrays, second, 8, BIG_END),
+		ARRAY_MEMBER_LAYOUT(struct adjacent_arrays, first, 4, BIG_END),
+	};
+	struct copy_plan plan;
+	size_t n_ops;
+
+	(void) input;
+
+	if (compile_copy_plan(&plan, adjacent_layout, 2)) {
+		return 0;
+	}
+	n_ops = plan.n_ops;
+	free_copy_plan(&plan);
+
+	if (n_ops != 1) {
+		printlg(ERROR_LEVEL, "Expected 1 step, but got %u.\n",
+			(unsigned) n_ops);
+		return 0;
+	}
+
+	return 1;
+}
+
+#define N_COPY_PLAN_TESTS	4
+static int (*copy_plan_tests[N_COPY_PLAN_TESTS])(struct file_struct *) = {
+	test_plan_array, test_plan_out_of_range, test_copy_member_from,
+	test_plan_coalescing
+};
+
+int main()
+{
+	struct file_structor structor;
+	struct file_struct input;
+	size_t test_i;
+
+	if (open_file_structor(&structor, PACKED_TEST_FILE) ||
+	    init_file_struct(&input, &structor, structor.size, 0)) {
+		printlg(ERROR_LEVEL, "Could not map %s.\n", PACKED_TEST_FILE);
+		return 1;
+	}
+
+	for (test_i = 0; test_i < N_COPY_PLAN_TESTS; test_i++) {
+		printlg(INFO_LEVEL, "Testing copy plans: %u...\n",
+			(unsigned) test_i);
+		if (copy_plan_tests[test_i](&input)) {
+			printlg(INFO_LEVEL, "Passed!\n");
+		} else {
+			printlg(ERROR_LEVEL, "Failed!\n");
+		}
+	}
+
+	teardown_file_struct(&input);
+	close_file_structor(&structor);
+
+	return 0;
+}
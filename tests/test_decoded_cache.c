@@ -0,0 +1,324 @@
+/* tests caching structs decoded from files */
+#include <decoded_cache.h>
+#include <fs_parallel.h>
+
+#include <logger.h>
+#include "test_common.h"
+
+#include <unistd.h>
+
+#define DECODED_TEST_FILE	TEST_TMP_FILE("decoded")
+/*
+ * The test file holds an array of raw headers,
+ * each with a big-endian 4-byte magic number, 2-byte version
+ * and 2-byte count, and a little-endian 8-byte location,
+ * with no padding in between.
+ */
+#define MAGIC_START	0
+#define VERSION_START	4
+#define COUNT_START	6
+#define LOCATION_START	8
+#define HEADER_SIZE	16
+#define N_HEADERS	64
+/* the number of threads looking up headers at once */
+#define N_THREADS	4
+/* the number of lookups of each thread */
+#define N_LOOKUPS	20000
+
+/* the decoded header */
+struct test_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t count;
+	uint64_t location;
+};
+
+#define N_HEADER_MEMBERS	4
+static const struct member_layout header_layout[N_HEADER_MEMBERS] = {
+	MEMBER_LAYOUT(struct test_header, magic, MAGIC_START, BIG_END),
+	MEMBER_LAYOUT(struct test_header, version, VERSION_START, BIG_END),
+	MEMBER_LAYOUT(struct test_header, count, COUNT_START, BIG_END),
+	MEMBER_LAYOUT(struct test_header, location, LOCATION_START,
+		      LITTLE_END),
+};
+
+/* the plans of every test, for the whole header and its magic alone */
+static struct copy_plan header_plan;
+static struct copy_plan magic_plan;
+
+/*
+ * Write the test file, replacing any file there.
+ * magic:	the magic number of every header
+ * extra:	the number of bytes to add after the headers
+ * returns	1 on success; 0 otherwise
+ */
+static int write_test_file(uint32_t magic, size_t extra)
+{
+	uint8_t bytes[N_HEADERS * HEADER_SIZE + HEADER_SIZE] = { 0 };
+	const size_t size = N_HEADERS * HEADER_SIZE + extra;
+	size_t header_i, byte_i;
+
+	for (header_i = 0; header_i < N_HEADERS; header_i++) {
+		uint8_t *header = bytes + header_i * HEADER_SIZE;
+		uint64_t location = header_i * 0x1000;
+
+		for (byte_i = 0; byte_i < 4; byte_i++) {
+			header[MAGIC_START + byte_i] =
+				(uint8_t) (magic >> (24 - 8 * byte_i));
+		}
+		header[VERSION_START + 1] = 3;
+		header[COUNT_START + 1] = (uint8_t) header_i;
+		for (byte_i = 0; byte_i < 8; byte_i++) {
+			header[LOCATION_START + byte_i] =
+				(uint8_t) (location >> (8 * byte_i));
+		}
+	}
+
+	return write_test_file_bytes(DECODED_TEST_FILE, bytes, size);
+}
+
+/* Check a decoded header against the values written at its index. */
+static int
+check_header(const struct test_header *header, size_t header_i,
+	     uint32_t magic)
+{
+	return header->magic == magic && header->version == 3 &&
+	       header->count == header_i &&
+	       header->location == header_i * 0x1000;
+}
+
+/*
+ * Decode a header through a cache, and check it.
+ * returns	1 if the header is decoded and correct; 0 otherwise
+ */
+static int
+lookup_header(struct decoded_cache *cache, struct file_structor *file,
+	      size_t header_i, uint32_t magic)
+{
+	struct test_header header;
+
+	return decode_cached(cache, file, header_i * HEADER_SIZE,
+			     &header_plan, &header) == FS_NO_ERROR &&
+	       check_header(&header, header_i, magic);
+}
+
+/* A second lookup should be a hit, with the same struct. */
+static int test_hit()
+{
+	struct decoded_cache cache;
+	struct decoded_cache_stats stats;
+	struct file_structor file;
+	int ret;
+
+	if (!write_test_file(0xfeedf00d, 0) ||
+	    open_file_structor(&file, DECODED_TEST_FILE) ||
+	    init_decoded_cache(&cache, 1 << 20, 1000)) {
+		return 0;
+	}
+	ret = lookup_header(&cache, &file, 3, 0xfeedf00d) &&
+	      lookup_header(&cache, &file, 3, 0xfeedf00d);
+	get_decoded_cache_stats(&cache, &stats);
+	ret = ret && stats.n_hits == 1 && stats.n_misses == 1 &&
+	      stats.n_entries == 1 &&
+	      stats.memory >= sizeof(struct test_header);
+	teardown_decoded_cache(&cache);
+	close_file_structor(&file);
+
+	return ret;
+}
+
+/* Different locations and plans should be different entries. */
+static int test_keys()
+{
+	struct decoded_cache cache;
+	struct decoded_cache_stats stats;
+	struct file_structor file;
+	uint32_t magic = 0;
+	int ret;
+
+	if (open_file_structor(&file, DECODED_TEST_FILE) ||
+	    init_decoded_cache(&cache, 1 << 20, 1000)) {
+		return 0;
+	}
+	ret = lookup_header(&cache, &file, 0, 0xfeedf00d) &&
+	      lookup_header(&cache, &file, 1, 0xfeedf00d) &&
+	      decode_cached(&cache, &file, HEADER_SIZE, &magic_plan,
+			    &magic) == FS_NO_ERROR && magic == 0xfeedf00d &&
+	      decode_cached(&cache, &file, N_HEADERS * HEADER_SIZE,
+			    &magic_plan, &magic) == FSERR_OUT_OF_FILE;
+	get_decoded_cache_stats(&cache, &stats);
+	ret = ret && stats.n_hits == 0 && stats.n_entries == 3;
+	teardown_decoded_cache(&cache);
+	close_file_structor(&file);
+
+	return ret;
+}
+
+/*
+ * The cache should stay within its memory bound,
+ * keeping the struct that is hit between the others.
+ */
+static int test_memory_bound()
+{
+	struct decoded_cache cache;
+	struct decoded_cache_stats stats;
+	struct file_structor file;
+	size_t entry_memory, max_memory, header_i;
+	unsigned round_i;
+	int ret = 1;
+
+	if (open_file_structor(&file, DECODED_TEST_FILE) ||
+	    init_decoded_cache(&cache, 1 << 20, 1000)) {
+		return 0;
+	}
+	ret = lookup_header(&cache, &file, 0, 0xfeedf00d);
+	get_decoded_cache_stats(&cache, &stats);
+	entry_memory = stats.memory;
+	teardown_decoded_cache(&cache);
+
+	/* Room for about 3 headers in each shard */
+	max_memory = DECODED_CACHE_SHARDS * 3 * entry_memory;
+	if (init_decoded_cache(&cache, max_memory, 1000)) {
+		return 0;
+	}
+	for (round_i = 0; round_i < 3; round_i++) {
+		for (header_i = 1; ret && header_i < N_HEADERS; header_i++) {
+			ret = lookup_header(&cache, &file, 0, 0xfeedf00d) &&
+			      lookup_header(&cache, &file, header_i,
+					    0xfeedf00d);
+		}
+	}
+	get_decoded_cache_stats(&cache, &stats);
+	ret = ret && stats.memory <= max_memory && stats.n_evictions > 0 &&
+	      stats.n_hits >= 3 * (N_HEADERS - 1) - 1;
+	if (!ret) {
+		printlg(ERROR_LEVEL,
+			"%u bytes in %u entries, %u hits, %u evictions.\n",
+			(unsigned) stats.memory, (unsigned) stats.n_entries,
+			(unsigned) stats.n_hits, (unsigned) stats.n_evictions);
+	}
+	teardown_decoded_cache(&cache);
+	close_file_structor(&file);
+
+	return ret;
+}
+
+/* A struct should be decoded again once its file changes. */
+static int test_changed_file()
+{
+	struct decoded_cache cache;
+	struct decoded_cache_stats stats;
+	struct file_structor file;
+	int ret;
+
+	if (!write_test_file(0xfeedf00d, 0) ||
+	    open_file_structor(&file, DECODED_TEST_FILE) ||
+	    init_decoded_cache(&cache, 1 << 20, 0)) {
+		return 0;
+	}
+	/* The size changes too, in case the modification time does not. */
+	ret = lookup_header(&cache, &file, 5, 0xfeedf00d) &&
+	      write_test_file(0xcafef00d, 8) &&
+	      lookup_header(&cache, &file, 5, 0xcafef00d) &&
+	      lookup_header(&cache, &file, 5, 0xcafef00d);
+	get_decoded_cache_stats(&cache, &stats);
+	ret = ret && stats.n_stale == 1 && stats.n_hits == 1;
+
+	invalidate_decoded(&cache, &file);
+	get_decoded_cache_stats(&cache, &stats);
+	ret = ret && stats.n_entries == 0 && stats.memory == 0 &&
+	      lookup_header(&cache, &file, 5, 0xcafef00d);
+	get_decoded_cache_stats(&cache, &stats);
+	ret = ret && stats.n_misses == 3;
+	teardown_decoded_cache(&cache);
+	close_file_structor(&file);
+
+	return ret;
+}
+
+/* the state shared by the threads of "test_concurrent" */
+struct concurrent_work {
+	struct decoded_cache *cache;
+	struct file_structor *file;
+	/* the number of wrong headers */
+	size_t n_wrong;
+};
+
+/* Look up pseudo-random headers, counting the wrong ones. */
+static enum fs_status lookup_headers(void *arg, unsigned worker_i)
+{
+	struct concurrent_work *work = arg;
+	uint64_t state = worker_i * 0x9e3779b97f4a7c15ull + 1;
+	size_t lookup_i, n_wrong = 0;
+
+	for (lookup_i = 0; lookup_i < N_LOOKUPS; lookup_i++) {
+		state = state * 6364136223846793005ull + 1442695040888963407ull;
+		n_wrong += !lookup_header(work->cache, work->file,
+					  (state >> 33) % N_HEADERS,
+					  0xcafef00d);
+	}
+	__atomic_fetch_add(&work->n_wrong, n_wrong, __ATOMIC_RELAXED);
+
+	return FS_NO_ERROR;
+}
+
+/* Threads sharing a cache should all get the right structs. */
+static int test_concurrent()
+{
+	struct decoded_cache cache;
+	struct decoded_cache_stats stats;
+	struct file_structor file;
+	struct concurrent_work work;
+	int ret;
+
+	if (open_file_structor(&file, DECODED_TEST_FILE) ||
+	    init_decoded_cache(&cache, 1 << 20, 1)) {
+		return 0;
+	}
+	work.cache = &cache;
+	work.file = &file;
+	work.n_wrong = 0;
+	ret = run_parallel(N_THREADS, lookup_headers, &work) == FS_NO_ERROR &&
+	      work.n_wrong == 0;
+	get_decoded_cache_stats(&cache, &stats);
+	ret = ret && stats.n_hits + stats.n_misses == N_THREADS * N_LOOKUPS &&
+	      stats.n_entries == N_HEADERS && stats.n_hits > stats.n_misses;
+	teardown_decoded_cache(&cache);
+	close_file_structor(&file);
+
+	return ret;
+}
+
+#define N_DECODED_TESTS	5
+static int (*decoded_tests[N_DECODED_TESTS])() = {
+	test_hit, test_keys, test_memory_bound, test_changed_file,
+	test_concurrent
+};
+
+int main()
+{
+	size_t test_i;
+
+	if (compile_copy_plan(&header_plan, header_layout,
+			      N_HEADER_MEMBERS) ||
+	    compile_copy_plan(&magic_plan, header_layout, 1)) {
+		printlg(ERROR_LEVEL, "Could not compile the header plans.\n");
+		return 1;
+	}
+
+	for (test_i = 0; test_i < N_DECODED_TESTS; test_i++) {
+		printlg(INFO_LEVEL, "Testing decoded caches: %u...\n",
+			(unsigned) test_i);
+		if (decoded_tests[test_i]()) {
+			printlg(INFO_LEVEL, "Passed!\n");
+		} else {
+			printlg(ERROR_LEVEL, "Failed!\n");
+		}
+	}
+
+	free_copy_plan(&header_plan);
+	free_copy_plan(&magic_plan);
+	unlink(DECODED_TEST_FILE);
+
+	return 0;
+}
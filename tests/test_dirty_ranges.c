@@ -0,0 +1,291 @@
+/* tests updating records in place and flushing their dirty pages */
+#include <dirty_ranges.h>
+
+#include <logger.h>
+#include "test_common.h"
+
+#include <unistd.h>
+
+#define DIRTY_TEST_FILE	TEST_TMP_FILE("dirty")
+/* the number of pages in the test file */
+#define N_TEST_PAGES	64
+/*
+ * Each record of the test file holds a big-endian 3-byte signed counter,
+ * a little-endian 4-byte "float" and a big-endian 8-byte id,
+ * with no padding in between.
+ */
+#define COUNTER_START	0
+#define COUNTER_WIDTH	3
+#define SCORE_START	3
+#define ID_START	7
+#define RECORD_SIZE	15
+
+/* a decoded record */
+struct test_record {
+	int32_t counter;
+	double score;
+	uint64_t id;
+};
+
+/* the size of a page */
+static size_t page_size;
+
+/*
+ * Store a record into a tracked chunk, member by member.
+ * returns	FS_NO_ERROR on success; the first error otherwise
+ */
+static enum fs_status
+update_record(struct dirty_ranges *dirty, off_t start,
+	      const struct test_record *record)
+{
+	enum fs_status status;
+
+	status = update_int_section(dirty, start + COUNTER_START,
+				    COUNTER_WIDTH, record,
+				    offsetof(struct test_record, counter),
+				    sizeof(record->counter), BIG_END, 1);
+	if (status == FS_NO_ERROR) {
+		status = update_float_section(dirty, start + SCORE_START,
+					      sizeof(float), record,
+					      offsetof(struct test_record,
+						       score),
+					      sizeof(record->score),
+					      LITTLE_END);
+	}
+	if (status == FS_NO_ERROR) {
+		status = update_section_at(dirty, start + ID_START, record,
+					   offsetof(struct test_record, id),
+					   sizeof(record->id), BIG_END);
+	}
+
+	return status;
+}
+
+/* Decode a record from a chunk, and compare it with the expected one. */
+static int
+check_record(struct file_struct *chunk, off_t start,
+	     const struct test_record *expected)
+{
+	struct test_record record;
+	struct file_struct record_chunk;
+
+	return derive_file_struct(&record_chunk, chunk, RECORD_SIZE,
+				  start) == FS_NO_ERROR &&
+	       COPY_INT_MEMBER_FROM(&record, &record_chunk,
+				    struct test_record, counter,
+				    COUNTER_START, COUNTER_WIDTH, BIG_END,
+				    1) == FS_NO_ERROR &&
+	       COPY_FLOAT_MEMBER_FROM(&record, &record_chunk,
+				      struct test_record, score, SCORE_START,
+				      sizeof(float), LITTLE_END) ==
+	       FS_NO_ERROR &&
+	       COPY_MEMBER_FROM(&record, &record_chunk, struct test_record, id,
+				ID_START, BIG_END) == FS_NO_ERROR &&
+	       record.counter == expected->counter &&
+	       record.score == expected->score && record.id == expected->id;
+}
+
+/* Stores should encode values in the byte order and width of the file. */
+static int test_store()
+{
+	const struct test_record record = { -2, 1.5, 0x0102030405060708ull };
+	static const uint8_t expected[RECORD_SIZE] = {
+		0xff, 0xff, 0xfe, 0x00, 0x00, 0xc0, 0x3f,
+		1, 2, 3, 4, 5, 6, 7, 8
+	};
+	uint8_t bytes[RECORD_SIZE + 1] = { 0 };
+	struct file_structor file;
+	struct file_struct chunk;
+	uint16_t narrow = 0xabcd;
+	int ret;
+
+	open_memory_structor(&file, bytes, RECORD_SIZE);
+	ret = init_file_struct(&chunk, &file, RECORD_SIZE, 0) == FS_NO_ERROR &&
+	      STORE_INT_MEMBER_TO(&chunk, &record, struct test_record,
+				  counter, COUNTER_START, COUNTER_WIDTH,
+				  BIG_END, 1) == FS_NO_ERROR &&
+	      STORE_FLOAT_MEMBER_TO(&chunk, &record, struct test_record, score,
+				    SCORE_START, sizeof(float),
+				    LITTLE_END) == FS_NO_ERROR &&
+	      STORE_MEMBER_TO(&chunk, &record, struct test_record, id,
+			      ID_START, BIG_END) == FS_NO_ERROR &&
+	      memcmp(bytes, expected, RECORD_SIZE) == 0 &&
+	      check_record(&chunk, 0, &record);
+
+	/* Stores past the end should not touch the byte after the chunk. */
+	ret = ret && store_section_at(&chunk, RECORD_SIZE - 1, &narrow, 0,
+				      sizeof(narrow), BIG_END) ==
+		     FSERR_OUT_OF_STRUCT &&
+	      store_int_section(&chunk, RECORD_SIZE - 1, 2, &narrow, 0,
+				sizeof(narrow), BIG_END, 0) ==
+	      FSERR_OUT_OF_STRUCT && bytes[RECORD_SIZE] == 0;
+	teardown_file_struct(&chunk);
+	close_file_structor(&file);
+
+	return ret;
+}
+
+/* Updates through a writable mapping should reach the file. */
+static int test_writable_file()
+{
+	struct test_record record = { 0, 0, 0 };
+	struct file_structor file;
+	struct file_struct chunk;
+	struct dirty_ranges dirty;
+	off_t start;
+	int ret;
+
+	if (!write_test_file_bytes(DIRTY_TEST_FILE, NULL,
+				   N_TEST_PAGES * page_size) ||
+	    open_file_structor(&file, DIRTY_TEST_FILE)) {
+		return 0;
+	}
+	ret = !file.is_writable;
+	close_file_structor(&file);
+
+	if (open_writable_file_structor(&file, DIRTY_TEST_FILE) ||
+	    init_file_struct(&chunk, &file, file.size, 0) ||
+	    init_dirty_ranges(&dirty, &chunk, 0)) {
+		return 0;
+	}
+	ret = ret && file.is_writable;
+	for (start = 0; ret && start + RECORD_SIZE <= file.size;
+	     start += 7 * RECORD_SIZE) {
+		record.counter = -(int32_t) start;
+		record.score = start * 0.25;
+		record.id = start;
+		ret = update_record(&dirty, start, &record) == FS_NO_ERROR;
+	}
+	ret = ret && dirty.n_dirty == N_TEST_PAGES &&
+	      flush_dirty(&dirty, FLUSH_SYNC) == FS_NO_ERROR &&
+	      dirty.n_dirty == 0 && dirty.n_syncs == 1 &&
+	      dirty.n_synced_pages == N_TEST_PAGES;
+	teardown_dirty_ranges(&dirty);
+	teardown_file_struct(&chunk);
+	close_file_structor(&file);
+
+	/* The records should be read back from a fresh read-only mapping. */
+	if (!ret || open_file_structor(&file, DIRTY_TEST_FILE) ||
+	    init_file_struct(&chunk, &file, file.size, 0)) {
+		return 0;
+	}
+	for (start = 0; ret && start + RECORD_SIZE <= file.size;
+	     start += 7 * RECORD_SIZE) {
+		record.counter = -(int32_t) start;
+		record.score = start * 0.25;
+		record.id = start;
+		ret = check_record(&chunk, start, &record);
+	}
+	teardown_file_struct(&chunk);
+	close_file_structor(&file);
+
+	return ret;
+}
+
+/* Dirty runs a few clean pages apart should be flushed together. */
+static int test_coalesce()
+{
+	static const size_t dirty_pages[] = { 0, 1, 3, 20, 40, 41, 63 };
+	const size_t n_dirty_pages = sizeof(dirty_pages) /
+				     sizeof(dirty_pages[0]);
+	/* the gaps allowed, and the runs flushed with each */
+	static const size_t max_gaps[] = { 0, 1, 20 };
+	static const uint64_t n_syncs[] = { 5, 4, 2 };
+	struct file_structor file;
+	struct file_struct chunk, derived;
+	struct dirty_ranges dirty;
+	size_t gap_i, page_i;
+	int ret = 1;
+
+	if (open_writable_file_structor(&file, DIRTY_TEST_FILE) ||
+	    init_file_struct(&chunk, &file, file.size, 0)) {
+		return 0;
+	}
+	for (gap_i = 0; ret && gap_i < 3; gap_i++) {
+		ret = init_dirty_ranges(&dirty, &chunk, max_gaps[gap_i]) ==
+		      FS_NO_ERROR;
+		for (page_i = 0; ret && page_i < n_dirty_pages; page_i++) {
+			ret = mark_dirty(&dirty,
+					 dirty_pages[page_i] * page_size + 1,
+					 page_size - 1) == FS_NO_ERROR;
+		}
+		/* A second flush should have nothing left to flush. */
+		ret = ret && dirty.n_dirty == n_dirty_pages &&
+		      flush_dirty(&dirty, FLUSH_ASYNC) == FS_NO_ERROR &&
+		      dirty.n_syncs == n_syncs[gap_i] && dirty.n_dirty == 0 &&
+		      flush_dirty(&dirty, FLUSH_SYNC) == FS_NO_ERROR &&
+		      dirty.n_syncs == n_syncs[gap_i];
+		teardown_dirty_ranges(&dirty);
+	}
+
+	/* A derived chunk off a page boundary should mark the pages it spans */
+	ret = ret && derive_file_struct(&derived, &chunk, 2 * page_size,
+					page_size + 5) == FS_NO_ERROR &&
+	      init_dirty_ranges(&dirty, &derived, 0) == FS_NO_ERROR;
+	ret = ret && dirty.n_pages == 3 &&
+	      mark_dirty(&dirty, page_size - 6, 2) == FS_NO_ERROR &&
+	      dirty.n_dirty == 2 &&
+	      mark_dirty(&dirty, 2 * page_size - 1, 2) == FSERR_OUT_OF_STRUCT &&
+	      flush_dirty(&dirty, FLUSH_SYNC) == FS_NO_ERROR &&
+	      dirty.n_syncs == 1 && dirty.n_synced_pages == 2;
+	teardown_dirty_ranges(&dirty);
+	teardown_file_struct(&chunk);
+	close_file_structor(&file);
+
+	return ret;
+}
+
+/* Memory sources should be updated without any "msync" call. */
+static int test_memory()
+{
+	const struct test_record record = { 7, -0.5, 42 };
+	uint8_t *bytes = calloc(3 * page_size, 1);
+	struct file_structor file;
+	struct file_struct chunk;
+	struct dirty_ranges dirty;
+	int ret;
+
+	if (bytes == NULL) {
+		return 0;
+	}
+	open_memory_structor(&file, bytes, 3 * page_size);
+	ret = init_file_struct(&chunk, &file, file.size, 0) == FS_NO_ERROR &&
+	      init_dirty_ranges(&dirty, &chunk, 0) == FS_NO_ERROR &&
+	      update_record(&dirty, 2 * page_size, &record) == FS_NO_ERROR &&
+	      update_record(&dirty, 3 * page_size - 1, &record) ==
+	      FSERR_OUT_OF_STRUCT &&
+	      flush_dirty(&dirty, FLUSH_SYNC) == FS_NO_ERROR &&
+	      dirty.n_dirty == 0 && dirty.n_syncs == 0 &&
+	      check_record(&chunk, 2 * page_size, &record);
+	teardown_dirty_ranges(&dirty);
+	teardown_file_struct(&chunk);
+	close_file_structor(&file);
+	free(bytes);
+
+	return ret;
+}
+
+#define N_DIRTY_TESTS	4
+static int (*dirty_tests[N_DIRTY_TESTS])() = {
+	test_store, test_writable_file, test_coalesce, test_memory
+};
+
+int main()
+{
+	size_t test_i;
+
+	page_size = sysconf(_SC_PAGE_SIZE);
+	for (test_i = 0; test_i < N_DIRTY_TESTS; test_i++) {
+		printlg(INFO_LEVEL, "Testing dirty ranges: %u...\n",
+			(unsigned) test_i);
+		if (dirty_tests[test_i]()) {
+			printlg(INFO_LEVEL, "Passed!\n");
+		} else {
+			printlg(ERROR_LEVEL, "Failed!\n");
+		}
+	}
+
+	unlink(DIRTY_TEST_FILE);
+
+	return 0;
+}
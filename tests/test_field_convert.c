@@ -0,0 +1,361 @@
+/* tests copying numeric fields into members of other widths */
+#include <field_convert.h>
+#include <copy_plan.h>
+
+#include <logger.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Each test record has a big-endian signed 3-byte offset,
+ * a little-endian signed 6-byte balance, a big-endian "float" rate
+ * and a big-endian "double" weight, with no padding in between,
+ * so that most fields are unaligned.
+ */
+#define OFFSET_START	0
+#define OFFSET_WIDTH	3
+#define BALANCE_START	(OFFSET_START + OFFSET_WIDTH)
+#define BALANCE_WIDTH	6
+#define RATE_START	(BALANCE_START + BALANCE_WIDTH)
+#define WEIGHT_START	(RATE_START + sizeof(float))
+/* the size of each record */
+#define CONVERT_SIZE	(WEIGHT_START + sizeof(double))
+/* the number of records, which is not a multiple of any vector width */
+#define N_RECORDS	1003
+
+/* the values of the record at an index */
+#define OFFSET_OF(record_i)	((int64_t) (record_i) * 1000 - 500000)
+#define BALANCE_OF(record_i)	((int64_t) (record_i) * 123456789 - \
+				 100000000000LL)
+#define RATE_OF(record_i)	((float) (record_i) * 0.5f - 7.0f)
+#define WEIGHT_OF(record_i)	((double) (record_i) * 1.25 - 3.0)
+
+/* the aligned struct in memory, with every member widened */
+struct wide_record {
+	int64_t offset;
+	int64_t balance;
+	double rate;
+	float weight;
+};
+
+/* a struct with a member narrower than its raw field */
+struct narrow_record {
+	int16_t low_balance;
+};
+
+/*
+ * Store the low bytes of an integer in a byte order.
+ * dst:		the destination
+ * value:	the integer
+ * width:	the number of bytes to store
+ * endianness:	the byte order to store them in
+ */
+static void
+put_bytes(uint8_t *dst, uint64_t value, size_t width,
+	  enum endianness endianness)
+{
+	size_t byte_i;
+
+	for (byte_i = 0; byte_i < width; byte_i++) {
+		uint8_t byte = (uint8_t) (value >> (8 * byte_i));
+
+		if (endianness == LITTLE_END) {
+			dst[byte_i] = byte;
+		} else {
+			dst[width - 1 - byte_i] = byte;
+		}
+	}
+}
+
+/* Fill the raw test records. */
+static void fill_records(uint8_t *records)
+{
+	size_t record_i;
+
+	for (record_i = 0; record_i < N_RECORDS; record_i++) {
+		uint8_t *record = records + record_i * CONVERT_SIZE;
+		float rate = RATE_OF(record_i);
+		double weight = WEIGHT_OF(record_i);
+		uint32_t rate_bits;
+		uint64_t weight_bits;
+
+		memcpy(&rate_bits, &rate, sizeof(rate_bits));
+		memcpy(&weight_bits, &weight, sizeof(weight_bits));
+		put_bytes(record + OFFSET_START, OFFSET_OF(record_i),
+			  OFFSET_WIDTH, BIG_END);
+		put_bytes(record + BALANCE_START, BALANCE_OF(record_i),
+			  BALANCE_WIDTH, LITTLE_END);
+		put_bytes(record + RATE_START, rate_bits, sizeof(rate_bits),
+			  BIG_END);
+		put_bytes(record + WEIGHT_START, weight_bits,
+			  sizeof(weight_bits), BIG_END);
+	}
+}
+
+/*
+ * Check that a widened record has the values of the one at the index.
+ * record:	the copied record
+ * record_i:	the index of the record
+ * returns	1 if the values are correct; 0 otherwise
+ */
+static int check_record(const struct wide_record *record, size_t record_i)
+{
+	if (record->offset != OFFSET_OF(record_i) ||
+	    record->balance != BALANCE_OF(record_i) ||
+	    record->rate != RATE_OF(record_i) ||
+	    record->weight != (float) WEIGHT_OF(record_i)) {
+		printlg(ERROR_LEVEL,
+			"Record %u has offset %lld, balance %lld, "
+			"rate %g and weight %g.\n",
+			(unsigned) record_i, (long long) record->offset,
+			(long long) record->balance, record->rate,
+			(double) record->weight);
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Single members should be widened and narrowed from their raw fields. */
+static int test_member_macros(struct file_struct *input)
+{
+	const off_t record_start = 7 * CONVERT_SIZE;
+	struct wide_record record;
+	struct narrow_record narrow;
+	enum fs_status status;
+
+	if ((status = COPY_INT_MEMBER_FROM(&record, input, struct wide_record,
+					   offset,
+					   record_start + OFFSET_START,
+					   OFFSET_WIDTH, BIG_END, 1)) ||
+	    (status = COPY_INT_MEMBER_FROM(&record, input, struct wide_record,
+					   balance,
+					   record_start + BALANCE_START,
+					   BALANCE_WIDTH, LITTLE_END, 1)) ||
+	    (status = COPY_FLOAT_MEMBER_FROM(&record, input,
+					     struct wide_record, rate,
+					     record_start + RATE_START,
+					     sizeof(float), BIG_END)) ||
+	    (status = COPY_FLOAT_MEMBER_FROM(&record, input,
+					     struct wide_record, weight,
+					     record_start + WEIGHT_START,
+					     sizeof(double), BIG_END)) ||
+	    (status = COPY_INT_MEMBER_FROM(&narrow, input, struct narrow_record,
+					   low_balance,
+					   record_start + BALANCE_START,
+					   BALANCE_WIDTH, LITTLE_END, 1))) {
+		printlg(ERROR_LEVEL, "Unexpected copy error: %d.\n", status);
+		return 0;
+	}
+	if (narrow.low_balance != (int16_t) BALANCE_OF(7)) {
+		printlg(ERROR_LEVEL, "Expected low bytes %d, but got %d.\n",
+			(int) (int16_t) BALANCE_OF(7),
+			(int) narrow.low_balance);
+		return 0;
+	}
+
+	return check_record(&record, 7);
+}
+
+/* A copy plan with converting members should widen every record. */
+static int test_plan_conversions(struct file_struct *input)
+{
+	const struct member_layout wide_layout[4] = {
+		INT_MEMBER_LAYOUT(struct wide_record, offset, OFFSET_START,
+				  OFFSET_WIDTH, BIG_END, 1),
+		INT_MEMBER_LAYOUT(struct wide_record, balance, BALANCE_START,
+				  BALANCE_WIDTH, LITTLE_END, 1),
+		FLOAT_MEMBER_LAYOUT(struct wide_record, rate, RATE_START,
+				    sizeof(float), BIG_END),
+		FLOAT_MEMBER_LAYOUT(struct wide_record, weight, WEIGHT_START,
+				    sizeof(double), BIG_END),
+	};
+	struct wide_record *records;
+	struct copy_plan plan;
+	enum fs_status status;
+	size_t record_i;
+	int ret = 1;
+
+	if (compile_copy_plan(&plan, wide_layout, 4)) {
+		return 0;
+	}
+	records = malloc(sizeof(*records) * N_RECORDS);
+	status = apply_copy_plan_array(&plan, records, sizeof(*records),
+				       input, 0, CONVERT_SIZE, N_RECORDS);
+	free_copy_plan(&plan);
+
+	if (status) {
+		printlg(ERROR_LEVEL, "Unexpected copy error: %d.\n", status);
+		ret = 0;
+	}
+	for (record_i = 0; ret && record_i < N_RECORDS; record_i++) {
+		ret &= check_record(&records[record_i], record_i);
+	}
+	free(records);
+
+	return ret;
+}
+
+/*
+ * Check an extracted integer field against converting each record alone.
+ * input:	the chunk holding the records
+ * field:	the field to extract
+ * dst_width:	the number of bytes of each extracted integer
+ * returns	1 if every integer matches; 0 otherwise
+ */
+static int
+check_int_extraction(struct file_struct *input,
+		     const struct fs_int_field *field, size_t dst_width)
+{
+	uint8_t *extracted = malloc(N_RECORDS * dst_width);
+	uint8_t expected[sizeof(uint64_t)];
+	enum fs_status status;
+	size_t record_i;
+	int ret = 1;
+
+	if ((status = extract_int_field(input, CONVERT_SIZE, field, extracted,
+					dst_width))) {
+		printlg(ERROR_LEVEL, "Unexpected extraction error: %d.\n",
+			status);
+		ret = 0;
+	}
+	for (record_i = 0; ret && record_i < N_RECORDS; record_i++) {
+		convert_int(expected, dst_width,
+			    (uint8_t *) input->data +
+			    record_i * CONVERT_SIZE + field->offset,
+			    field->width, field->endianness,
+			    field->is_signed);
+		if (memcmp(expected, extracted + record_i * dst_width,
+			   dst_width)) {
+			printlg(ERROR_LEVEL,
+				"Field at %u was wrongly converted "
+				"to %u bytes in record %u.\n",
+				(unsigned) field->offset, (unsigned) dst_width,
+				(unsigned) record_i);
+			ret = 0;
+		}
+	}
+	free(extracted);
+
+	return ret;
+}
+
+/* Integer fields should be extracted in every width. */
+static int test_extract_ints(struct file_struct *input)
+{
+	const struct fs_int_field fields[] = {
+		{ OFFSET_START, OFFSET_WIDTH, BIG_END, 1 },
+		{ OFFSET_START, OFFSET_WIDTH, BIG_END, 0 },
+		{ BALANCE_START, BALANCE_WIDTH, LITTLE_END, 1 },
+		{ BALANCE_START, BALANCE_WIDTH, LITTLE_END, 0 },
+		{ RATE_START, sizeof(uint32_t), BIG_END, 0 },
+		{ WEIGHT_START, sizeof(uint64_t), BIG_END, 1 },
+	};
+	const size_t dst_widths[] = { 2, 4, 8 };
+	size_t field_i, width_i;
+	int ret = 1;
+
+	for (field_i = 0; field_i < sizeof(fields) / sizeof(*fields);
+	     field_i++) {
+		for (width_i = 0;
+		     width_i < sizeof(dst_widths) / sizeof(*dst_widths);
+		     width_i++) {
+			ret &= check_int_extraction(input, &fields[field_i],
+						    dst_widths[width_i]);
+		}
+	}
+
+	return ret;
+}
+
+/* Floating point fields should be extracted as both widths. */
+static int test_extract_floats(struct file_struct *input)
+{
+	double *doubles = malloc(sizeof(*doubles) * N_RECORDS);
+	float *floats = malloc(sizeof(*floats) * N_RECORDS);
+	size_t record_i;
+	int ret = 1;
+
+	if (extract_float_field(input, CONVERT_SIZE, RATE_START,
+				sizeof(float), BIG_END, doubles,
+				sizeof(*doubles)) ||
+	    extract_float_field(input, CONVERT_SIZE, WEIGHT_START,
+				sizeof(double), BIG_END, floats,
+				sizeof(*floats))) {
+		printlg(ERROR_LEVEL, "Unexpected extraction error.\n");
+		ret = 0;
+	}
+	for (record_i = 0; ret && record_i < N_RECORDS; record_i++) {
+		if (doubles[record_i] != RATE_OF(record_i) ||
+		    floats[record_i] != (float) WEIGHT_OF(record_i)) {
+			printlg(ERROR_LEVEL,
+				"Record %u has rate %g and weight %g.\n",
+				(unsigned) record_i, doubles[record_i],
+				(double) floats[record_i]);
+			ret = 0;
+		}
+	}
+	free(doubles);
+	free(floats);
+
+	return ret;
+}
+
+/* Fields outside of the record should be refused. */
+static int test_extract_out_of_record(struct file_struct *input)
+{
+	const struct fs_int_field field = {
+		WEIGHT_START + 1, sizeof(uint64_t), BIG_END, 0
+	};
+	uint64_t extracted[N_RECORDS];
+	enum fs_status status;
+
+	if ((status = extract_int_field(input, CONVERT_SIZE, &field,
+					extracted, sizeof(*extracted))) !=
+	    FSERR_OUT_OF_STRUCT) {
+		printlg(ERROR_LEVEL, "Expected error %d, but got %d.\n",
+			FSERR_OUT_OF_STRUCT, status);
+		return 0;
+	}
+
+	return 1;
+}
+
+#define N_FIELD_CONVERT_TESTS	5
+static int
+(*field_convert_tests[N_FIELD_CONVERT_TESTS])(struct file_struct *) = {
+	test_member_macros, test_plan_conversions, test_extract_ints,
+	test_extract_floats, test_extract_out_of_record
+};
+
+int main()
+{
+	uint8_t *raw = malloc(CONVERT_SIZE * N_RECORDS);
+	struct file_structor structor;
+	struct file_struct input;
+	size_t test_i;
+
+	fill_records(raw);
+	if (open_memory_structor(&structor, raw, CONVERT_SIZE * N_RECORDS) ||
+	    init_file_struct(&input, &structor, structor.size, 0)) {
+		printlg(ERROR_LEVEL, "Could not wrap the test records.\n");
+		return 1;
+	}
+
+	for (test_i = 0; test_i < N_FIELD_CONVERT_TESTS; test_i++) {
+		printlg(INFO_LEVEL, "Testing field conversions: %u...\n",
+			(unsigned) test_i);
+		if (field_convert_tests[test_i](&input)) {
+			printlg(INFO_LEVEL, "Passed!\n");
+		} else {
+			printlg(ERROR_LEVEL, "Failed!\n");
+		}
+	}
+
+	teardown_file_struct(&input);
+	close_file_structor(&structor);
+	free(raw);
+
+	return 0;
+}
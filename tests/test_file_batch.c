@@ -0,0 +1,208 @@
+/* tests initializing batches of struct chunks with shared mappings */
+#include <file_batch.h>
+
+#include <logger.h>
+#include "test_common.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#define BATCH_TEST_FILE	TEST_TMP_FILE("batch")
+/* the number of pages in the file, which holds the index of each word */
+#define N_PAGES		16
+
+/* the size of a page */
+static off_t page_size;
+
+/*
+ * Write the test file.
+ * returns	1 on success; 0 otherwise
+ */
+static int write_test_file()
+{
+	size_t n_words = N_PAGES * page_size / sizeof(uint32_t);
+	uint32_t *words = malloc(n_words * sizeof(*words));
+	uint32_t word_i;
+	int ret;
+
+	if (words == NULL) {
+		return 0;
+	}
+	for (word_i = 0; word_i < n_words; word_i++) {
+		words[word_i] = word_i;
+	}
+	ret = write_test_file_bytes(BATCH_TEST_FILE, words,
+				    n_words * sizeof(*words));
+	free(words);
+
+	return ret;
+}
+
+/*
+ * Check that each chunk covers its request, and holds the right words.
+ * requests:	the requests
+ * chunks:	the chunks from "init_file_batch"
+ * n_requests:	the number of requests
+ * returns	1 if every chunk matched; 0 otherwise
+ */
+static int
+check_chunks(const struct chunk_request *requests,
+	     struct file_struct *chunks, size_t n_requests)
+{
+	size_t request_i;
+
+	for (request_i = 0; request_i < n_requests; request_i++) {
+		const struct chunk_request *request = &requests[request_i];
+		struct file_struct *chunk = &chunks[request_i];
+		off_t word_start;
+
+		if (chunk->start_in_file != request->start_in_file ||
+		    chunk->size != (uint64_t) request->size) {
+			printlg(ERROR_LEVEL,
+				"Chunk %u covered %u-%u instead of %u-%u.\n",
+				(unsigned) request_i,
+				(unsigned) chunk->start_in_file,
+				(unsigned) (chunk->start_in_file +
+					    chunk->size),
+				(unsigned) request->start_in_file,
+				(unsigned) (request->start_in_file +
+					    request->size));
+			return 0;
+		}
+		for (word_start = 0; word_start + 4 <= request->size;
+		     word_start += 4) {
+			uint32_t word = 0;
+
+			copy_section_at(&word, 0, chunk, word_start,
+					sizeof(word), machine_endianness());
+			if (word != (request->start_in_file + word_start) / 4) {
+				printlg(ERROR_LEVEL,
+					"Chunk %u held word %u at %u.\n",
+					(unsigned) request_i, (unsigned) word,
+					(unsigned) word_start);
+				return 0;
+			}
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * Initialize unsorted, overlapping and empty requests,
+ * with and without merging gaps,
+ * and check the chunks and the number of mappings.
+ * structor:	the test file
+ * returns	1 if the batches matched; 0 otherwise
+ */
+static int test_coalescing(struct file_structor *structor)
+{
+	const struct chunk_request requests[] = {
+		{ page_size * 5 + 100, 16 },
+		{ 8, 8 },
+		/* This one straddles the first two pages. */
+		{ page_size - 96, 200 },
+		{ page_size + 300, 4 },
+		{ page_size * 5 + 104, 4 },
+		{ page_size * 9, 0 },
+		{ page_size * N_PAGES - 4, 4 },
+	};
+	const size_t n_requests = sizeof(requests) / sizeof(*requests);
+	const struct {
+		size_t max_gap;
+		size_t n_mappings;
+	} gaps[] = {
+		{ 0, 4 },
+		{ page_size * 3, 2 },
+		{ page_size * N_PAGES, 1 },
+	};
+	struct file_struct chunks[sizeof(requests) / sizeof(*requests)];
+	size_t gap_i;
+
+	for (gap_i = 0; gap_i < sizeof(gaps) / sizeof(*gaps); gap_i++) {
+		struct file_batch batch;
+		int matched;
+
+		if (init_file_batch(&batch, structor, requests, n_requests,
+				    chunks, gaps[gap_i].max_gap)) {
+			printlg(ERROR_LEVEL, "Could not map the batch.\n");
+			return 0;
+		}
+		matched = check_chunks(requests, chunks, n_requests);
+		if (batch.n_mappings != gaps[gap_i].n_mappings) {
+			printlg(ERROR_LEVEL,
+				"A gap of %u made %u mappings, not %u.\n",
+				(unsigned) gaps[gap_i].max_gap,
+				(unsigned) batch.n_mappings,
+				(unsigned) gaps[gap_i].n_mappings);
+			matched = 0;
+		}
+		teardown_file_batch(&batch);
+		if (!matched) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * A request beyond the file should fail the whole batch.
+ * structor:	the test file
+ * returns	1 if the error was caught; 0 otherwise
+ */
+static int test_out_of_file(struct file_structor *structor)
+{
+	const struct chunk_request requests[] = {
+		{ 0, 16 },
+		{ page_size * N_PAGES - 4, 8 },
+	};
+	struct file_struct chunks[2];
+	struct file_batch batch;
+	enum fs_status status;
+
+	if ((status = init_file_batch(&batch, structor, requests, 2, chunks,
+				      0)) != FSERR_OUT_OF_FILE ||
+	    batch.n_mappings != 0) {
+		printlg(ERROR_LEVEL, "Expected error %d, but got %d.\n",
+			FSERR_OUT_OF_FILE, status);
+		teardown_file_batch(&batch);
+		return 0;
+	}
+
+	return 1;
+}
+
+#define N_FILE_BATCH_TESTS	2
+static int (*file_batch_tests[N_FILE_BATCH_TESTS])(struct file_structor *) = {
+	test_coalescing, test_out_of_file
+};
+
+int main()
+{
+	struct file_structor structor;
+	size_t test_i;
+
+	page_size = sysconf(_SC_PAGE_SIZE);
+	if (!write_test_file() ||
+	    open_file_structor(&structor, BATCH_TEST_FILE)) {
+		printlg(ERROR_LEVEL, "Could not create %s.\n",
+			BATCH_TEST_FILE);
+		return 1;
+	}
+
+	for (test_i = 0; test_i < N_FILE_BATCH_TESTS; test_i++) {
+		printlg(INFO_LEVEL, "Testing batches of chunks: %u...\n",
+			(unsigned) test_i);
+		if (file_batch_tests[test_i](&structor)) {
+			printlg(INFO_LEVEL, "Passed!\n");
+		} else {
+			printlg(ERROR_LEVEL, "Failed!\n");
+		}
+	}
+
+	close_file_structor(&structor);
+	unlink(BATCH_TEST_FILE);
+
+	return 0;
+}
@@ -0,0 +1,185 @@
+/* tests following in-file offsets through a binary search tree */
+#include <file_chase.h>
+
+#include <logger.h>
+
+#include <stdlib.h>
+
+/*
+ * The test file holds a 4-byte tag,
+ * followed by a balanced binary search tree of "struct tree_node",
+ * whose big-endian child offsets are relative to the start of the file,
+ * with 0 meaning that there is no child.
+ */
+#define CHASE_TEST_FILE	"test_inputs/chase_test"
+/* the location of the root node */
+#define ROOT_START	4
+/* the number of keys in the tree, which are 1 up to this number */
+#define N_KEYS		7
+
+/* a node in the tree */
+struct tree_node {
+	uint32_t key;
+	uint32_t left;
+	uint32_t right;
+};
+
+/* the links to the left and right children */
+static const struct chase_link left_link = {
+	.field = {
+		.offset = offsetof(struct tree_node, left),
+		.width = sizeof(uint32_t),
+		.endianness = BIG_END,
+	},
+	.base = CHASE_FROM_ROOT,
+	.target_size = sizeof(struct tree_node),
+};
+static const struct chase_link right_link = {
+	.field = {
+		.offset = offsetof(struct tree_node, right),
+		.width = sizeof(uint32_t),
+		.endianness = BIG_END,
+	},
+	.base = CHASE_FROM_ROOT,
+	.target_size = sizeof(struct tree_node),
+};
+
+/* the state of a single lookup */
+struct lookup {
+	/* the key to look for */
+	uint32_t key;
+	/* the number of nodes visited */
+	unsigned n_visited;
+	/* Was the key found? */
+	int found;
+};
+
+static const struct chase_link *search_step(struct file_chase *chase)
+{
+	struct lookup *lookup = chase->arg;
+	struct tree_node node;
+	uint32_t child;
+
+	lookup->n_visited++;
+	COPY_MEMBER(&node, &chase->current, struct tree_node, key, BIG_END);
+	if (node.key == lookup->key) {
+		lookup->found = 1;
+		return NULL;
+	}
+
+	if (lookup->key < node.key) {
+		COPY_MEMBER(&node, &chase->current, struct tree_node, left,
+			    BIG_END);
+		child = node.left;
+	} else {
+		COPY_MEMBER(&node, &chase->current, struct tree_node, right,
+			    BIG_END);
+		child = node.right;
+	}
+	if (child == 0) {
+		return NULL;
+	}
+
+	return lookup->key < node.key ? &left_link : &right_link;
+}
+
+/*
+ * Look up every key, and one missing key, in interleaved traversals.
+ * root:	the whole test file
+ * returns	1 if every lookup ended as expected; 0 otherwise
+ */
+static int test_interleaved_lookups(struct file_struct *root)
+{
+	struct file_chase chases[N_KEYS + 1];
+	struct lookup lookups[N_KEYS + 1];
+	enum fs_status status;
+	size_t lookup_i;
+	int ret = 1;
+
+	for (lookup_i = 0; lookup_i <= N_KEYS; lookup_i++) {
+		lookups[lookup_i].key = lookup_i + 1;
+		lookups[lookup_i].n_visited = 0;
+		lookups[lookup_i].found = 0;
+		derive_file_struct(&chases[lookup_i].current, root,
+				   sizeof(struct tree_node), ROOT_START);
+		chases[lookup_i].arg = &lookups[lookup_i];
+	}
+
+	if ((status = run_file_chases(root, chases, N_KEYS + 1, search_step,
+				      CHASE_PREFETCH_PAGES))) {
+		printlg(ERROR_LEVEL, "Unexpected chase error: %d.\n", status);
+		return 0;
+	}
+
+	for (lookup_i = 0; lookup_i <= N_KEYS; lookup_i++) {
+		struct lookup *lookup = &lookups[lookup_i];
+		int expect_found = lookup->key <= N_KEYS;
+
+		if (lookup->found != expect_found || lookup->n_visited > 3) {
+			printlg(ERROR_LEVEL,
+				"Lookup of %u found %d after %u nodes.\n",
+				(unsigned) lookup->key, lookup->found,
+				lookup->n_visited);
+			ret = 0;
+		}
+	}
+
+	return ret;
+}
+
+/*
+ * Following a link to past the end of the file should fail.
+ * root:	the whole test file
+ * returns	1 if the error was caught; 0 otherwise
+ */
+static int test_link_out_of_root(struct file_struct *root)
+{
+	struct chase_link far_link = left_link;
+	struct file_struct node, target;
+	enum fs_status status;
+
+	far_link.base = CHASE_FROM_FIELD;
+	derive_file_struct(&node, root, sizeof(struct tree_node),
+			   root->size - sizeof(struct tree_node));
+	if ((status = follow_file_struct(&target, root, &node, &far_link)) !=
+	    FSERR_OUT_OF_STRUCT) {
+		printlg(ERROR_LEVEL, "Expected error %d, but got %d.\n",
+			FSERR_OUT_OF_STRUCT, status);
+		return 0;
+	}
+
+	return 1;
+}
+
+#define N_FILE_CHASE_TESTS	2
+static int (*file_chase_tests[N_FILE_CHASE_TESTS])(struct file_struct *) = {
+	test_interleaved_lookups, test_link_out_of_root
+};
+
+int main()
+{
+	struct file_structor structor;
+	struct file_struct root;
+	size_t test_i;
+
+	if (open_file_structor(&structor, CHASE_TEST_FILE) ||
+	    init_file_struct(&root, &structor, structor.size, 0)) {
+		printlg(ERROR_LEVEL, "Could not map %s.\n", CHASE_TEST_FILE);
+		return 1;
+	}
+
+	for (test_i = 0; test_i < N_FILE_CHASE_TESTS; test_i++) {
+		printlg(INFO_LEVEL, "Testing offset chasing: %u...\n",
+			(unsigned) test_i);
+		if (file_chase_tests[test_i](&root)) {
+			printlg(INFO_LEVEL, "Passed!\n");
+		} else {
+			printlg(ERROR_LEVEL, "Failed!\n");
+		}
+	}
+
+	teardown_file_struct(&root);
+	close_file_structor(&structor);
+
+	return 0;
+}
@@ -0,0 +1,262 @@
+/* tests following the records of a file while it is appended to */
+#include <file_follow.h>
+#include <io_backend.h>
+
+#include <logger.h>
+#include "test_common.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FOLLOW_TEST_FILE	TEST_TMP_FILE("follow")
+/* the size of each record, which holds its index in every byte */
+#define RECORD_SIZE		12
+
+/* the file being appended to, and the number of records written to it */
+static int write_fd = -1;
+static unsigned n_written;
+
+/*
+ * Append bytes of the records after the last one written,
+ * possibly ending in a partial record.
+ * n_bytes:	the number of bytes to append
+ * returns	1 on success; 0 otherwise
+ */
+static int append_bytes(size_t n_bytes)
+{
+	uint8_t buffer[RECORD_SIZE * 8];
+	off_t end = lseek(write_fd, 0, SEEK_END);
+	size_t byte_i;
+
+	for (byte_i = 0; byte_i < n_bytes; byte_i++) {
+		buffer[byte_i] = (end + byte_i) / RECORD_SIZE;
+	}
+	n_written = (end + n_bytes) / RECORD_SIZE;
+
+	return write(write_fd, buffer, n_bytes) == (ssize_t) n_bytes;
+}
+
+/*
+ * Check that a batch holds the expected records.
+ * batch:	the batch from "follow_records"
+ * first:	the index of the first expected record
+ * n_records:	the number of records in the batch
+ * returns	1 if every byte matched; 0 otherwise
+ */
+static int check_batch(const struct file_struct *batch, unsigned first,
+		       size_t n_records)
+{
+	const uint8_t *data = batch->data;
+	size_t byte_i;
+
+	if (batch->size != n_records * RECORD_SIZE) {
+		printlg(ERROR_LEVEL, "The batch had %u bytes, not %u.\n",
+			(unsigned) batch->size,
+			(unsigned) (n_records * RECORD_SIZE));
+		return 0;
+	}
+	for (byte_i = 0; byte_i < batch->size; byte_i++) {
+		if (data[byte_i] != first + byte_i / RECORD_SIZE) {
+			printlg(ERROR_LEVEL, "Byte %u of record %u was %u.\n",
+				(unsigned) (byte_i % RECORD_SIZE),
+				(unsigned) (first + byte_i / RECORD_SIZE),
+				(unsigned) data[byte_i]);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * Poll for records as complete and partial records are appended.
+ * structor:	the followed file, which is empty
+ * returns	1 if every batch held the new complete records; 0 otherwise
+ */
+static int test_poll_appends(struct file_structor *structor)
+{
+	struct file_follower follower;
+	struct file_struct batch;
+	size_t n_new;
+	int ret = 0;
+
+	if (init_file_follower(&follower, structor, NULL, 0, RECORD_SIZE)) {
+		return 0;
+	}
+
+	if (follow_records(&follower, 0, &batch, &n_new) || n_new != 0 ||
+	    !append_bytes(RECORD_SIZE * 3 + 5) ||
+	    follow_records(&follower, 0, &batch, &n_new) || n_new != 3 ||
+	    !check_batch(&batch, 0, 3) ||
+	    follow_records(&follower, 20, &batch, &n_new) || n_new != 0 ||
+	    !append_bytes(RECORD_SIZE * 2 - 5) ||
+	    follow_records(&follower, 0, &batch, &n_new) || n_new != 2 ||
+	    !check_batch(&batch, 3, 2)) {
+		printlg(ERROR_LEVEL, "Following by polling went wrong.\n");
+	} else {
+		ret = 1;
+	}
+
+	teardown_file_follower(&follower);
+
+	return ret;
+}
+
+/* Append two records after a short delay, from another thread. */
+static void *append_later(void *arg)
+{
+	struct timespec delay = { 0, 50 * 1000000 };
+
+	(void) arg;
+
+	nanosleep(&delay, NULL);
+	append_bytes(RECORD_SIZE * 2);
+
+	return NULL;
+}
+
+/*
+ * Block with inotify until another thread appends records.
+ * structor:	the followed file, which already has some records
+ * returns	1 if the follower woke up with the new records; 0 otherwise
+ */
+static int test_inotify_wakeup(struct file_structor *structor)
+{
+	struct file_follower follower;
+	struct file_struct batch;
+	unsigned n_before = n_written;
+	pthread_t writer;
+	size_t n_new;
+	int ret = 0;
+
+	if (init_file_follower(&follower, structor, FOLLOW_TEST_FILE, 0,
+			       RECORD_SIZE)) {
+		return 0;
+	}
+
+	if (follow_records(&follower, 0, &batch, &n_new) ||
+	    n_new != n_before ||
+	    pthread_create(&writer, NULL, append_later, NULL)) {
+		printlg(ERROR_LEVEL, "Could not start following.\n");
+		teardown_file_follower(&follower);
+		return 0;
+	}
+
+	if (follow_records(&follower, FOLLOW_FOREVER, &batch, &n_new) ||
+	    n_new == 0 || !check_batch(&batch, n_before, n_new)) {
+		printlg(ERROR_LEVEL, "Following with inotify went wrong.\n");
+	} else {
+		ret = 1;
+	}
+
+	pthread_join(writer, NULL);
+	teardown_file_follower(&follower);
+
+	return ret;
+}
+
+/*
+ * A small file loaded into memory by the automatic backend
+ * should be loaded again as records are appended.
+ * structor:	the followed file
+ * returns	1 if the follower found the new records; 0 otherwise
+ */
+static int test_loaded_appends(struct file_structor *structor)
+{
+	struct file_follower follower;
+	struct file_struct batch;
+	unsigned n_before;
+	size_t n_new;
+	int ret = 0;
+
+	if (refresh_file_structor(structor) ||
+	    set_io_backend(structor, IO_BACKEND_AUTO) ||
+	    structor->memory == NULL ||
+	    init_file_follower(&follower, structor, NULL, 0, RECORD_SIZE)) {
+		set_io_backend(structor, IO_BACKEND_MMAP);
+		return 0;
+	}
+
+	n_before = n_written;
+	if (follow_records(&follower, 0, &batch, &n_new) ||
+	    n_new != n_before || !append_bytes(RECORD_SIZE * 2) ||
+	    follow_records(&follower, 0, &batch, &n_new) || n_new != 2 ||
+	    !check_batch(&batch, n_before, 2) || structor->memory == NULL) {
+		printlg(ERROR_LEVEL, "Following a loaded file went wrong.\n");
+	} else {
+		ret = 1;
+	}
+
+	teardown_file_follower(&follower);
+	set_io_backend(structor, IO_BACKEND_MMAP);
+
+	return ret;
+}
+
+/*
+ * A mapping should be extendable, but a derived chunk should not.
+ * structor:	the followed file
+ * returns	1 if both behaved as expected; 0 otherwise
+ */
+static int test_extend_file_struct(struct file_structor *structor)
+{
+	struct file_struct mapped, derived;
+	int ret = 1;
+
+	refresh_file_structor(structor);
+	if (init_file_struct(&mapped, structor, RECORD_SIZE, RECORD_SIZE)) {
+		return 0;
+	}
+	derive_file_struct(&derived, &mapped, RECORD_SIZE, 0);
+
+	if (extend_file_struct(&mapped, RECORD_SIZE * 3) ||
+	    !check_batch(&mapped, 1, 3) ||
+	    extend_file_struct(&derived, RECORD_SIZE * 2) !=
+	    FSERR_OUT_OF_STRUCT ||
+	    extend_file_struct(&mapped, structor->size) != FSERR_OUT_OF_FILE) {
+		printlg(ERROR_LEVEL, "Extending a chunk went wrong.\n");
+		ret = 0;
+	}
+
+	teardown_file_struct(&mapped);
+
+	return ret;
+}
+
+#define N_FILE_FOLLOW_TESTS	4
+static int (*file_follow_tests[N_FILE_FOLLOW_TESTS])(struct file_structor *) =
+{
+	test_poll_appends, test_inotify_wakeup, test_loaded_appends,
+	test_extend_file_struct
+};
+
+int main()
+{
+	struct file_structor structor;
+	size_t test_i;
+
+	write_fd = open(FOLLOW_TEST_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (write_fd < 0 || open_file_structor(&structor, FOLLOW_TEST_FILE)) {
+		printlg(ERROR_LEVEL, "Could not create %s.\n",
+			FOLLOW_TEST_FILE);
+		return 1;
+	}
+
+	for (test_i = 0; test_i < N_FILE_FOLLOW_TESTS; test_i++) {
+		printlg(INFO_LEVEL, "Testing following files: %u...\n",
+			(unsigned) test_i);
+		if (file_follow_tests[test_i](&structor)) {
+			printlg(INFO_LEVEL, "Passed!\n");
+		} else {
+			printlg(ERROR_LEVEL, "Failed!\n");
+		}
+	}
+
+	close_file_structor(&structor);
+	close(write_fd);
+	unlink(FOLLOW_TEST_FILE);
+
+	return 0;
+}
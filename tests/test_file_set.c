@@ -0,0 +1,253 @@
+/* tests opening and scanning a set of shard files as one logical file */
+#include <file_set.h>
+
+#include <logger.h>
+
+#include <stdlib.h>
+#include <errno.h>
+
+/* the shard that holds an array of "struct array_element" */
+#define ELEMENTS_SHARD		"test_inputs/array_elements_test"
+/* a shard whose size is not a multiple of "struct array_element" */
+#define DEFAULT_SHARD		"test_inputs/default_test"
+/* a shard that does not exist */
+#define MISSING_SHARD		"test_inputs/nonexistent_test_file_name"
+/* the pattern matching "array_elements_test" and "array_test" */
+#define ARRAY_SHARD_PATTERN	"test_inputs/array_*"
+
+/* the number of records in "array_elements_test" */
+#define N_SHARD_ELEMENTS	4
+/* the number of times "array_elements_test" is repeated in the set */
+#define N_REPEATS		3
+/* the value of the constant element in each record */
+#define CONSTANT_NUMBER		0xdeadbeef
+
+/* the record type in "array_elements_test" */
+struct array_element {
+	/* stays the same for each array element */
+	uint32_t constant;
+	/* the index of the element in its shard */
+	uint32_t varying;
+};
+
+/* the set of the same elements shard repeated several times */
+static const char *repeated_shards[N_REPEATS] = {
+	ELEMENTS_SHARD, ELEMENTS_SHARD, ELEMENTS_SHARD
+};
+
+/* Opening a set with a missing shard should fail without leaking files. */
+static int test_missing_shard()
+{
+	const char *paths[] = {ELEMENTS_SHARD, MISSING_SHARD};
+	struct file_set set;
+	enum fs_status status;
+
+	if ((status = open_file_set(&set, paths, 2, 0)) != FSERR_ERRNO) {
+		printlg(ERROR_LEVEL, "Expected error %d, but got %d.\n",
+			FSERR_ERRNO, status);
+		if (status == FS_NO_ERROR) {
+			close_file_set(&set);
+		}
+		return 0;
+	}
+	if (errno != ENOENT) {
+		printlg(ERROR_LEVEL, "Expected errno %d, but got %d.\n",
+			ENOENT, errno);
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Records in later shards should be found by their logical index. */
+static int test_logical_record()
+{
+	struct file_set set;
+	struct file_struct record;
+	struct array_element element = {0, 0};
+	enum fs_status status;
+	int ret = 1;
+
+	if ((status = open_file_set(&set, repeated_shards, N_REPEATS, 0))) {
+		printlg(ERROR_LEVEL, "Could not open set: %d.\n", status);
+		return 0;
+	}
+
+	if ((status = INIT_FILE_SET_RECORD(&record, &set,
+					   struct array_element,
+					   N_SHARD_ELEMENTS + 2))) {
+		printlg(ERROR_LEVEL, "Could not map record: %d.\n", status);
+		ret = 0;
+	} else {
+		if (COPY_MEMBER(&element, &record, struct array_element,
+				varying, LITTLE_END) ||
+		    element.varying != 2) {
+			printlg(ERROR_LEVEL, "Expected element 2, but got %u.\n",
+				(unsigned) element.varying);
+			ret = 0;
+		}
+		teardown_file_struct(&record);
+	}
+
+	if ((status = INIT_FILE_SET_RECORD(&record, &set,
+					   struct array_element,
+					   N_SHARD_ELEMENTS * N_REPEATS)) !=
+	    FSERR_OUT_OF_FILE) {
+		printlg(ERROR_LEVEL, "Expected error %d past the set, "
+				     "but got %d.\n", FSERR_OUT_OF_FILE,
+			status);
+		ret = 0;
+	}
+
+	close_file_set(&set);
+
+	return ret;
+}
+
+/* A chunk crossing from one shard into the next should be rejected. */
+static int test_spanning_chunk()
+{
+	const char *paths[] = {ELEMENTS_SHARD, DEFAULT_SHARD};
+	struct file_set set;
+	struct file_struct chunk;
+	enum fs_status status;
+	int ret = 1;
+
+	if ((status = open_file_set(&set, paths, 2, 0))) {
+		printlg(ERROR_LEVEL, "Could not open set: %d.\n", status);
+		return 0;
+	}
+	if ((status = init_file_set_struct(&chunk, &set,
+					   sizeof(struct array_element),
+					   set.starts[1] - 4)) !=
+	    FSERR_SPANS_FILES) {
+		printlg(ERROR_LEVEL, "Expected error %d, but got %d.\n",
+			FSERR_SPANS_FILES, status);
+		if (status == FS_NO_ERROR) {
+			teardown_file_struct(&chunk);
+		}
+		ret = 0;
+	}
+	close_file_set(&set);
+
+	return ret;
+}
+
+/* the totals collected by "count_element" */
+struct scan_totals {
+	/* the number of records visited */
+	unsigned n_records;
+	/* the sum of the "varying" members */
+	unsigned varying_sum;
+	/* the number of records with the wrong constant */
+	unsigned n_bad_constants;
+};
+
+static enum fs_status
+count_element(struct file_struct *record, off_t logical_start, void *arg)
+{
+	struct scan_totals *totals = arg;
+	struct array_element element;
+	enum fs_status status;
+
+	(void) logical_start;
+
+	if ((status = COPY_MEMBER(&element, record, struct array_element,
+				  constant, LITTLE_END)) ||
+	    (status = COPY_MEMBER(&element, record, struct array_element,
+				  varying, LITTLE_END))) {
+		return status;
+	}
+
+	__atomic_add_fetch(&totals->n_records, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&totals->varying_sum, element.varying,
+			   __ATOMIC_RELAXED);
+	if (element.constant != CONSTANT_NUMBER) {
+		__atomic_add_fetch(&totals->n_bad_constants, 1,
+				   __ATOMIC_RELAXED);
+	}
+
+	return FS_NO_ERROR;
+}
+
+/* A parallel scan should visit every record of every shard once. */
+static int test_parallel_scan()
+{
+	struct file_set set;
+	struct scan_totals totals = {0, 0, 0};
+	unsigned expected_sum = N_REPEATS * (0 + 1 + 2 + 3);
+	enum fs_status status;
+
+	if ((status = open_file_set(&set, repeated_shards, N_REPEATS, 0))) {
+		printlg(ERROR_LEVEL, "Could not open set: %d.\n", status);
+		return 0;
+	}
+	status = scan_file_set(&set, sizeof(struct array_element), 2,
+			       count_element, &totals);
+	close_file_set(&set);
+
+	if (status) {
+		printlg(ERROR_LEVEL, "Unexpected scan error: %d.\n", status);
+		return 0;
+	}
+	if (totals.n_records != N_SHARD_ELEMENTS * N_REPEATS ||
+	    totals.varying_sum != expected_sum || totals.n_bad_constants) {
+		printlg(ERROR_LEVEL,
+			"Expected %u records summing to %u, but got %u "
+			"summing to %u, with %u bad constants.\n",
+			N_SHARD_ELEMENTS * N_REPEATS, expected_sum,
+			totals.n_records, totals.varying_sum,
+			totals.n_bad_constants);
+		return 0;
+	}
+
+	return 1;
+}
+
+/* A glob pattern should open the matching shards in sorted order. */
+static int test_glob()
+{
+	struct file_set set;
+	enum fs_status status;
+	int ret = 1;
+
+	if ((status = open_file_set_glob(&set, ARRAY_SHARD_PATTERN, 0))) {
+		printlg(ERROR_LEVEL, "Could not open set: %d.\n", status);
+		return 0;
+	}
+	if (set.n_files != 2 ||
+	    set.starts[1] != N_SHARD_ELEMENTS * sizeof(struct array_element)) {
+		printlg(ERROR_LEVEL, "Expected 2 shards with the first "
+				     "ending at %u, but got %u shards.\n",
+			(unsigned) (N_SHARD_ELEMENTS *
+				    sizeof(struct array_element)),
+			(unsigned) set.n_files);
+		ret = 0;
+	}
+	close_file_set(&set);
+
+	return ret;
+}
+
+#define N_FILE_SET_TESTS	5
+static int (*file_set_tests[N_FILE_SET_TESTS])() = {
+	test_missing_shard, test_logical_record, test_spanning_chunk,
+	test_parallel_scan, test_glob
+};
+
+int main()
+{
+	size_t test_i;
+
+	for (test_i = 0; test_i < N_FILE_SET_TESTS; test_i++) {
+		printlg(INFO_LEVEL, "Testing file sets: %u...\n",
+			(unsigned) test_i);
+		if (file_set_tests[test_i]()) {
+			printlg(INFO_LEVEL, "Passed!\n");
+		} else {
+			printlg(ERROR_LEVEL, "Failed!\n");
+		}
+	}
+
+	return 0;
+}
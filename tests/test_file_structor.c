@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 
 /* the directory containing the test input files */
 #define TEST_FILE_DIR		"test_inputs/"
@@ -157,7 +158,48 @@ static int test_file_struct(struct file_struct_tv *tv)
 }
 
 /*
- * Run all the tests in "file_struct_tvs".
+ * Run a test on the bytes of its file, read into memory,
+ * through a memory source instead of a mapping.
+ * tv:		the vector containing testing parameters and results,
+ *		which must not expect to fail while opening
+ * returns	1 if the test passed; 0 otherwise
+ */
+static int test_memory_struct(struct file_struct_tv *tv)
+{
+	size_t name_len = strlen(tv->test_name);
+	char path[DIR_LEN + name_len + 1];
+	struct file_structor file, memory;
+	uint8_t *bytes;
+	int ret;
+
+	strncpy(path, TEST_FILE_DIR, DIR_LEN + 1);
+	strncat(path, tv->test_name, name_len + 1);
+
+	if (open_file_structor(&file, path)) {
+		printlg(ERROR_LEVEL, "Could not open file at %s.\n", path);
+		return 0;
+	}
+	bytes = malloc(file.size + 1);
+	if (bytes == NULL ||
+	    pread(file.fd, bytes, file.size, 0) != file.size) {
+		printlg(ERROR_LEVEL, "Could not read file at %s.\n", path);
+		free(bytes);
+		close_file_structor(&file);
+		return 0;
+	}
+
+	open_memory_structor(&memory, bytes, file.size);
+	ret = _test_file_struct(tv, &memory);
+	close_file_structor(&memory);
+	close_file_structor(&file);
+	free(bytes);
+
+	return ret;
+}
+
+/*
+ * Run all the tests in "file_struct_tvs",
+ * and run them again from memory if they open their file.
  */
 static void test_file_structs()
 {
@@ -172,6 +214,19 @@ static void test_file_structs()
 			printlg(ERROR_LEVEL, "Failed!\n");
 		}
 	}
+
+	for (tv_i = 0; tv_i < N_FILE_STRUCT_TVS; tv_i++) {
+		if (file_struct_tvs[tv_i]->fail_stage <= FSFAIL_OPEN) {
+			continue;
+		}
+		printlg(INFO_LEVEL, "Testing memory struct copying: %u...\n",
+			(unsigned) tv_i);
+		if (test_memory_struct(file_struct_tvs[tv_i])) {
+			printlg(INFO_LEVEL, "Passed!\n");
+		} else {
+			printlg(ERROR_LEVEL, "Failed!\n");
+		}
+	}
 }
 
 int main()
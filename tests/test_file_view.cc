@@ -0,0 +1,182 @@
+/* tests the typed C++ views over struct chunks */
+#include <file_structor.hpp>
+
+#include <logger.h>
+
+#include <utility>
+
+/* the files used by the C tests */
+#define DEFAULT_TEST_FILE		"test_inputs/default_test"
+#define ARRAY_TEST_FILE			"test_inputs/array_test"
+#define ARRAY_ELEMENTS_TEST_FILE	"test_inputs/array_elements_test"
+
+/* the location of "struct test_struct" in "default_test" */
+#define TEST_STRUCT_START	0x10
+/* the size of "struct test_struct" in "default_test", without padding */
+#define TEST_STRUCT_SIZE	0x1a
+/* the number of characters in the string */
+#define N_CHARS			0x10
+/* the number of shorts in each array of "array_test" */
+#define N_SHORTS		8
+/* the number of records in "array_elements_test" */
+#define N_ARRAY_ELEMENTS	4
+/* the value of the constant element in each record */
+#define CONSTANT_NUMBER		0xdeadbeef
+
+/* the struct inside "default_test" */
+struct test_struct {
+	uint64_t first_int;
+	uint16_t second_int;
+	char string[N_CHARS];
+};
+
+using test_struct_layout = fs::record_layout<TEST_STRUCT_SIZE,
+	fs::member<&test_struct::first_int, 0, BIG_END>,
+	fs::member<&test_struct::second_int, 8, LITTLE_END>,
+	fs::member<&test_struct::string, 10>>;
+
+/* the struct inside "array_test" */
+struct array_struct {
+	uint16_t little_array[N_SHORTS];
+	uint16_t big_array[N_SHORTS];
+};
+
+using array_struct_layout = fs::record_layout<sizeof(array_struct),
+	fs::member<&array_struct::little_array, 0, LITTLE_END>,
+	fs::member<&array_struct::big_array, sizeof(uint16_t) * N_SHORTS,
+		   BIG_END>>;
+
+/* the records inside "array_elements_test" */
+struct array_element {
+	uint32_t constant;
+	uint32_t varying;
+};
+
+template <>
+struct fs::layout_of<array_element> {
+	using type = fs::record_layout<sizeof(array_element),
+		fs::member<&array_element::constant, 0, LITTLE_END>,
+		fs::member<&array_element::varying, 4, LITTLE_END>>;
+};
+
+/* Members of different byte orders should be decoded together. */
+static int test_mixed_orders()
+{
+	struct file_structor structor;
+	fs::file_view<test_struct, test_struct_layout> view;
+	test_struct decoded;
+	int ret = 1;
+
+	if (open_file_structor(&structor, DEFAULT_TEST_FILE) ||
+	    view.init(&structor, TEST_STRUCT_START)) {
+		printlg(ERROR_LEVEL, "Could not map test struct.\n");
+		return 0;
+	}
+
+	decoded = view[0];
+	if (decoded.first_int != 0x0001020304050607 ||
+	    decoded.second_int != 0x0123 ||
+	    std::memcmp(decoded.string, "0123456789abcdef", N_CHARS)) {
+		printlg(ERROR_LEVEL, "Decoded 0x%llx and 0x%x.\n",
+			(unsigned long long) decoded.first_int,
+			(unsigned) decoded.second_int);
+		ret = 0;
+	}
+	if (view.decode_checked(1, decoded) != FSERR_OUT_OF_STRUCT) {
+		printlg(ERROR_LEVEL, "Did not catch out of range record.\n");
+		ret = 0;
+	}
+
+	view.reset();
+	close_file_structor(&structor);
+
+	return ret;
+}
+
+/* Array members should have each element converted. */
+static int test_array_members()
+{
+	const uint16_t shorts[N_SHORTS] = {0x0001, 0x0203, 0x0405, 0x0607,
+					   0x0809, 0x0a0b, 0x0c0d, 0x0e0f};
+	struct file_structor structor;
+	fs::file_view<array_struct, array_struct_layout> view;
+	array_struct decoded;
+	int ret = 1;
+
+	if (open_file_structor(&structor, ARRAY_TEST_FILE) ||
+	    view.init(&structor, 0)) {
+		printlg(ERROR_LEVEL, "Could not map array struct.\n");
+		return 0;
+	}
+
+	view.decode(0, decoded);
+	if (std::memcmp(decoded.little_array, shorts, sizeof(shorts)) ||
+	    std::memcmp(decoded.big_array, shorts, sizeof(shorts))) {
+		printlg(ERROR_LEVEL, "Arrays were not decoded correctly.\n");
+		ret = 0;
+	}
+
+	view.reset();
+	close_file_structor(&structor);
+
+	return ret;
+}
+
+/* Iterating over a moved view should decode every record in order. */
+static int test_record_iteration()
+{
+	struct file_structor structor;
+	fs::file_view<array_element> mapped, moved;
+	uint32_t expected_varying = 0;
+	int ret = 1;
+
+	if (open_file_structor(&structor, ARRAY_ELEMENTS_TEST_FILE) ||
+	    mapped.init(&structor, 0, N_ARRAY_ELEMENTS)) {
+		printlg(ERROR_LEVEL, "Could not map array elements.\n");
+		return 0;
+	}
+
+	moved = std::move(mapped);
+	if (!mapped.empty() || moved.size() != N_ARRAY_ELEMENTS) {
+		printlg(ERROR_LEVEL, "Moving did not transfer the records.\n");
+		ret = 0;
+	}
+	for (array_element element : moved) {
+		if (element.constant != CONSTANT_NUMBER ||
+		    element.varying != expected_varying) {
+			printlg(ERROR_LEVEL, "Element %u has 0x%x and %u.\n",
+				(unsigned) expected_varying,
+				(unsigned) element.constant,
+				(unsigned) element.varying);
+			ret = 0;
+		}
+		expected_varying++;
+	}
+
+	moved.reset();
+	close_file_structor(&structor);
+
+	return ret;
+}
+
+#define N_FILE_VIEW_TESTS	3
+static int (*file_view_tests[N_FILE_VIEW_TESTS])() = {
+	test_mixed_orders, test_array_members, test_record_iteration
+};
+
+int main()
+{
+	size_t test_i;
+
+	for (test_i = 0; test_i < N_FILE_VIEW_TESTS; test_i++) {
+		printlg(INFO_LEVEL, "Testing typed views: %u...\n",
+			(unsigned) test_i);
+		if (file_view_tests[test_i]()) {
+			printlg(INFO_LEVEL, "Passed!\n");
+		} else {
+			printlg(ERROR_LEVEL, "Failed!\n");
+		}
+	}
+
+	return 0;
+}
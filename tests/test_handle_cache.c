@@ -0,0 +1,276 @@
+/* tests sharing opened files through a handle cache */
+#include <handle_cache.h>
+#include <fs_parallel.h>
+
+#include <logger.h>
+#include "test_common.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+/* the pattern of the paths of the test files */
+#define CACHE_TEST_PATTERN	TEST_TMP_FILE("handle_cache_%u")
+#define N_TEST_FILES		4
+/* the size of each test file, which is mapped whole */
+#define SMALL_SIZE		64
+/* the size of the files mapped whole in the tests */
+#define MAP_LIMIT		4096
+/* the number of acquisitions made by each thread */
+#define N_THREAD_ACQUIRES	2000
+
+/* the path of a test file */
+static void test_path(char *path, unsigned file_i)
+{
+	sprintf(path, CACHE_TEST_PATTERN, file_i);
+}
+
+/*
+ * Write a test file, with every byte holding a generation number.
+ * file_i:	the index of the file
+ * size:	the number of bytes
+ * generation:	the value of every byte
+ * returns	1 on success; 0 otherwise
+ */
+static int write_test_file(unsigned file_i, size_t size, uint8_t generation)
+{
+	uint8_t bytes[MAP_LIMIT * 2];
+	char path[64];
+
+	test_path(path, file_i);
+	memset(bytes, generation, size);
+
+	return write_test_file_bytes(path, bytes, size);
+}
+
+/*
+ * Check the size and every byte of a shared test file.
+ * file:	the wrapper from the cache
+ * size:	the expected size
+ * generation:	the expected value of every byte
+ * returns	1 if the file is as expected; 0 otherwise
+ */
+static int
+check_file(struct file_structor *file, size_t size, uint8_t generation)
+{
+	struct file_struct whole;
+	const uint8_t *bytes;
+	size_t byte_i;
+	int ret = 1;
+
+	if (file->size != (off_t) size ||
+	    init_file_struct(&whole, file, size, 0)) {
+		printlg(ERROR_LEVEL, "The file has %lld bytes, not %u.\n",
+			(long long) file->size, (unsigned) size);
+		return 0;
+	}
+	bytes = whole.data;
+	for (byte_i = 0; byte_i < size; byte_i++) {
+		ret &= bytes[byte_i] == generation;
+	}
+	teardown_file_struct(&whole);
+	if (!ret) {
+		printlg(ERROR_LEVEL, "The file is not generation %u.\n",
+			(unsigned) generation);
+	}
+
+	return ret;
+}
+
+/* A second acquisition should share the first, mapped whole. */
+static int test_cache_hit(struct handle_cache *cache)
+{
+	struct file_structor *first, *second;
+	char path[64];
+	int ret;
+
+	test_path(path, 0);
+	if (acquire_cached_file(cache, path, &first)) {
+		return 0;
+	}
+	if (acquire_cached_file(cache, path, &second)) {
+		release_cached_file(cache, first);
+		return 0;
+	}
+	ret = first == second && first->fd < 0 && first->memory != NULL &&
+	      cache->n_hits == 1 && cache->n_misses == 1 &&
+	      check_file(second, SMALL_SIZE, 0);
+	release_cached_file(cache, second);
+	release_cached_file(cache, first);
+
+	return ret;
+}
+
+/* Files larger than the limit should stay open instead of mapped. */
+static int test_large_file(struct handle_cache *cache)
+{
+	struct file_structor *file;
+	char path[64];
+	int ret;
+
+	test_path(path, N_TEST_FILES - 1);
+	if (!write_test_file(N_TEST_FILES - 1, MAP_LIMIT * 2, 9) ||
+	    acquire_cached_file(cache, path, &file)) {
+		return 0;
+	}
+	ret = file->fd >= 0 && file->memory == NULL &&
+	      check_file(file, MAP_LIMIT * 2, 9);
+	release_cached_file(cache, file);
+
+	return ret;
+}
+
+/* The least recently used file should be evicted from a full cache. */
+static int test_lru_eviction(struct handle_cache *cache)
+{
+	struct file_structor *file;
+	uint64_t n_misses;
+	char path[64];
+	unsigned file_i;
+
+	/* The cache holds 2 files, so the first is evicted by the third. */
+	for (file_i = 0; file_i < 3; file_i++) {
+		test_path(path, file_i);
+		if (acquire_cached_file(cache, path, &file)) {
+			return 0;
+		}
+		release_cached_file(cache, file);
+	}
+	if (cache->n_files != 2) {
+		printlg(ERROR_LEVEL, "The cache kept %u files, not 2.\n",
+			(unsigned) cache->n_files);
+		return 0;
+	}
+
+	n_misses = cache->n_misses;
+	test_path(path, 2);
+	if (acquire_cached_file(cache, path, &file)) {
+		return 0;
+	}
+	release_cached_file(cache, file);
+	test_path(path, 0);
+	if (acquire_cached_file(cache, path, &file)) {
+		return 0;
+	}
+	release_cached_file(cache, file);
+
+	if (cache->n_misses != n_misses + 1) {
+		printlg(ERROR_LEVEL, "Expected 1 more miss, but got %u.\n",
+			(unsigned) (cache->n_misses - n_misses));
+		return 0;
+	}
+
+	return 1;
+}
+
+/* A changed file should be reopened, while the old one is still held. */
+static int test_stale_file(struct handle_cache *cache)
+{
+	struct file_structor *old, *new;
+	char path[64];
+	int ret;
+
+	test_path(path, 1);
+	if (acquire_cached_file(cache, path, &old)) {
+		return 0;
+	}
+	if (!write_test_file(1, SMALL_SIZE / 2, 1) ||
+	    acquire_cached_file(cache, path, &new)) {
+		release_cached_file(cache, old);
+		return 0;
+	}
+	ret = old != new && cache->n_stale == 1 &&
+	      check_file(new, SMALL_SIZE / 2, 1);
+	release_cached_file(cache, new);
+	release_cached_file(cache, old);
+
+	return ret;
+}
+
+/*
+ * the worker for "test_threads",
+ * which acquires and checks the files in turn
+ */
+static enum fs_status acquire_files(void *arg, unsigned worker_i)
+{
+	struct handle_cache *cache = arg;
+	unsigned acquire_i;
+	char path[64];
+
+	for (acquire_i = 0; acquire_i < N_THREAD_ACQUIRES; acquire_i++) {
+		unsigned file_i = (acquire_i + worker_i) % 2;
+		struct file_structor *file;
+		int is_correct;
+
+		test_path(path, file_i);
+		if (acquire_cached_file(cache, path, &file)) {
+			return FSERR_ERRNO;
+		}
+		is_correct = file_i == 0 ?
+			     check_file(file, SMALL_SIZE, 0) :
+			     check_file(file, SMALL_SIZE / 2, 1);
+		release_cached_file(cache, file);
+		if (!is_correct) {
+			return FSERR_OUT_OF_FILE;
+		}
+	}
+
+	return FS_NO_ERROR;
+}
+
+/* Threads sharing the cache should each see the right files. */
+static int test_threads(struct handle_cache *cache)
+{
+	enum fs_status status = run_parallel(8, acquire_files, cache);
+
+	if (status) {
+		printlg(ERROR_LEVEL, "A thread failed with %d.\n", status);
+		return 0;
+	}
+
+	return 1;
+}
+
+#define N_HANDLE_CACHE_TESTS	5
+static int (*handle_cache_tests[N_HANDLE_CACHE_TESTS])(struct handle_cache *) =
+{
+	test_cache_hit, test_large_file, test_lru_eviction, test_stale_file,
+	test_threads
+};
+
+int main()
+{
+	struct handle_cache cache;
+	char path[64];
+	size_t test_i;
+	unsigned file_i;
+
+	for (file_i = 0; file_i < N_TEST_FILES; file_i++) {
+		if (!write_test_file(file_i, SMALL_SIZE, 0)) {
+			printlg(ERROR_LEVEL,
+				"Unable to write the test files.\n");
+			return 1;
+		}
+	}
+	/* Changes are checked on every hit, to see them right away. */
+	if (init_handle_cache(&cache, 2, MAP_LIMIT, 0)) {
+		return 1;
+	}
+
+	for (test_i = 0; test_i < N_HANDLE_CACHE_TESTS; test_i++) {
+		printlg(INFO_LEVEL, "Testing handle caches: %u...\n",
+			(unsigned) test_i);
+		if (handle_cache_tests[test_i](&cache)) {
+			printlg(INFO_LEVEL, "Passed!\n");
+		} else {
+			printlg(ERROR_LEVEL, "Failed!\n");
+		}
+	}
+
+	teardown_handle_cache(&cache);
+	for (file_i = 0; file_i < N_TEST_FILES; file_i++) {
+		test_path(path, file_i);
+		unlink(path);
+	}
+
+	return 0;
+}
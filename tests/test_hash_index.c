@@ -0,0 +1,293 @@
+/* tests building and querying a hash index sidecar */
+#include <hash_index.h>
+
+#include <logger.h>
+#include "test_common.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * The test file holds "N_RECORDS" records of a big-endian signed 4-byte key,
+ * followed by a little-endian 4-byte payload with the record's index.
+ * The key of record i is (i / 3) * 2 - 300,
+ * so that each even key from -300 appears three times.
+ */
+#define SOURCE_TEST_FILE	"test_inputs/sorted_test"
+#define N_RECORDS		1000
+#define RECORD_SIZE		8
+/* the sidecar written by the tests, in the working directory */
+#define INDEX_TEST_FILE		"hash_index_test.idx"
+/* a copy of the test file, whose modification time the tests change */
+#define COPY_TEST_FILE		TEST_TMP_FILE("hash_index")
+
+static const struct fs_int_field key_field = { 0, 4, BIG_END, 1 };
+static const struct fs_int_field payload_field = { 4, 4, LITTLE_END, 0 };
+
+/*
+ * Build an index of the payloads, skipping the first record,
+ * and look up every payload and a few missing ones.
+ * structor:	the source file
+ * returns	1 if every lookup matched; 0 otherwise
+ */
+static int test_unique_keys(struct file_structor *structor)
+{
+	struct hash_index index;
+	uint64_t payload;
+	int ret = 1;
+
+	if (build_hash_index(structor, RECORD_SIZE, RECORD_SIZE,
+			     N_RECORDS - 1, &payload_field, 0,
+			     INDEX_TEST_FILE) ||
+	    open_hash_index(&index, INDEX_TEST_FILE, structor)) {
+		printlg(ERROR_LEVEL, "Could not build the payload index.\n");
+		return 0;
+	}
+
+	for (payload = 0; payload < N_RECORDS + 10; payload++) {
+		off_t record_start = -1;
+		int found = hash_index_find(&index, payload, &record_start);
+
+		if (found != (payload > 0 && payload < N_RECORDS) ||
+		    (found && record_start != (off_t) payload * RECORD_SIZE)) {
+			printlg(ERROR_LEVEL,
+				"Payload %u was found %d at %d.\n",
+				(unsigned) payload, found, (int) record_start);
+			ret = 0;
+		}
+	}
+
+	close_hash_index(&index);
+
+	return ret;
+}
+
+/*
+ * Build an index of the repeated signed keys,
+ * using several threads, and find every record of a few keys.
+ * structor:	the source file
+ * returns	1 if every lookup matched; 0 otherwise
+ */
+static int test_repeated_keys(struct file_structor *structor)
+{
+	const int64_t values[] = { -300, -2, 0, 40, 364 };
+	struct hash_index index;
+	size_t value_i;
+	int ret = 1;
+
+	if (build_hash_index(structor, 0, RECORD_SIZE, N_RECORDS, &key_field,
+			     4, INDEX_TEST_FILE) ||
+	    open_hash_index(&index, INDEX_TEST_FILE, structor)) {
+		printlg(ERROR_LEVEL, "Could not build the key index.\n");
+		return 0;
+	}
+
+	for (value_i = 0; value_i < sizeof(values) / sizeof(*values);
+	     value_i++) {
+		off_t record_starts[3];
+		size_t first = (values[value_i] + 300) / 2 * 3;
+		size_t n_found, found_i;
+		unsigned found_mask = 0;
+
+		n_found = hash_index_find_all(&index, values[value_i],
+					      record_starts, 3);
+		for (found_i = 0; found_i < n_found && found_i < 3; found_i++) {
+			size_t record_i = record_starts[found_i] / RECORD_SIZE;
+
+			if (record_i >= first && record_i < first + 3) {
+				found_mask |= 1 << (record_i - first);
+			}
+		}
+		if (n_found != 3 || found_mask != 7) {
+			printlg(ERROR_LEVEL,
+				"Key %d had %u records, instead of 3.\n",
+				(int) values[value_i], (unsigned) n_found);
+			ret = 0;
+		}
+	}
+
+	if (hash_index_find_all(&index, 1, NULL, 0) != 0 ||
+	    hash_index_find_all(&index, (uint64_t) -302, NULL, 0) != 0) {
+		printlg(ERROR_LEVEL, "Missing keys were found.\n");
+		ret = 0;
+	}
+
+	close_hash_index(&index);
+
+	return ret;
+}
+
+/*
+ * An index should not open against a source file of another size.
+ * structor:	the source file
+ * returns	1 if the stale index was rejected; 0 otherwise
+ */
+static int test_stale_index(struct file_structor *structor)
+{
+	struct file_structor changed = *structor;
+	struct hash_index index;
+	enum fs_status status;
+
+	if (build_hash_index(structor, 0, RECORD_SIZE, N_RECORDS, &key_field,
+			     1, INDEX_TEST_FILE)) {
+		printlg(ERROR_LEVEL, "Could not build the key index.\n");
+		return 0;
+	}
+
+	changed.size += RECORD_SIZE;
+	if ((status = open_hash_index(&index, INDEX_TEST_FILE, &changed)) !=
+	    FSERR_BAD_SIDECAR) {
+		printlg(ERROR_LEVEL, "Expected error %d, but got %d.\n",
+			FSERR_BAD_SIDECAR, status);
+		if (status == FS_NO_ERROR) {
+			close_hash_index(&index);
+		}
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * An index should be renamed into place once built,
+ * and rejected after its source file is modified, even at the same size.
+ */
+static int test_touched_source(struct file_structor *structor)
+{
+	const struct timespec times[2] = {
+		{ 0, UTIME_OMIT }, { 1000000000, 0 }
+	};
+	struct file_structor copy;
+	struct file_struct records;
+	struct hash_index index;
+	enum fs_status status;
+	int ret;
+
+	if (init_file_struct(&records, structor, structor->size, 0)) {
+		return 0;
+	}
+	ret = write_test_file_bytes(COPY_TEST_FILE, records.data,
+				    records.size);
+	teardown_file_struct(&records);
+	if (!ret || open_file_structor(&copy, COPY_TEST_FILE)) {
+		return 0;
+	}
+
+	if (build_hash_index(&copy, 0, RECORD_SIZE, N_RECORDS, &key_field,
+			     1, INDEX_TEST_FILE) ||
+	    access(INDEX_TEST_FILE TMP_SUFFIX, F_OK) == 0 ||
+	    open_hash_index(&index, INDEX_TEST_FILE, &copy)) {
+		printlg(ERROR_LEVEL, "Could not build the key index.\n");
+		close_file_structor(&copy);
+		return 0;
+	}
+	close_hash_index(&index);
+
+	if (futimens(copy.fd, times)) {
+		close_file_structor(&copy);
+		return 0;
+	}
+	status = open_hash_index(&index, INDEX_TEST_FILE, &copy);
+	close_file_structor(&copy);
+	if (status != FSERR_BAD_SIDECAR) {
+		printlg(ERROR_LEVEL, "Expected error %d, but got %d.\n",
+			FSERR_BAD_SIDECAR, status);
+		if (status == FS_NO_ERROR) {
+			close_hash_index(&index);
+		}
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Indexes with a full table, or a key field that cannot be read,
+ * should be rejected, since lookups would not end or be wrong.
+ */
+static int test_corrupt_index(struct file_structor *structor)
+{
+	struct hash_index_header header, corrupt;
+	struct hash_index index;
+	enum fs_status status;
+	size_t corrupt_i;
+	int fd, ret = 1;
+
+	if (build_hash_index(structor, 0, RECORD_SIZE, N_RECORDS, &key_field,
+			     1, INDEX_TEST_FILE) ||
+	    (fd = open(INDEX_TEST_FILE, O_RDWR)) < 0) {
+		return 0;
+	}
+	if (pread(fd, &header, sizeof(header), 0) != sizeof(header)) {
+		close(fd);
+		return 0;
+	}
+
+	for (corrupt_i = 0; ret && corrupt_i < 3; corrupt_i++) {
+		corrupt = header;
+		switch (corrupt_i) {
+		case 0:
+			corrupt.n_records = corrupt.n_slots;
+			break;
+		case 1:
+			corrupt.key_width = 9;
+			break;
+		default:
+			corrupt.key_endianness = 2;
+			break;
+		}
+		if (pwrite(fd, &corrupt, sizeof(corrupt), 0) !=
+		    sizeof(corrupt)) {
+			ret = 0;
+			break;
+		}
+		status = open_hash_index(&index, INDEX_TEST_FILE, structor);
+		if (status != FSERR_BAD_SIDECAR) {
+			printlg(ERROR_LEVEL,
+				"Corruption %u gave %d, not %d.\n",
+				(unsigned) corrupt_i, status,
+				FSERR_BAD_SIDECAR);
+			if (status == FS_NO_ERROR) {
+				close_hash_index(&index);
+			}
+			ret = 0;
+		}
+	}
+	close(fd);
+
+	return ret;
+}
+
+#define N_HASH_INDEX_TESTS	5
+static int (*hash_index_tests[N_HASH_INDEX_TESTS])(struct file_structor *) = {
+	test_unique_keys, test_repeated_keys, test_stale_index,
+	test_touched_source, test_corrupt_index
+};
+
+int main()
+{
+	struct file_structor structor;
+	size_t test_i;
+
+	if (open_file_structor(&structor, SOURCE_TEST_FILE)) {
+		printlg(ERROR_LEVEL, "Could not open %s.\n", SOURCE_TEST_FILE);
+		return 1;
+	}
+
+	for (test_i = 0; test_i < N_HASH_INDEX_TESTS; test_i++) {
+		printlg(INFO_LEVEL, "Testing hash indexes: %u...\n",
+			(unsigned) test_i);
+		if (hash_index_tests[test_i](&structor)) {
+			printlg(INFO_LEVEL, "Passed!\n");
+		} else {
+			printlg(ERROR_LEVEL, "Failed!\n");
+		}
+	}
+
+	unlink(INDEX_TEST_FILE);
+	unlink(COPY_TEST_FILE);
+	close_file_structor(&structor);
+
+	return 0;
+}
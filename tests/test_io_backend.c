@@ -0,0 +1,277 @@
+/* tests reading chunks with each backend, and picking one automatically */
+#include <io_backend.h>
+
+#include <logger.h>
+#include "test_common.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+#define BACKEND_TEST_FILE	TEST_TMP_FILE("io_backend")
+/* the size of the large test file, which is not loaded automatically */
+#define LARGE_FILE_SIZE		(IO_AUTO_LOAD_MAX * 2)
+/* the size of the small test file, which is */
+#define SMALL_FILE_SIZE		(IO_AUTO_LOAD_MAX / 4)
+/* the number of chunks mapped by the automatic backend */
+#define N_AUTO_CHUNKS		256
+
+/* the byte at a location of the test file */
+static uint8_t test_byte(size_t location)
+{
+	return (uint8_t) (location * 7 + (location >> 9));
+}
+
+/*
+ * Write the test file, replacing any file there.
+ * size:	the size of the file
+ * returns	1 on success; 0 otherwise
+ */
+static int write_test_file(size_t size)
+{
+	uint8_t *bytes = malloc(size);
+	size_t byte_i;
+	int ret;
+
+	if (bytes == NULL) {
+		return 0;
+	}
+	for (byte_i = 0; byte_i < size; byte_i++) {
+		bytes[byte_i] = test_byte(byte_i);
+	}
+	ret = write_test_file_bytes(BACKEND_TEST_FILE, bytes, size);
+	free(bytes);
+
+	return ret;
+}
+
+/*
+ * Check that a chunk holds the bytes of the test file at its location.
+ * returns	1 if it does; 0 otherwise
+ */
+static int check_chunk(const struct file_struct *chunk)
+{
+	const uint8_t *data = chunk->data;
+	size_t byte_i;
+
+	for (byte_i = 0; byte_i < chunk->size; byte_i++) {
+		if (data[byte_i] != test_byte(chunk->start_in_file + byte_i)) {
+			printlg(ERROR_LEVEL, "Byte %u of chunk at %u is %u.\n",
+				(unsigned) byte_i,
+				(unsigned) chunk->start_in_file,
+				(unsigned) data[byte_i]);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* Every backend should read, extend and derive the same chunks. */
+static int test_backends()
+{
+	static const enum io_backend_kind kinds[] = {
+		IO_BACKEND_MMAP, IO_BACKEND_PREAD, IO_BACKEND_MEMORY
+	};
+	size_t kind_i;
+
+	if (!write_test_file(LARGE_FILE_SIZE)) {
+		return 0;
+	}
+
+	for (kind_i = 0; kind_i < sizeof(kinds) / sizeof(kinds[0]); kind_i++) {
+		struct file_structor file;
+		struct file_struct chunk, field;
+		int ret;
+
+		if (open_file_structor(&file, BACKEND_TEST_FILE)) {
+			return 0;
+		}
+		if (file.backend->kind != IO_BACKEND_MMAP ||
+		    set_io_backend(&file, kinds[kind_i]) ||
+		    init_file_struct(&chunk, &file, 5000, 12345)) {
+			close_file_structor(&file);
+			return 0;
+		}
+		ret = check_chunk(&chunk) &&
+		      (kinds[kind_i] == IO_BACKEND_MEMORY ?
+		       chunk.mapping_start == NULL :
+		       chunk.backend->kind == kinds[kind_i]) &&
+		      extend_file_struct(&chunk, 70000) == FS_NO_ERROR &&
+		      chunk.size == 70000 && check_chunk(&chunk) &&
+		      derive_file_struct(&field, &chunk, 8, 65536) ==
+		      FS_NO_ERROR && check_chunk(&field) &&
+		      extend_file_struct(&chunk, LARGE_FILE_SIZE) ==
+		      FSERR_OUT_OF_FILE && chunk.size == 70000 &&
+		      teardown_file_struct(&chunk) == FS_NO_ERROR &&
+		      chunk.data == NULL;
+		close_file_structor(&file);
+		if (!ret) {
+			printlg(ERROR_LEVEL, "The %s backend failed.\n",
+				get_io_backend(kinds[kind_i])->name);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* Backends should refuse sources they cannot read or write back to. */
+static int test_rejected()
+{
+	uint8_t bytes[16] = { 0 };
+	struct file_structor file;
+	struct file_struct chunk;
+	int ret;
+
+	open_memory_structor(&file, bytes, sizeof(bytes));
+	errno = 0;
+	ret = file.backend->kind == IO_BACKEND_MEMORY &&
+	      set_io_backend(&file, IO_BACKEND_PREAD) == FSERR_ERRNO &&
+	      errno == EBADF &&
+	      set_io_backend(&file, IO_BACKEND_AUTO) == FS_NO_ERROR &&
+	      init_file_struct(&chunk, &file, 4, 8) == FS_NO_ERROR &&
+	      chunk.data == bytes + 8;
+	close_file_structor(&file);
+	if (!ret) {
+		return 0;
+	}
+
+	if (!write_test_file(SMALL_FILE_SIZE) ||
+	    open_writable_file_structor(&file, BACKEND_TEST_FILE)) {
+		return 0;
+	}
+	errno = 0;
+	ret = set_io_backend(&file, IO_BACKEND_MEMORY) == FSERR_ERRNO &&
+	      errno == EINVAL && file.memory == NULL &&
+	      set_io_backend(&file, IO_BACKEND_PREAD) == FSERR_ERRNO &&
+	      file.backend->kind == IO_BACKEND_MMAP &&
+	      set_io_backend(&file, IO_BACKEND_AUTO) == FS_NO_ERROR &&
+	      file.memory == NULL &&
+	      init_file_struct(&chunk, &file, 64, 100) == FS_NO_ERROR;
+	if (ret) {
+		ret = chunk.backend->kind == IO_BACKEND_MMAP &&
+		      check_chunk(&chunk);
+		teardown_file_struct(&chunk);
+	}
+	close_file_structor(&file);
+
+	return ret;
+}
+
+/* Small files should be loaded into memory, until the backend changes. */
+static int test_auto_small()
+{
+	struct file_structor file;
+	struct file_struct chunk;
+	int ret;
+
+	if (!write_test_file(SMALL_FILE_SIZE) ||
+	    open_file_structor(&file, BACKEND_TEST_FILE)) {
+		return 0;
+	}
+	ret = set_io_backend(&file, IO_BACKEND_AUTO) == FS_NO_ERROR &&
+	      file.memory != NULL && file.fd >= 0 &&
+	      init_file_struct(&chunk, &file, 100, 4000) == FS_NO_ERROR;
+	if (ret) {
+		ret = chunk.mapping_start == NULL &&
+		      chunk.data == (uint8_t *) file.memory + 4000 &&
+		      check_chunk(&chunk);
+		teardown_file_struct(&chunk);
+	}
+	ret = ret && set_io_backend(&file, IO_BACKEND_PREAD) == FS_NO_ERROR &&
+	      file.memory == NULL &&
+	      init_file_struct(&chunk, &file, 100, 4000) == FS_NO_ERROR;
+	if (ret) {
+		ret = chunk.backend->kind == IO_BACKEND_PREAD &&
+		      check_chunk(&chunk);
+		teardown_file_struct(&chunk);
+	}
+	close_file_structor(&file);
+
+	return ret;
+}
+
+/*
+ * Larger files should have small chunks timed with both backends,
+ * and large chunks mapped.
+ */
+static int test_auto_large()
+{
+	const struct io_cost_class *cost;
+	struct file_structor file;
+	struct file_struct chunk;
+	uint64_t state = 1;
+	size_t chunk_i;
+	int ret = 1;
+
+	if (!write_test_file(LARGE_FILE_SIZE) ||
+	    open_file_structor(&file, BACKEND_TEST_FILE)) {
+		return 0;
+	}
+	if (set_io_backend(&file, IO_BACKEND_AUTO) || file.memory != NULL) {
+		close_file_structor(&file);
+		return 0;
+	}
+
+	for (chunk_i = 0; ret && chunk_i < N_AUTO_CHUNKS; chunk_i++) {
+		off_t start;
+
+		state = state * 6364136223846793005ull + 1442695040888963407ull;
+		start = (state >> 33) % (LARGE_FILE_SIZE - 64);
+		ret = init_file_struct(&chunk, &file, 64, start) ==
+		      FS_NO_ERROR;
+		if (ret) {
+			ret = check_chunk(&chunk);
+			teardown_file_struct(&chunk);
+		}
+	}
+	cost = &file.costs.classes[0][0];
+	ret = ret && file.costs.n_mmaps + file.costs.n_preads ==
+		     N_AUTO_CHUNKS &&
+	      cost->n_mmap_samples >= IO_AUTO_MIN_SAMPLES &&
+	      cost->n_pread_samples >= IO_AUTO_MIN_SAMPLES &&
+	      cost->mmap_ns > 0 && cost->pread_ns > 0;
+	if (!ret) {
+		printlg(ERROR_LEVEL,
+			"%u mappings and %u copies, %u and %u timed.\n",
+			(unsigned) file.costs.n_mmaps,
+			(unsigned) file.costs.n_preads,
+			(unsigned) cost->n_mmap_samples,
+			(unsigned) cost->n_pread_samples);
+	}
+
+	ret = ret && init_file_struct(&chunk, &file, IO_AUTO_PREAD_MAX + 1,
+				      0) == FS_NO_ERROR;
+	if (ret) {
+		ret = chunk.backend->kind == IO_BACKEND_MMAP &&
+		      check_chunk(&chunk);
+		teardown_file_struct(&chunk);
+	}
+	close_file_structor(&file);
+
+	return ret;
+}
+
+#define N_BACKEND_TESTS	4
+static int (*backend_tests[N_BACKEND_TESTS])() = {
+	test_backends, test_rejected, test_auto_small, test_auto_large
+};
+
+int main()
+{
+	size_t test_i;
+
+	for (test_i = 0; test_i < N_BACKEND_TESTS; test_i++) {
+		printlg(INFO_LEVEL, "Testing I/O backends: %u...\n",
+			(unsigned) test_i);
+		if (backend_tests[test_i]()) {
+			printlg(INFO_LEVEL, "Passed!\n");
+		} else {
+			printlg(ERROR_LEVEL, "Failed!\n");
+		}
+	}
+
+	unlink(BACKEND_TEST_FILE);
+
+	return 0;
+}
@@ -0,0 +1,172 @@
+/* tests finding strides in mapped chunks and reading ahead of them */
+#include <readahead.h>
+
+#include <logger.h>
+#include "test_common.h"
+
+#include <unistd.h>
+
+#define READAHEAD_TEST_FILE	TEST_TMP_FILE("readahead")
+/* the size of the test file, which is sparse */
+#define TEST_FILE_SIZE		(16 << 20)
+/* the size of each mapped chunk */
+#define CHUNK_SIZE		64
+
+/*
+ * Map and unmap chunks at a stride, like a loop of legacy code.
+ * file:	the source wrapper
+ * start:	the location of the first chunk
+ * stride:	the distance between chunks
+ * n_chunks:	the number of chunks
+ * returns	1 if every chunk was mapped; 0 otherwise
+ */
+static int
+map_chunks(struct file_structor *file, off_t start, off_t stride,
+	   size_t n_chunks)
+{
+	size_t chunk_i;
+
+	for (chunk_i = 0; chunk_i < n_chunks; chunk_i++) {
+		struct file_struct chunk;
+
+		if (init_file_struct(&chunk, file, CHUNK_SIZE,
+				     start + chunk_i * stride)) {
+			return 0;
+		}
+		teardown_file_struct(&chunk);
+	}
+
+	return 1;
+}
+
+/* A sequence of close chunks should be read ahead in a few large ranges. */
+static int test_dense()
+{
+	struct file_structor file;
+	int ret;
+
+	if (!write_test_file_bytes(READAHEAD_TEST_FILE, NULL, TEST_FILE_SIZE) ||
+	    open_file_structor(&file, READAHEAD_TEST_FILE)) {
+		return 0;
+	}
+	ret = file.pattern.max_distance == READAHEAD_MAX_DISTANCE &&
+	      map_chunks(&file, 100, 4096, 32) &&
+	      file.pattern.stride == 4096 && file.pattern.n_hits == 30 &&
+	      file.pattern.distance == READAHEAD_MAX_DISTANCE &&
+	      file.pattern.n_readaheads > 0 && file.pattern.n_readaheads < 16;
+	if (!ret) {
+		printlg(ERROR_LEVEL,
+			"Stride %d, %u hits, distance %u, %u readaheads.\n",
+			(int) file.pattern.stride, file.pattern.n_hits,
+			file.pattern.distance,
+			(unsigned) file.pattern.n_readaheads);
+	}
+	close_file_structor(&file);
+
+	return ret;
+}
+
+/* A chunk off the stride should halve the distance read ahead. */
+static int test_backoff()
+{
+	struct file_structor file;
+	unsigned distance;
+	uint64_t n_readaheads;
+	int ret;
+
+	if (open_file_structor(&file, READAHEAD_TEST_FILE)) {
+		return 0;
+	}
+	ret = map_chunks(&file, 0, 8192, 16);
+	distance = file.pattern.distance;
+	ret = ret && distance == READAHEAD_MAX_DISTANCE &&
+	      map_chunks(&file, 12345, 0, 1) &&
+	      file.pattern.distance == distance / 2 &&
+	      file.pattern.n_hits == 0 && file.pattern.n_ahead == 0;
+
+	/* Chunks at an unconfirmed stride should not be read ahead. */
+	n_readaheads = file.pattern.n_readaheads;
+	ret = ret && map_chunks(&file, 1 << 20, 8192, 3) &&
+	      file.pattern.n_readaheads == n_readaheads &&
+	      map_chunks(&file, (1 << 20) + 3 * 8192, 8192, 1) &&
+	      file.pattern.n_readaheads == n_readaheads + 1 &&
+	      file.pattern.distance == distance / 8;
+	close_file_structor(&file);
+
+	return ret;
+}
+
+/*
+ * Chunks far apart should be read ahead one by one,
+ * backwards for a negative stride, within the file.
+ */
+static int test_sparse_reverse()
+{
+	const off_t stride = 256 << 10;
+	const off_t last = TEST_FILE_SIZE - CHUNK_SIZE;
+	struct file_structor file;
+	int ret;
+
+	if (open_file_structor(&file, READAHEAD_TEST_FILE)) {
+		return 0;
+	}
+	ret = map_chunks(&file, last, -stride, 4) &&
+	      file.pattern.stride == -stride &&
+	      file.pattern.n_readaheads == READAHEAD_MIN_DISTANCE;
+
+	/* Only the chunks down to the start of the file are read ahead. */
+	set_adaptive_readahead(&file, READAHEAD_MAX_DISTANCE);
+	ret = ret && map_chunks(&file, 4 * stride, -stride, 4) &&
+	      file.pattern.n_readaheads == 1;
+	close_file_structor(&file);
+
+	return ret;
+}
+
+/* Nothing should be read ahead when disabled, or for memory sources. */
+static int test_disabled()
+{
+	static uint8_t bytes[1 << 16];
+	struct file_structor file;
+	int ret;
+
+	if (open_file_structor(&file, READAHEAD_TEST_FILE)) {
+		return 0;
+	}
+	set_adaptive_readahead(&file, 0);
+	ret = map_chunks(&file, 0, 4096, 16) &&
+	      file.pattern.n_readaheads == 0 && file.pattern.n_hits == 0;
+	close_file_structor(&file);
+
+	open_memory_structor(&file, bytes, sizeof(bytes));
+	set_adaptive_readahead(&file, READAHEAD_MAX_DISTANCE);
+	ret = ret && map_chunks(&file, 0, 1024, 16) &&
+	      file.pattern.n_readaheads == 0;
+	close_file_structor(&file);
+
+	return ret;
+}
+
+#define N_READAHEAD_TESTS	4
+static int (*readahead_tests[N_READAHEAD_TESTS])() = {
+	test_dense, test_backoff, test_sparse_reverse, test_disabled
+};
+
+int main()
+{
+	size_t test_i;
+
+	for (test_i = 0; test_i < N_READAHEAD_TESTS; test_i++) {
+		printlg(INFO_LEVEL, "Testing adaptive readahead: %u...\n",
+			(unsigned) test_i);
+		if (readahead_tests[test_i]()) {
+			printlg(INFO_LEVEL, "Passed!\n");
+		} else {
+			printlg(ERROR_LEVEL, "Failed!\n");
+		}
+	}
+
+	unlink(READAHEAD_TEST_FILE);
+
+	return 0;
+}
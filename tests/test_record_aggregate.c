@@ -0,0 +1,230 @@
+/* tests aggregating a field across an array of records */
+#include <record_aggregate.h>
+
+#include <logger.h>
+
+#include <stdlib.h>
+
+/* the number of records, which spans several batches of threads */
+#define N_RECORDS	200003
+
+/*
+ * the raw record, with a big-endian signed 4-byte value,
+ * a little-endian unsigned 8-byte value and a big-endian signed 3-byte value
+ */
+struct raw_record {
+	uint8_t small[4];
+	uint8_t large[8];
+	uint8_t odd[3];
+	uint8_t padding;
+};
+
+static const struct fs_int_field small_field = {
+	offsetof(struct raw_record, small), 4, BIG_END, 1
+};
+static const struct fs_int_field large_field = {
+	offsetof(struct raw_record, large), 8, LITTLE_END, 0
+};
+static const struct fs_int_field odd_field = {
+	offsetof(struct raw_record, odd), 3, BIG_END, 1
+};
+
+/* the raw records, and a chunk pointing to them */
+static struct raw_record *raw_records;
+static struct file_struct records;
+
+/* the value of each field in each record */
+static int32_t small_value(uint32_t record_i)
+{
+	return (int32_t) (record_i * 2654435761u) >> 8;
+}
+static uint64_t large_value(uint32_t record_i)
+{
+	return (uint64_t) record_i * 0x9e3779b97f4a7c15ull;
+}
+static int32_t odd_value(uint32_t record_i)
+{
+	return (int32_t) (record_i % 1000) - 500;
+}
+
+/*
+ * Fill the raw records.
+ * returns	1 on success; 0 if they could not be allocated
+ */
+static int fill_records()
+{
+	uint32_t record_i;
+
+	raw_records = calloc(N_RECORDS, sizeof(*raw_records));
+	if (raw_records == NULL) {
+		return 0;
+	}
+	for (record_i = 0; record_i < N_RECORDS; record_i++) {
+		struct raw_record *record = &raw_records[record_i];
+		int32_t small = small_value(record_i);
+		uint64_t large = large_value(record_i);
+		int32_t odd = odd_value(record_i);
+
+		portable_memcpy(record->small, &small, sizeof(small), BIG_END);
+		portable_memcpy(record->large, &large, sizeof(large),
+				LITTLE_END);
+		record->odd[0] = (odd >> 16) & 0xff;
+		record->odd[1] = (odd >> 8) & 0xff;
+		record->odd[2] = odd & 0xff;
+	}
+
+	records.src_file = NULL;
+	records.size = sizeof(*raw_records) * N_RECORDS;
+	records.start_in_file = 0;
+	records.data = raw_records;
+	records.mapping_start = NULL;
+
+	return 1;
+}
+
+/*
+ * Aggregate a field with several thread counts,
+ * and compare with the aggregates computed one by one.
+ * field:	the field to aggregate
+ * value:	the function giving the value of the field in each record
+ * returns	1 if the aggregates are correct; 0 otherwise
+ */
+static int check_aggregates(const struct fs_int_field *field,
+			    uint64_t (*value)(uint32_t record_i))
+{
+	struct field_aggregate expected, actual;
+	unsigned n_threads;
+	uint32_t record_i;
+
+	expected.count = N_RECORDS;
+	expected.sum = 0;
+	expected.min = value(0);
+	expected.max = value(0);
+	for (record_i = 0; record_i < N_RECORDS; record_i++) {
+		uint64_t record_value = value(record_i);
+
+		expected.sum += record_value;
+		if (field->is_signed ?
+		    (int64_t) record_value < (int64_t) expected.min :
+		    record_value < expected.min) {
+			expected.min = record_value;
+		}
+		if (field->is_signed ?
+		    (int64_t) record_value > (int64_t) expected.max :
+		    record_value > expected.max) {
+			expected.max = record_value;
+		}
+	}
+
+	for (n_threads = 1; n_threads <= 3; n_threads += 2) {
+		enum fs_status status;
+
+		if ((status = aggregate_field(&records,
+					      sizeof(struct raw_record), field,
+					      n_threads, &actual))) {
+			printlg(ERROR_LEVEL, "Unexpected error: %d.\n", status);
+			return 0;
+		}
+		if (actual.count != expected.count ||
+		    actual.sum != expected.sum ||
+		    actual.min != expected.min || actual.max != expected.max) {
+			printlg(ERROR_LEVEL,
+				"With %u threads, expected %llu, %llx, "
+				"%llx and %llx, but got %llu, %llx, "
+				"%llx and %llx.\n", n_threads,
+				(unsigned long long) expected.count,
+				(unsigned long long) expected.sum,
+				(unsigned long long) expected.min,
+				(unsigned long long) expected.max,
+				(unsigned long long) actual.count,
+				(unsigned long long) actual.sum,
+				(unsigned long long) actual.min,
+				(unsigned long long) actual.max);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static uint64_t small_as_u64(uint32_t record_i)
+{
+	return (uint64_t) (int64_t) small_value(record_i);
+}
+static uint64_t odd_as_u64(uint32_t record_i)
+{
+	return (uint64_t) (int64_t) odd_value(record_i);
+}
+
+/* A signed 4-byte big-endian field should be aggregated. */
+static int test_small_field()
+{
+	return check_aggregates(&small_field, small_as_u64);
+}
+
+/* An unsigned 8-byte little-endian field should be aggregated. */
+static int test_large_field()
+{
+	return check_aggregates(&large_field, large_value);
+}
+
+/* A signed 3-byte field should be aggregated. */
+static int test_odd_field()
+{
+	return check_aggregates(&odd_field, odd_as_u64);
+}
+
+/* Only the selected records should be aggregated. */
+static int test_selected()
+{
+	const size_t selection[3] = {1, 500, 999};
+	struct field_aggregate aggregate;
+	enum fs_status status;
+
+	if ((status = aggregate_selected(&records, sizeof(struct raw_record),
+					 &odd_field, selection, 3,
+					 &aggregate))) {
+		printlg(ERROR_LEVEL, "Unexpected error: %d.\n", status);
+		return 0;
+	}
+	if (aggregate.count != 3 || aggregate.sum != 0 ||
+	    (int64_t) aggregate.min != -499 || (int64_t) aggregate.max != 499) {
+		printlg(ERROR_LEVEL, "Got %llu records, summing to %lld, "
+				     "from %lld to %lld.\n",
+			(unsigned long long) aggregate.count,
+			(long long) aggregate.sum, (long long) aggregate.min,
+			(long long) aggregate.max);
+		return 0;
+	}
+
+	return 1;
+}
+
+#define N_RECORD_AGGREGATE_TESTS	4
+static int (*record_aggregate_tests[N_RECORD_AGGREGATE_TESTS])() = {
+	test_small_field, test_large_field, test_odd_field, test_selected
+};
+
+int main()
+{
+	size_t test_i;
+
+	if (!fill_records()) {
+		printlg(ERROR_LEVEL, "Could not allocate records.\n");
+		return 1;
+	}
+
+	for (test_i = 0; test_i < N_RECORD_AGGREGATE_TESTS; test_i++) {
+		printlg(INFO_LEVEL, "Testing field aggregates: %u...\n",
+			(unsigned) test_i);
+		if (record_aggregate_tests[test_i]()) {
+			printlg(INFO_LEVEL, "Passed!\n");
+		} else {
+			printlg(ERROR_LEVEL, "Failed!\n");
+		}
+	}
+
+	free(raw_records);
+
+	return 0;
+}
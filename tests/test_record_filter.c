@@ -0,0 +1,293 @@
+/* tests filtering records on their raw data */
+#include <record_filter.h>
+#include <copy_plan.h>
+
+#include <logger.h>
+
+#include <stdlib.h>
+
+/* the number of records, which is not a multiple of the vector width */
+#define N_RECORDS	1003
+
+/*
+ * the raw record, with a big-endian key,
+ * a little-endian signed temperature and a little-endian ID
+ */
+struct raw_record {
+	uint8_t key[4];
+	uint8_t temperature[2];
+	uint8_t flags;
+	uint8_t padding;
+	uint8_t id[8];
+};
+
+/* the decoded fields of a record */
+struct host_record {
+	uint32_t key;
+	int16_t temperature;
+	uint64_t id;
+};
+
+static const struct fs_int_field key_field = {
+	offsetof(struct raw_record, key), sizeof(uint32_t), BIG_END, 0
+};
+static const struct fs_int_field temperature_field = {
+	offsetof(struct raw_record, temperature), sizeof(int16_t), LITTLE_END, 1
+};
+static const struct fs_int_field id_field = {
+	offsetof(struct raw_record, id), sizeof(uint64_t), LITTLE_END, 0
+};
+
+/* the raw records, and a chunk pointing to them */
+static struct raw_record raw_records[N_RECORDS];
+static struct file_struct records = {
+	.src_file = NULL,
+	.size = sizeof(raw_records),
+	.start_in_file = 0,
+	.data = raw_records,
+	.mapping_start = NULL,
+};
+
+/* Fill the raw records. */
+static void fill_records()
+{
+	uint32_t record_i;
+
+	for (record_i = 0; record_i < N_RECORDS; record_i++) {
+		struct raw_record *record = &raw_records[record_i];
+		uint32_t key = record_i * 3;
+		int16_t temperature = (int16_t) (record_i % 200) - 100;
+		uint64_t id = (uint64_t) record_i * record_i;
+
+		portable_memcpy(record->key, &key, sizeof(key), BIG_END);
+		portable_memcpy(record->temperature, &temperature,
+				sizeof(temperature), LITTLE_END);
+		portable_memcpy(record->id, &id, sizeof(id), LITTLE_END);
+		record->flags = record_i & 1;
+		record->padding = 0;
+	}
+}
+
+/*
+ * Check a predicate by comparing against testing every record one by one.
+ * predicates:		the predicates to test
+ * n_predicates:	the number of predicates
+ * expected_n:		the expected number of matches
+ * returns		1 if the selection is as expected; 0 otherwise
+ */
+static int check_filter(const struct record_predicate *predicates,
+			size_t n_predicates, size_t expected_n)
+{
+	size_t selection[N_RECORDS];
+	size_t n_selected, selected_i = 0, record_i;
+	enum fs_status status;
+
+	if ((status = filter_records(&records, sizeof(struct raw_record),
+				     predicates, n_predicates, selection,
+				     &n_selected))) {
+		printlg(ERROR_LEVEL, "Unexpected filter error: %d.\n", status);
+		return 0;
+	}
+	if (n_selected != expected_n) {
+		printlg(ERROR_LEVEL, "Expected %u matches, but got %u.\n",
+			(unsigned) expected_n, (unsigned) n_selected);
+		return 0;
+	}
+
+	for (record_i = 0; record_i < N_RECORDS; record_i++) {
+		size_t predicate_i;
+		int matches = 1;
+
+		for (predicate_i = 0; predicate_i < n_predicates;
+		     predicate_i++) {
+			const struct record_predicate *predicate =
+				&predicates[predicate_i];
+			int64_t value = (int64_t) load_int_field(
+				&raw_records[record_i], &predicate->field);
+			size_t value_i;
+			int in_set = 0;
+
+			switch (predicate->type) {
+			case PREDICATE_EQUAL:
+				matches &= value == (int64_t) predicate->low;
+				break;
+			case PREDICATE_RANGE:
+				matches &= value >= (int64_t) predicate->low &&
+					   value <= (int64_t) predicate->high;
+				break;
+			case PREDICATE_IN_SET:
+				for (value_i = 0; value_i < predicate->n_values;
+				     value_i++) {
+					in_set |= value == (int64_t)
+						  predicate->values[value_i];
+				}
+				matches &= in_set;
+				break;
+			}
+		}
+		if (matches) {
+			if (selected_i >= n_selected ||
+			    selection[selected_i] != record_i) {
+				printlg(ERROR_LEVEL,
+					"Record %u was not selected.\n",
+					(unsigned) record_i);
+				return 0;
+			}
+			selected_i++;
+		}
+	}
+
+	return 1;
+}
+
+/* A range of a 4-byte big-endian key should be found. */
+static int test_key_range()
+{
+	const struct record_predicate key_range = {
+		.field = key_field,
+		.type = PREDICATE_RANGE,
+		.low = 300,
+		.high = 600,
+	};
+
+	return check_filter(&key_range, 1, 101);
+}
+
+/* A set of 8-byte IDs should be found, ignoring values not in the file. */
+static int test_id_set()
+{
+	const uint64_t ids[] = {0, 4, 9, 1000000, 999999999};
+	const struct record_predicate id_set = {
+		.field = id_field,
+		.type = PREDICATE_IN_SET,
+		.values = ids,
+		.n_values = 5,
+	};
+
+	return check_filter(&id_set, 1, 4);
+}
+
+/* Several predicates, one on a signed field, should all be tested. */
+static int test_combined_predicates()
+{
+	const struct record_predicate predicates[2] = {
+		{
+			.field = temperature_field,
+			.type = PREDICATE_RANGE,
+			.low = (uint64_t) -5,
+			.high = 5,
+		}, {
+			.field = key_field,
+			.type = PREDICATE_RANGE,
+			.low = 0,
+			.high = 1500,
+		}
+	};
+
+	return check_filter(predicates, 2, 28);
+}
+
+/* A value outside of the range of the field should match nothing. */
+static int test_impossible_value()
+{
+	const struct record_predicate too_large = {
+		.field = temperature_field,
+		.type = PREDICATE_EQUAL,
+		.low = 1 << 20,
+	};
+
+	return check_filter(&too_large, 1, 0);
+}
+
+/* A field outside of the record should be rejected. */
+static int test_field_out_of_record()
+{
+	const struct record_predicate outside = {
+		.field = {sizeof(struct raw_record), 1, BIG_END, 0},
+		.type = PREDICATE_EQUAL,
+	};
+	size_t selection[N_RECORDS];
+	size_t n_selected;
+	enum fs_status status;
+
+	if ((status = filter_records(&records, sizeof(struct raw_record),
+				     &outside, 1, selection, &n_selected)) !=
+	    FSERR_OUT_OF_STRUCT) {
+		printlg(ERROR_LEVEL, "Expected error %d, but got %d.\n",
+			FSERR_OUT_OF_STRUCT, status);
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Only the selected records should be copied by a copy plan. */
+static int test_decode_selected()
+{
+	const struct record_predicate key_equal = {
+		.field = key_field,
+		.type = PREDICATE_EQUAL,
+		.low = 3 * 500,
+	};
+	const struct member_layout layout[3] = {
+		MEMBER_LAYOUT(struct host_record, key,
+			      offsetof(struct raw_record, key), BIG_END),
+		MEMBER_LAYOUT(struct host_record, temperature,
+			      offsetof(struct raw_record, temperature),
+			      LITTLE_END),
+		MEMBER_LAYOUT(struct host_record, id,
+			      offsetof(struct raw_record, id), LITTLE_END),
+	};
+	struct copy_plan plan;
+	struct host_record decoded;
+	size_t selection[N_RECORDS];
+	size_t n_selected;
+	enum fs_status status;
+
+	if (filter_records(&records, sizeof(struct raw_record), &key_equal, 1,
+			   selection, &n_selected) || n_selected != 1 ||
+	    compile_copy_plan(&plan, layout, 3)) {
+		printlg(ERROR_LEVEL, "Could not select record 500.\n");
+		return 0;
+	}
+	status = apply_copy_plan_selected(&plan, &decoded, sizeof(decoded),
+					  &records, sizeof(struct raw_record),
+					  selection, n_selected);
+	free_copy_plan(&plan);
+
+	if (status || decoded.key != 1500 || decoded.temperature != 0 ||
+	    decoded.id != 250000) {
+		printlg(ERROR_LEVEL, "Decoded key %u, temperature %d "
+				     "and ID %llu.\n",
+			(unsigned) decoded.key, (int) decoded.temperature,
+			(unsigned long long) decoded.id);
+		return 0;
+	}
+
+	return 1;
+}
+
+#define N_RECORD_FILTER_TESTS	6
+static int (*record_filter_tests[N_RECORD_FILTER_TESTS])() = {
+	test_key_range, test_id_set, test_combined_predicates,
+	test_impossible_value, test_field_out_of_record, test_decode_selected
+};
+
+int main()
+{
+	size_t test_i;
+
+	fill_records();
+
+	for (test_i = 0; test_i < N_RECORD_FILTER_TESTS; test_i++) {
+		printlg(INFO_LEVEL, "Testing record filters: %u...\n",
+			(unsigned) test_i);
+		if (record_filter_tests[test_i]()) {
+			printlg(INFO_LEVEL, "Passed!\n");
+		} else {
+			printlg(ERROR_LEVEL, "Failed!\n");
+		}
+	}
+
+	return 0;
+}
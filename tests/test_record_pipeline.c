@@ -0,0 +1,360 @@
+/* tests pipelined scans and the queues between their stages */
+#include <record_pipeline.h>
+#include <fs_queue.h>
+#include <io_backend.h>
+
+#include <logger.h>
+#include "test_common.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define PIPELINE_TEST_FILE	TEST_TMP_FILE("pipeline")
+/*
+ * Each raw record has a big-endian 4-byte ID
+ * followed by a big-endian 8-byte value, with no padding.
+ */
+#define ID_START	0
+#define VALUE_START	sizeof(uint32_t)
+#define RECORD_SIZE	(VALUE_START + sizeof(uint64_t))
+/* the number of records, which is not a multiple of the batch sizes */
+#define N_RECORDS	100003
+/* the number of items passed through the queues by each producer */
+#define N_QUEUE_ITEMS	100000
+/* the number of producers and of consumers of the queue test */
+#define N_QUEUE_THREADS	4
+
+/* the decoded record */
+struct decoded_record {
+	uint32_t id;
+	uint64_t value;
+};
+
+static const struct member_layout decoded_layout[2] = {
+	MEMBER_LAYOUT(struct decoded_record, id, ID_START, BIG_END),
+	MEMBER_LAYOUT(struct decoded_record, value, VALUE_START, BIG_END),
+};
+
+/* the value of the record at an index */
+#define VALUE_OF(record_i)	((uint64_t) (record_i) * 0x9e3779b97f4a7c15ull)
+
+/* the state of the consumer of the pipeline tests */
+struct consumer_check {
+	/* the index of the next record expected */
+	size_t next;
+	/* the batch after which to fail, or SIZE_MAX */
+	size_t failing_batch;
+	/* the number of batches consumed */
+	size_t n_batches;
+	/* nonzero once a record was wrong */
+	int is_wrong;
+};
+
+/* the consumer checking that records arrive in order and decoded */
+static enum fs_status
+check_batch(void *arg, const void *decoded, size_t first, size_t n_records)
+{
+	struct consumer_check *check = arg;
+	const struct decoded_record *records = decoded;
+	size_t record_i;
+
+	if (first != check->next) {
+		printlg(ERROR_LEVEL, "Expected record %u, but got %u.\n",
+			(unsigned) check->next, (unsigned) first);
+		check->is_wrong = 1;
+	}
+	for (record_i = 0; record_i < n_records; record_i++) {
+		if (records[record_i].id != first + record_i ||
+		    records[record_i].value != VALUE_OF(first + record_i)) {
+			check->is_wrong = 1;
+		}
+	}
+	check->next = first + n_records;
+
+	if (check->n_batches++ == check->failing_batch) {
+		return FSERR_OUT_OF_STRUCT;
+	}
+
+	return FS_NO_ERROR;
+}
+
+/*
+ * Run a pipeline over the test records.
+ * input:	the chunk holding the test records
+ * pipeline:	the pipeline, with its sizes set
+ * check:	the state of the consumer
+ * returns	the status of the pipeline
+ */
+static enum fs_status
+run_checked(struct file_struct *input, struct record_pipeline *pipeline,
+	    struct consumer_check *check)
+{
+	struct copy_plan plan;
+	struct plan_decoder decoder;
+	enum fs_status status;
+
+	if ((status = compile_copy_plan(&plan, decoded_layout, 2))) {
+		return status;
+	}
+	decoder.plan = &plan;
+	decoder.dst_stride = sizeof(struct decoded_record);
+
+	pipeline->start_in_file = 0;
+	pipeline->record_size = RECORD_SIZE;
+	pipeline->n_records = N_RECORDS;
+	pipeline->decoded_size = sizeof(struct decoded_record);
+	pipeline->decode = decode_with_plan;
+	pipeline->decode_arg = &decoder;
+	pipeline->consume = check_batch;
+	pipeline->consume_arg = check;
+	check->next = 0;
+	check->n_batches = 0;
+	check->is_wrong = 0;
+
+	status = run_record_pipeline(input->src_file, pipeline);
+	free_copy_plan(&plan);
+
+	return status;
+}
+
+/* Every record should be decoded and consumed in order. */
+static int test_pipeline_order(struct file_struct *input)
+{
+	struct record_pipeline pipeline = { 0 };
+	struct consumer_check check;
+	enum fs_status status;
+
+	check.failing_batch = SIZE_MAX;
+	if ((status = run_checked(input, &pipeline, &check))) {
+		printlg(ERROR_LEVEL, "Unexpected pipeline error: %d.\n",
+			status);
+		return 0;
+	}
+
+	return !check.is_wrong && check.next == N_RECORDS;
+}
+
+/* Small batches with few in flight should hold back the decoders. */
+static int test_pipeline_back_pressure(struct file_struct *input)
+{
+	struct record_pipeline pipeline = { 0 };
+	struct consumer_check check;
+	enum fs_status status;
+
+	pipeline.batch_records = 7;
+	pipeline.depth = 2;
+	pipeline.n_decoders = 6;
+	check.failing_batch = SIZE_MAX;
+	if ((status = run_checked(input, &pipeline, &check))) {
+		printlg(ERROR_LEVEL, "Unexpected pipeline error: %d.\n",
+			status);
+		return 0;
+	}
+
+	return !check.is_wrong && check.next == N_RECORDS &&
+	       check.n_batches == (N_RECORDS + 6) / 7;
+}
+
+/* A failing consumer should stop the pipeline with its error. */
+static int test_pipeline_error(struct file_struct *input)
+{
+	struct record_pipeline pipeline = { 0 };
+	struct consumer_check check;
+	enum fs_status status;
+
+	pipeline.batch_records = 1000;
+	pipeline.depth = 4;
+	check.failing_batch = 10;
+	if ((status = run_checked(input, &pipeline, &check)) !=
+	    FSERR_OUT_OF_STRUCT) {
+		printlg(ERROR_LEVEL, "Expected error %d, but got %d.\n",
+			FSERR_OUT_OF_STRUCT, status);
+		return 0;
+	}
+
+	return !check.is_wrong && check.n_batches == 11;
+}
+
+/* the shared state of the queue test */
+struct queue_check {
+	struct mpmc_queue queue;
+	/* the sum of the items popped by each consumer */
+	uint64_t sums[N_QUEUE_THREADS];
+	/* the index of the next thread to start */
+	unsigned next_thread;
+};
+
+/* a producer of the queue test, pushing items counting from 1 */
+static void *produce_items(void *arg)
+{
+	struct queue_check *check = arg;
+	uintptr_t item;
+
+	for (item = 1; item <= N_QUEUE_ITEMS; item++) {
+		unsigned spins = 0;
+
+		while (!mpmc_push(&check->queue, (void *) item)) {
+			queue_backoff(&spins);
+		}
+	}
+
+	return NULL;
+}
+
+/* a consumer of the queue test, summing its share of the items */
+static void *consume_items(void *arg)
+{
+	struct queue_check *check = arg;
+	unsigned thread_i = __atomic_fetch_add(&check->next_thread, 1,
+					       __ATOMIC_RELAXED);
+	size_t item_i;
+
+	for (item_i = 0; item_i < N_QUEUE_ITEMS; item_i++) {
+		unsigned spins = 0;
+		void *item;
+
+		while (!mpmc_pop(&check->queue, &item)) {
+			queue_backoff(&spins);
+		}
+		check->sums[thread_i] += (uintptr_t) item;
+	}
+
+	return NULL;
+}
+
+/* Items should pass through a small shared queue exactly once. */
+static int test_mpmc_queue(struct file_struct *input)
+{
+	pthread_t threads[2 * N_QUEUE_THREADS];
+	struct queue_check check = { 0 };
+	uint64_t total = 0;
+	unsigned thread_i;
+
+	(void) input;
+
+	if (init_mpmc_queue(&check.queue, 8)) {
+		return 0;
+	}
+	for (thread_i = 0; thread_i < 2 * N_QUEUE_THREADS; thread_i++) {
+		pthread_create(&threads[thread_i], NULL,
+			       thread_i % 2 ? produce_items : consume_items,
+			       &check);
+	}
+	for (thread_i = 0; thread_i < 2 * N_QUEUE_THREADS; thread_i++) {
+		pthread_join(threads[thread_i], NULL);
+	}
+	free_mpmc_queue(&check.queue);
+
+	for (thread_i = 0; thread_i < N_QUEUE_THREADS; thread_i++) {
+		total += check.sums[thread_i];
+	}
+	if (total != (uint64_t) N_QUEUE_THREADS * N_QUEUE_ITEMS *
+		     (N_QUEUE_ITEMS + 1) / 2) {
+		printlg(ERROR_LEVEL, "The items summed to %llu.\n",
+			(unsigned long long) total);
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Items should come out of a single-producer queue in order. */
+static int test_spsc_queue(struct file_struct *input)
+{
+	struct spsc_queue queue;
+	uintptr_t item_i;
+	void *item;
+	int ret = 1;
+
+	(void) input;
+
+	if (init_spsc_queue(&queue, 3)) {
+		return 0;
+	}
+	for (item_i = 0; item_i < 4; item_i++) {
+		ret &= spsc_push(&queue, (void *) item_i);
+	}
+	/* The capacity is rounded up to 4. */
+	ret &= !spsc_push(&queue, (void *) item_i);
+	for (item_i = 0; item_i < 4; item_i++) {
+		ret &= spsc_pop(&queue, &item) && item == (void *) item_i;
+	}
+	ret &= !spsc_pop(&queue, &item);
+	free_spsc_queue(&queue);
+
+	return ret;
+}
+
+/* A file read with "pread" should have its batches read one by one. */
+static int test_pipeline_pread(struct file_struct *input)
+{
+	struct record_pipeline pipeline = { 0 };
+	struct consumer_check check;
+	struct file_structor file;
+	struct file_struct in_file;
+	int ret;
+
+	if (!write_test_file_bytes(PIPELINE_TEST_FILE, input->data,
+				   input->size) ||
+	    open_file_structor(&file, PIPELINE_TEST_FILE)) {
+		return 0;
+	}
+
+	in_file.src_file = &file;
+	pipeline.batch_records = 1000;
+	check.failing_batch = SIZE_MAX;
+	ret = set_io_backend(&file, IO_BACKEND_PREAD) == FS_NO_ERROR &&
+	      run_checked(&in_file, &pipeline, &check) == FS_NO_ERROR &&
+	      !check.is_wrong && check.next == N_RECORDS;
+	close_file_structor(&file);
+	unlink(PIPELINE_TEST_FILE);
+
+	return ret;
+}
+
+#define N_PIPELINE_TESTS	6
+static int (*pipeline_tests[N_PIPELINE_TESTS])(struct file_struct *) = {
+	test_pipeline_order, test_pipeline_back_pressure, test_pipeline_error,
+	test_pipeline_pread, test_mpmc_queue, test_spsc_queue
+};
+
+int main()
+{
+	uint8_t *raw = malloc(RECORD_SIZE * N_RECORDS);
+	struct file_structor structor;
+	struct file_struct input;
+	size_t record_i, test_i;
+
+	for (record_i = 0; record_i < N_RECORDS; record_i++) {
+		uint32_t id = record_i;
+		uint64_t value = VALUE_OF(record_i);
+
+		portable_memcpy(raw + record_i * RECORD_SIZE + ID_START, &id,
+				sizeof(id), BIG_END);
+		portable_memcpy(raw + record_i * RECORD_SIZE + VALUE_START,
+				&value, sizeof(value), BIG_END);
+	}
+	if (open_memory_structor(&structor, raw, RECORD_SIZE * N_RECORDS) ||
+	    init_file_struct(&input, &structor, structor.size, 0)) {
+		printlg(ERROR_LEVEL, "Could not wrap the test records.\n");
+		return 1;
+	}
+
+	for (test_i = 0; test_i < N_PIPELINE_TESTS; test_i++) {
+		printlg(INFO_LEVEL, "Testing record pipelines: %u...\n",
+			(unsigned) test_i);
+		if (pipeline_tests[test_i](&input)) {
+			printlg(INFO_LEVEL, "Passed!\n");
+		} else {
+			printlg(ERROR_LEVEL, "Failed!\n");
+		}
+	}
+
+	teardown_file_struct(&input);
+	close_file_structor(&structor);
+	free(raw);
+
+	return 0;
+}
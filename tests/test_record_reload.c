@@ -0,0 +1,287 @@
+/* tests reloading only the changed blocks of a rewritten file */
+#include <record_reload.h>
+
+#include <logger.h>
+#include "test_common.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+/* the test file, and its replacement */
+#define RELOAD_TEST_FILE	TEST_TMP_FILE("reload")
+#define RELOAD_NEW_FILE		TEST_TMP_FILE("reload_new")
+/* the bytes before the first record */
+#define HEADER_SIZE		8
+/* each record has a big-endian 4-byte ID and value, and 4 other bytes */
+#define RECORD_SIZE		12
+#define N_RECORDS		1000
+#define BLOCK_RECORDS		100
+/* the number of threads checking blocks */
+#define N_THREADS		2
+
+/* a decoded record */
+struct decoded_record {
+	uint32_t id;
+	uint32_t value;
+};
+
+/* the number of records decoded so far */
+static size_t n_decoded;
+
+/* a "pipeline_decoder" decoding the IDs and values of a block */
+static enum fs_status
+decode_records(void *arg, struct file_struct *records, size_t record_size,
+	       size_t n_records, void *decoded)
+{
+	struct decoded_record *dst = decoded;
+	const uint8_t *data = records->data;
+	size_t record_i;
+
+	(void) arg;
+
+	for (record_i = 0; record_i < n_records; record_i++) {
+		dst[record_i].id = load_uint(data + record_i * record_size,
+					     sizeof(uint32_t), BIG_END);
+		dst[record_i].value = load_uint(data + record_i * record_size +
+						sizeof(uint32_t),
+						sizeof(uint32_t), BIG_END);
+	}
+	__atomic_fetch_add(&n_decoded, n_records, __ATOMIC_RELAXED);
+
+	return FS_NO_ERROR;
+}
+
+/* Store a big-endian 4-byte integer. */
+static void store_be32(uint8_t *dst, uint32_t value)
+{
+	dst[0] = (uint8_t) (value >> 24);
+	dst[1] = (uint8_t) (value >> 16);
+	dst[2] = (uint8_t) (value >> 8);
+	dst[3] = (uint8_t) value;
+}
+
+/* Encode a record whose value is its ID plus an offset. */
+static void encode_record(uint8_t *record, uint32_t id, uint32_t offset)
+{
+	store_be32(record, id);
+	store_be32(record + sizeof(uint32_t), id + offset);
+	memset(record + 2 * sizeof(uint32_t), 0xee,
+	       RECORD_SIZE - 2 * sizeof(uint32_t));
+}
+
+/*
+ * Write a test file, with a partial record at its end.
+ * path:	the path of the file
+ * n_records:	the number of complete records
+ * offset:	the difference between the value and ID of each record
+ * returns	1 on success; 0 otherwise
+ */
+static int write_test_file(const char *path, uint32_t n_records,
+			   uint32_t offset)
+{
+	uint8_t data[HEADER_SIZE + 2 * N_RECORDS * RECORD_SIZE] = { 0 };
+	size_t size = HEADER_SIZE + n_records * RECORD_SIZE + 5;
+	uint32_t record_i;
+
+	for (record_i = 0; record_i < n_records; record_i++) {
+		encode_record(data + HEADER_SIZE + record_i * RECORD_SIZE,
+			      record_i, offset);
+	}
+
+	return write_test_file_bytes(path, data, size);
+}
+
+/* Rewrite a record of the test file in place. */
+static int rewrite_record(uint32_t record_i, uint32_t offset)
+{
+	uint8_t record[RECORD_SIZE];
+	int fd = open(RELOAD_TEST_FILE, O_WRONLY);
+	int ret;
+
+	encode_record(record, record_i, offset);
+	ret = fd >= 0 && pwrite(fd, record, RECORD_SIZE, HEADER_SIZE +
+				record_i * RECORD_SIZE) == RECORD_SIZE;
+	if (fd >= 0) {
+		close(fd);
+	}
+
+	return ret;
+}
+
+/*
+ * Check the decoded records of a reload.
+ * reload:	the reload
+ * n_records:	the expected number of records
+ * offset:	the expected difference between the value and ID of each
+ * changed_i:	the index of a record whose value is off by one more,
+ *		or "n_records"
+ * returns	1 if the records are as expected; 0 otherwise
+ */
+static int check_records(const struct record_reload *reload,
+			 size_t n_records, uint32_t offset, size_t changed_i)
+{
+	const struct decoded_record *records = reload->decoded;
+	size_t record_i;
+
+	if (reload->n_records != n_records) {
+		printlg(ERROR_LEVEL, "There are %u records, not %u.\n",
+			(unsigned) reload->n_records, (unsigned) n_records);
+		return 0;
+	}
+	for (record_i = 0; record_i < n_records; record_i++) {
+		uint32_t expected = record_i + offset + (record_i == changed_i);
+
+		if (records[record_i].id != record_i ||
+		    records[record_i].value != expected) {
+			printlg(ERROR_LEVEL, "Record %u is wrong.\n",
+				(unsigned) record_i);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* Start a reload of the test file. */
+static int init_test_reload(struct record_reload *reload)
+{
+	reload->start_in_file = HEADER_SIZE;
+	reload->record_size = RECORD_SIZE;
+	reload->block_records = BLOCK_RECORDS;
+	reload->decoded_size = sizeof(struct decoded_record);
+	reload->decode = decode_records;
+	reload->decode_arg = NULL;
+	reload->n_threads = N_THREADS;
+	n_decoded = 0;
+
+	return write_test_file(RELOAD_TEST_FILE, N_RECORDS, 0) &&
+	       init_record_reload(reload, RELOAD_TEST_FILE) == FS_NO_ERROR;
+}
+
+/* The first load should decode every record. */
+static int test_first_load()
+{
+	struct record_reload reload;
+	int ret;
+
+	if (!init_test_reload(&reload)) {
+		return 0;
+	}
+	ret = check_records(&reload, N_RECORDS, 0, N_RECORDS) &&
+	      reload.n_changed == N_RECORDS / BLOCK_RECORDS &&
+	      n_decoded == N_RECORDS;
+	teardown_record_reload(&reload);
+
+	return ret;
+}
+
+/* Reloading an unchanged file should decode nothing. */
+static int test_unchanged()
+{
+	struct record_reload reload;
+	int ret;
+
+	if (!init_test_reload(&reload)) {
+		return 0;
+	}
+	n_decoded = 0;
+	ret = reload_records(&reload, 0) == FS_NO_ERROR &&
+	      reload_records(&reload, RELOAD_FORCE) == FS_NO_ERROR &&
+	      reload.n_changed == 0 && n_decoded == 0 &&
+	      check_records(&reload, N_RECORDS, 0, N_RECORDS);
+	teardown_record_reload(&reload);
+
+	return ret;
+}
+
+/*
+ * Rewriting a record in place should only decode its block,
+ * even if the file's modification time has not moved on since the load.
+ */
+static int test_rewrite_in_place()
+{
+	const uint32_t changed_i = 5 * BLOCK_RECORDS + 7;
+	struct record_reload reload;
+	int ret;
+
+	if (!init_test_reload(&reload) || !rewrite_record(changed_i, 1)) {
+		return 0;
+	}
+	n_decoded = 0;
+	ret = reload_records(&reload, 0) == FS_NO_ERROR &&
+	      reload.n_changed == 1 && reload.is_changed[5] &&
+	      !reload.is_changed[4] && n_decoded == BLOCK_RECORDS &&
+	      check_records(&reload, N_RECORDS, 0, changed_i);
+	teardown_record_reload(&reload);
+
+	return ret;
+}
+
+/* Records appended to the file should be decoded, and only them. */
+static int test_append()
+{
+	const uint32_t n_appended = BLOCK_RECORDS + BLOCK_RECORDS / 2;
+	struct record_reload reload;
+	int ret;
+
+	if (!init_test_reload(&reload) ||
+	    !write_test_file(RELOAD_TEST_FILE, N_RECORDS + n_appended, 0)) {
+		return 0;
+	}
+	n_decoded = 0;
+	ret = reload_records(&reload, 0) == FS_NO_ERROR &&
+	      reload.n_changed == 2 && n_decoded == n_appended &&
+	      check_records(&reload, N_RECORDS + n_appended, 0,
+			    N_RECORDS + n_appended);
+	teardown_record_reload(&reload);
+
+	return ret;
+}
+
+/* A file replaced by another should be compared block by block. */
+static int test_replaced()
+{
+	const uint32_t changed_i = 2 * BLOCK_RECORDS;
+	struct record_reload reload;
+	int ret;
+
+	if (!init_test_reload(&reload) ||
+	    !write_test_file(RELOAD_NEW_FILE, N_RECORDS, 0) ||
+	    rename(RELOAD_NEW_FILE, RELOAD_TEST_FILE) ||
+	    !rewrite_record(changed_i, 1)) {
+		return 0;
+	}
+	n_decoded = 0;
+	ret = reload_records(&reload, 0) == FS_NO_ERROR &&
+	      reload.n_changed == 1 && reload.is_changed[2] &&
+	      check_records(&reload, N_RECORDS, 0, changed_i);
+	teardown_record_reload(&reload);
+
+	return ret;
+}
+
+#define N_RELOAD_TESTS	5
+static int (*reload_tests[N_RELOAD_TESTS])() = {
+	test_first_load, test_unchanged, test_rewrite_in_place, test_append,
+	test_replaced
+};
+
+int main()
+{
+	size_t test_i;
+
+	for (test_i = 0; test_i < N_RELOAD_TESTS; test_i++) {
+		printlg(INFO_LEVEL, "Testing reloading records: %u...\n",
+			(unsigned) test_i);
+		if (reload_tests[test_i]()) {
+			printlg(INFO_LEVEL, "Passed!\n");
+		} else {
+			printlg(ERROR_LEVEL, "Failed!\n");
+		}
+	}
+
+	unlink(RELOAD_TEST_FILE);
+
+	return 0;
+}
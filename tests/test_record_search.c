@@ -0,0 +1,208 @@
+/* tests searching a sorted array of records */
+#include <record_search.h>
+
+#include <logger.h>
+
+/*
+ * The test file holds "N_RECORDS" records of a big-endian signed 4-byte key,
+ * followed by a little-endian 4-byte payload with the record's index.
+ * The key of record i is (i / 3) * 2 - 300,
+ * so that each even key from -300 appears three times.
+ */
+#define SORTED_TEST_FILE	"test_inputs/sorted_test"
+#define N_RECORDS		1000
+#define RECORD_SIZE		8
+/* a number of samples that does not divide the number of records */
+#define N_SAMPLES		37
+
+static const struct fs_int_field key_field = { 0, 4, BIG_END, 1 };
+
+/* the key of each record in the test file */
+static int64_t record_key(size_t record_i)
+{
+	return (int64_t) (record_i / 3) * 2 - 300;
+}
+
+/* the lower and upper bounds of a value, found by brute force */
+static size_t naive_lower_bound(int64_t value)
+{
+	size_t record_i = 0;
+
+	while (record_i < N_RECORDS && record_key(record_i) < value) {
+		record_i++;
+	}
+	return record_i;
+}
+static size_t naive_upper_bound(int64_t value)
+{
+	size_t record_i = 0;
+
+	while (record_i < N_RECORDS && record_key(record_i) <= value) {
+		record_i++;
+	}
+	return record_i;
+}
+
+/*
+ * Search for every key, every value between keys,
+ * and values beyond both ends, comparing with brute force.
+ * sorted:	the sorted test file
+ * returns	1 if every search matched; 0 otherwise
+ */
+static int test_bounds(struct sorted_records *sorted)
+{
+	int64_t value;
+	int ret = 1;
+
+	for (value = -310; value <= record_key(N_RECORDS - 1) + 10; value++) {
+		size_t lower = sorted_lower_bound(sorted, value);
+		size_t upper = sorted_upper_bound(sorted, value);
+
+		if (lower != naive_lower_bound(value) ||
+		    upper != naive_upper_bound(value)) {
+			printlg(ERROR_LEVEL,
+				"Bounds of %d were %u-%u, instead of %u-%u.\n",
+				(int) value, (unsigned) lower, (unsigned) upper,
+				(unsigned) naive_lower_bound(value),
+				(unsigned) naive_upper_bound(value));
+			ret = 0;
+		}
+	}
+
+	return ret;
+}
+
+/*
+ * Find single keys and ranges, and check the payloads of the results.
+ * sorted:	the sorted test file
+ * returns	1 if every result matched; 0 otherwise
+ */
+static int test_find_and_range(struct sorted_records *sorted)
+{
+	struct file_struct record;
+	uint32_t payload = 0;
+	size_t index, first, end;
+
+	if (!sorted_find(sorted, 40, &index) || index != 510) {
+		printlg(ERROR_LEVEL, "Key 40 was not found at 510.\n");
+		return 0;
+	}
+	derive_file_struct(&record, &sorted->records, RECORD_SIZE,
+			   index * RECORD_SIZE);
+	copy_section_at(&payload, 0, &record, 4, sizeof(payload), LITTLE_END);
+	if (payload != 510) {
+		printlg(ERROR_LEVEL, "Record 510 had payload %u.\n",
+			(unsigned) payload);
+		return 0;
+	}
+
+	if (sorted_find(sorted, 41, &index) || index != 513) {
+		printlg(ERROR_LEVEL, "Key 41 was found, or misplaced.\n");
+		return 0;
+	}
+
+	sorted_range(sorted, (uint64_t) -5, 5, &first, &end);
+	if (first != naive_lower_bound(-5) || end != naive_upper_bound(5) ||
+	    end - first != 15) {
+		printlg(ERROR_LEVEL, "Range -5-5 was %u-%u.\n",
+			(unsigned) first, (unsigned) end);
+		return 0;
+	}
+
+	sorted_range(sorted, 5, (uint64_t) -5, &first, &end);
+	if (first != end) {
+		printlg(ERROR_LEVEL, "The empty range 5 to -5 had records.\n");
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Searches should work with one sample, and with a sample of every record.
+ * sorted:	the sorted test file, which is reinitialized
+ * returns	1 if both sample sizes worked; 0 otherwise
+ */
+static int test_sample_sizes(struct sorted_records *sorted)
+{
+	struct file_structor *structor = sorted->records.src_file;
+	size_t n_samples[] = { 1, N_RECORDS };
+	size_t size_i;
+	int ret = 1;
+
+	for (size_i = 0; size_i < sizeof(n_samples) / sizeof(*n_samples);
+	     size_i++) {
+		teardown_sorted_records(sorted);
+		if (init_sorted_records(sorted, structor, 0, RECORD_SIZE,
+					N_RECORDS, &key_field,
+					n_samples[size_i])) {
+			printlg(ERROR_LEVEL, "Could not sample %u keys.\n",
+				(unsigned) n_samples[size_i]);
+			return 0;
+		}
+		ret &= test_bounds(sorted);
+	}
+
+	return ret;
+}
+
+/*
+ * A key field outside of the record should be rejected.
+ * sorted:	the sorted test file
+ * returns	1 if the error was caught; 0 otherwise
+ */
+static int test_key_out_of_record(struct sorted_records *sorted)
+{
+	struct fs_int_field far_key = { 6, 4, LITTLE_END, 0 };
+	struct sorted_records bad;
+	enum fs_status status;
+
+	if ((status = init_sorted_records(&bad, sorted->records.src_file, 0,
+					  RECORD_SIZE, N_RECORDS, &far_key,
+					  0)) != FSERR_OUT_OF_STRUCT) {
+		printlg(ERROR_LEVEL, "Expected error %d, but got %d.\n",
+			FSERR_OUT_OF_STRUCT, status);
+		if (status == FS_NO_ERROR) {
+			teardown_sorted_records(&bad);
+		}
+		return 0;
+	}
+
+	return 1;
+}
+
+#define N_RECORD_SEARCH_TESTS	4
+static int (*record_search_tests[N_RECORD_SEARCH_TESTS])
+	(struct sorted_records *) = {
+	test_bounds, test_find_and_range, test_key_out_of_record,
+	test_sample_sizes
+};
+
+int main()
+{
+	struct file_structor structor;
+	struct sorted_records sorted;
+	size_t test_i;
+
+	if (open_file_structor(&structor, SORTED_TEST_FILE) ||
+	    init_sorted_records(&sorted, &structor, 0, RECORD_SIZE, N_RECORDS,
+				&key_field, N_SAMPLES)) {
+		printlg(ERROR_LEVEL, "Could not map %s.\n", SORTED_TEST_FILE);
+		return 1;
+	}
+
+	for (test_i = 0; test_i < N_RECORD_SEARCH_TESTS; test_i++) {
+		printlg(INFO_LEVEL, "Testing sorted searches: %u...\n",
+			(unsigned) test_i);
+		if (record_search_tests[test_i](&sorted)) {
+			printlg(INFO_LEVEL, "Passed!\n");
+		} else {
+			printlg(ERROR_LEVEL, "Failed!\n");
+		}
+	}
+
+	teardown_sorted_records(&sorted);
+	close_file_structor(&structor);
+
+	return 0;
+}
@@ -0,0 +1,204 @@
+/* tests sorting record files by a key field */
+#include <record_sort.h>
+#include <fs_common.h>
+
+#include <logger.h>
+#include "test_common.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* the sorted file */
+#define SORT_TEST_FILE		TEST_TMP_FILE("sort")
+/*
+ * Each record has a native 4-byte index, a big-endian signed 3-byte key,
+ * and 6 bytes derived from the index, with no padding in between.
+ */
+#define INDEX_START		0
+#define KEY_START		4
+#define KEY_WIDTH		3
+#define TAIL_START		(KEY_START + KEY_WIDTH)
+#define RECORD_SIZE		13
+/* the threads sorting runs */
+#define N_THREADS		2
+/* the records in each run of the smallest budget, on "N_THREADS" threads */
+#define RUN_RECORDS		\
+	(SORT_MIN_BUDGET / N_THREADS / (2 * RECORD_SIZE + 2 * 16))
+/* enough records for several runs and a partial one */
+#define N_RECORDS		(4 * RUN_RECORDS + RUN_RECORDS / 2)
+/* the keys are between -KEY_RANGE and KEY_RANGE, so many are equal */
+#define KEY_RANGE		5000
+
+static const struct fs_int_field record_key = {
+	KEY_START, KEY_WIDTH, BIG_END, 1
+};
+
+/*
+ * Generate records with random keys.
+ * n_records:	the number of records
+ * returns	the records, to be freed, or NULL
+ */
+static uint8_t *generate_records(uint32_t n_records)
+{
+	uint8_t *records = malloc((size_t) n_records * RECORD_SIZE);
+	uint32_t state = 12345, record_i;
+
+	if (records == NULL) {
+		return NULL;
+	}
+	for (record_i = 0; record_i < n_records; record_i++) {
+		uint8_t *record = records + (size_t) record_i * RECORD_SIZE;
+		int32_t key;
+
+		state = state * 1103515245 + 12345;
+		key = (int32_t) ((state >> 8) % (2 * KEY_RANGE + 1)) -
+		      KEY_RANGE;
+		memcpy(record + INDEX_START, &record_i, sizeof(record_i));
+		record[KEY_START] = (uint8_t) (key >> 16);
+		record[KEY_START + 1] = (uint8_t) (key >> 8);
+		record[KEY_START + 2] = (uint8_t) key;
+		memset(record + TAIL_START, (uint8_t) (record_i * 7),
+		       RECORD_SIZE - TAIL_START);
+	}
+
+	return records;
+}
+
+/*
+ * Sort records in memory into the test file, and check the file.
+ * n_records:	the number of records
+ * budget:	the memory budget of the sort
+ * returns	1 if the file holds every record, ordered by key,
+ *		with equal keys in their original order; 0 otherwise
+ */
+static int check_sort(uint32_t n_records, size_t budget)
+{
+	uint8_t *records = generate_records(n_records);
+	uint8_t *seen = calloc(n_records, 1);
+	struct file_structor src, sorted;
+	struct file_struct output;
+	const uint8_t *data;
+	uint32_t record_i, index, last_index = 0;
+	int64_t key, last_key = INT64_MIN;
+	int ret = 0;
+
+	if (records == NULL || seen == NULL) {
+		goto out;
+	}
+	open_memory_structor(&src, records, (size_t) n_records * RECORD_SIZE);
+	if (sort_record_file(&src, 0, RECORD_SIZE, n_records, &record_key,
+			     budget, N_THREADS, SORT_TEST_FILE)) {
+		printlg(ERROR_LEVEL, "Unable to sort the records.\n");
+		goto close_src;
+	}
+	if (access(SORT_TEST_FILE SORT_RUNS_SUFFIX, F_OK) == 0 ||
+	    access(SORT_TEST_FILE TMP_SUFFIX, F_OK) == 0) {
+		printlg(ERROR_LEVEL, "The runs were not removed.\n");
+		goto close_src;
+	}
+	if (open_file_structor(&sorted, SORT_TEST_FILE)) {
+		goto close_src;
+	}
+	if (sorted.size != (off_t) n_records * RECORD_SIZE ||
+	    init_file_struct(&output, &sorted, sorted.size, 0)) {
+		printlg(ERROR_LEVEL, "The sorted file has the wrong size.\n");
+		goto close_sorted;
+	}
+	data = output.data;
+
+	for (record_i = 0; record_i < n_records; record_i++) {
+		const uint8_t *record = data + (size_t) record_i * RECORD_SIZE;
+
+		memcpy(&index, record + INDEX_START, sizeof(index));
+		key = (int64_t) load_int_field(record, &record_key);
+		if (index >= n_records || seen[index] ||
+		    memcmp(record, records + (size_t) index * RECORD_SIZE,
+			   RECORD_SIZE)) {
+			printlg(ERROR_LEVEL, "Record %u is not an input.\n",
+				(unsigned) record_i);
+			goto teardown;
+		}
+		if (key < last_key ||
+		    (key == last_key && index < last_index)) {
+			printlg(ERROR_LEVEL, "Record %u is out of order.\n",
+				(unsigned) record_i);
+			goto teardown;
+		}
+		seen[index] = 1;
+		last_key = key;
+		last_index = index;
+	}
+	ret = 1;
+
+teardown:
+	teardown_file_struct(&output);
+close_sorted:
+	close_file_structor(&sorted);
+close_src:
+	close_file_structor(&src);
+out:
+	free(records);
+	free(seen);
+
+	return ret;
+}
+
+/* Records in several runs should be merged in order. */
+static int test_sort_runs()
+{
+	return check_sort(N_RECORDS, 0);
+}
+
+/* Records that fit in a single run should be sorted straight. */
+static int test_sort_one_run()
+{
+	return check_sort(N_RECORDS, 64 * SORT_MIN_BUDGET);
+}
+
+/* A key outside of the records should be an error. */
+static int test_key_outside()
+{
+	const struct fs_int_field bad_key = {
+		RECORD_SIZE - 2, KEY_WIDTH, BIG_END, 0
+	};
+	uint8_t records[4 * RECORD_SIZE] = { 0 };
+	struct file_structor src;
+	enum fs_status status;
+	int ret;
+
+	open_memory_structor(&src, records, sizeof(records));
+	status = sort_record_file(&src, 0, RECORD_SIZE, 4, &bad_key, 0,
+				  N_THREADS, SORT_TEST_FILE);
+	ret = status == FSERR_OUT_OF_STRUCT &&
+	      sort_record_file(&src, 0, RECORD_SIZE, 5, &record_key, 0,
+			       N_THREADS, SORT_TEST_FILE) == FSERR_OUT_OF_FILE;
+	close_file_structor(&src);
+
+	return ret;
+}
+
+#define N_SORT_TESTS	3
+static int (*sort_tests[N_SORT_TESTS])() = {
+	test_sort_runs, test_sort_one_run, test_key_outside
+};
+
+int main()
+{
+	size_t test_i;
+
+	for (test_i = 0; test_i < N_SORT_TESTS; test_i++) {
+		printlg(INFO_LEVEL, "Testing sorting records: %u...\n",
+			(unsigned) test_i);
+		if (sort_tests[test_i]()) {
+			printlg(INFO_LEVEL, "Passed!\n");
+		} else {
+			printlg(ERROR_LEVEL, "Failed!\n");
+		}
+	}
+
+	unlink(SORT_TEST_FILE);
+
+	return 0;
+}
@@ -0,0 +1,282 @@
+/* tests scanning records within a memory budget */
+#include <stream_scan.h>
+
+#include <io_backend.h>
+#include <logger.h>
+#include "test_common.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define STREAM_TEST_FILE	TEST_TMP_FILE("stream")
+/* a record size that does not divide the page size */
+#define RECORD_SIZE		24
+/* enough records for a dozen batches at the smallest budget */
+#define N_RECORDS		(3 * STREAM_MIN_BUDGET / RECORD_SIZE)
+
+/*
+ * Write the test file, where each record starts with its index.
+ * returns	1 on success; 0 otherwise
+ */
+static int write_test_file()
+{
+	uint8_t *data = calloc(N_RECORDS, RECORD_SIZE);
+	uint32_t record_i;
+	int fd, ret;
+
+	if (data == NULL) {
+		return 0;
+	}
+	for (record_i = 0; record_i < N_RECORDS; record_i++) {
+		memcpy(data + record_i * RECORD_SIZE, &record_i,
+		       sizeof(record_i));
+	}
+	ret = write_test_file_bytes(STREAM_TEST_FILE, data,
+				    N_RECORDS * RECORD_SIZE);
+	free(data);
+	if (!ret || (fd = open(STREAM_TEST_FILE, O_RDONLY)) < 0) {
+		return 0;
+	}
+
+	/*
+	 * Dirty pages would not be dropped from the page cache,
+	 * and written pages may be cached in folios larger than the budget,
+	 * so the scan reads the file back as if it were cold.
+	 */
+	ret = fsync(fd) == 0 &&
+	      posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+	close(fd);
+
+	return ret;
+}
+
+/*
+ * Count the pages of the file that are in the page cache.
+ * scan:	the scan of the file
+ * end:		the location in the records up to which to count
+ * returns	the number of resident pages
+ */
+static size_t count_resident(struct stream_scan *scan, size_t end)
+{
+	const size_t page_size = sysconf(_SC_PAGE_SIZE);
+	uint8_t *mapping_start = scan->records.mapping_start;
+	size_t length = (uint8_t *) scan->records.data + end - mapping_start;
+	size_t n_pages = length / page_size, page_i, n_resident = 0;
+	unsigned char *residency = malloc(n_pages + 1);
+
+	if (residency == NULL ||
+	    mincore(mapping_start, n_pages * page_size, residency)) {
+		free(residency);
+		return (size_t) -1;
+	}
+	for (page_i = 0; page_i < n_pages; page_i++) {
+		n_resident += residency[page_i] & 1;
+	}
+	free(residency);
+
+	return n_resident;
+}
+
+/*
+ * Scan every record, checking that each is returned once, in order,
+ * in batches of at most a quarter of the budget,
+ * and that the pages behind each batch are dropped.
+ * structor:	the test file
+ * returns	1 if the scan matched; 0 otherwise
+ */
+static int test_bounded_scan(struct file_structor *structor)
+{
+	struct stream_scan scan;
+	struct file_struct batch;
+	uint32_t expected = 0;
+	size_t n_batch;
+	int ret = 1;
+
+	if (init_stream_scan(&scan, structor, 0, RECORD_SIZE, N_RECORDS, 0,
+			     STREAM_DROP_CACHE)) {
+		return 0;
+	}
+
+	while ((n_batch = stream_scan_next(&scan, &batch)) > 0) {
+		size_t record_i, n_behind;
+
+		if (n_batch * RECORD_SIZE > STREAM_MIN_BUDGET / 4) {
+			printlg(ERROR_LEVEL, "A batch had %u records.\n",
+				(unsigned) n_batch);
+			ret = 0;
+		}
+		for (record_i = 0; record_i < n_batch; record_i++) {
+			uint32_t index = 0;
+
+			copy_section_at(&index, 0, &batch,
+					record_i * RECORD_SIZE, sizeof(index),
+					machine_endianness());
+			if (index != expected++) {
+				printlg(ERROR_LEVEL,
+					"Record %u came in place of %u.\n",
+					(unsigned) index,
+					(unsigned) (expected - 1));
+				ret = 0;
+			}
+		}
+
+		n_behind = count_resident(&scan, scan.released);
+		if (n_behind > 1) {
+			printlg(ERROR_LEVEL,
+				"%u released pages were still resident.\n",
+				(unsigned) n_behind);
+			ret = 0;
+		}
+	}
+
+	if (expected != N_RECORDS || scan.released + RECORD_SIZE <
+	    scan.records.size - sysconf(_SC_PAGE_SIZE)) {
+		printlg(ERROR_LEVEL,
+			"The scan ended after %u records, with %u bytes "
+			"released.\n", (unsigned) expected,
+			(unsigned) scan.released);
+		ret = 0;
+	}
+
+	teardown_stream_scan(&scan);
+
+	return ret;
+}
+
+/*
+ * A scan starting in the middle of a page should return its records.
+ * structor:	the test file
+ * returns	1 if the records matched; 0 otherwise
+ */
+static int test_unaligned_start(struct file_structor *structor)
+{
+	struct stream_scan scan;
+	struct file_struct batch;
+	uint32_t expected = 1000;
+	size_t n_batch;
+	int ret = 1;
+
+	if (init_stream_scan(&scan, structor, expected * RECORD_SIZE,
+			     RECORD_SIZE, N_RECORDS - expected,
+			     STREAM_MIN_BUDGET * 2, 0)) {
+		return 0;
+	}
+
+	while ((n_batch = stream_scan_next(&scan, &batch)) > 0) {
+		uint32_t first = 0, last = 0;
+
+		copy_section_at(&first, 0, &batch, 0, sizeof(first),
+				machine_endianness());
+		copy_section_at(&last, 0, &batch,
+				(n_batch - 1) * RECORD_SIZE, sizeof(last),
+				machine_endianness());
+		if (first != expected || last != expected + n_batch - 1) {
+			printlg(ERROR_LEVEL,
+				"A batch held records %u-%u, not from %u.\n",
+				(unsigned) first, (unsigned) last,
+				(unsigned) expected);
+			ret = 0;
+		}
+		expected += n_batch;
+	}
+
+	if (expected != N_RECORDS) {
+		printlg(ERROR_LEVEL, "The scan ended at record %u.\n",
+			(unsigned) expected);
+		ret = 0;
+	}
+
+	teardown_stream_scan(&scan);
+
+	return ret;
+}
+
+/*
+ * A file read with "pread" should be read one batch at a time,
+ * rather than copied whole into memory.
+ * structor:	the test file
+ * returns	1 if the records matched within the budget; 0 otherwise
+ */
+static int test_pread_batches(struct file_structor *structor)
+{
+	struct stream_scan scan;
+	struct file_struct batch;
+	uint32_t expected = 0;
+	size_t n_batch;
+	int ret = 1;
+
+	if (set_io_backend(structor, IO_BACKEND_PREAD) ||
+	    init_stream_scan(&scan, structor, 0, RECORD_SIZE, N_RECORDS, 0,
+			     STREAM_DROP_CACHE)) {
+		set_io_backend(structor, IO_BACKEND_MMAP);
+		return 0;
+	}
+
+	while ((n_batch = stream_scan_next(&scan, &batch)) > 0) {
+		size_t record_i;
+
+		if (scan.records.size > STREAM_MIN_BUDGET / 4 ||
+		    scan.records.backend->kind != IO_BACKEND_PREAD) {
+			printlg(ERROR_LEVEL, "A batch read %u bytes.\n",
+				(unsigned) scan.records.size);
+			ret = 0;
+		}
+		for (record_i = 0; record_i < n_batch; record_i++) {
+			uint32_t index = 0;
+
+			copy_section_at(&index, 0, &batch,
+					record_i * RECORD_SIZE, sizeof(index),
+					machine_endianness());
+			ret &= index == expected++;
+		}
+	}
+
+	if (expected != N_RECORDS || scan.status ||
+	    scan.records.data != NULL) {
+		printlg(ERROR_LEVEL, "The scan ended at record %u.\n",
+			(unsigned) expected);
+		ret = 0;
+	}
+
+	teardown_stream_scan(&scan);
+	set_io_backend(structor, IO_BACKEND_MMAP);
+
+	return ret;
+}
+
+#define N_STREAM_SCAN_TESTS	3
+static int (*stream_scan_tests[N_STREAM_SCAN_TESTS])(struct file_structor *) =
+{
+	test_bounded_scan, test_unaligned_start, test_pread_batches
+};
+
+int main()
+{
+	struct file_structor structor;
+	size_t test_i;
+
+	if (!write_test_file() ||
+	    open_file_structor(&structor, STREAM_TEST_FILE)) {
+		printlg(ERROR_LEVEL, "Could not create %s.\n",
+			STREAM_TEST_FILE);
+		return 1;
+	}
+
+	for (test_i = 0; test_i < N_STREAM_SCAN_TESTS; test_i++) {
+		printlg(INFO_LEVEL, "Testing bounded scans: %u...\n",
+			(unsigned) test_i);
+		if (stream_scan_tests[test_i](&structor)) {
+			printlg(INFO_LEVEL, "Passed!\n");
+		} else {
+			printlg(ERROR_LEVEL, "Failed!\n");
+		}
+	}
+
+	close_file_structor(&structor);
+	unlink(STREAM_TEST_FILE);
+
+	return 0;
+}
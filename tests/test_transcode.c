@@ -0,0 +1,310 @@
+/* tests transcoding big-endian files into native-endian sidecars */
+#include <transcode.h>
+
+#include <logger.h>
+#include "test_common.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TRANSCODE_TEST_FILE	TEST_TMP_FILE("transcode")
+/* the bytes before the first record */
+#define HEADER_SIZE		16
+/*
+ * Each record has a big-endian 4-byte ID, an array of 3 big-endian
+ * 2-byte values, a 1-byte tag and a little-endian 4-byte weight,
+ * with no padding in between.
+ */
+#define ID_START		0
+#define VALUES_START		4
+#define N_VALUES		3
+#define TAG_START		(VALUES_START + N_VALUES * sizeof(uint16_t))
+#define WEIGHT_START		(TAG_START + 1)
+#define RECORD_SIZE		(WEIGHT_START + sizeof(uint32_t))
+/* the number of records, followed by a partial record */
+#define N_RECORDS		100000
+#define PARTIAL_SIZE		5
+
+/* the fields put in machine order by the transcoding */
+static const struct member_layout record_members[] = {
+	{ ID_START, 0, sizeof(uint32_t), sizeof(uint32_t), BIG_END,
+	  MEMBER_BYTES, 0 },
+	{ VALUES_START, 0, N_VALUES * sizeof(uint16_t), sizeof(uint16_t),
+	  BIG_END, MEMBER_BYTES, 0 },
+	{ WEIGHT_START, 0, sizeof(uint32_t), sizeof(uint32_t), LITTLE_END,
+	  MEMBER_BYTES, 0 },
+};
+static const struct transcode_layout record_layout = {
+	HEADER_SIZE, RECORD_SIZE, record_members,
+	sizeof(record_members) / sizeof(*record_members)
+};
+/* the same records, read by a caller that does not know about the weight */
+static const struct transcode_layout other_layout = {
+	HEADER_SIZE, RECORD_SIZE, record_members,
+	sizeof(record_members) / sizeof(*record_members) - 1
+};
+
+/* the raw byte at a location of the file outside of every field */
+#define RAW_BYTE(location)	((uint8_t) ((location) * 7 + 3))
+
+/*
+ * Store the low bytes of an integer in a byte order.
+ * dst:		the destination
+ * value:	the integer
+ * width:	the number of bytes to store
+ * endianness:	the byte order to store them in
+ */
+static void
+put_bytes(uint8_t *dst, uint64_t value, size_t width,
+	  enum endianness endianness)
+{
+	size_t byte_i;
+
+	for (byte_i = 0; byte_i < width; byte_i++) {
+		uint8_t byte = (uint8_t) (value >> (8 * byte_i));
+
+		if (endianness == LITTLE_END) {
+			dst[byte_i] = byte;
+		} else {
+			dst[width - 1 - byte_i] = byte;
+		}
+	}
+}
+
+/*
+ * Write the test file, replacing any file there.
+ * n_extra:	the number of whole records to add after "N_RECORDS",
+ *		before the partial record
+ * returns	1 on success; 0 otherwise
+ */
+static int write_test_file(size_t n_extra)
+{
+	size_t size = HEADER_SIZE + (N_RECORDS + n_extra) * RECORD_SIZE +
+		      PARTIAL_SIZE;
+	uint8_t *bytes = malloc(size);
+	size_t byte_i, record_i;
+	int ret;
+
+	if (bytes == NULL) {
+		return 0;
+	}
+	for (byte_i = 0; byte_i < size; byte_i++) {
+		bytes[byte_i] = RAW_BYTE(byte_i);
+	}
+	for (record_i = 0; record_i < N_RECORDS + n_extra; record_i++) {
+		uint8_t *record = bytes + HEADER_SIZE + record_i * RECORD_SIZE;
+		unsigned value_i;
+
+		put_bytes(record + ID_START, record_i * 2654435761u,
+			  sizeof(uint32_t), BIG_END);
+		for (value_i = 0; value_i < N_VALUES; value_i++) {
+			put_bytes(record + VALUES_START +
+				  value_i * sizeof(uint16_t),
+				  record_i + value_i * 1000, sizeof(uint16_t),
+				  BIG_END);
+		}
+		put_bytes(record + WEIGHT_START, record_i * 3,
+			  sizeof(uint32_t), LITTLE_END);
+	}
+
+	ret = write_test_file_bytes(TRANSCODE_TEST_FILE, bytes, size);
+	free(bytes);
+
+	return ret;
+}
+
+/*
+ * Check every byte of an opened test file,
+ * reading the fields in the byte order the wrapper says they are in.
+ * file:	the opened test file or sidecar
+ * n_records:	the number of whole records in the file
+ * returns	1 if every byte is correct; 0 otherwise
+ */
+static int check_file(struct file_structor *file, size_t n_records)
+{
+	const enum endianness id_order =
+		native_member_endianness(file, &record_members[0]);
+	const enum endianness value_order =
+		native_member_endianness(file, &record_members[1]);
+	const enum endianness weight_order =
+		native_member_endianness(file, &record_members[2]);
+	off_t records_end = HEADER_SIZE + n_records * RECORD_SIZE;
+	struct file_struct whole;
+	const uint8_t *bytes;
+	size_t record_i;
+	off_t byte_i;
+	int ret = 1;
+
+	if (file->size != records_end + PARTIAL_SIZE ||
+	    init_file_struct(&whole, file, file->size, 0)) {
+		printlg(ERROR_LEVEL, "The file has %lld bytes.\n",
+			(long long) file->size);
+		return 0;
+	}
+	bytes = whole.data;
+
+	for (byte_i = 0; byte_i < HEADER_SIZE; byte_i++) {
+		ret &= bytes[byte_i] == RAW_BYTE(byte_i);
+	}
+	for (byte_i = records_end; byte_i < file->size; byte_i++) {
+		ret &= bytes[byte_i] == RAW_BYTE(byte_i);
+	}
+	for (record_i = 0; ret && record_i < n_records; record_i++) {
+		const uint8_t *record = bytes + HEADER_SIZE +
+					record_i * RECORD_SIZE;
+		unsigned value_i;
+
+		ret &= load_uint(record + ID_START, sizeof(uint32_t),
+				 id_order) ==
+		       (uint32_t) (record_i * 2654435761u);
+		for (value_i = 0; value_i < N_VALUES; value_i++) {
+			ret &= load_uint(record + VALUES_START +
+					 value_i * sizeof(uint16_t),
+					 sizeof(uint16_t), value_order) ==
+			       (uint16_t) (record_i + value_i * 1000);
+		}
+		ret &= record[TAG_START] ==
+		       RAW_BYTE(HEADER_SIZE + record_i * RECORD_SIZE +
+				TAG_START);
+		ret &= load_uint(record + WEIGHT_START, sizeof(uint32_t),
+				 weight_order) == record_i * 3;
+		if (!ret) {
+			printlg(ERROR_LEVEL, "Record %u is wrong.\n",
+				(unsigned) record_i);
+		}
+	}
+	teardown_file_struct(&whole);
+
+	return ret;
+}
+
+/*
+ * Open the test file with "open_native_file_structor", and check it.
+ * layout:	the layout to open the file with
+ * is_native:	1 if the sidecar should be opened; 0 otherwise
+ * n_records:	the number of whole records in the file
+ * returns	1 if the file is opened as expected and correct,
+ *		also after refreshing its size
+ */
+static int check_opened(const struct transcode_layout *layout, int is_native,
+			size_t n_records)
+{
+	struct file_structor file;
+	off_t size;
+	int ret;
+
+	if (open_native_file_structor(&file, TRANSCODE_TEST_FILE, layout)) {
+		return 0;
+	}
+	if (file.is_native != is_native) {
+		printlg(ERROR_LEVEL, "Expected the %s, but opened the %s.\n",
+			is_native ? "sidecar" : "source",
+			file.is_native ? "sidecar" : "source");
+		close_file_structor(&file);
+		return 0;
+	}
+	size = file.size;
+	ret = check_file(&file, n_records) &&
+	      refresh_file_structor(&file) == FS_NO_ERROR &&
+	      file.size == size && check_file(&file, n_records);
+	close_file_structor(&file);
+
+	return ret;
+}
+
+/* The sidecar should be opened in place of the file once transcoded. */
+static int test_transcode_opens_sidecar()
+{
+	if (!write_test_file(0) ||
+	    !check_opened(&record_layout, 0, N_RECORDS)) {
+		return 0;
+	}
+	if (transcode_file(TRANSCODE_TEST_FILE, &record_layout, 0)) {
+		printlg(ERROR_LEVEL, "Unable to transcode the file.\n");
+		return 0;
+	}
+
+	return check_opened(&record_layout, 1, N_RECORDS);
+}
+
+/* Transcoding again with the same layout should leave the sidecar alone. */
+static int test_transcode_once()
+{
+	struct stat before, after;
+
+	if (stat(TRANSCODE_TEST_FILE NATIVE_SIDECAR_SUFFIX, &before) ||
+	    transcode_file(TRANSCODE_TEST_FILE, &record_layout, 0) ||
+	    stat(TRANSCODE_TEST_FILE NATIVE_SIDECAR_SUFFIX, &after)) {
+		return 0;
+	}
+	if (before.st_ino != after.st_ino ||
+	    before.st_mtim.tv_sec != after.st_mtim.tv_sec ||
+	    before.st_mtim.tv_nsec != after.st_mtim.tv_nsec) {
+		printlg(ERROR_LEVEL, "The valid sidecar was rewritten.\n");
+		return 0;
+	}
+
+	return 1;
+}
+
+/* "open_file_structor" should ignore the sidecar. */
+static int test_open_source_only()
+{
+	struct file_structor file;
+	int ret;
+
+	if (open_file_structor(&file, TRANSCODE_TEST_FILE)) {
+		return 0;
+	}
+	ret = !file.is_native && check_file(&file, N_RECORDS);
+	close_file_structor(&file);
+
+	return ret;
+}
+
+/* A sidecar should not be opened for a layout it was not built with. */
+static int test_other_layout()
+{
+	return check_opened(&other_layout, 0, N_RECORDS);
+}
+
+/* A sidecar should stop being used once its source file changes. */
+static int test_stale_sidecar()
+{
+	if (!write_test_file(10) ||
+	    !check_opened(&record_layout, 0, N_RECORDS + 10)) {
+		return 0;
+	}
+	if (transcode_file(TRANSCODE_TEST_FILE, &record_layout, 0)) {
+		printlg(ERROR_LEVEL, "Unable to transcode the file again.\n");
+		return 0;
+	}
+
+	return check_opened(&record_layout, 1, N_RECORDS + 10);
+}
+
+#define N_TRANSCODE_TESTS	5
+static int (*transcode_tests[N_TRANSCODE_TESTS])() = {
+	test_transcode_opens_sidecar, test_transcode_once,
+	test_open_source_only, test_other_layout, test_stale_sidecar
+};
+
+int main()
+{
+	size_t test_i;
+
+	for (test_i = 0; test_i < N_TRANSCODE_TESTS; test_i++) {
+		printlg(INFO_LEVEL, "Testing transcoding: %u...\n",
+			(unsigned) test_i);
+		if (transcode_tests[test_i]()) {
+			printlg(INFO_LEVEL, "Passed!\n");
+		} else {
+			printlg(ERROR_LEVEL, "Failed!\n");
+		}
+	}
+
+	remove_native_sidecar(TRANSCODE_TEST_FILE);
+	unlink(TRANSCODE_TEST_FILE);
+
+	return 0;
+}
@@ -0,0 +1,378 @@
+/* tests building zone maps and skipping blocks in range scans */
+#include <zone_map.h>
+
+#include <logger.h>
+#include "test_common.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define ZONE_TEST_FILE	TEST_TMP_FILE("zone")
+/*
+ * The test file holds a header, then records of a big-endian 8-byte
+ * signed timestamp, a little-endian "float" temperature
+ * and a big-endian 2-byte sensor, padded to the record size.
+ */
+#define RECORDS_START	16
+#define TIME_START	0
+#define TEMP_START	8
+#define SENSOR_START	12
+#define RECORD_SIZE	24
+#define N_RECORDS	10000
+/* the number of records in each block */
+#define BLOCK_RECORDS	100
+#define N_BLOCKS	(N_RECORDS / BLOCK_RECORDS)
+
+/* a decoded record */
+struct test_record {
+	int64_t time;
+	double temp;
+	uint32_t sensor;
+};
+
+#define N_FIELDS	3
+static const struct member_layout fields[N_FIELDS] = {
+	INT_MEMBER_LAYOUT(struct test_record, time, TIME_START, 8, BIG_END, 1),
+	FLOAT_MEMBER_LAYOUT(struct test_record, temp, TEMP_START,
+			    sizeof(float), LITTLE_END),
+	INT_MEMBER_LAYOUT(struct test_record, sensor, SENSOR_START, 2, BIG_END,
+			  0),
+};
+
+static const struct column_layout layout = {
+	.records_start = RECORDS_START,
+	.record_size = RECORD_SIZE,
+	.members = fields,
+	.n_members = N_FIELDS,
+	.block_values = BLOCK_RECORDS,
+};
+
+/* the plan decoding a whole record, for the visitors */
+static struct copy_plan record_plan;
+
+/* the values of the record at an index */
+static void make_record(struct test_record *record, size_t record_i)
+{
+	record->time = (int64_t) record_i * 10 - 5000;
+	record->temp = (double) (record_i % 50) - 10.5;
+	record->sensor = record_i % 7;
+}
+
+/*
+ * Write the test file, replacing any file there.
+ * n_records:	the number of records to write
+ * returns	1 on success; 0 otherwise
+ */
+static int write_test_file(size_t n_records)
+{
+	const size_t size = RECORDS_START + n_records * RECORD_SIZE;
+	uint8_t *bytes = calloc(size, 1);
+	struct file_structor file;
+	struct file_struct chunk;
+	size_t record_i;
+	int ret = 1;
+
+	if (bytes == NULL) {
+		return 0;
+	}
+	open_memory_structor(&file, bytes, size);
+	init_file_struct(&chunk, &file, size, 0);
+	for (record_i = 0; ret && record_i < n_records; record_i++) {
+		const off_t start = RECORDS_START + record_i * RECORD_SIZE;
+		struct test_record record;
+
+		make_record(&record, record_i);
+		ret = !STORE_INT_MEMBER_TO(&chunk, &record, struct test_record,
+					   time, start + TIME_START, 8,
+					   BIG_END, 1) &&
+		      !STORE_FLOAT_MEMBER_TO(&chunk, &record,
+					     struct test_record, temp,
+					     start + TEMP_START, sizeof(float),
+					     LITTLE_END) &&
+		      !STORE_INT_MEMBER_TO(&chunk, &record, struct test_record,
+					   sensor, start + SENSOR_START, 2,
+					   BIG_END, 0);
+	}
+	teardown_file_struct(&chunk);
+
+	ret = ret && write_test_file_bytes(ZONE_TEST_FILE, bytes, size);
+	free(bytes);
+
+	return ret;
+}
+
+/* the state of "count_matches" */
+struct match_count {
+	/* the ranges the records should be in */
+	const struct zone_range *ranges;
+	size_t n_ranges;
+	/* the number of matching records */
+	size_t n_matches;
+	/* the number of records visited */
+	size_t n_visited;
+};
+
+/* Check if every field of a record is in its range. */
+static int
+record_matches(const struct test_record *record,
+	       const struct zone_range *ranges, size_t n_ranges)
+{
+	size_t range_i;
+
+	for (range_i = 0; range_i < n_ranges; range_i++) {
+		const struct zone_range *range = &ranges[range_i];
+
+		if ((range->field_i == 0 &&
+		     (record->time < range->min.i ||
+		      record->time > range->max.i)) ||
+		    (range->field_i == 1 &&
+		     (record->temp < range->min.f ||
+		      record->temp > range->max.f)) ||
+		    (range->field_i == 2 &&
+		     (record->sensor < range->min.u ||
+		      record->sensor > range->max.u))) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* Count the records of a run in every range, checking their values. */
+static enum fs_status
+count_matches(struct file_struct *records, size_t first, size_t n_records,
+	      void *arg)
+{
+	struct match_count *count = arg;
+	size_t record_i;
+
+	for (record_i = 0; record_i < n_records; record_i++) {
+		struct test_record record, expected;
+
+		apply_copy_plan(&record_plan, &record, records,
+				record_i * RECORD_SIZE);
+		make_record(&expected, first + record_i);
+		if (record.time != expected.time ||
+		    record.sensor != expected.sensor) {
+			return FSERR_OUT_OF_STRUCT;
+		}
+		count->n_matches += record_matches(&record, count->ranges,
+						   count->n_ranges);
+	}
+	count->n_visited += n_records;
+
+	return FS_NO_ERROR;
+}
+
+/*
+ * Scan the test file with some ranges, and check the matching records
+ * and the number of blocks visited.
+ * returns	1 if they are as expected; 0 otherwise
+ */
+static int
+check_scan(const struct zone_range *ranges, size_t n_ranges,
+	   size_t expected_blocks)
+{
+	struct file_structor file;
+	struct zone_map map;
+	struct match_count count = { ranges, n_ranges, 0, 0 };
+	size_t n_expected = 0, record_i, n_visited;
+	int ret;
+
+	for (record_i = 0; record_i < N_RECORDS; record_i++) {
+		struct test_record record;
+
+		make_record(&record, record_i);
+		n_expected += record_matches(&record, ranges, n_ranges);
+	}
+
+	if (open_file_structor(&file, ZONE_TEST_FILE)) {
+		return 0;
+	}
+	if (open_zone_map(&map, ZONE_TEST_FILE, &layout)) {
+		close_file_structor(&file);
+		return 0;
+	}
+	ret = scan_zones(&file, &map, ranges, n_ranges, count_matches, &count,
+			 &n_visited) == FS_NO_ERROR &&
+	      count.n_matches == n_expected &&
+	      n_visited == expected_blocks &&
+	      count.n_visited == expected_blocks * BLOCK_RECORDS;
+	if (!ret) {
+		printlg(ERROR_LEVEL,
+			"%u of %u matches, in %u blocks instead of %u.\n",
+			(unsigned) count.n_matches, (unsigned) n_expected,
+			(unsigned) n_visited, (unsigned) expected_blocks);
+	}
+	close_zone_map(&map);
+	close_file_structor(&file);
+
+	return ret;
+}
+
+/* A zone map should hold the bounds of each block. */
+static int test_build()
+{
+	struct zone_map map;
+	const struct column_bounds *bounds;
+	struct stat built;
+	int ret;
+
+	remove_zone_map(ZONE_TEST_FILE);
+	if (!write_test_file(N_RECORDS) ||
+	    build_zone_map(ZONE_TEST_FILE, &layout, 4) ||
+	    open_zone_map(&map, ZONE_TEST_FILE, &layout)) {
+		return 0;
+	}
+	bounds = &map.bounds[3 * N_FIELDS];
+	ret = map.n_blocks == N_BLOCKS && map.n_records == N_RECORDS &&
+	      bounds[0].min.i == 300 * 10 - 5000 &&
+	      bounds[0].max.i == 399 * 10 - 5000 &&
+	      bounds[1].min.f == -10.5 && bounds[1].max.f == 38.5 &&
+	      bounds[2].min.u == 0 && bounds[2].max.u == 6;
+	close_zone_map(&map);
+
+	/* A valid zone map should not be built again. */
+	ret = ret && stat(ZONE_TEST_FILE ZONE_MAP_SUFFIX, &built) == 0 &&
+	      build_zone_map(ZONE_TEST_FILE, &layout, 1) == FS_NO_ERROR;
+	if (ret) {
+		struct stat rebuilt;
+
+		ret = stat(ZONE_TEST_FILE ZONE_MAP_SUFFIX, &rebuilt) == 0 &&
+		      rebuilt.st_ino == built.st_ino;
+	}
+
+	return ret;
+}
+
+/* A time range should only visit the blocks it overlaps. */
+static int test_time_range()
+{
+	struct zone_range range = { .field_i = 0 };
+
+	/* Records 2050 to 2349, in blocks 20 to 23 */
+	range.min.i = 2050 * 10 - 5000;
+	range.max.i = 2349 * 10 - 5000;
+	if (!check_scan(&range, 1, 4)) {
+		return 0;
+	}
+
+	/* Before every record, and the very first one */
+	range.min.i = INT64_MIN;
+	range.max.i = -5001;
+	if (!check_scan(&range, 1, 0)) {
+		return 0;
+	}
+	range.max.i = -5000;
+
+	return check_scan(&range, 1, 1);
+}
+
+/* Every range should hold for a block to be visited. */
+static int test_combined_ranges()
+{
+	struct zone_range ranges[2] = {
+		{ .field_i = 0 }, { .field_i = 1 }
+	};
+
+	ranges[0].min.i = INT64_MIN;
+	ranges[0].max.i = INT64_MAX;
+	ranges[1].min.f = 39;
+	ranges[1].max.f = 1000;
+	if (!check_scan(ranges, 2, 0)) {
+		return 0;
+	}
+
+	ranges[0].min.i = 0;
+	ranges[0].max.i = 999 * 10 - 5000;
+	ranges[1].min.f = 30;
+	ranges[1].max.f = 31;
+
+	return check_scan(ranges, 2, 5);
+}
+
+/* Ranges of fields outside of the layout should be rejected. */
+static int test_bad_range()
+{
+	struct zone_range range = { .field_i = N_FIELDS };
+	struct file_structor file;
+	struct zone_map map;
+	size_t n_visited;
+	int ret;
+
+	if (open_file_structor(&file, ZONE_TEST_FILE)) {
+		return 0;
+	}
+	if (open_zone_map(&map, ZONE_TEST_FILE, &layout)) {
+		close_file_structor(&file);
+		return 0;
+	}
+	ret = zone_may_match(&map, 0, &range, 1) == -1 &&
+	      scan_zones(&file, &map, &range, 1, count_matches, NULL,
+			 &n_visited) == FSERR_OUT_OF_STRUCT;
+	close_zone_map(&map);
+	close_file_structor(&file);
+
+	return ret;
+}
+
+/* A zone map should not be used once its file changes. */
+static int test_stale()
+{
+	static const struct member_layout bytes_field =
+		MEMBER_LAYOUT(struct test_record, sensor, SENSOR_START,
+			      BIG_END);
+	struct column_layout bytes_layout = layout;
+	struct zone_map map;
+	int ret;
+
+	bytes_layout.members = &bytes_field;
+	bytes_layout.n_members = 1;
+	ret = build_zone_map(ZONE_TEST_FILE, &bytes_layout, 1) ==
+	      FSERR_OUT_OF_STRUCT &&
+	      write_test_file(N_RECORDS + 1) &&
+	      open_zone_map(&map, ZONE_TEST_FILE, &layout) ==
+	      FSERR_BAD_SIDECAR &&
+	      build_zone_map(ZONE_TEST_FILE, &layout, 1) == FS_NO_ERROR &&
+	      open_zone_map(&map, ZONE_TEST_FILE, &layout) == FS_NO_ERROR;
+	if (ret) {
+		ret = map.n_blocks == N_BLOCKS + 1 &&
+		      map.bounds[N_BLOCKS * N_FIELDS].min.i ==
+		      N_RECORDS * 10 - 5000;
+		close_zone_map(&map);
+	}
+
+	return ret;
+}
+
+#define N_ZONE_TESTS	5
+static int (*zone_tests[N_ZONE_TESTS])() = {
+	test_build, test_time_range, test_combined_ranges, test_bad_range,
+	test_stale
+};
+
+int main()
+{
+	size_t test_i;
+
+	if (compile_copy_plan(&record_plan, fields, N_FIELDS)) {
+		printlg(ERROR_LEVEL, "Could not compile the record plan.\n");
+		return 1;
+	}
+
+	for (test_i = 0; test_i < N_ZONE_TESTS; test_i++) {
+		printlg(INFO_LEVEL, "Testing zone maps: %u...\n",
+			(unsigned) test_i);
+		if (zone_tests[test_i]()) {
+			printlg(INFO_LEVEL, "Passed!\n");
+		} else {
+			printlg(ERROR_LEVEL, "Failed!\n");
+		}
+	}
+
+	free_copy_plan(&record_plan);
+	remove_zone_map(ZONE_TEST_FILE);
+	unlink(ZONE_TEST_FILE);
+
+	return 0;
+}